@@ -29,3 +29,10 @@ uint8_t cam_write_array(const struct regval_list *vals) {
     return 0;
 }
 
+uint8_t cam_set_quality(uint8_t qs) {
+  /* Selects the DSP bank and sets QS, leaves the DSP bank selected */
+  if (cam_write_reg(0xFF, 0x00) != 0) {
+    return 1;
+  }
+  return cam_write_reg(0x44, qs);
+}
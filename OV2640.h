@@ -17,6 +17,9 @@ struct regval_list {
 };
 #define ENDMARKER               { 0xff, 0xff }
 
+/* JPEG quantiser scale (DSP bank 0x44), larger is coarser */
+#define OV2640_QS_DEFAULT       0x0C
+
 static const struct regval_list ov2640_reset_regs[] = {
      {0xFF, 0x01},
      {0x12, 0x80},
@@ -245,8 +248,7 @@ static const struct regval_list ov2640_jpeg_regs[] = {
 
 static const struct regval_list ov2640_320x240_regs[] = {
      {0xff, 0x01},
-     //{0x12, 0x40},
-     {0x12, 0x42},
+     {0x12, 0x40},  // SVGA; 0x42 would add the colour bar test pattern
      {0x17, 0x11},
      {0x18, 0x43},
      {0x19, 0x00},
@@ -498,8 +500,8 @@ static const struct regval_list ov2640_1280x1024_regs[] = {
 	{0x55, 0x88},
 	{0x57, 0x00},
 	{0x5a, 0x40},
-	{0x5b, 0xf0},
-	{0x5c, 0x01},
+	{0x5b, 0x00},
+	{0x5c, 0x05},  // ZMOW/ZMOH bit 8, 1280x1024
 	{0xd3, 0x02},
 	{0xe0, 0x00},
 
@@ -661,5 +663,6 @@ ENDMARKER,
 uint8_t cam_write_reg(uint8_t reg, uint8_t value);
 uint8_t cam_read_reg(uint8_t reg, uint8_t *value);
 uint8_t cam_write_array(const struct regval_list *vals);
+uint8_t cam_set_quality(uint8_t qs);
 
 #endif /* OV2640_H_ */
@@ -1,14 +1,21 @@
 #include "ch.h"
 #include "hal.h"
+#include "probe.h"
+#include "trace.h"
 
 msg_t SCCB_Write(const uint8_t addr, const uint8_t reg, const uint8_t value) {
    msg_t status;
    uint8_t txbuf[2] = {reg, value};
    uint8_t rxbuf = 0;
 
+   PROBE_BEGIN(PROBE_SCCB_WRITE);
    i2cAcquireBus(&I2CD1);
    status = i2cMasterTransmitTimeout(&I2CD1, addr, txbuf, 2, &rxbuf, 0, MS2ST(5));
    i2cReleaseBus(&I2CD1);
+   PROBE_END(PROBE_SCCB_WRITE);
+   if (status != RDY_OK) {
+     TRACE(TRACE_SCCB_ERROR, reg | ((uint8_t)status << 8));
+   }
 
    return status;
 }
@@ -18,10 +25,13 @@ msg_t SCCB_Read(const uint8_t addr, const uint8_t reg, uint8_t *value) {
   uint8_t rxbuf[1];
   uint8_t txbuf[1] = {reg};
 
+  PROBE_BEGIN(PROBE_SCCB_READ);
   i2cAcquireBus(&I2CD1);
   status = i2cMasterTransmitTimeout(&I2CD1, addr, txbuf, 1, rxbuf, 1, MS2ST(5));
   i2cReleaseBus(&I2CD1);
+  PROBE_END(PROBE_SCCB_READ);
   if (status != RDY_OK) {
+    TRACE(TRACE_SCCB_ERROR, reg | ((uint8_t)status << 8) | (1UL << 16));
     return status;
   } else {
     *value = rxbuf[0];
@@ -0,0 +1,149 @@
+#include <string.h>
+
+#include "avi.h"
+#include "proto.h"
+
+#define AVIF_HASINDEX       0x10
+#define AVIIF_KEYFRAME      0x10
+#define AVI_JUNK            212     /* After hdrl */
+
+static uint8_t *fourcc(uint8_t *out, const char *cc, uint32_t v) {
+	memcpy(out, cc, 4);
+	proto_put32(&out[4], v);
+	return &out[8];
+}
+
+static uint8_t *put32(uint8_t *out, uint32_t v) {
+	proto_put32(out, v);
+	return &out[4];
+}
+
+void avi_start(avi_t *a, uint16_t width, uint16_t height) {
+	a->width = width;
+	a->height = height;
+	a->frames = 0;
+	a->saved = 0;
+	a->movi = 0;
+	a->max_frame = 0;
+	a->ms = 0;
+}
+
+int avi_add(avi_t *a, uint32_t len, uint32_t ms) {
+	/* Counts a frame written as a chunk; 1 when the window is full and
+	 * has to be saved before the next */
+	uint8_t *p = &a->win[(a->frames - a->saved) * AVI_TENT_SIZE];
+
+	p = put32(p, 4 + a->movi);
+	p = put32(p, len);
+	put32(p, ms);
+	a->frames++;
+	a->movi += AVI_CHUNK_SIZE(len);
+	if (len > a->max_frame) {
+		a->max_frame = len;
+	}
+	return a->frames - a->saved == AVI_CHECKPOINT;
+}
+
+void avi_saved(avi_t *a) {
+	/* The window went to AVI_TENT(a->saved) on */
+	a->saved = a->frames;
+}
+
+void avi_header(uint8_t *out, const avi_t *a, int index) {
+	/* First sector: without the index the file ends after the frames */
+	uint32_t us = a->frames > 0
+			? (uint32_t)((uint64_t)a->ms * 1000 / a->frames) : 0;
+	uint32_t rate = a->ms > 0 ? (uint32_t)((uint64_t)a->movi * 1000 / a->ms)
+			: 0;
+	uint8_t *p = out;
+
+	memset(out, 0, AVI_SECTOR);
+	p = fourcc(p, "RIFF", AVI_HDR_SIZE - 8 + a->movi
+			+ (index ? 8 + a->frames * AVI_ENTRY_SIZE : 0));
+	memcpy(p, "AVI ", 4);
+	p += 4;
+	p = fourcc(p, "LIST", 192);
+	memcpy(p, "hdrl", 4);
+	p += 4;
+
+	p = fourcc(p, "avih", 56);
+	p = put32(p, us);
+	p = put32(p, rate);
+	p = put32(p, 0);                    /* Padding granularity */
+	p = put32(p, index ? AVIF_HASINDEX : 0);
+	p = put32(p, a->frames);
+	p = put32(p, 0);                    /* Initial frames */
+	p = put32(p, 1);                    /* Streams */
+	p = put32(p, a->max_frame + AVI_CHUNK_HDR);
+	p = put32(p, a->width);
+	p = put32(p, a->height);
+	p += 16;
+
+	p = fourcc(p, "LIST", 116);
+	memcpy(p, "strl", 4);
+	p += 4;
+	p = fourcc(p, "strh", 56);
+	memcpy(p, "vidsMJPG", 8);
+	p += 8;
+	p = put32(p, 0);                    /* Flags */
+	p = put32(p, 0);                    /* Priority, language */
+	p = put32(p, 0);                    /* Initial frames */
+	p = put32(p, us > 0 ? us : 1);      /* Scale over rate: frame time */
+	p = put32(p, 1000000);
+	p = put32(p, 0);                    /* Start */
+	p = put32(p, a->frames);
+	p = put32(p, a->max_frame + AVI_CHUNK_HDR);
+	p = put32(p, 0xFFFFFFFF);           /* Quality, default */
+	p = put32(p, 0);                    /* Sample size, varies */
+	p = put32(p, 0);                    /* Frame rectangle */
+	p = put32(p, a->width | ((uint32_t)a->height << 16));
+
+	p = fourcc(p, "strf", 40);
+	p = put32(p, 40);
+	p = put32(p, a->width);
+	p = put32(p, a->height);
+	p = put32(p, 1 | (24 << 16));       /* Planes, bits per pixel */
+	memcpy(p, "MJPG", 4);
+	p += 4;
+	put32(p, (uint32_t)a->width * a->height * 3);
+
+	fourcc(&out[AVI_JUNK], "JUNK", AVI_TIDX - 8 - AVI_JUNK - 8);
+	fourcc(&out[AVI_TIDX - 8], "tidx", AVI_MOVI - 8 - AVI_TIDX);
+}
+
+void avi_movi(uint8_t *out, const avi_t *a) {
+	/* Last sector: the end of tidx and the movi LIST header */
+	memset(out, 0, AVI_SECTOR);
+	fourcc(&out[AVI_SECTOR - 12], "LIST", 4 + a->movi);
+	memcpy(&out[AVI_SECTOR - 4], "movi", 4);
+}
+
+void avi_chunk(uint8_t *out, uint32_t len) {
+	fourcc(out, "00dc", len);
+}
+
+void avi_index(uint8_t *out, const avi_t *a) {
+	/* idx1 chunk header, the entries follow from avi_entry() */
+	fourcc(out, "idx1", a->frames * AVI_ENTRY_SIZE);
+}
+
+void avi_entry(uint8_t *out, uint32_t off, uint32_t len) {
+	out = fourcc(out, "00dc", AVIIF_KEYFRAME);
+	out = put32(out, off);
+	put32(out, len);
+}
+
+uint32_t avi_frames(const uint8_t *hdr) {
+	/* Frames in the first 64 bytes of a recording, 0 if it is not one */
+	if (memcmp(hdr, "RIFF", 4) != 0 || memcmp(&hdr[8], "AVI ", 4) != 0
+			|| memcmp(&hdr[24], "avih", 4) != 0) {
+		return 0;
+	}
+	return proto_get32(&hdr[48]);
+}
+
+void avi_tent(const uint8_t *in, uint32_t *off, uint32_t *len, uint32_t *ms) {
+	*off = proto_get32(&in[0]);
+	*len = proto_get32(&in[4]);
+	*ms = proto_get32(&in[8]);
+}
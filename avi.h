@@ -0,0 +1,75 @@
+/*
+ * avi.h
+ *
+ * Motion-JPEG AVI container for recordings (PROTO_CMD_RECORD). A recording
+ * is one file:
+ *
+ *   header      AVI_HDR_SIZE bytes: RIFF, hdrl (avih, strl with strh and
+ *               a MJPG strf), JUNK padding, the frame index 'tidx' and the
+ *               movi LIST header
+ *   movi        one '00dc' chunk per frame, AVI_CHUNK_HDR bytes of chunk
+ *               header, the JPEG and a pad byte when its length is odd
+ *   idx1        AVI_ENTRY_SIZE bytes per frame, keyframe flag set
+ *
+ * tidx has room for AVI_FRAMES_MAX entries of
+ *
+ *   off32 len32 ms32
+ *
+ * at fixed places, entry k at AVI_TENT(k): the chunk's offset from 'movi'
+ * as in idx1, the JPEG length and the capture time from the start of the
+ * recording. Finding frame k in a recording of any size is one read of
+ * its entry, and players skip the chunk. The header is padded to whole
+ * sectors, so the frames start on a sector boundary and each goes to the
+ * card as one write of its chunk header and data.
+ *
+ * The entries of the last frames are kept in RAM, AVI_CHECKPOINT of them
+ * at most; avi_add() says when the window is full and the caller then
+ * writes it to its place in tidx together with the header sectors, which
+ * carry the frame count, so the file can be read back up to that frame if
+ * the recording never ends. At the end idx1 is built from tidx for the
+ * players and the header written again with the frame rate.
+ *
+ * Plain byte layout, reading and writing the file is left to the caller.
+ */
+
+#ifndef AVI_H_
+#define AVI_H_
+
+#include <stdint.h>
+
+#define AVI_SECTOR          512
+#define AVI_FRAMES_MAX      1024
+#define AVI_CHECKPOINT      32
+#define AVI_TENT_SIZE       12
+#define AVI_TIDX            AVI_SECTOR      /* Entry 0 */
+#define AVI_TENT(k)         (AVI_TIDX + (uint32_t)(k) * AVI_TENT_SIZE)
+#define AVI_HDR_SIZE        (AVI_TENT(AVI_FRAMES_MAX) + AVI_SECTOR)
+#define AVI_MOVI            (AVI_HDR_SIZE - 4)  /* Offset of 'movi' */
+#define AVI_CHUNK_HDR       8
+#define AVI_ENTRY_SIZE      16
+
+#define AVI_CHUNK_SIZE(len) (AVI_CHUNK_HDR + (len) + ((len) & 1))
+
+typedef struct {
+	uint16_t width;
+	uint16_t height;
+	uint32_t frames;
+	uint32_t saved;     /* Frames with their entry in tidx */
+	uint32_t movi;      /* Bytes of frame chunks */
+	uint32_t max_frame;
+	uint32_t ms;        /* Recording time, for the frame rate */
+	uint8_t win[AVI_CHECKPOINT * AVI_TENT_SIZE];
+} avi_t;
+
+void avi_start(avi_t *a, uint16_t width, uint16_t height);
+int avi_add(avi_t *a, uint32_t len, uint32_t ms);
+void avi_saved(avi_t *a);
+void avi_header(uint8_t *out, const avi_t *a, int index);
+void avi_movi(uint8_t *out, const avi_t *a);
+void avi_chunk(uint8_t *out, uint32_t len);
+void avi_index(uint8_t *out, const avi_t *a);
+void avi_entry(uint8_t *out, uint32_t off, uint32_t len);
+uint32_t avi_frames(const uint8_t *hdr);
+void avi_tent(const uint8_t *in, uint32_t *off, uint32_t *len, uint32_t *ms);
+
+#endif /* AVI_H_ */
@@ -0,0 +1,50 @@
+#include "baud.h"
+
+static const uint32_t rates[] = {
+	38400, 57600, 115200, 230400, 460800, 921600
+};
+
+void baud_init(baud_t *b, stream_t *sp, uint32_t rate) {
+	b->sp = sp;
+	b->rate = rate;
+	b->fallback = rate;
+	b->deadline = 0;
+	b->pending = 0;
+	streamSetBaud(sp, rate);
+}
+
+int baud_supported(uint32_t rate) {
+	unsigned i;
+
+	for (i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+		if (rates[i] == rate) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void baud_switch(baud_t *b, uint32_t rate, uint32_t now_ms) {
+	/* Call after the reply to the request has been queued */
+	streamFlush(b->sp);
+	if (!b->pending) {
+		b->fallback = b->rate;
+	}
+	b->rate = rate;
+	b->deadline = now_ms + BAUD_CONFIRM_MS;
+	b->pending = 1;
+	streamSetBaud(b->sp, rate);
+}
+
+void baud_frame(baud_t *b) {
+	/* A frame with a good CRC arrived, the host is on our rate */
+	b->pending = 0;
+}
+
+void baud_poll(baud_t *b, uint32_t now_ms) {
+	if (b->pending && (int32_t)(now_ms - b->deadline) >= 0) {
+		b->pending = 0;
+		b->rate = b->fallback;
+		streamSetBaud(b->sp, b->rate);
+	}
+}
@@ -0,0 +1,35 @@
+/*
+ * baud.h
+ *
+ * Runtime baud rate negotiation for the host link.
+ *
+ * The host sends PROTO_CMD_BAUD with the rate it wants. The device answers
+ * at the current rate, waits for the answer to leave the wire and switches.
+ * The host then has BAUD_CONFIRM_MS to get a valid frame through at the new
+ * rate; if none arrives the device falls back to the rate it came from, so
+ * a host or adapter that cannot follow never loses the link.
+ */
+
+#ifndef BAUD_H_
+#define BAUD_H_
+
+#include "stream.h"
+
+#define BAUD_DEFAULT        38400
+#define BAUD_CONFIRM_MS     1000
+
+typedef struct {
+	stream_t *sp;
+	uint32_t rate;
+	uint32_t fallback;
+	uint32_t deadline;
+	uint8_t pending;
+} baud_t;
+
+void baud_init(baud_t *b, stream_t *sp, uint32_t rate);
+int baud_supported(uint32_t rate);
+void baud_switch(baud_t *b, uint32_t rate, uint32_t now_ms);
+void baud_frame(baud_t *b);
+void baud_poll(baud_t *b, uint32_t now_ms);
+
+#endif /* BAUD_H_ */
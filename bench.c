@@ -0,0 +1,61 @@
+#include "bench.h"
+#include "proto.h"
+
+void bench_init(bench_stat_t *s) {
+	s->n = 0;
+	s->min = 0xFFFFFFFF;
+	s->max = 0;
+	s->sum = 0;
+}
+
+void bench_add(bench_stat_t *s, uint32_t ticks) {
+	s->n++;
+	s->sum += ticks;
+	if (ticks < s->min) {
+		s->min = ticks;
+	}
+	if (ticks > s->max) {
+		s->max = ticks;
+	}
+}
+
+uint16_t bench_put(uint8_t *out, uint8_t id, const bench_stat_t *s,
+		uint32_t units) {
+	out[0] = id;
+	out[1] = (uint8_t)s->n;
+	out[2] = (uint8_t)(s->n >> 8);
+	proto_put32(&out[3], units);
+	proto_put32(&out[7], s->n ? s->min : 0);
+	proto_put32(&out[11], s->n ? (uint32_t)(s->sum / s->n) : 0);
+	proto_put32(&out[15], s->max);
+	return BENCH_REC_SIZE;
+}
+
+void bench_get(const uint8_t *in, bench_rec_t *r) {
+	r->id = in[0];
+	r->n = (uint16_t)(in[1] | (in[2] << 8));
+	r->units = proto_get32(&in[3]);
+	r->min = proto_get32(&in[7]);
+	r->mean = proto_get32(&in[11]);
+	r->max = proto_get32(&in[15]);
+}
+
+const char *bench_name(uint8_t id) {
+	switch (id) {
+	case BENCH_EOI_SCAN:
+		return "eoi_scan";
+	case BENCH_CAM_SAVE:
+		return "cam_save";
+	case BENCH_INDEX:
+		return "index_questions";
+	case BENCH_MARK:
+		return "mark_question";
+	case BENCH_REGS:
+		return "cam_write_array";
+	case BENCH_BLK_SEQ:
+		return "blk_seq_write";
+	case BENCH_BLK_RAND:
+		return "blk_rand_write";
+	}
+	return "unknown";
+}
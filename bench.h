@@ -0,0 +1,58 @@
+/*
+ * bench.h
+ *
+ * Benchmarks of the firmware hot paths (PROTO_CMD_BENCH, built in with
+ * -DCAM_BENCH).
+ *
+ * Each case runs a fixed number of times and is timed with PROBE_NOW(),
+ * the Cortex-M4 DWT cycle counter; the simulation (sim/) backs the counter
+ * with the host monotonic clock, so the same code measures both. Results travel as
+ *
+ *   ACK hz32 count8 { id8 n16 units32 min32 mean32 max32 } * count
+ *
+ * with times in counter ticks of hz and units the work one run does (bytes
+ * written, register writes, ...). A case that could not run has n = 0.
+ */
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stdint.h>
+
+#include "probe.h"
+
+#define BENCH_EOI_SCAN      1   /* jpeg_length() over a buffered frame   */
+#define BENCH_CAM_SAVE      2   /* cam_save() of the same frame          */
+#define BENCH_INDEX         3   /* index_questions() on a full q.txt     */
+#define BENCH_MARK          4   /* cmd_mark_question()                   */
+#define BENCH_REGS          5   /* cam_write_array() of the JPEG table   */
+#define BENCH_BLK_SEQ       6   /* Card backend, sequential writes       */
+#define BENCH_BLK_RAND      7   /* Card backend, single sector writes    */
+
+#define BENCH_REC_SIZE      19
+#define BENCH_HDR_SIZE      6
+
+typedef struct {
+	uint32_t n;
+	uint32_t min;
+	uint32_t max;
+	uint64_t sum;
+} bench_stat_t;
+
+typedef struct {
+	uint8_t id;
+	uint16_t n;
+	uint32_t units;
+	uint32_t min;
+	uint32_t mean;
+	uint32_t max;
+} bench_rec_t;
+
+void bench_init(bench_stat_t *s);
+void bench_add(bench_stat_t *s, uint32_t ticks);
+uint16_t bench_put(uint8_t *out, uint8_t id, const bench_stat_t *s,
+		uint32_t units);
+void bench_get(const uint8_t *in, bench_rec_t *r);
+const char *bench_name(uint8_t id);
+
+#endif /* BENCH_H_ */
@@ -0,0 +1,170 @@
+/*
+ * blk_mmc.c
+ *
+ * Card backend on the ChibiOS MMC_SPI driver: MMC/SD cards on SPI2, one
+ * data line. Writes are the driver's sequential writes (CMD25). The pre-erase
+ * count (ACMD23) has no driver call, so it is sent over the driver's SPI
+ * bus the way the driver sends its own commands.
+ */
+
+#include "ch.h"
+#include "hal.h"
+#include "blkdev.h"
+
+#if !defined(CAM_BLK_FILE)
+
+#define CMD_APP             55
+#define ACMD_WR_BLK_ERASE   23
+#define CMD_RETRY           9
+#define READY_RETRY         50000
+
+/**
+ * MMC driver instance.
+ */
+MMCDriver MMCD1;
+
+/* Maximum speed SPI configuration (18MHz, CPHA=0, CPOL=0, MSb first).*/
+static SPIConfig hs_spicfg = { NULL, GPIOB, GPIOB_PIN12, 0 };
+
+/* Low speed SPI configuration (281.250kHz, CPHA=0, CPOL=0, MSb first).*/
+static SPIConfig ls_spicfg = { NULL, GPIOB, GPIOB_PIN12, SPI_CR1_BR_2
+		| SPI_CR1_BR_1 };
+
+/* MMC/SD over SPI driver configuration.*/
+static MMCConfig mmccfg = { &SPID2, &ls_spicfg, &hs_spicfg };
+
+static uint8_t crc7(const uint8_t *p, uint8_t n) {
+	uint8_t crc = 0, i;
+
+	while (n-- > 0) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++) {
+			crc = crc & 0x80 ? (uint8_t) ((crc << 1) ^ 0x12) : (uint8_t) (crc << 1);
+		}
+	}
+	return crc | 1;
+}
+
+static uint8_t mmc_command(MMCDriver *mmcp, uint8_t cmd, uint32_t arg) {
+	/* One R1 command, as the ChibiOS driver sends them; 0xFF when the card
+	 * does not answer */
+	SPIDriver *spip = mmcp->config->spip;
+	uint8_t b[6];
+	uint16_t i;
+
+	spiSelect(spip);
+	for (i = 0; i < READY_RETRY; i++) {
+		spiReceive(spip, 1, b);
+		if (b[0] == 0xFF) {
+			break;
+		}
+	}
+	b[0] = 0x40 | cmd;
+	b[1] = (uint8_t) (arg >> 24);
+	b[2] = (uint8_t) (arg >> 16);
+	b[3] = (uint8_t) (arg >> 8);
+	b[4] = (uint8_t) arg;
+	b[5] = crc7(b, 5);
+	spiSend(spip, 6, b);
+	for (i = 0; i < CMD_RETRY; i++) {
+		spiReceive(spip, 1, b);
+		if (b[0] != 0xFF) {
+			break;
+		}
+	}
+	spiUnselect(spip);
+	return b[0];
+}
+
+static int mmc_read(void *dev, uint32_t lba, uint8_t *buf, uint32_t n) {
+	MMCDriver *mmcp = dev;
+
+	if (mmcStartSequentialRead(mmcp, lba)) {
+		return -1;
+	}
+	while (n-- > 0) {
+		if (mmcSequentialRead(mmcp, buf)) {
+			mmcStopSequentialRead(mmcp);
+			return -1;
+		}
+		buf += BLK_SECTOR;
+	}
+	return mmcStopSequentialRead(mmcp) ? -1 : 0;
+}
+
+static int mmc_write_begin(void *dev, uint32_t lba, uint32_t erase) {
+	/* The pre-erase count goes right before CMD25. MMC cards and some SD
+	 * cards answer ACMD23 with illegal command, they get the write without */
+	MMCDriver *mmcp = dev;
+	int rc = 0;
+
+	if (erase > 0) {
+		spiStart(mmcp->config->spip, mmcp->config->hscfg);
+		if ((mmc_command(mmcp, CMD_APP, 0) & 0xFE) != 0
+				|| mmc_command(mmcp, ACMD_WR_BLK_ERASE, erase & 0x7FFFFF) != 0) {
+			rc = BLK_REFUSED;
+		}
+	}
+	return mmcStartSequentialWrite(mmcp, lba) ? -1 : rc;
+}
+
+static int mmc_write_block(void *dev, const uint8_t *buf) {
+	return mmcSequentialWrite((MMCDriver *) dev, buf) ? -1 : 0;
+}
+
+static int mmc_write_end(void *dev) {
+	return mmcStopSequentialWrite((MMCDriver *) dev) ? -1 : 0;
+}
+
+static int mmc_sync(void *dev) {
+	return mmcSync((MMCDriver *) dev) ? -1 : 0;
+}
+
+static const blk_ops_t mmc_ops = { mmc_read, mmc_write_begin,
+		mmc_write_block, mmc_write_end, mmc_sync };
+
+static void mmc_start(void) {
+	mmcObjectInit(&MMCD1);
+	mmcStart(&MMCD1, &mmccfg);
+	palSetPad(GPIOB, 12);
+	palSetPadMode(GPIOB, GPIOB_PIN12, PAL_MODE_OUTPUT_PUSHPULL |
+			PAL_STM32_OSPEED_HIGHEST); /* NSS.     */
+	palSetPadMode(GPIOB, GPIOB_PIN13, PAL_MODE_ALTERNATE(5) |
+			PAL_STM32_OSPEED_HIGHEST); /* SCK.     */
+	palSetPadMode(GPIOB, GPIOB_PIN14, PAL_MODE_ALTERNATE(5)); /* MISO.    */
+	palSetPadMode(GPIOB, GPIOB_PIN15, PAL_MODE_ALTERNATE(5) |
+			PAL_STM32_OSPEED_HIGHEST); /* MOSI.    */
+}
+
+static int mmc_inserted(void) {
+	return blkIsInserted(&MMCD1);
+}
+
+static int mmc_connect(void) {
+	return mmcConnect(&MMCD1) ? -1 : 0;
+}
+
+static void mmc_disconnect(void) {
+	mmcDisconnect(&MMCD1);
+}
+
+static int mmc_ready(void) {
+	/* Ready, or in a write the block layer keeps open */
+	blkstate_t st = blkGetDriverState(&MMCD1);
+
+	return st == BLK_READY || st == BLK_WRITING;
+}
+
+static int mmc_protect(void) {
+	return mmcIsWriteProtected(&MMCD1);
+}
+
+static uint32_t mmc_sectors(void) {
+	return mmcsdGetCardCapacity(&MMCD1);
+}
+
+const blk_card_t blk_card = { BLK_CARD_MMC, &mmc_ops, &MMCD1, mmc_start,
+		mmc_inserted, mmc_connect, mmc_disconnect, mmc_ready, mmc_protect,
+		mmc_sectors };
+
+#endif /* !CAM_BLK_FILE */
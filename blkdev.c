@@ -0,0 +1,166 @@
+#include "blkdev.h"
+#include "proto.h"
+
+void blk_init(blk_t *b, const blk_card_t *card, uint32_t (*clock)(void),
+		uint32_t hz) {
+	b->card = card->id;
+	b->ops = card->ops;
+	b->dev = card->dev;
+	b->clock = clock;
+	b->hz = hz;
+	b->open = 0;
+	b->erase = 1;
+	b->run = 0;
+	blk_clear(b);
+}
+
+void blk_clear(blk_t *b) {
+	b->reads = 0;
+	b->read_blocks = 0;
+	b->writes = 0;
+	b->write_blocks = 0;
+	b->joined = 0;
+	b->erased = 0;
+	b->refused = 0;
+	b->errors = 0;
+	probe_reset(&b->lat);
+}
+
+void blk_close(blk_t *b) {
+	/* Before the card goes or after a new one came: ends an open write
+	 * whatever it costs and tries pre-erasing again */
+	blk_end(b);
+	b->erase = 1;
+	b->run = 0;
+}
+
+static void failed(blk_t *b) {
+	b->ops->write_end(b->dev);
+	b->open = 0;
+	b->errors++;
+}
+
+int blk_end(blk_t *b) {
+	uint32_t t;
+	int rc;
+
+	if (!b->open) {
+		return 0;
+	}
+	b->open = 0;
+	t = b->clock();
+	rc = b->ops->write_end(b->dev);
+	b->busy += b->clock() - t;
+	probe_add(&b->lat, b->busy);
+	if (rc != 0) {
+		b->errors++;
+	}
+	return rc;
+}
+
+int blk_begin(blk_t *b, uint32_t lba, uint32_t n) {
+	/* Opens a write of at least n blocks at lba unless the open one goes on
+	 * from there */
+	uint32_t t;
+	int rc;
+
+	if (b->open && b->next == lba) {
+		b->joined++;
+		return 0;
+	}
+	if (blk_end(b) != 0) {
+		return -1;
+	}
+	if (lba >= b->run_lba && lba - b->run_lba < b->run
+			&& n < b->run_lba + b->run - lba) {
+		n = b->run_lba + b->run - lba;
+	}
+	n = b->erase && n >= BLK_ERASE_MIN ? n : 0;
+	t = b->clock();
+	rc = b->ops->write_begin(b->dev, lba, n);
+	b->busy = b->clock() - t;
+	if (rc < 0) {
+		b->errors++;
+		return -1;
+	}
+	if (rc == BLK_REFUSED) {
+		b->erase = 0;
+		b->refused++;
+	} else if (n > 0) {
+		b->erased++;
+	}
+	b->open = 1;
+	b->next = lba;
+	b->writes++;
+	return 0;
+}
+
+int blk_write(blk_t *b, uint32_t lba, const uint8_t *buf, uint32_t n) {
+	uint32_t t;
+
+	if (blk_begin(b, lba, n) != 0) {
+		return -1;
+	}
+	t = b->clock();
+	for (; n > 0; n--) {
+		if (b->ops->write_block(b->dev, buf) != 0) {
+			failed(b);
+			return -1;
+		}
+		buf += BLK_SECTOR;
+		b->next++;
+		b->write_blocks++;
+	}
+	b->busy += b->clock() - t;
+	return 0;
+}
+
+int blk_read(blk_t *b, uint32_t lba, uint8_t *buf, uint32_t n) {
+	if (blk_end(b) != 0) {
+		return -1;
+	}
+	b->reads++;
+	b->read_blocks += n;
+	if (b->ops->read(b->dev, lba, buf, n) != 0) {
+		b->errors++;
+		return -1;
+	}
+	return 0;
+}
+
+int blk_sync(blk_t *b) {
+	b->run = 0;
+	if (blk_end(b) != 0 || b->ops->sync(b->dev) != 0) {
+		return -1;
+	}
+	return 0;
+}
+
+void blk_expect(blk_t *b, uint32_t lba, uint32_t n) {
+	/* Nothing in sectors lba to lba + n - 1 needs keeping but what is
+	 * written there before the next sync */
+	b->run_lba = lba;
+	b->run = n;
+}
+
+uint16_t blk_put(uint8_t *out, const blk_t *b) {
+	out[0] = b->card;
+	proto_put32(&out[1], b->hz);
+	proto_put32(&out[5], b->reads);
+	proto_put32(&out[9], b->read_blocks);
+	proto_put32(&out[13], b->writes);
+	proto_put32(&out[17], b->write_blocks);
+	proto_put32(&out[21], b->joined);
+	proto_put32(&out[25], b->erased);
+	proto_put32(&out[29], b->refused);
+	proto_put32(&out[33], b->errors);
+	return 37 + probe_put(&out[37], 0, &b->lat);
+}
+
+const char *blk_card_name(uint8_t id) {
+	static const char *const names[BLK_CARDS] = {
+		"mmc_spi", "file"
+	};
+
+	return id < BLK_CARDS ? names[id] : "unknown";
+}
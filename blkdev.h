@@ -0,0 +1,125 @@
+/*
+ * blkdev.h
+ *
+ * Block device under the sector cache (sectcache.h). A backend only knows
+ * how to read sectors and how to run one multi-block write: begun at a
+ * sector with an optional pre-erase count, fed block by block, ended. On
+ * top of that the layer
+ *
+ *   - keeps the write open while the writes that follow continue where it
+ *     left off, so the clusters of an image FatFs hands down one by one
+ *     go to the card as one write command; a read, a write elsewhere or a
+ *     sync ends it
+ *   - asks the backend to pre-erase the blocks it knows will be written
+ *     (ACMD23 on SD cards). A backend that says the card refused it gets
+ *     plain writes from then on, until blk_close() for the next card
+ *   - times each write command, from begin to end, counting only the time
+ *     spent in the backend
+ *
+ * The pre-erase count never goes past the blocks of the write that opens
+ * the command: blocks pre-erased but not written are left undefined by
+ * the card, and the disk layer cannot know whether the sectors after them
+ * belong to the same file. The one who can is the writer of a file laid
+ * out in one run of clusters: after blk_expect() a write opened inside
+ * that run pre-erases up to its end. The run is forgotten at the next
+ * sync, which FatFs issues when the file is closed.
+ *
+ * The card under the disk layer is one backend chosen at build time, each
+ * filling in blk_card:
+ *
+ *   blk_mmc.c      MMC/SD over SPI2, the ChibiOS MMC_SPI driver (default)
+ *   sim/blkfile.c  an image file on the host (-DCAM_BLK_FILE, sim/ only)
+ *
+ * blk_put() gives the counters as
+ *
+ *   card8 hz32 reads32 read_blocks32 writes32 write_blocks32 joined32
+ *   erased32 refused32 errors32 latency
+ *
+ * with latency the write command times as a probe record (probe.h) in
+ * ticks of the clock given to blk_init(), hz per second. writes counts
+ * write commands and joined the writes that continued an open one.
+ */
+
+#ifndef BLKDEV_H_
+#define BLKDEV_H_
+
+#include <stdint.h>
+
+#include "probe.h"
+
+#define BLK_SECTOR          512
+#define BLK_ERASE_MIN       2       /* Fewer blocks are not worth a command */
+#define BLK_STATS_SIZE      (37 + PROBE_REC_SIZE)
+
+#define BLK_CARD_MMC        0
+#define BLK_CARD_FILE       1
+#define BLK_CARDS           2
+
+/* write_begin() result when the card would not take the pre-erase count
+ * but the write was started anyway */
+#define BLK_REFUSED         1
+
+typedef struct {
+	int (*read)(void *dev, uint32_t lba, uint8_t *buf, uint32_t n);
+	int (*write_begin)(void *dev, uint32_t lba, uint32_t erase);
+	int (*write_block)(void *dev, const uint8_t *buf);
+	int (*write_end)(void *dev);
+	int (*sync)(void *dev);
+} blk_ops_t;
+
+typedef struct {
+	uint8_t id;
+	const blk_ops_t *ops;
+	void *dev;
+	void (*start)(void);
+	int (*inserted)(void);      /* From the card monitor timer, locked */
+	int (*connect)(void);
+	void (*disconnect)(void);
+	int (*ready)(void);
+	int (*protect)(void);
+	uint32_t (*sectors)(void);
+} blk_card_t;
+
+typedef struct {
+	uint8_t card;
+	const blk_ops_t *ops;
+	void *dev;
+	uint32_t (*clock)(void);
+	uint32_t hz;
+	uint8_t open;
+	uint8_t erase;      /* Pre-erase not refused yet */
+	uint32_t next;      /* Sector the open write continues at */
+	uint32_t busy;      /* Ticks in the backend for the open write */
+	uint32_t run;       /* Sectors of the blk_expect() run, 0 for none */
+	uint32_t run_lba;
+	uint32_t reads;
+	uint32_t read_blocks;
+	uint32_t writes;
+	uint32_t write_blocks;
+	uint32_t joined;
+	uint32_t erased;
+	uint32_t refused;
+	uint32_t errors;
+	probe_t lat;
+} blk_t;
+
+void blk_init(blk_t *b, const blk_card_t *card, uint32_t (*clock)(void),
+		uint32_t hz);
+void blk_clear(blk_t *b);
+void blk_close(blk_t *b);
+int blk_read(blk_t *b, uint32_t lba, uint8_t *buf, uint32_t n);
+int blk_begin(blk_t *b, uint32_t lba, uint32_t n);
+int blk_write(blk_t *b, uint32_t lba, const uint8_t *buf, uint32_t n);
+int blk_end(blk_t *b);
+int blk_sync(blk_t *b);
+void blk_expect(blk_t *b, uint32_t lba, uint32_t n);
+uint16_t blk_put(uint8_t *out, const blk_t *b);
+const char *blk_card_name(uint8_t id);
+
+/* The backend built in */
+extern const blk_card_t blk_card;
+
+/* The FatFs disk layer's device, in diskio.c */
+extern blk_t disk_blk;
+
+#endif /* BLKDEV_H_ */
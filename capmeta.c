@@ -0,0 +1,110 @@
+#include <string.h>
+
+#include "capmeta.h"
+#include "proto.h"
+
+static void put16(uint8_t *p, uint16_t v) {
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+}
+
+static uint16_t get16(const uint8_t *p) {
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t seg_len(const uint8_t *p) {
+	/* Big endian segment length, after the marker */
+	return ((uint32_t)p[2] << 8) | p[3];
+}
+
+void capmeta_put(uint8_t *out, const capmeta_t *m) {
+	memset(out, 0, CAPMETA_SIZE);
+	out[0] = 0xFF;
+	out[1] = CAPMETA_MARKER;
+	out[2] = (uint8_t)((CAPMETA_SIZE - 2) >> 8);
+	out[3] = (uint8_t)(CAPMETA_SIZE - 2);
+	memcpy(&out[4], "CAMM", 4);
+	out[8] = CAPMETA_VERSION;
+	out[9] = m->kind;
+	out[10] = m->q;
+	out[11] = m->tally;
+	proto_put32(&out[12], m->frame);
+	proto_put32(&out[16], m->time);
+	proto_put32(&out[20], m->uptime);
+	put16(&out[24], m->width);
+	put16(&out[26], m->height);
+	out[28] = m->qs;
+	proto_put32(&out[30], m->fcrc);
+	put16(&out[34], m->dma);
+	put16(&out[36], m->wait);
+	put16(&out[38], m->save);
+}
+
+int capmeta_parse(const uint8_t *in, capmeta_t *m) {
+	/* 0 if in holds a segment of this version */
+	if (in[0] != 0xFF || in[1] != CAPMETA_MARKER
+			|| seg_len(in) != CAPMETA_SIZE - 2
+			|| memcmp(&in[4], "CAMM", 4) != 0 || in[8] != CAPMETA_VERSION) {
+		return -1;
+	}
+	m->kind = in[9];
+	m->q = in[10];
+	m->tally = in[11];
+	m->frame = proto_get32(&in[12]);
+	m->time = proto_get32(&in[16]);
+	m->uptime = proto_get32(&in[20]);
+	m->width = get16(&in[24]);
+	m->height = get16(&in[26]);
+	m->qs = in[28];
+	m->fcrc = proto_get32(&in[30]);
+	m->dma = get16(&in[34]);
+	m->wait = get16(&in[36]);
+	m->save = get16(&in[38]);
+	return 0;
+}
+
+uint32_t capmeta_at(const uint8_t *p, uint32_t len) {
+	/* Where the segment goes into the frame p, 0 if p is no JPEG */
+	uint32_t at = 2;
+
+	if (len < 4 || p[0] != 0xFF || p[1] != 0xD8) {
+		return 0;
+	}
+	if (p[2] == 0xFF && p[3] == 0xE0 && len >= 6) {
+		/* JFIF wants its APP0 first */
+		at += 2 + seg_len(&p[2]);
+	}
+	return at < len ? at : 0;
+}
+
+uint32_t capmeta_find(const uint8_t *p, uint32_t len) {
+	/* Offset of the segment in the file p, 0 if it has none */
+	uint32_t at = capmeta_at(p, len);
+	capmeta_t m;
+
+	if (at == 0 || len - at < CAPMETA_SIZE || capmeta_parse(&p[at], &m) != 0) {
+		return 0;
+	}
+	return at;
+}
+
+int capmeta_dims(const uint8_t *p, uint32_t len, uint16_t *width,
+		uint16_t *height) {
+	/* Size from the first SOFn of the frame p, 0 if found before the SOS */
+	uint32_t at = 2;
+	uint8_t m;
+
+	while (at + 9 <= len && p[at] == 0xFF) {
+		m = p[at + 1];
+		if (m == 0xDA || m == 0xD9) {
+			break;
+		}
+		if (m >= 0xC0 && m <= 0xCF && m != 0xC4 && m != 0xC8 && m != 0xCC) {
+			*height = (uint16_t)((p[at + 5] << 8) | p[at + 6]);
+			*width = (uint16_t)((p[at + 7] << 8) | p[at + 8]);
+			return 0;
+		}
+		at += 2 + seg_len(&p[at]);
+	}
+	return -1;
+}
@@ -0,0 +1,65 @@
+/*
+ * capmeta.h
+ *
+ * Capture metadata carried in each saved image: an APP9 segment put in
+ * right after the SOI, or after the JFIF APP0 segment when the frame
+ * starts with one, of CAPMETA_SIZE bytes
+ *
+ *   FF E9 len16 'CAMM' ver8 kind8 q8 tally8 frame32 time32 uptime32
+ *   width16 height16 qs8 0 fcrc32 dma16 wait16 save16
+ *
+ * len (big endian, as for every JPEG segment) counts itself and the rest,
+ * the fields are little endian like the rest of the protocol:
+ *
+ *   kind, q, tally  as in the catalog record (catalog.h)
+ *   frame           captures since power up
+ *   time            FAT date and time of the save (get_fattime())
+ *   uptime          ms since power up at the start of the capture
+ *   width, height   from the frame's SOF
+ *   qs              OV2640 quantisation scale the frame was taken with
+ *   fcrc            frame CRC (fcrc.h) of the frame, without this segment
+ *   dma             ms from the capture start until the DMA was armed
+ *   wait            ms from then until the frame end, 0xFFFF if none
+ *   save            ms from the capture start until the save
+ *
+ * The segment is written between the pieces of the frame in ImageBuffer
+ * (sglist.h), the frame itself is not moved.
+ *
+ * capmeta_find() locates the segment in a file read back, to take it out
+ * again before the frame CRC is checked.
+ */
+
+#ifndef CAPMETA_H_
+#define CAPMETA_H_
+
+#include <stdint.h>
+
+#define CAPMETA_MARKER      0xE9
+#define CAPMETA_VERSION     1
+#define CAPMETA_SIZE        40
+#define CAPMETA_NONE        0xFFFF
+
+typedef struct {
+	uint8_t kind;
+	uint8_t q;
+	uint8_t tally;
+	uint32_t frame;
+	uint32_t time;
+	uint32_t uptime;
+	uint16_t width;
+	uint16_t height;
+	uint8_t qs;
+	uint32_t fcrc;
+	uint16_t dma;
+	uint16_t wait;
+	uint16_t save;
+} capmeta_t;
+
+void capmeta_put(uint8_t *out, const capmeta_t *m);
+int capmeta_parse(const uint8_t *in, capmeta_t *m);
+uint32_t capmeta_at(const uint8_t *p, uint32_t len);
+uint32_t capmeta_find(const uint8_t *p, uint32_t len);
+int capmeta_dims(const uint8_t *p, uint32_t len, uint16_t *width,
+		uint16_t *height);
+
+#endif /* CAPMETA_H_ */
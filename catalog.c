@@ -0,0 +1,65 @@
+#include <string.h>
+
+#include "catalog.h"
+#include "proto.h"
+
+#define CAT_CRC             (CAT_REC_SIZE - 2)
+
+static void cat_crc(uint8_t *out) {
+	uint16_t crc = proto_crc16(0xFFFF, out, CAT_CRC);
+
+	out[CAT_CRC] = (uint8_t)crc;
+	out[CAT_CRC + 1] = (uint8_t)(crc >> 8);
+}
+
+void cat_put(uint8_t *out, const cat_rec_t *r) {
+	const char *name = r->name;
+	size_t n;
+
+	if (r->kind == CAT_IMAGE && name[SEQ_DIR_LEN] == '/') {
+		name += SEQ_DIR_LEN + 1;
+	}
+	n = strlen(name);
+	memset(out, 0, CAT_NAME_SIZE);
+	memcpy(out, name, n < CAT_NAME_SIZE ? n : CAT_NAME_SIZE);
+	proto_put32(&out[15], r->size);
+	proto_put32(&out[19], r->time);
+	proto_put32(&out[23], r->fcrc);
+	out[27] = r->kind;
+	out[28] = r->q;
+	out[29] = r->tally;
+	cat_crc(out);
+}
+
+int cat_get(const uint8_t *in, cat_rec_t *r) {
+	/* 0 for a sound record */
+	if (proto_crc16(0xFFFF, in, CAT_CRC)
+			!= (in[CAT_CRC] | (in[CAT_CRC + 1] << 8))) {
+		return -1;
+	}
+	r->kind = in[27];
+	if ((r->kind & ~CAT_GONE) == CAT_IMAGE) {
+		seq_path(r->name, seq_number((const char *)in, 6));
+	} else {
+		memcpy(r->name, in, CAT_NAME_SIZE);
+		r->name[CAT_NAME_SIZE] = 0;
+	}
+	r->size = proto_get32(&in[15]);
+	r->time = proto_get32(&in[19]);
+	r->fcrc = proto_get32(&in[23]);
+	r->q = in[28];
+	r->tally = in[29];
+	return 0;
+}
+
+int cat_match(const cat_rec_t *r, const cat_filter_t *f) {
+	return (r->kind & CAT_GONE) == 0
+			&& (f->kind == CAT_ANY || r->kind == f->kind)
+			&& (f->q == CAT_ANY || r->q == f->q) && r->time >= f->since;
+}
+
+void cat_gone(uint8_t *rec) {
+	/* Marks a sound record as that of a deleted file */
+	rec[27] |= CAT_GONE;
+	cat_crc(rec);
+}
@@ -0,0 +1,78 @@
+/*
+ * catalog.h
+ *
+ * Catalog of what was saved on the card, so a listing is one sequential
+ * read of CAT_FILE instead of a directory walk. Every save appends a
+ * record of CAT_REC_SIZE bytes
+ *
+ *   name[15] size32 time32 fcrc32 kind8 q8 tally8 crc16
+ *
+ * name being the path, NUL padded, of a button image without its shard
+ * directory (seqname.h), time the FAT date and time the file got
+ * (get_fattime()), fcrc the frame CRC of the image (fcrc.h, 0 for a
+ * recording) without its metadata segment (capmeta.h), q and tally the question and the tally index of an answer
+ * (CAT_ANY otherwise) and crc the CRC-16/CCITT-FALSE of what comes before
+ * it, so a record torn by a power loss is skipped. Records never
+ * straddle a sector. The kind of a file deleted to make room (retain.h)
+ * gets CAT_GONE set and queries skip it.
+ *
+ * PROTO_CMD_CATALOG pages through it:
+ *
+ *   from32 count8 kind8 q8 since32
+ *
+ * looks at up to CAT_SCAN_MAX records from record index from on for at
+ * most count (CAT_PAGE at most) of the kind and question asked for
+ * (CAT_ANY for all) saved at or after since (FAT time, 0 for all), and
+ * answers
+ *
+ *   ACK total32 next32 n8 record * n
+ *
+ * total being the records in the catalog and next where the following
+ * page starts, total when the catalog has been read to its end.
+ *
+ * Plain byte layout, reading and writing the file is left to the caller.
+ */
+
+#ifndef CATALOG_H_
+#define CATALOG_H_
+
+#include <stdint.h>
+
+#include "seqname.h"
+
+#define CAT_FILE            "cat.dat"
+#define CAT_REC_SIZE        32
+#define CAT_NAME_SIZE       15
+#define CAT_ANY             0xFF
+#define CAT_PAGE            15
+#define CAT_SCAN_MAX        512
+#define CAT_QUERY_SIZE      11
+#define CAT_REPLY_HDR       9
+
+#define CAT_IMAGE           0   /* Button image */
+#define CAT_ANSWER          1
+#define CAT_RECORDING       2
+#define CAT_GONE            0x80
+
+typedef struct {
+	char name[SEQ_PATH_SIZE];
+	uint32_t size;
+	uint32_t time;
+	uint32_t fcrc;
+	uint8_t kind;
+	uint8_t q;
+	uint8_t tally;
+} cat_rec_t;
+
+typedef struct {
+	uint8_t kind;
+	uint8_t q;
+	uint32_t since;
+} cat_filter_t;
+
+void cat_put(uint8_t *out, const cat_rec_t *r);
+int cat_get(const uint8_t *in, cat_rec_t *r);
+int cat_match(const cat_rec_t *r, const cat_filter_t *f);
+void cat_gone(uint8_t *rec);
+
+#endif /* CATALOG_H_ */
@@ -0,0 +1,145 @@
+/*
+ * diskio.c
+ *
+ * FatFs disk layer on the card backend built in (blkdev.h), in place of
+ * the ChibiOS fatfs_diskio.c binding. Transfers go through the write-back sector cache
+ * (sectcache.h) so the FAT and directory sectors FatFs rewrites one at a
+ * time reach the card together, in order of sector and as multi-block
+ * writes, when FatFs syncs (f_sync(), f_close(), f_unlink() and the
+ * directory calls) or when a dirty line is evicted.
+ *
+ * Under the cache the card is a block device: consecutive writes share
+ * one write command, opened with a pre-erase count where the card takes
+ * one.
+ *
+ * The card is mounted and removed by the storage thread, which is the only
+ * caller, so the cache needs no locking of its own.
+ */
+
+#include <string.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "ff.h"
+#include "diskio.h"
+#include "blkdev.h"
+#include "sectcache.h"
+
+/* Cached sectors, 0 for none */
+#if !defined(CAM_CACHE_SECTORS)
+#define CAM_CACHE_SECTORS   8
+#endif
+
+static uint32_t card_clock(void) {
+	return PROBE_NOW();
+}
+
+#if CAM_CACHE_SECTORS > 0
+static uint8_t cache_buf[CAM_CACHE_SECTORS][SC_SECTOR];
+static sc_line_t cache_line[CAM_CACHE_SECTORS];
+#define CACHE_BUF           cache_buf
+#define CACHE_LINE          cache_line
+#else
+#define CACHE_BUF           NULL
+#define CACHE_LINE          NULL
+#endif
+
+blk_t disk_blk;
+sc_t disk_cache;
+
+DSTATUS disk_initialize(BYTE drv) {
+	DSTATUS stat = 0;
+
+	if (drv != 0) {
+		return STA_NOINIT;
+	}
+	/* The card is connected by the storage thread, a new volume starts
+	 * with an empty cache */
+	if (disk_cache.dev == NULL) {
+		blk_init(&disk_blk, &blk_card, card_clock, STM32_SYSCLK);
+		sc_init(&disk_cache, &disk_blk, CACHE_BUF, CACHE_LINE,
+				CAM_CACHE_SECTORS);
+	}
+	blk_close(&disk_blk);
+	sc_invalidate(&disk_cache);
+	if (!blk_card.ready()) {
+		stat |= STA_NOINIT;
+	}
+	if (blk_card.protect()) {
+		stat |= STA_PROTECT;
+	}
+	return stat;
+}
+
+DSTATUS disk_status(BYTE drv) {
+	DSTATUS stat = 0;
+
+	if (drv != 0) {
+		return STA_NOINIT;
+	}
+	if (!blk_card.ready()) {
+		stat |= STA_NOINIT;
+	}
+	if (blk_card.protect()) {
+		stat |= STA_PROTECT;
+	}
+	return stat;
+}
+
+DRESULT disk_read(BYTE drv, BYTE *buff, DWORD sector, BYTE count) {
+	if (drv != 0 || count == 0) {
+		return RES_PARERR;
+	}
+	if (!blk_card.ready()) {
+		return RES_NOTRDY;
+	}
+	return sc_read(&disk_cache, sector, buff, count) == 0 ? RES_OK : RES_ERROR;
+}
+
+DRESULT disk_write(BYTE drv, const BYTE *buff, DWORD sector, BYTE count) {
+	if (drv != 0 || count == 0) {
+		return RES_PARERR;
+	}
+	if (!blk_card.ready()) {
+		return RES_NOTRDY;
+	}
+	if (blk_card.protect()) {
+		return RES_WRPRT;
+	}
+	return sc_write(&disk_cache, sector, buff, count) == 0 ? RES_OK : RES_ERROR;
+}
+
+DRESULT disk_ioctl(BYTE drv, BYTE ctrl, void *buff) {
+	if (drv != 0) {
+		return RES_PARERR;
+	}
+	if (!blk_card.ready()) {
+		return RES_NOTRDY;
+	}
+	switch (ctrl) {
+	case CTRL_SYNC:
+		/* The flush point: dirty sectors out, then the card idle */
+		if (sc_flush(&disk_cache) != 0 || blk_sync(&disk_blk) != 0) {
+			return RES_ERROR;
+		}
+		return RES_OK;
+	case GET_SECTOR_COUNT:
+		*((DWORD *) buff) = blk_card.sectors();
+		return RES_OK;
+	case GET_SECTOR_SIZE:
+		*((WORD *) buff) = SC_SECTOR;
+		return RES_OK;
+	case GET_BLOCK_SIZE:
+		*((DWORD *) buff) = 256;    /* Erase block, in sectors */
+		return RES_OK;
+	}
+	return RES_PARERR;
+}
+
+DWORD get_fattime(void) {
+#if HAL_USE_RTC
+	return rtcGetTimeFat(&RTCD1);
+#else
+	return ((uint32_t) 0 | (1 << 16)) | (1 << 21); /* wrong but valid time */
+#endif
+}
@@ -0,0 +1,69 @@
+#include "fcrc.h"
+
+#define FCRC_POLY           0x04C11DB7
+
+static uint32_t fcrc_tab[8][256];
+static int fcrc_ready;
+
+static void fcrc_init(void) {
+	/* Table k advances a byte followed by k zero bytes */
+	uint32_t c;
+	int i, j, k;
+
+	for (i = 0; i < 256; i++) {
+		c = (uint32_t)i << 24;
+		for (j = 0; j < 8; j++) {
+			c = (c & 0x80000000) ? (c << 1) ^ FCRC_POLY : c << 1;
+		}
+		fcrc_tab[0][i] = c;
+	}
+	for (k = 1; k < 8; k++) {
+		for (i = 0; i < 256; i++) {
+			c = fcrc_tab[k - 1][i];
+			fcrc_tab[k][i] = (c << 8) ^ fcrc_tab[0][c >> 24];
+		}
+	}
+	fcrc_ready = 1;
+}
+
+static uint32_t get_word(const uint8_t *p, uint32_t n) {
+	/* Little endian, missing bytes zero */
+	uint32_t w = 0;
+
+	while (n > 0) {
+		n--;
+		w = (w << 8) | p[n];
+	}
+	return w;
+}
+
+static uint32_t fcrc_word(uint32_t crc, uint32_t w) {
+	crc ^= w;
+	return fcrc_tab[3][crc >> 24] ^ fcrc_tab[2][(crc >> 16) & 0xFF]
+			^ fcrc_tab[1][(crc >> 8) & 0xFF] ^ fcrc_tab[0][crc & 0xFF];
+}
+
+uint32_t fcrc_update(uint32_t crc, const uint8_t *p, uint32_t n) {
+	uint32_t a, b;
+
+	if (!fcrc_ready) {
+		fcrc_init();
+	}
+	for (; n >= 8; n -= 8, p += 8) {
+		a = crc ^ get_word(p, 4);
+		b = get_word(&p[4], 4);
+		crc = fcrc_tab[7][a >> 24] ^ fcrc_tab[6][(a >> 16) & 0xFF]
+				^ fcrc_tab[5][(a >> 8) & 0xFF] ^ fcrc_tab[4][a & 0xFF]
+				^ fcrc_tab[3][b >> 24] ^ fcrc_tab[2][(b >> 16) & 0xFF]
+				^ fcrc_tab[1][(b >> 8) & 0xFF] ^ fcrc_tab[0][b & 0xFF];
+	}
+	if (n >= 4) {
+		crc = fcrc_word(crc, get_word(p, 4));
+		n -= 4;
+		p += 4;
+	}
+	if (n > 0) {
+		crc = fcrc_word(crc, get_word(p, n));
+	}
+	return crc;
+}
@@ -0,0 +1,26 @@
+/*
+ * fcrc.h
+ *
+ * Frame CRC: the CRC the STM32 CRC unit gives for the frame fed to it in
+ * 32-bit words read from memory (little endian), the last one padded with
+ * zero bytes. That is CRC-32 polynomial 0x04C11DB7, initial value
+ * 0xFFFFFFFF, not reflected, no final XOR, over each word's bytes from
+ * the most significant down.
+ *
+ * The firmware feeds the unit while the frame comes in, a DMA buffer half
+ * at a time from the capturing thread, and the rest at the first save.
+ * fcrc_update() is the same CRC in software, eight bytes per step with
+ * slicing-by-8 tables, for the host tools and the builds without the unit
+ * (-DCAM_CRC_SW). Every call but the last must pass a multiple of 4 bytes.
+ */
+
+#ifndef FCRC_H_
+#define FCRC_H_
+
+#include <stdint.h>
+
+#define FCRC_INIT           0xFFFFFFFF
+
+uint32_t fcrc_update(uint32_t crc, const uint8_t *p, uint32_t n);
+
+#endif /* FCRC_H_ */
@@ -0,0 +1,122 @@
+/*
+ * camcat.c
+ *
+ * Listing client for PROTO_CMD_CATALOG.
+ *
+ *   camcat [-k kind] [-q question] [-s since] [-n max] TTY
+ *
+ * pages through the catalog of saved files (catalog.h) and prints one JSON
+ * line per file: only button images (-k 0), answers (-k 1) or recordings
+ * (-k 2), only the answers to -q, only what was saved at or after -s (FAT
+ * date and time, decimal or 0x hex), at most -n of them. A last line has
+ * the totals and the time the listing took.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "link.h"
+#include "catalog.h"
+
+#define REPLY_TIMEOUT_MS    3000
+
+static const char *const kinds[] = { "image", "answer", "recording" };
+
+static int list(link_t *l, uint8_t kind, uint8_t q, uint32_t since,
+		unsigned max) {
+	uint8_t req[CAT_QUERY_SIZE];
+	uint32_t from = 0, total = 0, listed = 0, bad = 0, pages = 0;
+	double start = link_now();
+	proto_frame_t f;
+	cat_rec_t r;
+	const uint8_t *p;
+	uint8_t i, n;
+	int rc;
+
+	do {
+		proto_put32(&req[0], from);
+		req[4] = CAT_PAGE;
+		req[5] = kind;
+		req[6] = q;
+		proto_put32(&req[7], since);
+		link_send(l, PROTO_CMD_CATALOG, (uint8_t)pages, req, sizeof(req));
+		do {
+			rc = link_recv(l, &f, REPLY_TIMEOUT_MS);
+		} while (rc > 0 && (f.cmd != (PROTO_CMD_CATALOG | PROTO_REPLY)
+				|| f.req != (uint8_t)pages));
+		if (rc <= 0 || f.len < 1 + CAT_REPLY_HDR
+				|| f.payload[0] != PROTO_ACK) {
+			fprintf(stderr, "catalog refused (no card?)\n");
+			return -1;
+		}
+		p = &f.payload[1];
+		total = proto_get32(&p[0]);
+		from = proto_get32(&p[4]);
+		n = p[8];
+		if (f.len < 1 + CAT_REPLY_HDR + n * CAT_REC_SIZE) {
+			fprintf(stderr, "short reply\n");
+			return -1;
+		}
+		for (i = 0; i < n && listed < max; i++) {
+			if (cat_get(&p[CAT_REPLY_HDR + i * CAT_REC_SIZE], &r) != 0) {
+				bad++;
+				continue;
+			}
+			printf("{\"name\":\"%s\",\"kind\":\"%s\",\"size\":%u,"
+					"\"fcrc\":\"%08x\",\"time\":\"%04u-%02u-%02u "
+					"%02u:%02u:%02u\"", r.name, r.kind < 3 ? kinds[r.kind] : "?",
+					r.size, r.fcrc,
+					1980 + (r.time >> 25), (r.time >> 21) & 15,
+					(r.time >> 16) & 31, (r.time >> 11) & 31,
+					(r.time >> 5) & 63, (r.time & 31) * 2);
+			if (r.kind == CAT_ANSWER) {
+				printf(",\"question\":%u,\"tally\":%u", r.q, r.tally);
+			}
+			printf("}\n");
+			listed++;
+		}
+		pages++;
+	} while (from < total && listed < max);
+	printf("{\"catalog\":%u,\"listed\":%u,\"bad\":%u,\"pages\":%u,"
+			"\"seconds\":%.2f}\n", total, listed, bad, pages,
+			link_now() - start);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	uint8_t kind = CAT_ANY, q = CAT_ANY;
+	uint32_t since = 0;
+	unsigned max = ~0u;
+	link_t l;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "k:q:s:n:")) != -1) {
+		switch (opt) {
+		case 'k':
+			kind = (uint8_t)atoi(optarg);
+			break;
+		case 'q':
+			q = (uint8_t)atoi(optarg);
+			break;
+		case 's':
+			since = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			max = (unsigned)atoi(optarg);
+			break;
+		default:
+			optind = argc + 1;
+			break;
+		}
+	}
+	if (optind != argc - 1) {
+		fprintf(stderr, "usage: camcat [-k kind] [-q question] [-s since] "
+				"[-n max] TTY\n");
+		return 2;
+	}
+	if (link_open_tty(&l, argv[optind], B38400) != 0) {
+		return 1;
+	}
+	return list(&l, kind, q, since, max) != 0;
+}
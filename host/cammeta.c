@@ -0,0 +1,72 @@
+/*
+ * cammeta.c
+ *
+ * Reader of the capture metadata in saved images (capmeta.h).
+ *
+ *   cammeta FILE...
+ *
+ * prints one JSON line per file with the fields of its metadata segment,
+ * the capture timings in ms, and whether the frame CRC of the file with
+ * the segment taken out still matches the one recorded at capture. Files
+ * without the segment get a line saying so. The exit status is 1 when a
+ * file could not be read or a CRC did not match.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "capmeta.h"
+#include "fcrc.h"
+#include "catalog.h"
+
+static const char *const kinds[] = { "image", "answer", "recording" };
+
+static int show(const char *path) {
+	static uint8_t buf[4 * 1024 * 1024];
+	uint32_t n, at, crc;
+	capmeta_t m;
+	FILE *fp = fopen(path, "rb");
+
+	if (fp == NULL) {
+		perror(path);
+		return 1;
+	}
+	n = (uint32_t)fread(buf, 1, sizeof(buf), fp);
+	fclose(fp);
+	if ((at = capmeta_find(buf, n)) == 0) {
+		printf("{\"file\":\"%s\",\"meta\":false}\n", path);
+		return 0;
+	}
+	capmeta_parse(&buf[at], &m);
+	memmove(&buf[at], &buf[at + CAPMETA_SIZE], n - at - CAPMETA_SIZE);
+	crc = fcrc_update(FCRC_INIT, buf, n - CAPMETA_SIZE);
+	printf("{\"file\":\"%s\",\"kind\":\"%s\",\"frame\":%u,\"time\":\"%04u-%02u-"
+			"%02u %02u:%02u:%02u\",\"uptime_ms\":%u,\"width\":%u,"
+			"\"height\":%u,\"qs\":%u", path,
+			m.kind < 3 ? kinds[m.kind] : "?", m.frame,
+			1980 + (m.time >> 25), (m.time >> 21) & 15, (m.time >> 16) & 31,
+			(m.time >> 11) & 31, (m.time >> 5) & 63, (m.time & 31) * 2,
+			m.uptime, m.width, m.height, m.qs);
+	if (m.kind == CAT_ANSWER) {
+		printf(",\"question\":%u,\"tally\":%u", m.q, m.tally);
+	}
+	printf(",\"dma_ms\":%u", m.dma);
+	if (m.wait != CAPMETA_NONE) {
+		printf(",\"wait_ms\":%u", m.wait);
+	}
+	printf(",\"save_ms\":%u,\"fcrc\":\"%08x\",\"fcrc_ok\":%s}\n", m.save,
+			m.fcrc, crc == m.fcrc ? "true" : "false");
+	return crc != m.fcrc;
+}
+
+int main(int argc, char *argv[]) {
+	int i, rc = 0;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: cammeta FILE...\n");
+		return 2;
+	}
+	for (i = 1; i < argc; i++) {
+		rc |= show(argv[i]);
+	}
+	return rc;
+}
@@ -0,0 +1,304 @@
+/*
+ * camperf.c
+ *
+ * Hot path benchmark client.
+ *
+ *   camperf [-n pings] [-c baseline] [-t percent] TTY
+ *   camperf -p|-r TTY
+ *   camperf -s|-S TTY
+ *
+ * times PING round trips over the link, then has the device run its
+ * benchmarks (PROTO_CMD_BENCH, firmware built with -DCAM_BENCH) and prints
+ * one JSON object per line:
+ *
+ *   {"bench":"cam_save","n":3,"units":60000,"min_us":..,"mean_us":..,
+ *    "max_us":..,"units_per_s":..}
+ *
+ * -p instead prints the timing probe table (PROTO_CMD_PROBES, firmware
+ * built with -DCAM_PROBES), one line per probe with the histogram as the
+ * counts of times from 4^i to 4^(i+1) ticks; -r also clears it. -s
+ * prints the storage queue statistics (PROTO_CMD_STORAGE, storage.h), one
+ * line per request class, a line with the disk sector cache counters
+ * (sectcache.h) and one with the card backend's write commands and their
+ * latency (blkdev.h); -S also clears them.
+ *
+ * TTY is the board or the simulation's link (sim/, CAMSIM_LINK). With -c
+ * the means are compared against an earlier run's output and any that got
+ * slower by more than -t percent (10) are reported; the exit status is
+ * then non-zero.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "blkdev.h"
+#include "link.h"
+#include "probe.h"
+#include "sectcache.h"
+#include "storage.h"
+
+#define PING_SIZE       16
+#define PING_TIMEOUT_MS 1000
+#define BENCH_TIMEOUT_S 300
+
+typedef struct {
+	char name[32];
+	double mean_us;
+} result_t;
+
+static result_t results[16];
+static unsigned nresults;
+
+static void emit(const char *name, unsigned n, uint32_t units, double min_us,
+		double mean_us, double max_us) {
+	printf("{\"bench\":\"%s\",\"n\":%u,\"units\":%u,\"min_us\":%.1f,"
+			"\"mean_us\":%.1f,\"max_us\":%.1f,\"units_per_s\":%.0f}\n", name, n,
+			units, min_us, mean_us, max_us,
+			mean_us > 0 ? units * 1e6 / mean_us : 0.0);
+	if (n > 0 && nresults < sizeof(results) / sizeof(results[0])) {
+		snprintf(results[nresults].name, sizeof(results[0].name), "%s", name);
+		results[nresults++].mean_us = mean_us;
+	}
+}
+
+static int ping(link_t *l, unsigned count) {
+	uint8_t payload[PING_SIZE];
+	proto_frame_t f;
+	double t, dt, min = 1e9, max = 0, sum = 0;
+	unsigned i, ok = 0;
+	int rc;
+
+	memset(payload, 0x55, sizeof(payload));
+	for (i = 0; i < count; i++) {
+		t = link_now();
+		link_send(l, PROTO_CMD_PING, (uint8_t)i, payload, PING_SIZE);
+		do {
+			rc = link_recv(l, &f, PING_TIMEOUT_MS);
+		} while (rc > 0 && (f.cmd != (PROTO_CMD_PING | PROTO_REPLY)
+				|| f.req != (uint8_t)i));
+		if (rc <= 0) {
+			continue;
+		}
+		dt = (link_now() - t) * 1e6;
+		min = dt < min ? dt : min;
+		max = dt > max ? dt : max;
+		sum += dt;
+		ok++;
+	}
+	emit("uart_rtt", ok, PING_SIZE, ok ? min : 0, ok ? sum / ok : 0, max);
+	return ok == count ? 0 : -1;
+}
+
+static int bench(link_t *l) {
+	proto_frame_t f;
+	bench_rec_t r;
+	double start = link_now(), us;
+	uint32_t hz;
+	unsigned i;
+	int rc;
+
+	link_send(l, PROTO_CMD_BENCH, 0x42, NULL, 0);
+	do {
+		rc = link_recv(l, &f, 1000);
+	} while (rc >= 0 && (rc == 0 || f.cmd != (PROTO_CMD_BENCH | PROTO_REPLY))
+			&& link_now() - start < BENCH_TIMEOUT_S);
+	if (rc <= 0 || f.len < BENCH_HDR_SIZE || f.payload[0] != PROTO_ACK) {
+		fprintf(stderr, "benchmarks refused (firmware built without "
+				"CAM_BENCH, or busy)\n");
+		return -1;
+	}
+	hz = proto_get32(&f.payload[1]);
+	us = 1e6 / hz;
+	for (i = 0; i < f.payload[5]
+			&& BENCH_HDR_SIZE + (i + 1) * BENCH_REC_SIZE <= f.len; i++) {
+		bench_get(&f.payload[BENCH_HDR_SIZE + i * BENCH_REC_SIZE], &r);
+		emit(bench_name(r.id), r.n, r.units, r.min * us, r.mean * us,
+				r.max * us);
+	}
+	return 0;
+}
+
+static int probes(link_t *l, uint8_t clear) {
+	proto_frame_t f;
+	probe_rec_t r;
+	double us;
+	unsigned i, b;
+	int rc;
+
+	link_send(l, PROTO_CMD_PROBES, 0x50, &clear, 1);
+	do {
+		rc = link_recv(l, &f, 1000);
+	} while (rc > 0 && f.cmd != (PROTO_CMD_PROBES | PROTO_REPLY));
+	if (rc <= 0 || f.len < PROBE_HDR_SIZE || f.payload[0] != PROTO_ACK) {
+		fprintf(stderr, "no probe table (firmware built without "
+				"CAM_PROBES)\n");
+		return -1;
+	}
+	us = 1e6 / proto_get32(&f.payload[1]);
+	for (i = 0; i < f.payload[5]
+			&& PROBE_HDR_SIZE + (i + 1) * PROBE_REC_SIZE <= f.len; i++) {
+		probe_get(&f.payload[PROBE_HDR_SIZE + i * PROBE_REC_SIZE], &r);
+		printf("{\"probe\":\"%s\",\"n\":%u,\"min_us\":%.1f,"
+				"\"mean_us\":%.1f,\"max_us\":%.1f,\"hist\":[",
+				probe_name(r.id), r.n, r.min * us, r.mean * us, r.max * us);
+		for (b = 0; b < PROBE_BINS; b++) {
+			printf(b ? ",%u" : "%u", r.hist[b]);
+		}
+		printf("]}\n");
+	}
+	return 0;
+}
+
+static int storage(link_t *l, uint8_t clear) {
+	static const char *const names[STG_CLASSES] = {
+		"control", "interactive", "bulk"
+	};
+	const uint8_t *p;
+	proto_frame_t f;
+	uint32_t hits, misses, blocks;
+	probe_rec_t lat;
+	unsigned i;
+	double us;
+	int rc;
+
+	link_send(l, PROTO_CMD_STORAGE, 0x53, &clear, 1);
+	do {
+		rc = link_recv(l, &f, 1000);
+	} while (rc > 0 && f.cmd != (PROTO_CMD_STORAGE | PROTO_REPLY));
+	if (rc <= 0 || f.len < 8 || f.payload[0] != PROTO_ACK) {
+		fprintf(stderr, "no storage statistics\n");
+		return -1;
+	}
+	p = &f.payload[1];
+	printf("{\"queue\":\"storage\",\"depth\":%u,\"peak\":%u,\"batched\":%u}\n",
+			p[0], p[1], proto_get32(&p[2]));
+	for (i = 0; i < p[6] && 8 + (i + 1) * 12 <= f.len; i++) {
+		printf("{\"class\":\"%s\",\"n\":%u,\"mean_wait_ms\":%u,"
+				"\"max_wait_ms\":%u}\n", i < STG_CLASSES ? names[i] : "unknown",
+				proto_get32(&p[7 + i * 12]), proto_get32(&p[11 + i * 12]),
+				proto_get32(&p[15 + i * 12]));
+	}
+	if (f.len >= 1 + STG_STATS_SIZE + SC_STATS_SIZE) {
+		p = &f.payload[1 + STG_STATS_SIZE];
+		hits = proto_get32(&p[2]);
+		misses = proto_get32(&p[6]);
+		printf("{\"cache\":\"disk\",\"lines\":%u,\"hits\":%u,\"misses\":%u,"
+				"\"hit_rate\":%.3f,\"absorbed\":%u,\"dev_reads\":%u,"
+				"\"dev_read_blocks\":%u,\"dev_writes\":%u,"
+				"\"dev_write_blocks\":%u,\"flushes\":%u}\n",
+				p[0] | (p[1] << 8), hits, misses,
+				hits + misses ? (double)hits / (hits + misses) : 0.0,
+				proto_get32(&p[10]), proto_get32(&p[14]), proto_get32(&p[18]),
+				proto_get32(&p[22]), proto_get32(&p[26]), proto_get32(&p[30]));
+	}
+	if (f.len >= 1 + STG_STATS_SIZE + SC_STATS_SIZE + BLK_STATS_SIZE) {
+		p = &f.payload[1 + STG_STATS_SIZE + SC_STATS_SIZE];
+		us = 1e6 / proto_get32(&p[1]);
+		probe_get(&p[37], &lat);
+		blocks = proto_get32(&p[17]);
+		printf("{\"device\":\"%s\",\"reads\":%u,\"read_blocks\":%u,"
+				"\"writes\":%u,\"write_blocks\":%u,\"joined\":%u,"
+				"\"erased\":%u,\"refused\":%u,\"errors\":%u,"
+				"\"write_min_us\":%.0f,\"write_mean_us\":%.0f,"
+				"\"write_max_us\":%.0f,\"write_kb_s\":%.1f}\n",
+				blk_card_name(p[0]), proto_get32(&p[5]), proto_get32(&p[9]),
+				proto_get32(&p[13]), blocks, proto_get32(&p[21]),
+				proto_get32(&p[25]), proto_get32(&p[29]), proto_get32(&p[33]),
+				lat.min * us,
+				lat.mean * us, lat.max * us, lat.mean > 0 ? blocks * BLK_SECTOR
+				/ 1024.0 / (lat.mean * us * lat.n / 1e6) : 0.0);
+	}
+	return 0;
+}
+
+static int compare(const char *path, double percent) {
+	/* Reads an earlier run's output, reports the benchmarks that slowed */
+	char line[256], name[32];
+	double mean;
+	unsigned i;
+	int worse = 0;
+	FILE *fp = fopen(path, "r");
+
+	if (fp == NULL) {
+		perror(path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		char *m = strstr(line, "\"mean_us\":");
+
+		if (sscanf(line, "{\"bench\":\"%31[^\"]\"", name) != 1 || m == NULL
+				|| sscanf(m, "\"mean_us\":%lf", &mean) != 1 || mean <= 0) {
+			continue;
+		}
+		for (i = 0; i < nresults; i++) {
+			if (strcmp(results[i].name, name) == 0
+					&& results[i].mean_us > mean * (1 + percent / 100)) {
+				fprintf(stderr, "%s: %.1f us, was %.1f us (+%.0f%%)\n", name,
+						results[i].mean_us, mean,
+						100 * (results[i].mean_us / mean - 1));
+				worse++;
+			}
+		}
+	}
+	fclose(fp);
+	return worse;
+}
+
+int main(int argc, char *argv[]) {
+	const char *baseline = NULL;
+	unsigned pings = 50;
+	double percent = 10;
+	link_t l;
+	int opt, dump = -1, queue = -1, fail = 0;
+
+	while ((opt = getopt(argc, argv, "n:c:t:prsS")) != -1) {
+		switch (opt) {
+		case 's':
+			queue = 0;
+			break;
+		case 'S':
+			queue = 1;
+			break;
+		case 'p':
+			dump = 0;
+			break;
+		case 'r':
+			dump = 1;
+			break;
+		case 'n':
+			pings = (unsigned)atoi(optarg);
+			break;
+		case 'c':
+			baseline = optarg;
+			break;
+		case 't':
+			percent = atof(optarg);
+			break;
+		default:
+			optind = argc;
+			break;
+		}
+	}
+	if (optind != argc - 1) {
+		fprintf(stderr, "usage: camperf [-n pings] [-c baseline] [-t percent]"
+				" TTY\n       camperf -p|-r TTY\n       camperf -s|-S TTY\n");
+		return 2;
+	}
+	if (link_open_tty(&l, argv[optind], B38400) != 0) {
+		return 1;
+	}
+	if (dump >= 0) {
+		return probes(&l, (uint8_t)dump) != 0;
+	}
+	if (queue >= 0) {
+		return storage(&l, (uint8_t)queue) != 0;
+	}
+	fail |= ping(&l, pings) != 0;
+	fail |= bench(&l) != 0;
+	if (baseline != NULL) {
+		fail |= compare(baseline, percent) != 0;
+	}
+	return fail;
+}
@@ -0,0 +1,215 @@
+/*
+ * camrec.c
+ *
+ * Recording client for PROTO_CMD_RECORD and checker of the AVI files it
+ * makes.
+ *
+ *   camrec [-I] [-n frames] [-i interval_ms] [-t seconds] TTY NAME
+ *
+ * records into NAME on the card (8.3, .avi by convention), after powering
+ * up and initialising the camera with -I. The device records -n frames (0,
+ * the default, for as many as the index holds), one every -i ms or as
+ * fast as the card keeps up; with -t the recording is stopped after that
+ * many seconds. Prints one JSON line with the device's counts.
+ *
+ *   camrec -c FILE
+ *
+ * checks a recording copied off the card: the header, that the frame
+ * index (tidx), idx1 and the chunks agree, that the frame times go
+ * forward and that every frame is a whole JPEG. Prints one JSON line, the
+ * exit status is 1 if anything is off. A single frame is fetched with
+ * fetch -k.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "link.h"
+#include "avi.h"
+
+#define START_TIMEOUT_MS    5000
+#define WAIT_TIMEOUT_MS     100
+
+static int request(link_t *l, uint8_t cmd, uint8_t req, const uint8_t *p,
+		uint16_t len, proto_frame_t *f, int timeout_ms) {
+	int rc;
+
+	link_send(l, cmd, req, p, len);
+	do {
+		rc = link_recv(l, f, timeout_ms);
+	} while (rc > 0 && (f->cmd != (cmd | PROTO_REPLY) || f->req != req));
+	return rc > 0 && f->len > 0 && f->payload[0] == PROTO_ACK ? 0 : -1;
+}
+
+static int record(link_t *l, int init, unsigned frames, unsigned interval,
+		double seconds, const char *name) {
+	uint8_t arg[5 + 12];
+	size_t n = strlen(name);
+	double stop_at;
+	proto_frame_t f;
+	const uint8_t *p;
+	int rc;
+
+	if (init && request(l, PROTO_CMD_INIT, 1, NULL, 0, &f,
+			START_TIMEOUT_MS) != 0) {
+		fprintf(stderr, "camera init failed\n");
+		return -1;
+	}
+	n = n < sizeof(arg) - 5 ? n : sizeof(arg) - 5;
+	arg[0] = 1;
+	arg[1] = (uint8_t)frames;
+	arg[2] = (uint8_t)(frames >> 8);
+	arg[3] = (uint8_t)interval;
+	arg[4] = (uint8_t)(interval >> 8);
+	memcpy(&arg[5], name, n);
+	if (request(l, PROTO_CMD_RECORD, 2, arg, (uint16_t)(5 + n), &f,
+			START_TIMEOUT_MS) != 0) {
+		fprintf(stderr, "recording not started (camera not initialised, "
+				"no card or bad name)\n");
+		return -1;
+	}
+	stop_at = seconds > 0 ? link_now() + seconds : 0;
+	for (;;) {
+		rc = link_recv(l, &f, WAIT_TIMEOUT_MS);
+		if (rc < 0) {
+			fprintf(stderr, "device went away\n");
+			return -1;
+		}
+		if (rc > 0 && f.cmd == (PROTO_CMD_RECORD | PROTO_REPLY) && f.req == 2) {
+			break;
+		}
+		if (stop_at > 0 && link_now() >= stop_at) {
+			arg[0] = 0;
+			link_send(l, PROTO_CMD_RECORD, 3, arg, 1);
+			stop_at = 0;
+		}
+	}
+	if (f.len < 23) {
+		fprintf(stderr, "short reply\n");
+		return -1;
+	}
+	p = &f.payload[1];
+	printf("{\"record\":\"%s\",\"closed\":%s,\"frames\":%u,\"dropped\":%u,"
+			"\"bad\":%u,\"bytes\":%u,\"ms\":%u,\"fps\":%.1f}\n", name,
+			f.payload[0] == PROTO_ACK ? "true" : "false", proto_get32(&p[0]),
+			proto_get32(&p[4]), proto_get32(&p[8]), proto_get32(&p[12]),
+			proto_get32(&p[16]), (p[20] | (p[21] << 8)) / 10.0);
+	return f.payload[0] == PROTO_ACK ? 0 : -1;
+}
+
+static int check(const char *path) {
+	/* Every frame by its tidx entry, then idx1 against tidx */
+	uint8_t hdr[AVI_SECTOR], tent[AVI_TENT_SIZE], ent[AVI_ENTRY_SIZE];
+	uint8_t ck[AVI_CHUNK_HDR];
+	uint8_t *frame = NULL;
+	uint32_t frames, movi, idx, i, off, len, ms, last = 0, us, bad = 0;
+	long size;
+	FILE *fp;
+
+	if ((fp = fopen(path, "rb")) == NULL) {
+		perror(path);
+		return -1;
+	}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	rewind(fp);
+	if (fread(hdr, 1, sizeof(hdr), fp) != sizeof(hdr)
+			|| (frames = avi_frames(hdr)) > AVI_FRAMES_MAX
+			|| fseek(fp, AVI_MOVI - 8, SEEK_SET) != 0
+			|| fread(ck, 1, sizeof(ck), fp) != sizeof(ck)
+			|| memcmp(ck, "LIST", 4) != 0) {
+		fprintf(stderr, "%s: not a recording\n", path);
+		fclose(fp);
+		return -1;
+	}
+	movi = proto_get32(&ck[4]) - 4;
+	idx = AVI_HDR_SIZE + movi;
+	if (proto_get32(&hdr[4]) + 8 != (uint32_t)size
+			|| fseek(fp, idx, SEEK_SET) != 0 || fread(ck, 1, 8, fp) != 8
+			|| memcmp(ck, "idx1", 4) != 0
+			|| proto_get32(&ck[4]) != frames * AVI_ENTRY_SIZE) {
+		fprintf(stderr, "%s: sizes or index header off (recording not "
+				"closed?)\n", path);
+		fclose(fp);
+		return -1;
+	}
+	for (i = 0; i < frames; i++) {
+		fseek(fp, AVI_TENT(i), SEEK_SET);
+		if (fread(tent, 1, sizeof(tent), fp) != sizeof(tent)) {
+			bad++;
+			break;
+		}
+		avi_tent(tent, &off, &len, &ms);
+		fseek(fp, idx + 8 + i * AVI_ENTRY_SIZE, SEEK_SET);
+		if (fread(ent, 1, sizeof(ent), fp) != sizeof(ent)
+				|| memcmp(ent, "00dc", 4) != 0
+				|| proto_get32(&ent[8]) != off
+				|| proto_get32(&ent[12]) != len || ms < last) {
+			bad++;
+			continue;
+		}
+		last = ms;
+		fseek(fp, AVI_MOVI + off, SEEK_SET);
+		if (off + AVI_CHUNK_SIZE(len) > movi + 4
+				|| fread(ck, 1, sizeof(ck), fp) != sizeof(ck)
+				|| memcmp(ck, "00dc", 4) != 0 || proto_get32(&ck[4]) != len
+				|| len < 4 || (frame = realloc(frame, len)) == NULL
+				|| fread(frame, 1, len, fp) != len
+				|| frame[0] != 0xFF || frame[1] != 0xD8
+				|| frame[len - 2] != 0xFF || frame[len - 1] != 0xD9) {
+			bad++;
+		}
+	}
+	us = proto_get32(&hdr[32]);
+	printf("{\"file\":\"%s\",\"frames\":%u,\"width\":%u,\"height\":%u,"
+			"\"fps\":%.1f,\"last_ms\":%u,\"bytes\":%ld,\"bad\":%u}\n", path,
+			frames, proto_get32(&hdr[64]), proto_get32(&hdr[68]),
+			us > 0 ? 1e6 / us : 0.0, last, size, bad);
+	free(frame);
+	fclose(fp);
+	return bad == 0 ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+	unsigned frames = 0, interval = 0;
+	double seconds = 0;
+	const char *verify = NULL;
+	link_t l;
+	int opt, init = 0;
+
+	while ((opt = getopt(argc, argv, "In:i:t:c:")) != -1) {
+		switch (opt) {
+		case 'I':
+			init = 1;
+			break;
+		case 'n':
+			frames = (unsigned)atoi(optarg);
+			break;
+		case 'i':
+			interval = (unsigned)atoi(optarg);
+			break;
+		case 't':
+			seconds = atof(optarg);
+			break;
+		case 'c':
+			verify = optarg;
+			break;
+		default:
+			optind = argc + 1;
+			break;
+		}
+	}
+	if (verify != NULL && optind == argc) {
+		return check(verify) != 0;
+	}
+	if (verify != NULL || optind != argc - 2) {
+		fprintf(stderr, "usage: camrec [-I] [-n frames] [-i interval_ms] "
+				"[-t seconds] TTY NAME\n       camrec -c FILE\n");
+		return 2;
+	}
+	if (link_open_tty(&l, argv[optind], B38400) != 0) {
+		return 1;
+	}
+	return record(&l, init, frames, interval, seconds, argv[optind + 1]) != 0;
+}
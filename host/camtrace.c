@@ -0,0 +1,170 @@
+/*
+ * camtrace.c
+ *
+ * Capture event trace client.
+ *
+ *   camtrace [-w seconds] [-a] TTY
+ *
+ * reads the device's event trace (PROTO_CMD_TRACE, firmware built with
+ * -DCAM_TRACE) and prints it as one timeline per capture, each starting at
+ * a trigger (button or host command):
+ *
+ *   capture 3 (host) at 41.207 s
+ *         0.000 ms  trigger
+ *         0.021 ms  dcmi_start
+ *       312.940 ms  frame_end   1
+ *       ...
+ *      2893.114 ms  f_close     0
+ *
+ * Event times are cycle counter ticks and wrap every 2^32 ticks (25.6 s at
+ * 168 MHz); timelines are unwrapped from event to event, so quiet spells
+ * longer than that shift the absolute times printed but not the ones
+ * within a capture. -w keeps polling every given number of seconds and
+ * prints new events as they come in. Without -a only events from the first
+ * trigger on are shown.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "link.h"
+#include "trace.h"
+
+#define TRACE_TIMEOUT_MS 1000
+
+typedef struct {
+	uint32_t next;      /* Sequence number to ask for */
+	uint32_t last_t;    /* Unwrapping */
+	uint64_t ticks;
+	double hz;
+	int started;
+	int open;           /* Events shown since the last trigger */
+	unsigned captures;
+	double capture_at;  /* Seconds, start of the open capture */
+} timeline_t;
+
+static int fetch(link_t *l, timeline_t *tl, trace_ev_t *evs, unsigned max,
+		unsigned *count, uint32_t *head) {
+	/* One page from tl->next on, moves tl->next past it */
+	proto_frame_t f;
+	uint8_t from[4];
+	uint32_t first;
+	unsigned i, n;
+	int rc;
+
+	proto_put32(from, tl->next);
+	link_send(l, PROTO_CMD_TRACE, 0x54, from, 4);
+	do {
+		rc = link_recv(l, &f, TRACE_TIMEOUT_MS);
+	} while (rc > 0 && f.cmd != (PROTO_CMD_TRACE | PROTO_REPLY));
+	if (rc <= 0 || f.len < TRACE_HDR_SIZE || f.payload[0] != PROTO_ACK) {
+		fprintf(stderr, "no event trace (firmware built without "
+				"CAM_TRACE)\n");
+		return -1;
+	}
+	tl->hz = proto_get32(&f.payload[1]);
+	*head = proto_get32(&f.payload[5]);
+	first = proto_get32(&f.payload[9]);
+	n = f.payload[13];
+	if (first != tl->next) {
+		printf("  (%u events overwritten)\n", first - tl->next);
+	}
+	for (i = 0; i < n && i < max
+			&& TRACE_HDR_SIZE + (i + 1) * TRACE_REC_SIZE <= f.len; i++) {
+		trace_get(&f.payload[TRACE_HDR_SIZE + i * TRACE_REC_SIZE], &evs[i]);
+	}
+	*count = i;
+	tl->next = first + i;
+	return 0;
+}
+
+static void show(timeline_t *tl, const trace_ev_t *e, int all) {
+	double at;
+
+	if (!tl->started && e->ev != TRACE_TRIGGER && !all) {
+		tl->last_t = e->t;
+		return;
+	}
+	tl->ticks += tl->started ? (uint32_t)(e->t - tl->last_t) : 0;
+	tl->last_t = e->t;
+	at = tl->ticks / tl->hz;
+	if (!tl->started) {
+		tl->started = 1;
+		tl->capture_at = at;
+		if (e->ev != TRACE_TRIGGER) {
+			printf("before the first capture\n");
+		}
+	}
+	if (e->ev == TRACE_TRIGGER) {
+		if (tl->open) {
+			printf("\n");
+		}
+		tl->captures++;
+		tl->capture_at = at;
+		printf("capture %u (%s) at %.3f s\n", tl->captures,
+				e->arg ? "host" : "button", at);
+	}
+	printf("  %12.3f ms  %-12s", (at - tl->capture_at) * 1e3,
+			trace_name(e->ev));
+	switch (e->ev) {
+	case TRACE_FRAME_END:
+	case TRACE_FILE_WRITE:
+	case TRACE_FILE_OPEN:
+	case TRACE_FILE_CLOSE:
+		printf("%u", e->arg);
+		break;
+	case TRACE_SCCB_ERROR:
+		printf("%s reg 0x%02x status %d", e->arg >> 16 ? "read" : "write",
+				e->arg & 0xFF, (int8_t)(e->arg >> 8));
+		break;
+	}
+	printf("\n");
+	tl->open = 1;
+}
+
+int main(int argc, char *argv[]) {
+	static trace_ev_t evs[TRACE_DUMP_MAX];
+	timeline_t tl = { 0 };
+	double watch = 0;
+	unsigned i, n;
+	uint32_t head;
+	link_t l;
+	int opt, all = 0;
+
+	while ((opt = getopt(argc, argv, "w:a")) != -1) {
+		switch (opt) {
+		case 'w':
+			watch = atof(optarg);
+			break;
+		case 'a':
+			all = 1;
+			break;
+		default:
+			optind = argc;
+			break;
+		}
+	}
+	if (optind != argc - 1) {
+		fprintf(stderr, "usage: camtrace [-w seconds] [-a] TTY\n");
+		return 2;
+	}
+	if (link_open_tty(&l, argv[optind], B38400) != 0) {
+		return 1;
+	}
+	for (;;) {
+		do {
+			if (fetch(&l, &tl, evs, TRACE_DUMP_MAX, &n, &head) != 0) {
+				return 1;
+			}
+			for (i = 0; i < n; i++) {
+				show(&tl, &evs[i], all);
+			}
+		} while (n > 0 && tl.next != head);
+		if (watch <= 0) {
+			break;
+		}
+		fflush(stdout);
+		link_sleep(watch);
+	}
+	return 0;
+}
@@ -0,0 +1,72 @@
+#include "chan.h"
+#include "link.h"
+
+void chan_init(chan_t *c, stream_t *sp) {
+	c->sp = sp;
+	c->pos = 0;
+	c->len = 0;
+	c->next_req = 0;
+	proto_init(&c->parser);
+}
+
+void chan_send(chan_t *c, uint8_t cmd, uint8_t req, const uint8_t *payload,
+		uint16_t len) {
+	uint8_t frame[PROTO_MAX_FRAME];
+
+	streamWrite(c->sp, frame, proto_encode(frame, cmd, req, payload, len));
+}
+
+int chan_recv(chan_t *c, proto_frame_t *f, uint32_t timeout_ms) {
+	/* Returns 1 with the next frame, 0 if none arrived within timeout_ms */
+	double deadline = link_now() + timeout_ms / 1000.0;
+	int left;
+
+	for (;;) {
+		while (c->pos < c->len) {
+			if (proto_feed(&c->parser, c->buf[c->pos++], f)) {
+				return 1;
+			}
+		}
+		left = (int)((deadline - link_now()) * 1000.0);
+		c->pos = 0;
+		c->len = streamRead(c->sp, c->buf, sizeof(c->buf),
+				left > 0 ? (uint32_t)left : 0);
+		if (c->len == 0) {
+			return 0;
+		}
+	}
+}
+
+int chan_request(chan_t *c, uint8_t cmd, const uint8_t *payload,
+		uint16_t len, uint32_t timeout_ms, proto_frame_t *f) {
+	/* Sends one request and waits for its reply, skipping anything else;
+	 * 1 on ACK, 0 on NAK or no reply */
+	uint8_t req = c->next_req++;
+
+	chan_send(c, cmd, req, payload, len);
+	while (chan_recv(c, f, timeout_ms) > 0) {
+		if (f->cmd == (cmd | PROTO_REPLY) && f->req == req) {
+			return f->len > 0 && f->payload[0] == PROTO_ACK;
+		}
+	}
+	return 0;
+}
+
+int chan_baud(chan_t *c, uint32_t baud) {
+	/* BAUD at the current rate, follow, then confirm with a PING */
+	uint8_t arg[4];
+	proto_frame_t f;
+	int tries;
+
+	proto_put32(arg, baud);
+	if (!chan_request(c, PROTO_CMD_BAUD, arg, 4, 2000, &f)) {
+		return 0;
+	}
+	streamSetBaud(c->sp, baud);
+	for (tries = 0; tries < 3; tries++) {
+		if (chan_request(c, PROTO_CMD_PING, NULL, 0, 200, &f)) {
+			return 1;
+		}
+	}
+	return 0;
+}
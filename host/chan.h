@@ -0,0 +1,32 @@
+/*
+ * chan.h
+ *
+ * Framed requests on top of a stream_t (../stream.h) for the host tools
+ * that run the firmware stream layer: send, receive with timeout, one
+ * request/reply round trip and baud negotiation (../baud.h).
+ */
+
+#ifndef CHAN_H_
+#define CHAN_H_
+
+#include "proto.h"
+#include "stream.h"
+
+typedef struct {
+	stream_t *sp;
+	proto_parser_t parser;
+	uint8_t buf[256];
+	size_t pos;
+	size_t len;
+	uint8_t next_req;
+} chan_t;
+
+void chan_init(chan_t *c, stream_t *sp);
+void chan_send(chan_t *c, uint8_t cmd, uint8_t req, const uint8_t *payload,
+		uint16_t len);
+int chan_recv(chan_t *c, proto_frame_t *f, uint32_t timeout_ms);
+int chan_request(chan_t *c, uint8_t cmd, const uint8_t *payload,
+		uint16_t len, uint32_t timeout_ms, proto_frame_t *f);
+int chan_baud(chan_t *c, uint32_t baud);
+
+#endif /* CHAN_H_ */
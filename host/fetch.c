@@ -0,0 +1,396 @@
+/*
+ * fetch.c
+ *
+ * Download client for PROTO_CMD_DOWNLOAD.
+ *
+ *   fetch [-w window] [-c chunk] [-o offset] [-l ms] [-k frame] [-v] TTY
+ *         [NAME [OUT]]
+ *
+ * fetches NAME from the card (or the frame still in ImageBuffer when NAME
+ * is omitted or "-") into OUT, resuming at -o bytes. The frame in
+ * ImageBuffer comes with its frame CRC (fcrc.h), which is checked against
+ * OUT; -v checks NAME the same way against the CRC in its catalog record
+ * (catalog.h), with the metadata segment of the file (capmeta.h) taken
+ * out, the CRC being of the frame as it came in. The exit status is 1 on a mismatch. With -k it fetches
+ * only that frame of the recording NAME (see avi.h), by default into
+ * frame.jpg, and prints the frame's time in the recording. With "-" as the TTY it
+ * runs a benchmark instead: a stand-in device on a pseudo-terminal serves a
+ * 32 KB object through the firmware sender (xfer.c) with its output paced
+ * to 38400 baud, and the client fetches it stop-and-wait, windowed, with
+ * chunks lost on the way and resumed half way, reporting the throughput of
+ * each against the line rate. -l adds a turnaround delay before each ACK to
+ * model USB serial adapter latency (10 ms by default).
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "link.h"
+#include "xfer.h"
+#include "seqname.h"
+#include "catalog.h"
+#include "fcrc.h"
+#include "capmeta.h"
+
+#define BAUD            38400
+#define OBJ_SIZE        32768
+#define ACK_TIMEOUT_MS  500     /* Same as DL_ACK_TIMEOUT in main.c */
+#define IDLE_TIMEOUT_MS 1000
+
+static double ack_delay;
+static long frame = -1;
+
+typedef struct {
+	uint32_t size;
+	uint32_t ms;
+	uint32_t fcrc;      /* Of the frame in ImageBuffer */
+	uint32_t got;
+	unsigned acks;
+	double elapsed;
+} fetch_t;
+
+static int fetch(link_t *l, const char *name, uint32_t offset, uint16_t chunk,
+		uint8_t window, uint8_t *dst, uint32_t dst_size, fetch_t *r) {
+	/* Receiver side: take chunks in order, ACK the next offset wanted and
+	 * repeat that ACK once when a chunk turns up out of order.
+	 */
+	uint8_t req[12 + SEQ_PATH_SIZE - 1];
+	uint16_t n = 8;
+	uint32_t expected = offset, off, wanted_dup = 0xFFFFFFFF;
+	proto_frame_t f;
+	uint8_t ack[4];
+	int idle = 0, rc;
+	double start = link_now();
+
+	memset(r, 0, sizeof(*r));
+	req[0] = name != NULL;
+	proto_put32(&req[1], offset);
+	req[5] = (uint8_t)chunk;
+	req[6] = (uint8_t)(chunk >> 8);
+	req[7] = window;
+	if (name != NULL && frame >= 0) {
+		req[0] = 2;
+		proto_put32(&req[8], (uint32_t)frame);
+		n += 4;
+	}
+	if (name != NULL) {
+		size_t len = strlen(name) < SEQ_PATH_SIZE - 1 ? strlen(name)
+				: SEQ_PATH_SIZE - 1;
+		memcpy(&req[n], name, len);
+		n += (uint16_t)len;
+	}
+	link_send(l, PROTO_CMD_DOWNLOAD, 0x5A, req, n);
+
+	do {
+		rc = link_recv(l, &f, IDLE_TIMEOUT_MS);
+	} while (rc > 0 && f.cmd != (PROTO_CMD_DOWNLOAD | PROTO_REPLY));
+	if (rc <= 0 || f.len < 5 || f.payload[0] != PROTO_ACK) {
+		fprintf(stderr, "download refused\n");
+		return -1;
+	}
+	r->size = proto_get32(&f.payload[1]);
+	r->ms = f.len >= 9 && name != NULL ? proto_get32(&f.payload[5]) : 0;
+	r->fcrc = f.len >= 9 && name == NULL ? proto_get32(&f.payload[5]) : 0;
+	if (r->size > dst_size) {
+		fprintf(stderr, "object of %u bytes does not fit\n", r->size);
+		return -1;
+	}
+
+	while (expected < r->size) {
+		rc = link_recv(l, &f, IDLE_TIMEOUT_MS);
+		if (rc < 0) {
+			return -1;
+		}
+		if (rc == 0) {
+			if (++idle > XFER_MAX_RETRIES) {
+				fprintf(stderr, "device stopped sending at %u\n", expected);
+				return -1;
+			}
+			proto_put32(ack, expected);
+			link_send(l, PROTO_CMD_ACK, 0, ack, 4);
+			continue;
+		}
+		if (f.cmd != (PROTO_CMD_DATA | PROTO_REPLY) || f.len < 4) {
+			continue;
+		}
+		idle = 0;
+		off = proto_get32(f.payload);
+		if (off == expected && off + f.len - 4 <= r->size) {
+			memcpy(&dst[off], &f.payload[4], f.len - 4);
+			expected += f.len - 4;
+			r->got += f.len - 4;
+		} else if (wanted_dup == expected) {
+			continue;
+		} else {
+			wanted_dup = expected;
+		}
+		proto_put32(ack, expected);
+		link_sleep(ack_delay);
+		link_send(l, PROTO_CMD_ACK, 0, ack, 4);
+		r->acks++;
+	}
+	r->elapsed = link_now() - start;
+	return 0;
+}
+
+static int catalog_crc(link_t *l, const char *name, uint32_t *fcrc) {
+	/* Frame CRC in NAME's catalog record, the newest when there are more */
+	uint8_t req[CAT_QUERY_SIZE];
+	uint32_t from = 0, total;
+	proto_frame_t f;
+	cat_rec_t r;
+	int rc, found = -1;
+	uint8_t i;
+
+	memset(req, 0, sizeof(req));
+	req[4] = CAT_PAGE;
+	req[5] = CAT_ANY;
+	req[6] = CAT_ANY;
+	do {
+		proto_put32(req, from);
+		link_send(l, PROTO_CMD_CATALOG, 0x43, req, sizeof(req));
+		do {
+			rc = link_recv(l, &f, IDLE_TIMEOUT_MS);
+		} while (rc > 0 && f.cmd != (PROTO_CMD_CATALOG | PROTO_REPLY));
+		if (rc <= 0 || f.len < 1 + CAT_REPLY_HDR || f.payload[0] != PROTO_ACK
+				|| f.len < 1 + CAT_REPLY_HDR + f.payload[9] * CAT_REC_SIZE) {
+			return -1;
+		}
+		total = proto_get32(&f.payload[1]);
+		from = proto_get32(&f.payload[5]);
+		for (i = 0; i < f.payload[9]; i++) {
+			if (cat_get(&f.payload[1 + CAT_REPLY_HDR + i * CAT_REC_SIZE], &r)
+					== 0 && strcmp(r.name, name) == 0 && r.fcrc != 0) {
+				*fcrc = r.fcrc;
+				found = 0;
+			}
+		}
+	} while (from < total);
+	return found;
+}
+
+static int file_crc(const char *path, uint32_t *fcrc) {
+	/* Frame CRC of the file without its metadata segment, if it has one */
+	static uint8_t buf[4 * 1024 * 1024];
+	uint32_t n, at;
+	FILE *fp = fopen(path, "rb");
+
+	if (fp == NULL) {
+		return -1;
+	}
+	n = (uint32_t)fread(buf, 1, sizeof(buf), fp);
+	fclose(fp);
+	if ((at = capmeta_find(buf, n)) != 0) {
+		memmove(&buf[at], &buf[at + CAPMETA_SIZE], n - at - CAPMETA_SIZE);
+		n -= CAPMETA_SIZE;
+	}
+	*fcrc = fcrc_update(FCRC_INIT, buf, n);
+	return 0;
+}
+
+/* Stand-in device for the benchmark */
+static link_t dev;
+static uint8_t object[OBJ_SIZE];
+static unsigned loss_every;     /* Drop every n-th chunk, 0 for none */
+static xfer_t dev_xfer;
+
+static void paced_send(link_t *l, const uint8_t *payload, uint16_t len,
+		uint8_t req, double *line_free) {
+	/* Sends a DATA frame no faster than the UART could shift it out */
+	uint8_t frame[PROTO_MAX_FRAME];
+	size_t n = proto_encode(frame, PROTO_CMD_DATA | PROTO_REPLY, req,
+			payload, len);
+	double t = link_now();
+
+	if (*line_free < t) {
+		*line_free = t;
+	}
+	*line_free += n * 10.0 / BAUD;
+	link_sleep(*line_free - t);
+	link_write(l, frame, n);
+}
+
+static void *device_thread(void *arg) {
+	uint8_t buf[PROTO_MAX_PAYLOAD], info[5];
+	proto_frame_t f;
+	uint32_t off;
+	uint16_t len, chunk;
+	uint8_t req;
+	double line_free = 0;
+	int rc;
+
+	(void)arg;
+	while ((rc = link_recv(&dev, &f, 1000)) >= 0) {
+		if (rc == 0 || f.cmd != PROTO_CMD_DOWNLOAD || f.len < 8) {
+			continue;
+		}
+		chunk = f.payload[5] | (f.payload[6] << 8);
+		req = f.req;
+		info[0] = PROTO_ACK;
+		proto_put32(&info[1], OBJ_SIZE);
+		link_send(&dev, PROTO_CMD_DOWNLOAD | PROTO_REPLY, f.req, info, 5);
+
+		xfer_start(&dev_xfer, OBJ_SIZE, proto_get32(&f.payload[1]), chunk,
+				f.payload[7]);
+		while (!xfer_done(&dev_xfer)) {
+			while (xfer_next(&dev_xfer, &off, &len)) {
+				if (loss_every && dev_xfer.chunks % loss_every == 0) {
+					line_free += (len + 12) * 10.0 / BAUD;
+					continue;
+				}
+				proto_put32(buf, off);
+				memcpy(&buf[4], &object[off], len);
+				paced_send(&dev, buf, len + 4, req, &line_free);
+				/* Like the firmware receiver thread, take ACKs as they come */
+				while (link_recv(&dev, &f, 0) > 0) {
+					if (f.cmd == PROTO_CMD_ACK && f.len >= 4) {
+						xfer_ack(&dev_xfer, proto_get32(f.payload));
+					}
+				}
+			}
+			if (xfer_done(&dev_xfer)) {
+				break;
+			}
+			rc = link_recv(&dev, &f, ACK_TIMEOUT_MS);
+			if (rc < 0) {
+				return NULL;
+			}
+			if (rc == 0) {
+				xfer_timeout(&dev_xfer);
+			} else if (f.cmd == PROTO_CMD_ACK && f.len >= 4) {
+				xfer_ack(&dev_xfer, proto_get32(f.payload));
+			}
+		}
+	}
+	return NULL;
+}
+
+static int bench(link_t *host, const char *name, uint16_t chunk,
+		uint8_t window, uint32_t offset, unsigned loss) {
+	static uint8_t got[OBJ_SIZE];
+	fetch_t r;
+	double rate;
+	int ok;
+
+	memset(got, 0, sizeof(got));
+	memcpy(got, object, offset);
+	loss_every = loss;
+	if (fetch(host, NULL, offset, chunk, window, got, sizeof(got), &r) != 0) {
+		return 1;
+	}
+	ok = memcmp(got, object, OBJ_SIZE) == 0;
+	rate = r.got / r.elapsed;
+	printf("%-14s window %2u  %6u bytes  %5.2f s  %6.0f B/s  %5.1f%% of line"
+			"  resent %3u  timeouts %u  %s\n", name, window, r.got, r.elapsed,
+			rate, 100.0 * rate / (BAUD / 10.0), (unsigned)dev_xfer.resent,
+			(unsigned)dev_xfer.timeouts, ok ? "ok" : "CORRUPT");
+	return !ok;
+}
+
+int main(int argc, char *argv[]) {
+	link_t host;
+	pthread_t tid;
+	uint32_t offset = 0;
+	unsigned chunk = 256, window = 8;
+	const char *name = NULL, *out = "frame.jpg";
+	double latency = 0.010;
+	int opt, fail = 0, verify = 0;
+
+	while ((opt = getopt(argc, argv, "w:c:o:l:k:v")) != -1) {
+		switch (opt) {
+		case 'w':
+			window = (unsigned)atoi(optarg);
+			break;
+		case 'c':
+			chunk = (unsigned)atoi(optarg);
+			break;
+		case 'o':
+			offset = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			latency = atof(optarg) / 1000.0;
+			break;
+		case 'k':
+			frame = atol(optarg);
+			break;
+		case 'v':
+			verify = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: fetch [-w window] [-c chunk] [-o offset]"
+					" [-l ms] [-k frame] [-v] TTY|- [NAME [OUT]]\n");
+			return 2;
+		}
+	}
+
+	if (optind < argc && strcmp(argv[optind], "-") != 0) {
+		static uint8_t img[4 * 1024 * 1024];
+		fetch_t r;
+		FILE *fp;
+
+		if (optind + 1 < argc && strcmp(argv[optind + 1], "-") != 0) {
+			name = argv[optind + 1];
+			out = frame >= 0 ? out : name;
+		}
+		if (optind + 2 < argc) {
+			out = argv[optind + 2];
+		}
+		if (link_open_tty(&host, argv[optind], B38400) != 0
+				|| fetch(&host, name, offset, (uint16_t)chunk, (uint8_t)window,
+						img, sizeof(img), &r) != 0) {
+			return 1;
+		}
+		/* Resumed downloads append to what is already there */
+		fp = fopen(out, offset ? "r+b" : "wb");
+		if (fp == NULL || fseek(fp, (long)offset, SEEK_SET) != 0
+				|| fwrite(&img[offset], 1, r.got, fp) != r.got) {
+			perror(out);
+			return 1;
+		}
+		fclose(fp);
+		printf("%s: %u bytes in %.2f s (%.0f B/s)", out, r.size, r.elapsed,
+				r.got / r.elapsed);
+		if (frame >= 0) {
+			printf(", frame %ld at %u ms", frame, r.ms);
+		}
+		if (frame < 0 && (name == NULL || verify)) {
+			uint32_t want = r.fcrc, got;
+
+			if (name != NULL && catalog_crc(&host, name, &want) != 0) {
+				printf(", no frame CRC on the card\n");
+				return 1;
+			}
+			if (file_crc(out, &got) != 0) {
+				perror(out);
+				return 1;
+			}
+			if (got == want) {
+				printf(", frame CRC %08x ok", got);
+			} else {
+				printf(", frame CRC %08x MISMATCH, expected %08x", got, want);
+			}
+			fail = got != want;
+		}
+		printf("\n");
+		return fail;
+	}
+
+	ack_delay = latency;
+	if (link_open_pty(&host, &dev) != 0) {
+		return 1;
+	}
+	srand(1);
+	for (opt = 0; opt < OBJ_SIZE; opt++) {
+		object[opt] = (uint8_t)rand();
+	}
+	pthread_create(&tid, NULL, device_thread, NULL);
+
+	fail |= bench(&host, "stop-and-wait", (uint16_t)chunk, 1, 0, 0);
+	fail |= bench(&host, "windowed", (uint16_t)chunk, (uint8_t)window, 0, 0);
+	fail |= bench(&host, "lossy 1/50", (uint16_t)chunk, (uint8_t)window, 0, 50);
+	fail |= bench(&host, "resume 50%", (uint16_t)chunk, (uint8_t)window,
+			OBJ_SIZE / 2, 0);
+	return fail;
+}
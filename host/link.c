@@ -0,0 +1,135 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "link.h"
+
+double link_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void link_sleep(double seconds) {
+	struct timespec ts;
+
+	if (seconds <= 0) {
+		return;
+	}
+	ts.tv_sec = (time_t)seconds;
+	ts.tv_nsec = (long)((seconds - ts.tv_sec) * 1e9);
+	nanosleep(&ts, NULL);
+}
+
+static void set_raw(int fd, speed_t baud) {
+	struct termios t;
+
+	if (tcgetattr(fd, &t) != 0) {
+		return;
+	}
+	cfmakeraw(&t);
+	if (baud) {
+		cfsetispeed(&t, baud);
+		cfsetospeed(&t, baud);
+	}
+	tcsetattr(fd, TCSANOW, &t);
+}
+
+void link_init(link_t *l, int fd) {
+	l->fd = fd;
+	l->pos = 0;
+	l->len = 0;
+	proto_init(&l->parser);
+}
+
+int link_open_tty(link_t *l, const char *path, speed_t baud) {
+	int fd = open(path, O_RDWR | O_NOCTTY);
+
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+	set_raw(fd, baud);
+	link_init(l, fd);
+	return 0;
+}
+
+int link_open_pty(link_t *master, link_t *slave) {
+	int m, s;
+
+	m = posix_openpt(O_RDWR | O_NOCTTY);
+	if (m < 0 || grantpt(m) != 0 || unlockpt(m) != 0) {
+		perror("posix_openpt");
+		return -1;
+	}
+	s = open(ptsname(m), O_RDWR | O_NOCTTY);
+	if (s < 0) {
+		perror("ptsname");
+		return -1;
+	}
+	set_raw(m, 0);
+	set_raw(s, 0);
+	link_init(master, m);
+	link_init(slave, s);
+	return 0;
+}
+
+void link_write(link_t *l, const uint8_t *p, size_t n) {
+	while (n > 0) {
+		ssize_t w = write(l->fd, p, n);
+		if (w < 0) {
+			if (errno == EINTR || errno == EAGAIN) {
+				continue;
+			}
+			perror("write");
+			exit(1);
+		}
+		p += w;
+		n -= (size_t)w;
+	}
+}
+
+size_t link_send(link_t *l, uint8_t cmd, uint8_t req, const uint8_t *payload,
+		uint16_t len) {
+	uint8_t frame[PROTO_MAX_FRAME];
+	size_t n = proto_encode(frame, cmd, req, payload, len);
+
+	link_write(l, frame, n);
+	return n;
+}
+
+int link_recv(link_t *l, proto_frame_t *f, int timeout_ms) {
+	/* Returns 1 with the next frame, 0 if none arrived within timeout_ms
+	 * (0 polls without waiting), -1 when the other end went away.
+	 */
+	double deadline = link_now() + timeout_ms / 1000.0;
+
+	for (;;) {
+		while (l->pos < l->len) {
+			if (proto_feed(&l->parser, l->buf[l->pos++], f)) {
+				return 1;
+			}
+		}
+		{
+			struct pollfd pfd = { l->fd, POLLIN, 0 };
+			int left = (int)((deadline - link_now()) * 1000.0);
+			ssize_t n;
+
+			if (poll(&pfd, 1, left > 0 ? left : 0) <= 0) {
+				return 0;
+			}
+			n = read(l->fd, l->buf, sizeof(l->buf));
+			if (n <= 0) {
+				return n == 0 || errno != EAGAIN ? -1 : 0;
+			}
+			l->pos = 0;
+			l->len = (size_t)n;
+		}
+	}
+}
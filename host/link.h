@@ -0,0 +1,35 @@
+/*
+ * link.h
+ *
+ * Serial link helpers shared by the host tools: raw tty / pseudo-terminal
+ * setup and framed send/receive on top of proto.h.
+ */
+
+#ifndef LINK_H_
+#define LINK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <termios.h>
+
+#include "proto.h"
+
+typedef struct {
+	int fd;
+	uint8_t buf[512];
+	size_t pos;
+	size_t len;
+	proto_parser_t parser;
+} link_t;
+
+double link_now(void);
+void link_sleep(double seconds);
+int link_open_tty(link_t *l, const char *path, speed_t baud);
+int link_open_pty(link_t *master, link_t *slave);
+void link_init(link_t *l, int fd);
+void link_write(link_t *l, const uint8_t *p, size_t n);
+size_t link_send(link_t *l, uint8_t cmd, uint8_t req, const uint8_t *payload,
+		uint16_t len);
+int link_recv(link_t *l, proto_frame_t *f, int timeout_ms);
+
+#endif /* LINK_H_ */
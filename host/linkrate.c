@@ -0,0 +1,202 @@
+/*
+ * linkrate.c
+ *
+ * Host harness for the stream layer (stream.h) and baud negotiation
+ * (baud.h).
+ *
+ * Without arguments a stand-in device runs the firmware receiver loop -
+ * stream read, proto parser, baud_poll/baud_frame - on one side of a
+ * pseudo-terminal, with both ends paced to their line rate and bytes
+ * garbled whenever the two rates differ. The harness then steps through
+ * every supported rate, measuring pipelined PING throughput at each, checks
+ * that an unsupported rate is refused and that a device left on a rate the
+ * host never followed falls back within BAUD_CONFIRM_MS. Given a tty (e.g.
+ * linkrate /dev/ttyUSB0) it runs the rate sweep against real hardware.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "link.h"
+#include "ttystream.h"
+#include "chan.h"
+#include "baud.h"
+
+#define WINDOW      4       /* Requests in flight */
+#define PAYLOAD     256     /* PING payload size */
+#define SECONDS     1.0     /* Measuring time per rate */
+
+static const uint32_t sweep[] = {
+	38400, 57600, 115200, 230400, 460800, 921600
+};
+
+/* Stand-in device, the receiver loop of main.c on a ttystream */
+static ttystream_t dev_ts;
+static baud_t dev_baud;
+
+static void dev_send(uint8_t cmd, uint8_t req, const uint8_t *payload,
+		uint16_t len) {
+	uint8_t frame[PROTO_MAX_FRAME];
+
+	streamWrite(&dev_ts.s, frame, proto_encode(frame, cmd, req, payload, len));
+}
+
+static uint32_t now_ms(void) {
+	return (uint32_t)(link_now() * 1000.0);
+}
+
+static void *device_thread(void *arg) {
+	static uint8_t rxbuf[64], out[PROTO_MAX_PAYLOAD];
+	proto_parser_t parser;
+	proto_frame_t f;
+	size_t i, n;
+
+	(void)arg;
+	proto_init(&parser);
+	baud_init(&dev_baud, &dev_ts.s, BAUD_DEFAULT);
+	for (;;) {
+		n = streamRead(&dev_ts.s, rxbuf, sizeof(rxbuf), parser.n > 0 ? 50 :
+				dev_baud.pending ? BAUD_CONFIRM_MS : STREAM_INFINITE);
+		baud_poll(&dev_baud, now_ms());
+		if (n == 0) {
+			proto_reset(&parser);
+			continue;
+		}
+		for (i = 0; i < n; i++) {
+			if (!proto_feed(&parser, rxbuf[i], &f)) {
+				continue;
+			}
+			baud_frame(&dev_baud);
+			out[0] = PROTO_ACK;
+			if (f.cmd == PROTO_CMD_BAUD) {
+				if (f.len < 4 || !baud_supported(proto_get32(f.payload))) {
+					out[0] = PROTO_NAK;
+				}
+				dev_send(f.cmd | PROTO_REPLY, f.req, out, 1);
+				if (out[0] == PROTO_ACK) {
+					baud_switch(&dev_baud, proto_get32(f.payload), now_ms());
+				}
+				continue;
+			}
+			if (f.cmd != PROTO_CMD_PING) {
+				out[0] = PROTO_NAK;
+			}
+			memcpy(&out[1], f.payload, f.len);
+			dev_send(f.cmd | PROTO_REPLY, f.req, out, (uint16_t)(f.len + 1));
+		}
+	}
+	return NULL;
+}
+
+static double throughput(chan_t *c, unsigned *done, unsigned *bad) {
+	/* Pipelined PINGs for SECONDS, returns payload bytes/s each way */
+	uint8_t payload[PAYLOAD];
+	proto_frame_t f;
+	unsigned inflight = 0, k;
+	double start = link_now(), elapsed;
+
+	*done = 0;
+	*bad = 0;
+	for (k = 0; k < PAYLOAD; k++) {
+		payload[k] = (uint8_t)k;
+	}
+	for (;;) {
+		elapsed = link_now() - start;
+		while (inflight < WINDOW && elapsed < SECONDS) {
+			chan_send(c, PROTO_CMD_PING, c->next_req++, payload, PAYLOAD);
+			inflight++;
+		}
+		if (inflight == 0) {
+			break;
+		}
+		if (chan_recv(c, &f, 2000) <= 0) {
+			(*bad) += inflight;
+			break;
+		}
+		inflight--;
+		if (f.len == PAYLOAD + 1 && f.payload[0] == PROTO_ACK
+				&& memcmp(&f.payload[1], payload, PAYLOAD) == 0) {
+			(*done)++;
+		} else {
+			(*bad)++;
+		}
+	}
+	return *done * (double)PAYLOAD / (link_now() - start);
+}
+
+int main(int argc, char *argv[]) {
+	ttystream_t host_ts;
+	link_t host, dev;
+	pthread_t tid;
+	chan_t c;
+	proto_frame_t f;
+	uint8_t arg[4];
+	unsigned i, done, bad;
+	double rate, t;
+	int pty = 1, fail = 0;
+
+	if (argc > 1 && strcmp(argv[1], "-") != 0) {
+		if (link_open_tty(&host, argv[1], B38400) != 0) {
+			return 1;
+		}
+		ttystream_init(&host_ts, host.fd, 1, BAUD_DEFAULT);
+		pty = 0;
+	} else {
+		if (link_open_pty(&host, &dev) != 0) {
+			return 1;
+		}
+		ttystream_init(&host_ts, host.fd, 0, BAUD_DEFAULT);
+		ttystream_init(&dev_ts, dev.fd, 0, BAUD_DEFAULT);
+		ttystream_peer(&host_ts, &dev_ts);
+		pthread_create(&tid, NULL, device_thread, NULL);
+	}
+	chan_init(&c, &host_ts.s);
+
+	for (i = 0; i < sizeof(sweep) / sizeof(sweep[0]); i++) {
+		if (!chan_baud(&c, sweep[i])) {
+			printf("%7u  negotiation failed\n", (unsigned)sweep[i]);
+			fail = 1;
+			break;
+		}
+		rate = throughput(&c, &done, &bad);
+		printf("%7u  %4u pings  %8.0f B/s  %5.1f%% of line  bad %u\n",
+				(unsigned)sweep[i], done, rate, 100.0 * rate / (sweep[i] / 10.0),
+				bad);
+		fail |= bad != 0;
+	}
+
+	/* Back down to the default for the remaining checks */
+	if (!chan_baud(&c, BAUD_DEFAULT)) {
+		printf("could not return to %u\n", BAUD_DEFAULT);
+		return 1;
+	}
+
+	proto_put32(arg, 12345);
+	if (chan_request(&c, PROTO_CMD_BAUD, arg, 4, 2000, &f)) {
+		printf("unsupported rate accepted\n");
+		fail = 1;
+	} else {
+		printf("unsupported rate refused\n");
+	}
+
+	if (pty) {
+		/* Ask for a rate and never follow: the device must come back */
+		proto_put32(arg, 921600);
+		chan_request(&c, PROTO_CMD_BAUD, arg, 4, 2000, &f);
+		t = link_now();
+		while (!chan_request(&c, PROTO_CMD_PING, NULL, 0, 100, &f)
+				&& link_now() - t < 3 * BAUD_CONFIRM_MS / 1000.0) {
+		}
+		t = link_now() - t;
+		if (dev_baud.rate == BAUD_DEFAULT && t < 2 * BAUD_CONFIRM_MS / 1000.0) {
+			printf("fallback after %.2f s\n", t);
+		} else {
+			printf("no fallback\n");
+			fail = 1;
+		}
+		printf("garbled bytes host %u device %u\n",
+				(unsigned)host_ts.garbled, (unsigned)dev_ts.garbled);
+	}
+	return fail;
+}
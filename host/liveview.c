@@ -0,0 +1,313 @@
+/*
+ * liveview.c
+ *
+ * Live preview client for PROTO_CMD_PREVIEW.
+ *
+ *   liveview [-b baud] [-t seconds] TTY|- [OUT]
+ *
+ * raises the link to -b (see baud.h), starts the preview and reassembles
+ * the FRAME pieces, writing every complete frame over OUT (preview.jpg by
+ * default, replaced atomically so an image viewer can keep reloading it).
+ * After -t seconds (5 by default) it stops the preview and prints the
+ * frames per second seen by both ends and the frames the device dropped.
+ *
+ * With "-" as the TTY a stand-in device on a pseudo-terminal runs the
+ * firmware slot logic (preview.c) against a sensor producing 6-8 KB frames
+ * at 25 fps, with both ends paced to the line rate, and the preview is run
+ * for 3 s (or -t) at 115200 and 921600 baud. Every frame received is
+ * checked byte for byte.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "link.h"
+#include "ttystream.h"
+#include "chan.h"
+#include "baud.h"
+#include "preview.h"
+
+#define SLOT_SIZE   33332   /* PV_SLOT_SIZE in main.c */
+#define CHUNK       (PROTO_MAX_PAYLOAD - PV_HDR_SIZE)
+#define SENSOR_FPS  25
+
+typedef struct {
+	double elapsed;
+	unsigned frames;
+	unsigned partial;
+	unsigned corrupt;
+	uint32_t dev_sent;
+	uint32_t dev_dropped;
+	uint32_t dev_bad;
+	uint32_t dev_ms;
+	uint16_t dev_fps10;
+} view_t;
+
+static int frame_ok(const uint8_t *p, uint16_t n) {
+	/* Stand-in frames count up from the byte after SOI */
+	uint16_t k;
+
+	if (n < 4 || p[0] != 0xFF || p[1] != 0xD8 || p[n - 2] != 0xFF
+			|| p[n - 1] != 0xD9) {
+		return 0;
+	}
+	for (k = 3; k < n - 2; k++) {
+		if (p[k] != (uint8_t)(p[k - 1] + 1)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int view(chan_t *c, double seconds, const char *out, int check,
+		view_t *v) {
+	static uint8_t img[65536];
+	uint8_t on = 1, req;
+	uint16_t seq = 0, off, total, got = 0;
+	proto_frame_t f;
+	double start;
+	int stopping = 0;
+	FILE *fp;
+
+	memset(v, 0, sizeof(*v));
+	req = c->next_req;
+	if (!chan_request(c, PROTO_CMD_PREVIEW, &on, 1, 2000, &f)) {
+		fprintf(stderr, "preview refused\n");
+		return -1;
+	}
+	start = link_now();
+	for (;;) {
+		if (!stopping && link_now() - start >= seconds) {
+			on = 0;
+			chan_send(c, PROTO_CMD_PREVIEW, (uint8_t)(req + 1), &on, 1);
+			stopping = 1;
+		}
+		if (chan_recv(c, &f, 2000) <= 0) {
+			fprintf(stderr, "device went quiet\n");
+			return -1;
+		}
+		if (f.cmd == (PROTO_CMD_PREVIEW | PROTO_REPLY) && f.req == req
+				&& f.len >= 19) {
+			break;
+		}
+		if (f.cmd != (PROTO_CMD_FRAME | PROTO_REPLY) || f.len < PV_HDR_SIZE) {
+			continue;
+		}
+		off = f.payload[2] | (f.payload[3] << 8);
+		total = f.payload[4] | (f.payload[5] << 8);
+		if (off == 0) {
+			if (got != 0) {
+				v->partial++;
+			}
+			seq = f.payload[0] | (f.payload[1] << 8);
+			got = 0;
+		} else if ((f.payload[0] | (f.payload[1] << 8)) != seq || off != got) {
+			got = 0;
+			v->partial++;
+			continue;
+		}
+		memcpy(&img[off], &f.payload[PV_HDR_SIZE], f.len - PV_HDR_SIZE);
+		got += f.len - PV_HDR_SIZE;
+		if (got < total) {
+			continue;
+		}
+		got = 0;
+		if (check && !frame_ok(img, total)) {
+			v->corrupt++;
+			continue;
+		}
+		v->frames++;
+		if (out != NULL) {
+			char tmp[256];
+
+			snprintf(tmp, sizeof(tmp), "%s.tmp", out);
+			if ((fp = fopen(tmp, "wb")) != NULL) {
+				fwrite(img, 1, total, fp);
+				fclose(fp);
+				rename(tmp, out);
+			}
+		}
+	}
+	v->elapsed = link_now() - start;
+	v->dev_sent = proto_get32(&f.payload[1]);
+	v->dev_dropped = proto_get32(&f.payload[5]);
+	v->dev_bad = proto_get32(&f.payload[9]);
+	v->dev_ms = proto_get32(&f.payload[13]);
+	v->dev_fps10 = f.payload[17] | (f.payload[18] << 8);
+	return 0;
+}
+
+static void report(uint32_t baud, const view_t *v) {
+	printf("%7u  %4u frames  %5.2f fps  device: sent %u dropped %u bad %u"
+			"  %u.%u fps  partial %u corrupt %u\n", (unsigned)baud, v->frames,
+			v->frames / v->elapsed, (unsigned)v->dev_sent,
+			(unsigned)v->dev_dropped, (unsigned)v->dev_bad,
+			v->dev_fps10 / 10, v->dev_fps10 % 10, v->partial, v->corrupt);
+}
+
+/* Stand-in device: the loop of cmd_preview with a simulated sensor */
+static ttystream_t dev_ts;
+static chan_t dev;
+static uint8_t slots[PV_SLOTS][SLOT_SIZE];
+static pv_t pv;
+static unsigned sensor_frames;
+static double sensor_due;
+
+static void sensor(void) {
+	/* Completes the filling slot whenever a frame time has passed */
+	uint8_t *p;
+	uint16_t n, k;
+
+	while (link_now() >= sensor_due) {
+		sensor_due += 1.0 / SENSOR_FPS;
+		p = slots[pv.fill];
+		n = (uint16_t)(6000 + rand() % 2000);
+		p[0] = 0xFF;
+		p[1] = 0xD8;
+		p[2] = (uint8_t)sensor_frames++;
+		for (k = 3; k < n - 2; k++) {
+			p[k] = (uint8_t)(p[k - 1] + 1);
+		}
+		p[n - 2] = 0xFF;
+		p[n - 1] = 0xD9;
+		pv_frame(&pv, 1);
+	}
+}
+
+static int dev_running(void) {
+	proto_frame_t f;
+
+	while (chan_recv(&dev, &f, 0) > 0) {
+		if (f.cmd == PROTO_CMD_PREVIEW && f.len > 0 && f.payload[0] == 0) {
+			chan_send(&dev, f.cmd | PROTO_REPLY, f.req,
+					(const uint8_t[]){ PROTO_ACK }, 1);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void *device_thread(void *arg) {
+	uint8_t buf[PROTO_MAX_PAYLOAD], ack = PROTO_ACK, slot;
+	uint16_t off, len, total;
+	proto_frame_t f;
+	double start, elapsed;
+	uint16_t fps10;
+
+	(void)arg;
+	for (;;) {
+		if (chan_recv(&dev, &f, 1000) <= 0 || f.cmd != PROTO_CMD_PREVIEW
+				|| f.len == 0 || f.payload[0] != 1) {
+			continue;
+		}
+		chan_send(&dev, f.cmd | PROTO_REPLY, f.req, &ack, 1);
+		pv_start(&pv);
+		start = link_now();
+		sensor_due = start + 1.0 / SENSOR_FPS;
+		while (dev_running()) {
+			sensor();
+			if ((slot = pv_take(&pv)) == PV_NONE) {
+				link_sleep(sensor_due - link_now());
+				continue;
+			}
+			total = 0;
+			while (total < SLOT_SIZE - 1 && !(slots[slot][total] == 0xFF
+					&& slots[slot][total + 1] == 0xD9)) {
+				total++;
+			}
+			total += 2;
+			for (off = 0; off < total; off += len) {
+				len = total - off < CHUNK ? total - off : CHUNK;
+				pv_header(buf, pv.seq, off, total);
+				memcpy(&buf[PV_HDR_SIZE], &slots[slot][off], len);
+				chan_send(&dev, PROTO_CMD_FRAME | PROTO_REPLY, f.req, buf,
+						(uint16_t)(len + PV_HDR_SIZE));
+				sensor();
+			}
+			pv_sent(&pv);
+		}
+		elapsed = link_now() - start;
+		buf[0] = PROTO_ACK;
+		proto_put32(&buf[1], pv.sent);
+		proto_put32(&buf[5], pv.dropped);
+		proto_put32(&buf[9], pv.bad);
+		proto_put32(&buf[13], (uint32_t)(elapsed * 1000));
+		fps10 = (uint16_t)(pv.sent * 10 / elapsed);
+		buf[17] = (uint8_t)fps10;
+		buf[18] = (uint8_t)(fps10 >> 8);
+		chan_send(&dev, PROTO_CMD_PREVIEW | PROTO_REPLY, f.req, buf, 19);
+	}
+	return NULL;
+}
+
+int main(int argc, char *argv[]) {
+	static const uint32_t rates[] = { 115200, 921600 };
+	ttystream_t host_ts;
+	link_t host, dl;
+	pthread_t tid;
+	chan_t c;
+	view_t v;
+	uint32_t baud = 0;
+	double seconds = 0;
+	const char *out = "preview.jpg";
+	unsigned i;
+	int opt, fail = 0;
+
+	while ((opt = getopt(argc, argv, "b:t:")) != -1) {
+		switch (opt) {
+		case 'b':
+			baud = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = atof(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: liveview [-b baud] [-t seconds] TTY|- [OUT]\n");
+			return 2;
+		}
+	}
+	if (optind + 1 < argc) {
+		out = argv[optind + 1];
+	}
+
+	if (optind < argc && strcmp(argv[optind], "-") != 0) {
+		if (link_open_tty(&host, argv[optind], B38400) != 0) {
+			return 1;
+		}
+		ttystream_init(&host_ts, host.fd, 1, BAUD_DEFAULT);
+		chan_init(&c, &host_ts.s);
+		if (baud && !chan_baud(&c, baud)) {
+			fprintf(stderr, "could not switch to %u baud\n", (unsigned)baud);
+			return 1;
+		}
+		if (view(&c, seconds > 0 ? seconds : 5, out, 0, &v) != 0) {
+			return 1;
+		}
+		report(host_ts.baud, &v);
+		return 0;
+	}
+
+	if (link_open_pty(&host, &dl) != 0) {
+		return 1;
+	}
+	ttystream_init(&host_ts, host.fd, 0, BAUD_DEFAULT);
+	ttystream_init(&dev_ts, dl.fd, 0, BAUD_DEFAULT);
+	ttystream_peer(&host_ts, &dev_ts);
+	chan_init(&c, &host_ts.s);
+	chan_init(&dev, &dev_ts.s);
+	srand(1);
+	pthread_create(&tid, NULL, device_thread, NULL);
+	for (i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+		/* No negotiation here, linkrate covers that */
+		streamSetBaud(&host_ts.s, rates[i]);
+		streamSetBaud(&dev_ts.s, rates[i]);
+		if (view(&c, seconds > 0 ? seconds : 3, NULL, 1, &v) != 0) {
+			return 1;
+		}
+		report(rates[i], &v);
+		fail |= v.corrupt != 0 || v.frames == 0;
+	}
+	return fail;
+}
@@ -0,0 +1,162 @@
+/*
+ * protoloop.c
+ *
+ * Host harness for the framed command protocol (proto.h).
+ *
+ * Without arguments it opens a pseudo-terminal and runs a stand-in device
+ * on the slave side that parses frames with the firmware parser and answers
+ * PING, then measures pipelined commands/s and how the link recovers when
+ * bytes are corrupted or dropped on the way to the device. Given a tty
+ * (e.g. protoloop /dev/ttyUSB0) it runs the same measurements against real
+ * hardware at 38400 baud. An optional second argument sets the number of
+ * requests per run.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "link.h"
+
+#define WINDOW      8       /* Requests in flight */
+#define PAYLOAD     16      /* PING payload size */
+
+static double timeout = 0.05;   /* Seconds before a request counts as lost */
+
+/* Stand-in device: parse requests, echo PING payloads back */
+static link_t dev;
+
+static void *device_thread(void *arg) {
+	uint8_t out[PROTO_MAX_PAYLOAD];
+	proto_frame_t f;
+
+	(void)arg;
+	while (link_recv(&dev, &f, 1000) >= 0) {
+		out[0] = f.cmd == PROTO_CMD_PING ? PROTO_ACK : PROTO_NAK;
+		memcpy(&out[1], f.payload, f.len);
+		link_send(&dev, f.cmd | PROTO_REPLY, f.req, out, f.len + 1);
+	}
+	return NULL;
+}
+
+typedef struct {
+	unsigned sent;
+	unsigned ok;
+	unsigned lost;
+	unsigned wrong;
+	double elapsed;
+} run_t;
+
+static void run(link_t *l, unsigned count, unsigned corrupt_every, run_t *r) {
+	/* Sends count PINGs keeping WINDOW in flight. With corrupt_every set,
+	 * every n-th frame has one byte flipped or dropped on the way out.
+	 * Replies are matched by request ID; a request whose reply does not
+	 * come back within timeout is counted as lost.
+	 */
+	proto_frame_t f;
+	uint8_t frame[PROTO_MAX_FRAME];
+	uint8_t payload[PAYLOAD];
+	double sent_at[256];
+	int pending[256];
+	unsigned inflight = 0, next = 0, k;
+	double start;
+
+	memset(r, 0, sizeof(*r));
+	memset(pending, 0, sizeof(pending));
+	srand(1);
+	start = link_now();
+
+	while (next < count || inflight > 0) {
+		while (next < count && inflight < WINDOW) {
+			uint8_t req = (uint8_t)next;
+			size_t len;
+
+			for (k = 0; k < PAYLOAD; k++) {
+				payload[k] = (uint8_t)(req + k);
+			}
+			len = proto_encode(frame, PROTO_CMD_PING, req, payload, PAYLOAD);
+			if (corrupt_every && next % corrupt_every == corrupt_every - 1) {
+				size_t at = (size_t)rand() % len;
+				if (rand() & 1) {
+					frame[at] ^= (uint8_t)(1 << (rand() % 8));
+				} else {
+					memmove(&frame[at], &frame[at + 1], len - at - 1);
+					len--;
+				}
+			}
+			link_write(l, frame, len);
+			pending[req] = 1;
+			sent_at[req] = link_now();
+			inflight++;
+			next++;
+			r->sent++;
+		}
+
+		/* Wait only while the window is full or everything is sent */
+		while (link_recv(l, &f, inflight < WINDOW && next < count ? 0 : 10) > 0) {
+			if (!pending[f.req]) {
+				continue;
+			}
+			pending[f.req] = 0;
+			inflight--;
+			for (k = 0; k < PAYLOAD && f.len == PAYLOAD + 1; k++) {
+				if (f.payload[k + 1] != (uint8_t)(f.req + k)) {
+					break;
+				}
+			}
+			if (f.payload[0] == PROTO_ACK && k == PAYLOAD) {
+				r->ok++;
+			} else {
+				r->wrong++;
+			}
+		}
+
+		for (k = 0; k < 256; k++) {
+			if (pending[k] && link_now() - sent_at[k] > timeout) {
+				pending[k] = 0;
+				inflight--;
+				r->lost++;
+			}
+		}
+	}
+	r->elapsed = link_now() - start;
+}
+
+static void report(const char *name, const run_t *r) {
+	printf("%-10s sent %6u  ok %6u  lost %4u  wrong %u  %.0f cmd/s\n", name,
+			r->sent, r->ok, r->lost, r->wrong,
+			r->elapsed > 0 ? r->ok / r->elapsed : 0.0);
+}
+
+int main(int argc, char *argv[]) {
+	unsigned count = argc > 2 ? (unsigned)atoi(argv[2]) : 2000;
+	pthread_t tid;
+	link_t host;
+	int pty = 1;
+	run_t r;
+
+	if (argc > 1 && strcmp(argv[1], "-") != 0) {
+		if (link_open_tty(&host, argv[1], B38400) != 0) {
+			return 1;
+		}
+		timeout = 3.0;
+		pty = 0;
+	} else {
+		if (link_open_pty(&host, &dev) != 0) {
+			return 1;
+		}
+		pthread_create(&tid, NULL, device_thread, NULL);
+	}
+
+	run(&host, count, 0, &r);
+	report("clean", &r);
+	run(&host, count, 10, &r);
+	report("corrupt/10", &r);
+	if (pty) {
+		printf("device parser: frames %u bad %u dropped bytes %u\n",
+				(unsigned)dev.parser.frames, (unsigned)dev.parser.bad_frames,
+				(unsigned)dev.parser.dropped);
+	}
+	/* Every clean frame after a corrupted one must still get through */
+	return r.wrong == 0 && r.lost <= r.sent / 10 ? 0 : 1;
+}
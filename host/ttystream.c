@@ -0,0 +1,135 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "link.h"
+#include "ttystream.h"
+
+static speed_t tty_speed(uint32_t baud) {
+	switch (baud) {
+	case 38400:
+		return B38400;
+	case 57600:
+		return B57600;
+	case 115200:
+		return B115200;
+	case 230400:
+		return B230400;
+	case 460800:
+		return B460800;
+	case 921600:
+		return B921600;
+	}
+	return 0;
+}
+
+static size_t ts_read(stream_t *sp, uint8_t *bp, size_t n,
+		uint32_t timeout_ms) {
+	ttystream_t *t = (ttystream_t *)sp;
+	struct pollfd pfd = { t->fd, POLLIN, 0 };
+	ssize_t r;
+
+	if (poll(&pfd, 1, timeout_ms == STREAM_INFINITE ? -1 : (int)timeout_ms)
+			<= 0) {
+		return 0;
+	}
+	r = read(t->fd, bp, n);
+	if (r <= 0) {
+		return 0;
+	}
+	t->rx_bytes += (uint32_t)r;
+	return (size_t)r;
+}
+
+static size_t ts_write(stream_t *sp, const uint8_t *bp, size_t n) {
+	ttystream_t *t = (ttystream_t *)sp;
+	uint8_t buf[PROTO_MAX_FRAME];
+	size_t done = 0, k, run;
+	double now;
+
+	while (done < n) {
+		run = n - done < sizeof(buf) ? n - done : sizeof(buf);
+		for (k = 0; k < run; k++) {
+			buf[k] = bp[done + k];
+			if (t->peer != NULL && t->peer->baud != t->baud) {
+				buf[k] = (uint8_t)(buf[k] * 13 + 0x5B);
+				t->garbled++;
+			}
+		}
+		if (!t->tty) {
+			/* Hand the bytes over as the last one would leave the wire */
+			now = link_now();
+			if (t->line_free < now) {
+				t->line_free = now;
+			}
+			t->line_free += run * 10.0 / t->baud;
+			link_sleep(t->line_free - now);
+		}
+		for (k = 0; k < run; ) {
+			ssize_t w = write(t->fd, &buf[k], run - k);
+			if (w < 0) {
+				if (errno == EINTR || errno == EAGAIN) {
+					continue;
+				}
+				perror("write");
+				exit(1);
+			}
+			k += (size_t)w;
+		}
+		done += run;
+	}
+	t->tx_bytes += (uint32_t)n;
+	return n;
+}
+
+static void ts_flush(stream_t *sp) {
+	ttystream_t *t = (ttystream_t *)sp;
+
+	if (t->tty) {
+		tcdrain(t->fd);
+	}
+}
+
+static int ts_set_baud(stream_t *sp, uint32_t baud) {
+	ttystream_t *t = (ttystream_t *)sp;
+	struct termios tio;
+
+	if (t->tty) {
+		if (tty_speed(baud) == 0 || tcgetattr(t->fd, &tio) != 0) {
+			return -1;
+		}
+		cfsetispeed(&tio, tty_speed(baud));
+		cfsetospeed(&tio, tty_speed(baud));
+		if (tcsetattr(t->fd, TCSADRAIN, &tio) != 0) {
+			return -1;
+		}
+	}
+	t->baud = baud;
+	return 0;
+}
+
+static const struct stream_vmt ts_vmt = {
+	ts_read, ts_write, ts_flush, ts_set_baud
+};
+
+void ttystream_init(ttystream_t *t, int fd, int tty, uint32_t baud) {
+	t->s.vmt = &ts_vmt;
+	t->fd = fd;
+	t->tty = tty;
+	t->baud = baud;
+	t->peer = NULL;
+	t->line_free = 0;
+	t->tx_bytes = 0;
+	t->rx_bytes = 0;
+	t->garbled = 0;
+	ts_set_baud(&t->s, baud);
+}
+
+void ttystream_peer(ttystream_t *a, ttystream_t *b) {
+	a->peer = b;
+	b->peer = a;
+}
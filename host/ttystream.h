@@ -0,0 +1,35 @@
+/*
+ * ttystream.h
+ *
+ * stream_t (../stream.h) on a file descriptor, so code written against the
+ * firmware stream runs on a host tty or pseudo-terminal.
+ *
+ * On a real tty set_baud reprograms the port. A pseudo-terminal has no line
+ * rate, so there the stream keeps its own: writes are paced to it and, when
+ * the other end is bound with ttystream_peer() and sits on a different
+ * rate, bytes are garbled the way a receiver sampling at the wrong rate
+ * would see them.
+ */
+
+#ifndef TTYSTREAM_H_
+#define TTYSTREAM_H_
+
+#include "stream.h"
+
+typedef struct ttystream {
+	stream_t s;
+	int fd;
+	int tty;
+	uint32_t baud;
+	const struct ttystream *peer;
+	double line_free;
+	/* Statistics */
+	uint32_t tx_bytes;
+	uint32_t rx_bytes;
+	uint32_t garbled;
+} ttystream_t;
+
+void ttystream_init(ttystream_t *t, int fd, int tty, uint32_t baud);
+void ttystream_peer(ttystream_t *a, ttystream_t *b);
+
+#endif /* TTYSTREAM_H_ */
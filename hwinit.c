@@ -11,14 +11,6 @@ static const I2CConfig i2cfg1 = {
     FAST_DUTY_CYCLE_2,
 };
 
-/* UART 2 interface - debug and comms */
-SerialConfig uart2_config = {
-        38400,
-        0,
-        USART_CR2_STOP1_BITS | USART_CR2_LINEN,
-        0
-};
-
 /* PWM config - XCLK */
 static const PWMConfig pwmcfg = {
     20000000,
@@ -63,11 +55,10 @@ void hwInit(void) {
   /* Setup USART pins */
   palSetPadMode(GPIOA, 2, PAL_MODE_ALTERNATE(7));   /* USART2 TX */
   palSetPadMode(GPIOA, 3, PAL_MODE_ALTERNATE(7));   /* USART2 RX */
-  /* initialize serial output */
-  sdStart(&SD2, &uart2_config);
+  /* USART2 itself is started by uartdmaStart() from main() */
 
   /* Camera button input */
-  palSetPadMode(GPIOD, 2, PAL_MODE_INPUT_PULLUP);
+  palSetPadMode(BUTTON_PORT, BUTTON_PAD, PAL_MODE_INPUT_PULLUP);
   palSetPadMode(GPIOB, 3, PAL_MODE_OUTPUT_PUSHPULL);
 
   /* Setup alternate function for DCMI pins - DCMI is AF13 */
@@ -11,6 +11,10 @@ static const DCMIConfig dcmicfg = {
    DCMI_CR_JPEG | DCMI_CR_PCKPOL
 };
 
+/* Camera button */
+#define BUTTON_PORT     GPIOD
+#define BUTTON_PAD      2
+
 void hwInit(void);
 
 #endif /* HWINIT_H_ */
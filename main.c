@@ -20,6 +20,24 @@
 #include "OV2640.h"
 #include "evtimer.h"
 #include "ff.h"
+#include "proto.h"
+#include "xfer.h"
+#include "uartdma.h"
+#include "baud.h"
+#include "preview.h"
+#include "avi.h"
+#include "seqname.h"
+#include "catalog.h"
+#include "retain.h"
+#include "fcrc.h"
+#include "sglist.h"
+#include "capmeta.h"
+#include "bench.h"
+#include "probe.h"
+#include "trace.h"
+#include "storage.h"
+#include "blkdev.h"
+#include "sectcache.h"
 #include <string.h>
 //#define SOLOCAM
 //#define DEBUG
@@ -40,24 +58,23 @@ static unsigned cnt;
 uint8_t currQuestion = 0;
 
 static void tmrfunc(void *p) {
-	BaseBlockDevice *bbdp = p;
 
 	chSysLockFromIsr()
 	;
 	if (cnt > 0) {
-		if (blkIsInserted(bbdp)) {
+		if (blk_card.inserted()) {
 			if (--cnt == 0) {
 				chEvtBroadcastI(&inserted_event);
 			}
 		} else
 			cnt = POLLING_INTERVAL;
 	} else {
-		if (!blkIsInserted(bbdp)) {
+		if (!blk_card.inserted()) {
 			cnt = POLLING_INTERVAL;
 			chEvtBroadcastI(&removed_event);
 		}
 	}
-	chVTSetI(&tmr, MS2ST(POLLING_DELAY), tmrfunc, bbdp);
+	chVTSetI(&tmr, MS2ST(POLLING_DELAY), tmrfunc, p);
 	chSysUnlockFromIsr();
 }
 
@@ -83,47 +100,57 @@ static void tmr_init(void *p) {
  */
 FATFS MMC_FS;
 
-/**
- * MMC driver instance.
- */
-MMCDriver MMCD1;
-
 /* FS mounted and ready.*/
 static bool_t fs_ready = FALSE;
+/* Image numbering state read from this card (seq_load()).*/
+static bool_t seq_ready = FALSE;
+/* Retention state read from this card (ret_load()).*/
+static bool_t ret_ready = FALSE;
 
-/* Maximum speed SPI configuration (18MHz, CPHA=0, CPOL=0, MSb first).*/
-static SPIConfig hs_spicfg = { NULL, GPIOB, GPIOB_PIN12, 0 };
+static uint8_t stg_call(uint8_t cls, uint8_t (*fn)(void *arg), void *arg);
 
-/* Low speed SPI configuration (281.250kHz, CPHA=0, CPOL=0, MSb first).*/
-static SPIConfig ls_spicfg = { NULL, GPIOB, GPIOB_PIN12, SPI_CR1_BR_2
-		| SPI_CR1_BR_1 };
-
-/* MMC/SD over SPI driver configuration.*/
-static MMCConfig mmccfg = { &SPID2, &ls_spicfg, &hs_spicfg };
-
-static void InsertHandler(eventid_t id) {
+static uint8_t card_mount(void *arg) {
 	FRESULT err;
 
-	(void) id;
+	(void) arg;
 	/*
 	 * On insertion MMC initialization and FS mount.
 	 */
-	if (mmcConnect(&MMCD1)) {
-		return;
+	if (blk_card.connect() != 0) {
+		return 0x15;
 	}
 	err = f_mount(0, &MMC_FS);
 	if (err != FR_OK) {
-		mmcDisconnect(&MMCD1);
-		return;
+		blk_card.disconnect();
+		return 0x15;
 	}
 	fs_ready = TRUE;
+	return 0x06;
+}
+
+static uint8_t card_unmount(void *arg) {
+
+	(void) arg;
+	/* Whatever the cache still held for the card is lost with it */
+	blk_close(&disk_blk);
+	sc_invalidate(&disk_cache);
+	blk_card.disconnect();
+	fs_ready = FALSE;
+	seq_ready = FALSE;
+	ret_ready = FALSE;
+	return 0x06;
+}
+
+static void InsertHandler(eventid_t id) {
+
+	(void) id;
+	stg_call(STG_CONTROL, card_mount, NULL);
 }
 
 static void RemoveHandler(eventid_t id) {
 
 	(void) id;
-	mmcDisconnect(&MMCD1);
-	fs_ready = FALSE;
+	stg_call(STG_CONTROL, card_unmount, NULL);
 }
 
 // Question related
@@ -136,345 +163,1407 @@ static uint8_t AsciiToHex(char c);
 static uint8_t cam_init(void);
 static uint8_t cam_on(void);
 static uint8_t cam_capture(void);
-static uint8_t cam_save(char* filename);
+static uint8_t cam_save(char* filename, const uint8_t *meta, uint32_t *size);
+static uint8_t stg_capture(void *arg);
+static void cat_add(const char *name, uint32_t size, uint32_t fcrc,
+		uint8_t kind, uint8_t q, uint8_t tally);
+static uint32_t frame_crc(void);
+static void frame_crc_start(void);
+static void cmd_catalog(const proto_frame_t *f);
+static void ret_room(void);
 static uint8_t index_questions(void);
 static uint8_t get_total_questions(void);
-static char* get_question(uint8_t q);
 static void cmd_mark_question(uint8_t val);
-static char cam_tick_questions(uint8_t q);
+static uint8_t cam_commit_answer(uint8_t q);
+static uint32_t jpeg_length(const uint8_t *p, uint32_t max);
+static uint32_t frame_length(void);
+static uint8_t cam_set_resolution(const struct regval_list *res, uint8_t qs);
+#if defined(CAM_BENCH)
+static void cmd_bench(const proto_frame_t *f);
+#endif
 
 
 // Question variables
 uint16_t questionPositions[50];
 uint8_t numOfQuestions;
+static uint8_t questionMarks[MAXQUESTIONS]; /* '#' marks in q.txt */
+static uint8_t questionTicks[MAXQUESTIONS]; /* Marks plus answers since */
 
 //#define SHELL_WA_SIZE   THD_WA_SIZE(2048)
 #define BUFFER_SIZE     100000               // Max Image Size
+#define CAM_CAPTURE_REGS ov2640_1024x768_regs // Capture resolution
 
-static WORKING_AREA(waThread2, 2048);
-static msg_t uart_receiver_thread(void *arg)
-{
-  (void) arg;
+/* Status Registers */
+uint8_t power = 0; // 0 - OFF, 1 - ON
+uint8_t busy = 0;  // 0 - NOT BUSY, 1 - BUSY
+uint8_t init = 0;  // 0 - NOT INITiated, 1 - INITiated
+uint8_t captured = 0; // 0 - image NOT captured, 1 - image captured and buffered
+uint8_t error = 0x00; // Error register
 
-#ifndef SOLOCAM
+/* DMA and DCMI Registers */
+uint32_t DmaMode; // DMA Mode Setting to be loaded here
+const stm32_dma_stream_t *DmaStreamType; // DMA Stream Select
+uint8_t ImageBuffer[BUFFER_SIZE]; // This will hold the JPEG data after acquisition
+/* Split the ImageBuffer into two pointers for DCMI driver */
+uint8_t *ImageBuffer0 = ImageBuffer;
+uint8_t *ImageBuffer1 = &ImageBuffer[BUFFER_SIZE / 2];
 
-  char buf[4];
-  while (TRUE) {
-    sdReadTimeout(&SD2, (uint8_t *) buf, 4, TIME_INFINITE);
-    	if(buf[2] == (uint8_t)0x0D && buf[3] == (uint8_t)0x0A){
-    		if(buf[0] == (uint8_t)0x7E){
-    			//'~' If does not require input data
-    			if(buf[1] == (uint8_t)0x2B){
-    				//get question total and index them '+'
-    				uint8_t ok = index_questions();
-    				if(ok == (uint8_t)21){
-    					//FAILED
-    					char outBuff[3] = {'F','A','I'};
-    				    sdWriteTimeout(&SD2,(uint8_t *)outBuff, 3, TIME_INFINITE);
-    				}else if(ok == (uint8_t)6){
-    					//OK!
-    					char outBuff[3] = {(uint8_t)get_total_questions(),13,10};
-    					sdWriteTimeout(&SD2,(uint8_t *)outBuff, 3, TIME_INFINITE);
-    				} else {
-
-    					char outBuff[3] = {'N','O','!'};
-    					sdWriteTimeout(&SD2,(uint8_t *)outBuff, 3, TIME_INFINITE);
-    				}
-    			}
-    			if(buf[1] == (uint8_t)0x69){
-    				//init camera 'i'
-    				cam_on();
-    				chThdSleepMilliseconds(100);
-    				if(cam_init() == 0x06){;
-    				chThdSleepMilliseconds(100);
-    				char outBuff[3] = {'I','N','I'};
-    				sdWriteTimeout(&SD2,(uint8_t *)outBuff, 3, TIME_INFINITE);
-    				} else {
-    				char outBuff[3] = {'F','A','I'};
-    				sdWriteTimeout(&SD2,(uint8_t *)outBuff, 3, TIME_INFINITE);
-    				}
-    			}
-    		} else if(buf[0] == (uint8_t)0x71){
-    			//get question number 'q' + buf[1]
-    			currQuestion = (uint8_t)buf[1];
-    			char* buffer1 = get_question((uint8_t)buf[1]);
-    				sdWriteTimeout(&SD2,(uint8_t *) buffer1, 64, TIME_INFINITE);
-    		} else if(buf[0] == (uint8_t)0x22){
-    			char questionNum = buf[1];
-    			char numOfTicks = cam_tick_questions(questionNum);
-    			sdWriteTimeout(&SD2,(uint8_t *) numOfTicks , 1, TIME_INFINITE);
-    		} else if(buf[0] == (uint8_t)0x21){
-    			char picNum = buf[1];
-    			char questionAmount = cam_tick_questions(picNum);
-    				//take a picture '!'
-    				char fn[10] = {'Q','0','0','-','0','0','.','j','p','g'};
-    				cam_capture();
-    				chThdSleepMilliseconds(2000);
-    				cmd_mark_question((uint8_t)picNum);
-    				chThdSleepMilliseconds(200);
-
-    				if(picNum < 10){
-    					if(questionAmount < 10){
-    							fn[0] = 'Q';
-    							fn[1] = '0';
-    							fn[2] = (char)picNum+48;
-    							fn[3] = '-';
-    							fn[4] = '0';
-    							fn[5] = (char)questionAmount+48;
-    							fn[6] = '.';
-    							fn[7] = 'j';
-    							fn[8] = 'p';
-    							fn[9] = 'g';
-    					} else {
-    							int picDiv = (char)questionAmount/10;
-    						    fn[0] = 'Q';
-    						    fn[1] = '0';
-    						    fn[2] = (char)picNum+48;
-    						    fn[3] = '-';
-    						    fn[4] = (char)picDiv+48;
-    						    fn[5] = (char)(questionAmount-(picDiv*10)+48);
-    						    fn[6] = '.';
-    						    fn[7] = 'j';
-    						    fn[8] = 'p';
-    						    fn[9] = 'g';
-    					}
-
-    				} else if(picNum < 100 && picNum > 9) {
-    					if(questionAmount < 10){
-    							int div = (char)picNum/10;
-    							fn[0] = 'Q';
-    							fn[1] = (char)div+48;
-    							fn[2] = (char)(picNum-(div*10)+48);
-    							fn[3] = '-';
-    							fn[4] = '0';
-    							fn[5] = (char)questionAmount+48;
-    							fn[6] = '.';
-    							fn[7] = 'j';
-    							fn[8] = 'p';
-    							fn[9] = 'g';
-    					} else {
-    							int picDiv = (char)questionAmount/10;
-    							int div = (char)picNum/10;
-    							fn[0] = 'Q';
-    							fn[1] = (char)div+48;
-    						    fn[2] = (char)(picNum-(div*10)+48);
-    						    fn[3] = '-';
-    						    fn[4] = (char)picDiv+48;
-    						    fn[5] = (char)(questionAmount-(picDiv*10)+48);
-    						    fn[6] = '.';
-    						    fn[7] = 'j';
-    						    fn[8] = 'p';
-    						    fn[9] = 'g';
-    					}
-    				}
-    				cam_save(fn);
-    				uint8_t outBuff[1] = {0x06};
-    				sdWriteTimeout(&SD2,(uint8_t *)outBuff, 1, TIME_INFINITE);
-    			}
-    		//sdWriteTimeout(&SD2,(uint8_t *)buf, 10, TIME_INFINITE);
-    	} else {
-    		sdWriteTimeout(&SD2,(uint8_t *)buf, 4, TIME_INFINITE);
-    	}
-    chThdSleepMilliseconds(100);
- }
-#endif
-  return 0;
+/*
+ * Host link. Requests arrive as proto.h frames; a pause of more than
+ * RX_BYTE_TIMEOUT inside a frame abandons it so the next SYNC can start
+ * cleanly. PING and STATUS are answered by the receiver itself, everything
+ * that touches the camera or the card is queued for cmd_thread, which sends
+ * the reply once the command completes. The link runs over the DMA driven
+ * USART2 stream and starts at BAUD_DEFAULT; the host may raise the rate
+ * with PROTO_CMD_BAUD.
+ */
+#define RX_BYTE_TIMEOUT 50
+#define NOW_MS()        ((uint32_t)chTimeNow() * (1000 / CH_FREQUENCY))
+#define CMDQ_SIZE       8
+#define CMDQ_ARG_SIZE   32
+#define DL_CHUNK        256     /* Default download chunk */
+#define DL_WINDOW       8       /* Default chunks in flight */
+#define DL_ACK_TIMEOUT  500
+
+typedef struct {
+	proto_frame_t f;
+	uint8_t arg[CMDQ_ARG_SIZE];
+} cmd_slot_t;
+
+static stream_t *host;
+static baud_t host_baud;
+static proto_parser_t rx_parser;
+static uint8_t tx_frame[PROTO_MAX_FRAME];
+static MUTEX_DECL(tx_mtx);
+
+static cmd_slot_t cmd_slots[CMDQ_SIZE];
+static MEMORYPOOL_DECL(cmd_pool, sizeof(cmd_slot_t), NULL);
+static msg_t cmd_mb_buf[CMDQ_SIZE];
+static MAILBOX_DECL(cmd_mb, cmd_mb_buf, CMDQ_SIZE);
+
+static void cmd_reply(const proto_frame_t *f, uint8_t status,
+		const uint8_t *data, uint16_t len) {
+	/* Called from both the receiver and cmd_thread */
+	size_t n;
+
+	if (len > PROTO_MAX_PAYLOAD - 1) {
+		len = PROTO_MAX_PAYLOAD - 1;
+	}
+	chMtxLock(&tx_mtx);
+	tx_frame[PROTO_HDR_SIZE] = status;
+	if (len > 0) {
+		memcpy(&tx_frame[PROTO_HDR_SIZE + 1], data, len);
+	}
+	n = proto_encode(tx_frame, f->cmd | PROTO_REPLY, f->req,
+			&tx_frame[PROTO_HDR_SIZE], len + 1);
+	streamWrite(host, tx_frame, n);
+	chMtxUnlock();
 }
 
+/*
+ * File handles. Every file takes its FIL, sector buffer included, and a
+ * line buffer from a static pool instead of a FIL of its own or the calling
+ * thread's stack. Only the storage thread opens files. Rewriting q.txt
+ * (fold_ticks()) has it and q.new open together; a download or a recording
+ * keeps its file open between storage calls, and any other call opens one
+ * more. The rewrite, downloads and recordings all run from cmd_thread, so
+ * they never overlap and two slots do. file_acquire() does not wait; a miss
+ * is counted and the caller fails as if the card were busy. In use, peak
+ * and misses are reported by PROTO_CMD_STATUS.
+ */
+#define FILE_SLOTS      2
+#define FILE_LINE_SIZE  128
+
+typedef struct {
+	FIL fil;
+	char line[FILE_LINE_SIZE];
+} file_slot_t;
+
+static file_slot_t file_slots[FILE_SLOTS];
+static MEMORYPOOL_DECL(file_pool, sizeof(file_slot_t), NULL);
+static uint8_t file_used;
+static uint8_t file_peak;
+static uint8_t file_misses;
+
+static file_slot_t *file_acquire(void) {
+	file_slot_t *fs;
+
+	chSysLock();
+	fs = chPoolAllocI(&file_pool);
+	if (fs == NULL) {
+		if (file_misses != 0xFF) {
+			file_misses++;
+		}
+	} else if (++file_used > file_peak) {
+		file_peak = file_used;
+	}
+	chSysUnlock();
+	return fs;
+}
 
+static void file_release(file_slot_t *fs) {
+	chSysLock();
+	chPoolFreeI(&file_pool, fs);
+	file_used--;
+	chSysUnlock();
+}
 
-static WORKING_AREA(waThread1, 2048);
-static msg_t Thread1(void *arg) {
-	uint8_t camMode = palReadPad(GPIOA, 9);
-	if(!camMode){
-		#define SOLOCAM
+/*
+ * Storage thread, see storage.h. Other threads reach the card through
+ * stg_call(), which queues a function to run here and waits for its
+ * result. QUESTION and TICKS are queued straight from cmd_dispatch in their
+ * command slot and answered from here, so they do not wait behind a
+ * capture queued on cmd_thread, and those queued together share one open
+ * q.txt.
+ */
+#define STG_CALL        0   /* stg_call_t */
+#define STG_QLINE       1   /* cmd_slot_t of a QUESTION or TICKS */
+
+typedef uint8_t (*stg_fn_t)(void *arg);
+
+typedef struct {
+	stg_fn_t fn;
+	void *arg;
+	uint8_t result;
+	BinarySemaphore done;
+} stg_call_t;
+
+static stg_queue_t stg_q;
+static SEMAPHORE_DECL(stg_sem, 0);
+
+static int stg_post(uint8_t cls, uint8_t kind, void *p) {
+	int rc;
+
+	chSysLock();
+	rc = stg_push(&stg_q, cls, kind, p, NOW_MS());
+	chSysUnlock();
+	if (rc == 0) {
+		chSemSignal(&stg_sem);
 	}
-	#ifdef SOLOCAM
-	int count = 0;
+	return rc;
+}
+
+static uint8_t stg_call(uint8_t cls, stg_fn_t fn, void *arg) {
+	/* Runs fn(arg) on the storage thread, 0x15 when the queue is full */
+	stg_call_t c;
+
+	c.fn = fn;
+	c.arg = arg;
+	chBSemInit(&c.done, TRUE);
+	if (stg_post(cls, STG_CALL, &c) != 0) {
+		return 0x15;
+	}
+	chBSemWait(&c.done);
+	return c.result;
+}
+
+static void stg_qlines(cmd_slot_t *slot) {
+	/* Answers slot and every other QUESTION or TICKS queued by now */
+	file_slot_t *fs;
+	const char *line;
+	uint8_t open, q, ticks, n;
+
+	if (numOfQuestions == 0) {
+		/* No INDEX yet, the tallies are rolled forward from the card first
+		 * as for CAPTURE */
+		index_questions();
+	}
+	fs = file_acquire();
+	open = fs != NULL && f_open(&fs->fil, "q.txt", FA_READ) == FR_OK;
+	do {
+		q = slot->f.len > 0 ? slot->arg[0] : 0;
+		line = "";
+		if (open && q < MAXQUESTIONS
+				&& f_lseek(&fs->fil, questionPositions[q]) == FR_OK
+				&& f_gets(fs->line, sizeof(fs->line), &fs->fil) != NULL) {
+			line = fs->line;
+		}
+		if (slot->f.cmd == PROTO_CMD_QUESTION) {
+			currQuestion = q;
+			n = 0;
+			if (line[0] != '\0') {
+				n = (uint8_t)strnlen(fs->line, 63);
+			}
+			if (n > 0 && q < numOfQuestions) {
+				/* Marks for answers not yet in q.txt go in front */
+				ticks = questionTicks[q] - questionMarks[q];
+				if (ticks > 63) {
+					ticks = 63;
+				}
+				memmove(&fs->line[ticks], fs->line, n);
+				memset(fs->line, '#', ticks);
+				n = n + ticks > 63 ? 63 : n + ticks;
+			}
+			cmd_reply(&slot->f, PROTO_ACK, (const uint8_t *)line, n);
+		} else {
+			for (ticks = 0; line[ticks] == '#'; ticks++) {
+			}
+			if (q < numOfQuestions) {
+				/* Answers not yet marked in q.txt count too */
+				ticks = questionTicks[q];
+			}
+			cmd_reply(&slot->f, PROTO_ACK, &ticks, 1);
+		}
+		chPoolFree(&cmd_pool, slot);
+		chSysLock();
+		slot = stg_take(&stg_q, STG_QLINE, NOW_MS());
+		chSysUnlock();
+	} while (slot != NULL);
+	if (open) {
+		f_close(&fs->fil);
+	}
+	if (fs != NULL) {
+		file_release(fs);
+	}
+}
+
+static WORKING_AREA(waStorageThread, 1024);
+static msg_t storage_thread(void *arg) {
+	stg_call_t *c;
+	void *p;
+	uint8_t kind;
+
 	(void) arg;
-	chRegSetThreadName("btnthread");
-	palClearPad(GPIOB, 3);
-	cam_on();
-	chThdSleepMilliseconds(1000);
-	cam_init();
-	chThdSleepMilliseconds(1000);
+	chRegSetThreadName("storage");
 	while (TRUE) {
-		char ch1[9] = {'S','W','0','0','0','.','j','p','g'};
-		uint8_t btnval = palReadPad(GPIOD, 2);
-		if(!btnval) {
-			palSetPad(GPIOB,3);
-			cam_capture();
-			chThdSleepMilliseconds(200);
-			if(count < 10){
-			ch1[0] = 'S';
-			ch1[1] = 'W';
-			ch1[2] = '0';
-			ch1[3] = '0';
-			ch1[4] = (char)count+48;
-			ch1[5] = '.';
-			ch1[6] = 'j';
-			ch1[7] = 'p';
-			ch1[8] = 'g';
-
-		} else if(count < 100 && count > 9) {
-			int div = (char)count/10;
-			ch1[0] = 'S';
-			ch1[1] = 'W';
-			ch1[2] = '0';
-			ch1[3] = (char)div+48;
-			ch1[4] = (char)(count-(div*10)+48);
-			ch1[5] = '.';
-			ch1[6] = 'j';
-			ch1[7] = 'p';
-			ch1[8] = 'g';
-		} else if( count < 1000 && count > 99){
-			int div = (char)count/100;
-			int div10 = (char)(count-(div*100))/10;
-			int div100 = (char) (count - ((div*100) + (div10 * 10)));
-			ch1[0] = 'S';
-			ch1[1] = 'W';
-			ch1[2] = (char)div+48;
-			ch1[3] = (char)div10+48;
-			ch1[4] = (char)div100+48;
-			ch1[5] = '.';
-			ch1[6] = 'j';
-			ch1[7] = 'p';
-			ch1[8] = 'g';
-		} else if(count > 999) {
-			count = 0;
-		}
-		cam_save(ch1);
-		ch1[5] = '.';
-		ch1[6] = 'j';
-		ch1[7] = 'p';
-		ch1[8] = 'g';
-
-		chThdSleepMilliseconds(1000);
-		count++;
-		palClearPad(GPIOB, 3);
+		chSysLock();
+		while ((p = stg_pop(&stg_q, &kind, NOW_MS())) == NULL) {
+			/* Signals left over from batched requests just loop */
+			chSemWaitS(&stg_sem);
+		}
+		chSysUnlock();
+		if (kind == STG_QLINE) {
+			stg_qlines((cmd_slot_t *)p);
+		} else {
+			c = (stg_call_t *)p;
+			c->result = c->fn(c->arg);
+			chBSemSignal(&c->done);
 		}
 	}
-	#endif
-	chThdSleepMilliseconds(50);
 	return 0;
 }
 
-int FrameCount = 0; // Number of frames received
+static uint8_t stg_index(void *arg) {
+	(void) arg;
+	return index_questions();
+}
 
-void frameEndCb(DCMIDriver* dcmip) {
-	(void) dcmip;
-	FrameCount++;
-	if (FrameCount >= 10) {
-		dcmiStop(&DCMID1);
-		FrameCount = 0;
-	} palTogglePad(GPIOD, 12) ; // Green
+static uint8_t stg_commit(void *arg) {
+	return cam_commit_answer(*(uint8_t *)arg);
 }
 
-void dmaTxferEndCb(DCMIDriver* dcmip) {
-	(void) dcmip;
-	palTogglePad(GPIOD, 15); // Blue
-	// This Never Occurs!
+/*
+ * Download. ACK frames are picked up by the receiver and handed over through
+ * dl_ack; a binary semaphore is enough as ACKs are cumulative. A file is
+ * read through a FatFs fast seek cluster map when it is in no more than
+ * (DL_CLMT - 2) / 2 fragments, so a seek, a resend far back or frame k of
+ * a recording (src 2, found by its tidx entry, see avi.h) costs the same
+ * anywhere in the file.
+ */
+#define DL_CLMT         32
+
+static xfer_t dl;
+static file_slot_t *dl_fs;
+static DWORD dl_clmt[DL_CLMT];
+static uint8_t dl_buf[PROTO_MAX_PAYLOAD];
+static volatile uint32_t dl_ack;
+static BSEMAPHORE_DECL(dl_ack_sem, TRUE);
+static uint32_t dl_base;    /* Where the object starts in the file */
+static uint32_t dl_size;
+static uint32_t dl_frame;
+static uint32_t dl_ms;
+static uint32_t dl_off;
+static uint16_t dl_len;
+
+/* dl_fs is opened, read and closed on the storage thread */
+static uint8_t dl_close(void *arg) {
+	(void) arg;
+	f_close(&dl_fs->fil);
+	file_release(dl_fs);
+	return 0x06;
 }
 
-/* Status Registers */
-uint8_t power = 0; // 0 - OFF, 1 - ON
-uint8_t busy = 0;  // 0 - NOT BUSY, 1 - BUSY
-uint8_t init = 0;  // 0 - NOT INITiated, 1 - INITiated
-uint8_t captured = 0; // 0 - image NOT captured, 1 - image captured and buffered
-uint8_t error = 0x00; // Error register
+static uint8_t dl_open(void *arg) {
+	if ((dl_fs = file_acquire()) == NULL) {
+		return 0x15;
+	}
+	if (f_open(&dl_fs->fil, (const char *)arg, FA_READ) != FR_OK) {
+		file_release(dl_fs);
+		return 0x15;
+	}
+	dl_clmt[0] = DL_CLMT;
+	dl_fs->fil.cltbl = dl_clmt;
+	if (f_lseek(&dl_fs->fil, CREATE_LINKMAP) != FR_OK) {
+		dl_fs->fil.cltbl = NULL;    /* Too fragmented, seeks walk the chain */
+	}
+	dl_base = 0;
+	dl_size = f_size(&dl_fs->fil);
+	return 0x06;
+}
 
-/* DMA and DCMI Registers */
-uint32_t DmaMode; // DMA Mode Setting to be loaded here
-const stm32_dma_stream_t *DmaStreamType; // DMA Stream Select
-uint8_t ImageBuffer[BUFFER_SIZE]; // This will hold the JPEG data after acquisition
-/* Split the ImageBuffer into two pointers for DCMI driver */
-uint8_t *ImageBuffer0 = ImageBuffer;
-uint8_t *ImageBuffer1 = &ImageBuffer[BUFFER_SIZE / 2];
+static uint8_t dl_open_frame(void *arg) {
+	/* Frame dl_frame of a recording */
+	uint32_t off;
+	UINT br;
 
-/*===========================================================================*/
-/* Initialization and main thread.                                           */
-/*===========================================================================*/
-int main(void) {
+	if (dl_open(arg) != 0x06) {
+		return 0x15;
+	}
+	if (f_read(&dl_fs->fil, dl_buf, 64, &br) != FR_OK || br != 64
+			|| dl_frame >= avi_frames(dl_buf)
+			|| f_lseek(&dl_fs->fil, AVI_TENT(dl_frame)) != FR_OK
+			|| f_read(&dl_fs->fil, dl_buf, AVI_TENT_SIZE, &br) != FR_OK
+			|| br != AVI_TENT_SIZE) {
+		dl_close(NULL);
+		return 0x15;
+	}
+	avi_tent(dl_buf, &off, &dl_size, &dl_ms);
+	dl_base = AVI_MOVI + off + AVI_CHUNK_HDR;
+	return 0x06;
+}
 
-	static const evhandler_t evhndl[] = { InsertHandler, RemoveHandler };
-	//Thread *shelltp = NULL;
-	struct EventListener el0, el1;
+static uint8_t dl_read(void *arg) {
+	/* dl_len bytes at dl_off into the chunk buffer */
+	UINT br;
 
-	/* Initializes ChibiOS HAL and RTOs */
-	halInit();
-	chSysInit();
-	/* Initializes Project Specific HW resources */
-	hwInit();
+	(void) arg;
+	return f_lseek(&dl_fs->fil, dl_base + dl_off) == FR_OK
+			&& f_read(&dl_fs->fil, &dl_buf[4], dl_len, &br) == FR_OK
+			&& br == dl_len ? 0x06 : 0x15;
+}
 
-	sdStart(&SD2, NULL);
 
-	mmcObjectInit(&MMCD1);
-	mmcStart(&MMCD1, &mmccfg);
-	palSetPadMode(GPIOA, GPIOA_PIN2, PAL_MODE_ALTERNATE(7)); palSetPadMode(GPIOA, GPIOA_PIN3, PAL_MODE_ALTERNATE(7));
-		palSetPad(GPIOB, 12); palSetPadMode(GPIOB, GPIOB_PIN12, PAL_MODE_OUTPUT_PUSHPULL |
-				PAL_STM32_OSPEED_HIGHEST); /* NSS.     */
-		palSetPadMode(GPIOB, GPIOB_PIN13, PAL_MODE_ALTERNATE(5) |
-				PAL_STM32_OSPEED_HIGHEST); /* SCK.     */
-		palSetPadMode(GPIOB, GPIOB_PIN14, PAL_MODE_ALTERNATE(5)); /* MISO.    */
-		palSetPadMode(GPIOB, GPIOB_PIN15, PAL_MODE_ALTERNATE(5) |
-				PAL_STM32_OSPEED_HIGHEST); /* MOSI.    */
+static void cmd_download(const proto_frame_t *f) {
+	uint8_t src, window, info[8];
+	uint16_t chunk, len, arg = 8;
+	uint32_t size, off, ack;
+	char name[SEQ_PATH_SIZE];
 
+	if (f->len < 8) {
+		cmd_reply(f, PROTO_NAK, NULL, 0);
+		return;
+	}
+	src = f->payload[0];
+	off = proto_get32(&f->payload[1]);
+	chunk = f->payload[5] | (f->payload[6] << 8);
+	window = f->payload[7];
+	if (chunk == 0 || chunk > PROTO_MAX_PAYLOAD - 4) {
+		chunk = DL_CHUNK;
+	}
+	if (window == 0) {
+		window = DL_WINDOW;
+	}
 
-	tmr_init(&MMCD1);
+	if (src == 2) {
+		if (f->len < 12) {
+			cmd_reply(f, PROTO_NAK, NULL, 0);
+			return;
+		}
+		dl_frame = proto_get32(&f->payload[8]);
+		arg = 12;
+	}
+	if (src == 0) {
+		size = frame_length();
+	} else {
+		len = f->len - arg;
+		if (len > sizeof(name) - 1) {
+			len = sizeof(name) - 1;
+		}
+		memcpy(name, &f->payload[arg], len);
+		name[len] = 0;
+		if (stg_call(STG_INTERACTIVE, src == 2 ? dl_open_frame : dl_open,
+				name) != 0x06) {
+			cmd_reply(f, PROTO_NAK, NULL, 0);
+			return;
+		}
+		size = dl_size;
+	}
+	proto_put32(info, size);
+	proto_put32(&info[4], src == 0 ? frame_crc() : dl_ms);
+	chBSemReset(&dl_ack_sem, TRUE);
+	cmd_reply(f, PROTO_ACK, info, src == 1 ? 4 : 8);
+
+	xfer_start(&dl, size, off, chunk, window);
+	while (!xfer_done(&dl)) {
+		while (xfer_next(&dl, &off, &len)) {
+			proto_put32(dl_buf, off);
+			if (src == 0) {
+				memcpy(&dl_buf[4], &ImageBuffer[off], len);
+			} else {
+				dl_off = off;
+				dl_len = len;
+				if (stg_call(STG_INTERACTIVE, dl_read, NULL) != 0x06) {
+					xfer_ack(&dl, XFER_ABORT);
+					break;
+				}
+			}
+			chMtxLock(&tx_mtx);
+			streamWrite(host, tx_frame, proto_encode(tx_frame,
+					PROTO_CMD_DATA | PROTO_REPLY, f->req, dl_buf, len + 4));
+			chMtxUnlock();
+		}
+		if (xfer_done(&dl)) {
+			break;
+		}
+		if (chBSemWaitTimeout(&dl_ack_sem, MS2ST(DL_ACK_TIMEOUT)) != RDY_OK) {
+			xfer_timeout(&dl);
+			continue;
+		}
+		chSysLock();
+		ack = dl_ack;
+		chSysUnlock();
+		xfer_ack(&dl, ack);
+	}
+	if (src != 0) {
+		stg_call(STG_INTERACTIVE, dl_close, NULL);
+	}
+}
 
-	chThdCreateStatic(waThread1, sizeof(waThread1), NORMALPRIO, Thread1, NULL);
-	chThdCreateStatic(waThread2, sizeof(waThread2), HIGHPRIO, uart_receiver_thread, NULL);
+/*
+ * Live preview, see preview.h. ImageBuffer is split into PV_SLOTS slots and
+ * frameEndCb signals pv_frame_sem instead of counting frames while pv_active
+ * is set. Preview runs on cmd_thread until PREVIEW 0 arrives or another
+ * command is queued; the capture resolution is then restored and the start
+ * request gets ACK, frames sent, dropped and bad (u32 each), elapsed ms
+ * (u32) and frames per second x10 (u16).
+ */
+#define PV_SLOT_SIZE    (BUFFER_SIZE / PV_SLOTS / 4 * 4)
+#define PV_CHUNK        (PROTO_MAX_PAYLOAD - PV_HDR_SIZE)
+#define PV_QS           0x30    /* Coarse, keeps a 320x240 frame near 6 KB */
+#define PV_FRAME_TIMEOUT 500
 
-	chEvtRegister(&inserted_event, &el0, 0);
-	chEvtRegister(&removed_event, &el1, 1);
+static pv_t pv;
+static volatile uint8_t pv_active;
+static volatile uint8_t pv_stop;
+static BSEMAPHORE_DECL(pv_frame_sem, TRUE);
 
-	palSetPadMode(GPIOA,0, PAL_MODE_INPUT);
+static void pv_arm(uint8_t slot) {
+	uint8_t *p = &ImageBuffer[slot * PV_SLOT_SIZE];
 
-	while (TRUE) {
+	dcmiStartReceiveOneShot(&DCMID1, PV_SLOT_SIZE / 2, p, p + PV_SLOT_SIZE / 2);
+}
 
-		chEvtDispatch(evhndl, chEvtWaitOne(ALL_EVENTS));
+static void pv_captured(void) {
+	/* Frame end of the filling slot: keep it if it is a whole JPEG */
+	const uint8_t *p = &ImageBuffer[pv.fill * PV_SLOT_SIZE];
+
+	pv_arm(pv_frame(&pv, p[0] == 0xFF && p[1] == 0xD8
+			&& jpeg_length(p, PV_SLOT_SIZE) < PV_SLOT_SIZE));
+}
+
+static int pv_running(void) {
+	cnt_t queued;
+
+	chSysLock();
+	queued = chMBGetUsedCountI(&cmd_mb);
+	chSysUnlock();
+	return !pv_stop && queued == 0;
+}
+
+static void cmd_preview(const proto_frame_t *f) {
+	uint8_t stats[18];
+	const uint8_t *p;
+	uint16_t total, off, len;
+	systime_t start, elapsed;
+	uint8_t slot;
+
+	if (!init || cam_set_resolution(ov2640_320x240_regs, PV_QS) != 0) {
+		cmd_reply(f, PROTO_NAK, NULL, 0);
+		return;
 	}
-	return 0;
+	busy = 1;
+	captured = 0;
+	frame_crc_start();
+	pv_stop = 0;
+	pv_start(&pv);
+	chBSemReset(&pv_frame_sem, TRUE);
+	pv_active = 1;
+	dcmiStart(&DCMID1, &dcmicfg);
+	pv_arm(pv.fill);
+	cmd_reply(f, PROTO_ACK, NULL, 0);
+	start = chTimeNow();
+
+	while (pv_running()) {
+		if ((slot = pv_take(&pv)) == PV_NONE) {
+			if (chBSemWaitTimeout(&pv_frame_sem, MS2ST(PV_FRAME_TIMEOUT))
+					== RDY_OK) {
+				pv_captured();
+			} else {
+				/* Frame end never came, try again */
+				pv.bad++;
+				pv_arm(pv.fill);
+			}
+			continue;
+		}
+		p = &ImageBuffer[slot * PV_SLOT_SIZE];
+		total = (uint16_t)jpeg_length(p, PV_SLOT_SIZE);
+		for (off = 0; off < total && pv_running(); off += len) {
+			len = total - off < PV_CHUNK ? total - off : PV_CHUNK;
+			chMtxLock(&tx_mtx);
+			pv_header(&tx_frame[PROTO_HDR_SIZE], pv.seq, off, total);
+			memcpy(&tx_frame[PROTO_HDR_SIZE + PV_HDR_SIZE], &p[off], len);
+			streamWrite(host, tx_frame, proto_encode(tx_frame,
+					PROTO_CMD_FRAME | PROTO_REPLY, f->req,
+					&tx_frame[PROTO_HDR_SIZE], len + PV_HDR_SIZE));
+			chMtxUnlock();
+			/* Capture carries on while the link is busy */
+			if (chBSemWaitTimeout(&pv_frame_sem, TIME_IMMEDIATE) == RDY_OK) {
+				pv_captured();
+			}
+		}
+		if (off < total) {
+			break;
+		}
+		pv_sent(&pv);
+	}
+	elapsed = chTimeNow() - start;
+
+	pv_active = 0;
+	dcmiStop(&DCMID1);
+	cam_set_resolution(CAM_CAPTURE_REGS, OV2640_QS_DEFAULT);
+	busy = 0;
+
+	proto_put32(&stats[0], pv.sent);
+	proto_put32(&stats[4], pv.dropped);
+	proto_put32(&stats[8], pv.bad);
+	proto_put32(&stats[12], (uint32_t)elapsed * (1000 / CH_FREQUENCY));
+	len = elapsed > 0 ? (uint16_t)(pv.sent * 10 * CH_FREQUENCY / elapsed) : 0;
+	stats[16] = (uint8_t)len;
+	stats[17] = (uint8_t)(len >> 8);
+	cmd_reply(f, PROTO_ACK, stats, 18);
 }
 
-///*===========================================================================*/
-///* Command line commands.                                                    */
-///*===========================================================================*/
-//
-//static void cmd_mem(BaseSequentialStream *chp, int argc, char *argv[]) {
-//	size_t n, size;
-//
-//	(void) argv;
-//	if (argc > 0) {
-//#ifdef DEBUG
-//		chprintf(chp, "Usage: mem\r\n");
-//#endif
-//		return;
-//	}
-//	n = chHeapStatus(NULL, &size);
-//#ifdef DEBUG
-//	chprintf(chp, "core free memory : %u bytes\r\n", chCoreStatus());
-//	chprintf(chp, "heap fragments   : %u\r\n", n);
-//	chprintf(chp, "heap free total  : %u bytes\r\n", size);
-//#endif
-//}
-//
-//static void cmd_threads(BaseSequentialStream *chp, int argc, char *argv[]) {
-//	static const char *states[] = { THD_STATE_NAMES };
-//	Thread *tp;
-//
-//	(void) argv;
-//	if (argc > 0) {
-//#ifdef DEBUG
-//		chprintf(chp, "Usage: threads\r\n");
-//#endif
-//		return;
-//	}
-//#ifdef DEBUG
-//	chprintf(chp, "    addr    stack prio refs     state time\r\n");
-//#endif
-//	tp = chRegFirstThread();
-//	do {
+/*
+ * Recording, see avi.h. Frames are captured into the preview slots, each
+ * AVI_CHUNK_HDR bytes in so the chunk header goes in front of the JPEG and
+ * a frame is one write. Recording runs on cmd_thread like the preview,
+ * until RECORD 0 arrives, another command is queued, the frames asked for
+ * are written or the index is full; the writes go through the storage
+ * thread, where rec_fs stays open throughout. With an interval the next
+ * frame is only captured when it is due; without, capture goes on while a
+ * frame is written and frames the card could not keep up with are dropped.
+ * Every AVI_CHECKPOINT frames the index entries kept in RAM are written
+ * out with the header and the file synced. The start request gets ACK,
+ * then frames written, dropped and bad (u32 each), file bytes (u32),
+ * elapsed ms (u32) and frames per second x10 (u16), after ACK or NAK for
+ * closing the file.
+ */
+#define REC_DATA        ((PV_SLOT_SIZE - AVI_CHUNK_HDR) / 8 * 8)
+#define REC_WIDTH       320
+#define REC_HEIGHT      240
+
+static avi_t rec;
+static file_slot_t *rec_fs;
+static uint8_t rec_buf[AVI_SECTOR];
+static const uint8_t *rec_p;        /* Frame to write, chunk header first */
+static uint32_t rec_len;
+static uint32_t rec_ms;
+static uint8_t rec_armed;
+static systime_t rec_at[PV_SLOTS];  /* Frame end of each slot */
+
+static FRESULT rec_put(uint32_t pos, const void *p, uint32_t n) {
+	UINT bw;
+	FRESULT err;
+
+	if ((err = f_lseek(&rec_fs->fil, pos)) == FR_OK
+			&& (err = f_write(&rec_fs->fil, p, n, &bw)) == FR_OK && bw != n) {
+		err = FR_DENIED;    /* Volume full */
+	}
+	return err;
+}
+
+static FRESULT rec_save(int index) {
+	/* Unsaved index entries to tidx, then both header sectors */
+	FRESULT err;
+
+	err = rec_put(AVI_TENT(rec.saved), rec.win,
+			(rec.frames - rec.saved) * AVI_TENT_SIZE);
+	avi_saved(&rec);
+	if (err == FR_OK) {
+		avi_header(rec_buf, &rec, index);
+		err = rec_put(0, rec_buf, AVI_SECTOR);
+	}
+	if (err == FR_OK) {
+		avi_movi(rec_buf, &rec);
+		err = rec_put(AVI_HDR_SIZE - AVI_SECTOR, rec_buf, AVI_SECTOR);
+	}
+	return err;
+}
+
+/* rec_fs is opened, written and closed on the storage thread */
+static uint8_t rec_open(void *arg) {
+	if (fs_ready) {
+		ret_room();
+	}
+	if (!fs_ready || (rec_fs = file_acquire()) == NULL) {
+		return 0x15;
+	}
+	if (f_open(&rec_fs->fil, (const char *)arg,
+			FA_READ | FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) {
+		file_release(rec_fs);
+		return 0x15;
+	}
+	if (rec_save(0) != FR_OK) {
+		f_close(&rec_fs->fil);
+		file_release(rec_fs);
+		return 0x15;
+	}
+	return 0x06;
+}
+
+static uint8_t rec_write(void *arg) {
+	/* The frame after the last, then the checkpoint when it is due */
+	(void) arg;
+	if (rec_put(AVI_HDR_SIZE + rec.movi, rec_p, AVI_CHUNK_SIZE(rec_len))
+			!= FR_OK) {
+		return 0x15;
+	}
+	rec.ms = rec_ms;
+	if (avi_add(&rec, rec_len, rec_ms)
+			&& (rec_save(0) != FR_OK || f_sync(&rec_fs->fil) != FR_OK)) {
+		return 0x15;
+	}
+	return 0x06;
+}
+
+static uint8_t rec_close(void *arg) {
+	/* idx1 after the last frame written whole, made from tidx, then the
+	 * header with the totals */
+	uint32_t i, j, k, pos, off, len, ms, n = 8;
+	UINT br;
+	FRESULT err;
+
+	err = rec_save(0);
+	pos = AVI_HDR_SIZE + rec.movi;
+	avi_index(rec_buf, &rec);
+	for (i = 0; i < rec.frames && err == FR_OK; i += k) {
+		k = rec.frames - i < AVI_CHECKPOINT ? rec.frames - i : AVI_CHECKPOINT;
+		if ((err = f_lseek(&rec_fs->fil, AVI_TENT(i))) != FR_OK
+				|| (err = f_read(&rec_fs->fil, rec.win, k * AVI_TENT_SIZE, &br))
+				!= FR_OK) {
+			break;
+		}
+		for (j = 0; j < k && err == FR_OK; j++) {
+			avi_tent(&rec.win[j * AVI_TENT_SIZE], &off, &len, &ms);
+			avi_entry(&rec_buf[n], off, len);
+			n += AVI_ENTRY_SIZE;
+			if (n + AVI_ENTRY_SIZE > sizeof(rec_buf)) {
+				err = rec_put(pos, rec_buf, n);
+				pos += n;
+				n = 0;
+			}
+		}
+	}
+	if (err == FR_OK && n > 0) {
+		err = rec_put(pos, rec_buf, n);
+	}
+	if (err == FR_OK) {
+		err = f_truncate(&rec_fs->fil);
+	}
+	if (err == FR_OK) {
+		err = rec_save(1);
+	}
+	if (f_close(&rec_fs->fil) != FR_OK) {
+		err = FR_DISK_ERR;
+	}
+	file_release(rec_fs);
+	if (err != FR_OK) {
+		return 0x15;
+	}
+	cat_add((const char *)arg, AVI_HDR_SIZE + rec.movi + 8
+			+ rec.frames * AVI_ENTRY_SIZE, 0, CAT_RECORDING, CAT_ANY, CAT_ANY);
+	return 0x06;
+}
+
+static void rec_arm(void) {
+	uint8_t *p = &ImageBuffer[pv.fill * PV_SLOT_SIZE + AVI_CHUNK_HDR];
+
+	dcmiStartReceiveOneShot(&DCMID1, REC_DATA / 2, p, p + REC_DATA / 2);
+	rec_armed = 1;
+}
+
+static void rec_captured(uint16_t interval) {
+	/* Frame end of the filling slot: keep it if it is a whole JPEG and
+	 * capture the next one now unless there is an interval to wait out */
+	const uint8_t *p = &ImageBuffer[pv.fill * PV_SLOT_SIZE + AVI_CHUNK_HDR];
+	int good = p[0] == 0xFF && p[1] == 0xD8 && jpeg_length(p, REC_DATA)
+			< REC_DATA;
+
+	rec_at[pv.fill] = chTimeNow();
+	pv_frame(&pv, good);
+	rec_armed = 0;
+	if (!good || interval == 0) {
+		rec_arm();
+	}
+}
+
+static void cmd_record(const proto_frame_t *f) {
+	uint8_t stats[22];
+	uint8_t *p;
+	uint16_t frames, interval, len;
+	uint32_t n;
+	systime_t start, due, now, elapsed;
+	char name[13];
+	uint8_t slot, status;
+
+	if (f->len < 6 || !init
+			|| cam_set_resolution(ov2640_320x240_regs, OV2640_QS_DEFAULT) != 0) {
+		cmd_reply(f, PROTO_NAK, NULL, 0);
+		return;
+	}
+	frames = f->payload[1] | (f->payload[2] << 8);
+	interval = f->payload[3] | (f->payload[4] << 8);
+	len = (uint16_t)(f->len - 5);
+	if (len > sizeof(name) - 1) {
+		len = sizeof(name) - 1;
+	}
+	memcpy(name, &f->payload[5], len);
+	name[len] = 0;
+	avi_start(&rec, REC_WIDTH, REC_HEIGHT);
+	if (stg_call(STG_BULK, rec_open, name) != 0x06) {
+		cam_set_resolution(CAM_CAPTURE_REGS, OV2640_QS_DEFAULT);
+		cmd_reply(f, PROTO_NAK, NULL, 0);
+		return;
+	}
+	busy = 1;
+	captured = 0;
+	frame_crc_start();
+	pv_stop = 0;
+	pv_start(&pv);
+	chBSemReset(&pv_frame_sem, TRUE);
+	pv_active = 1;
+	dcmiStart(&DCMID1, &dcmicfg);
+	rec_arm();
+	cmd_reply(f, PROTO_ACK, NULL, 0);
+	start = due = chTimeNow();
+
+	while (pv_running() && (frames == 0 || rec.frames < frames)
+			&& rec.frames < AVI_FRAMES_MAX) {
+		if (rec_armed && chBSemWaitTimeout(&pv_frame_sem, TIME_IMMEDIATE)
+				== RDY_OK) {
+			rec_captured(interval);
+		}
+		if ((slot = pv_take(&pv)) != PV_NONE) {
+			p = &ImageBuffer[slot * PV_SLOT_SIZE];
+			n = jpeg_length(p + AVI_CHUNK_HDR, REC_DATA);
+			avi_chunk(p, n);
+			p[AVI_CHUNK_HDR + n] = 0;   /* Pad byte when n is odd */
+			rec_p = p;
+			rec_len = n;
+			rec_ms = (uint32_t)(rec_at[slot] - start) * (1000 / CH_FREQUENCY);
+			if (stg_call(STG_BULK, rec_write, NULL) != 0x06) {
+				break;
+			}
+			pv_sent(&pv);
+			continue;
+		}
+		if (rec_armed) {
+			if (chBSemWaitTimeout(&pv_frame_sem, MS2ST(PV_FRAME_TIMEOUT))
+					== RDY_OK) {
+				rec_captured(interval);
+			} else {
+				/* Frame end never came, try again */
+				pv.bad++;
+				rec_arm();
+			}
+			continue;
+		}
+		/* Interval to wait out; a late frame starts it again */
+		due += MS2ST(interval);
+		now = chTimeNow();
+		if ((int32_t)(due - now) > 0) {
+			chThdSleep(due - now);
+		} else {
+			due = now;
+		}
+		rec_arm();
+	}
+	elapsed = chTimeNow() - start;
+
+	pv_active = 0;
+	dcmiStop(&DCMID1);
+	cam_set_resolution(CAM_CAPTURE_REGS, OV2640_QS_DEFAULT);
+	busy = 0;
+	rec.ms = (uint32_t)elapsed * (1000 / CH_FREQUENCY);
+	status = stg_call(STG_BULK, rec_close, name);
+
+	proto_put32(&stats[0], rec.frames);
+	proto_put32(&stats[4], pv.dropped);
+	proto_put32(&stats[8], pv.bad);
+	proto_put32(&stats[12], AVI_HDR_SIZE + rec.movi + 8
+			+ rec.frames * AVI_ENTRY_SIZE);
+	proto_put32(&stats[16], rec.ms);
+	len = elapsed > 0 ? (uint16_t)(rec.frames * 10 * CH_FREQUENCY / elapsed)
+			: 0;
+	stats[20] = (uint8_t)len;
+	stats[21] = (uint8_t)(len >> 8);
+	cmd_reply(f, status, stats, sizeof(stats));
+}
+
+static void cmd_execute(const proto_frame_t *f) {
+	uint8_t arg = f->len > 0 ? f->payload[0] : 0;
+	uint8_t val;
+
+	switch (f->cmd) {
+	case PROTO_CMD_INDEX:
+		//get question total and index them '+'
+		if (stg_call(STG_INTERACTIVE, stg_index, NULL) != (uint8_t)6) {
+			cmd_reply(f, PROTO_NAK, NULL, 0);
+			break;
+		}
+		val = get_total_questions();
+		cmd_reply(f, PROTO_ACK, &val, 1);
+		break;
+	case PROTO_CMD_INIT:
+		//init camera 'i'
+		cam_on();
+		chThdSleepMilliseconds(100);
+		val = cam_init();
+		chThdSleepMilliseconds(100);
+		cmd_reply(f, val, NULL, 0);
+		break;
+	case PROTO_CMD_CAPTURE:
+		//take a picture '!'
+		TRACE(TRACE_TRIGGER, 1);
+		cam_capture();
+		chThdSleepMilliseconds(2000);
+		cmd_reply(f, stg_call(STG_BULK, stg_commit, &arg), NULL, 0);
+		break;
+	case PROTO_CMD_DOWNLOAD:
+		cmd_download(f);
+		break;
+	case PROTO_CMD_CATALOG:
+		cmd_catalog(f);
+		break;
+	case PROTO_CMD_PREVIEW:
+		cmd_preview(f);
+		break;
+	case PROTO_CMD_RECORD:
+		cmd_record(f);
+		break;
+#if defined(CAM_BENCH)
+	case PROTO_CMD_BENCH:
+		cmd_bench(f);
+		break;
+#endif
+	default:
+		cmd_reply(f, PROTO_NAK, NULL, 0);
+		break;
+	}
+}
+
+static void cmd_storage(const proto_frame_t *f) {
+	uint8_t out[STG_STATS_SIZE + SC_STATS_SIZE + BLK_STATS_SIZE];
+
+	chSysLock();
+	stg_put(out, &stg_q);
+	if (f->len > 0 && f->payload[0] == 1) {
+		stg_clear(&stg_q);
+	}
+	chSysUnlock();
+	/* Counted by the storage thread without a lock, a snapshot is fine */
+	sc_put(&out[STG_STATS_SIZE], &disk_cache);
+	blk_put(&out[STG_STATS_SIZE + SC_STATS_SIZE], &disk_blk);
+	if (f->len > 0 && f->payload[0] == 1) {
+		sc_clear(&disk_cache);
+		blk_clear(&disk_blk);
+	}
+	cmd_reply(f, PROTO_ACK, out, sizeof(out));
+}
+
+#if defined(CAM_PROBES)
+static void cmd_probes(const proto_frame_t *f) {
+	/* Answered by the receiver so the table can be read while cmd_thread
+	 * is in the middle of a capture */
+	static uint8_t out[PROBE_HDR_SIZE + PROBE_COUNT * PROBE_REC_SIZE];
+	uint16_t n = PROBE_HDR_SIZE;
+	uint8_t i;
+
+	proto_put32(&out[1], STM32_SYSCLK);
+	out[5] = PROBE_COUNT;
+	for (i = 0; i < PROBE_COUNT; i++) {
+		chSysLock();
+		n += probe_put(&out[n], i, &probe_tab[i]);
+		if (f->len > 0 && f->payload[0] == 1) {
+			probe_reset(&probe_tab[i]);
+		}
+		chSysUnlock();
+	}
+	cmd_reply(f, PROTO_ACK, &out[1], n - 1);
+}
+#endif
+
+#if defined(CAM_TRACE)
+static void cmd_trace(const proto_frame_t *f) {
+	/* Answered by the receiver, like cmd_probes */
+	static uint8_t out[TRACE_HDR_SIZE + TRACE_DUMP_MAX * TRACE_REC_SIZE];
+	uint32_t first;
+	uint8_t n;
+
+	if (f->len < 4) {
+		cmd_reply(f, PROTO_NAK, NULL, 0);
+		return;
+	}
+	n = trace_dump(&trace_ring, proto_get32(f->payload),
+			&out[TRACE_HDR_SIZE], TRACE_DUMP_MAX, &first);
+	proto_put32(&out[1], STM32_SYSCLK);
+	proto_put32(&out[5], trace_ring.head);
+	proto_put32(&out[9], first);
+	out[13] = n;
+	cmd_reply(f, PROTO_ACK, &out[1], TRACE_HDR_SIZE - 1 + n * TRACE_REC_SIZE);
+}
+#endif
+
+static void cmd_dispatch(const proto_frame_t *f) {
+	/* Runs on the receiver thread, must not block */
+	cmd_slot_t *slot;
+	uint8_t status[9];
+
+	switch (f->cmd) {
+	case PROTO_CMD_PING:
+		cmd_reply(f, PROTO_ACK, f->payload, f->len);
+		return;
+	case PROTO_CMD_STATUS:
+		status[0] = power;
+		status[1] = init;
+		status[2] = busy;
+		status[3] = captured;
+		status[4] = error;
+		chSysLock();
+		status[5] = (uint8_t)chMBGetUsedCountI(&cmd_mb);
+		status[6] = file_used;
+		status[7] = file_peak;
+		status[8] = file_misses;
+		chSysUnlock();
+		cmd_reply(f, PROTO_ACK, status, sizeof(status));
+		return;
+	case PROTO_CMD_BAUD:
+		if (f->len < 4 || !baud_supported(proto_get32(f->payload))) {
+			cmd_reply(f, PROTO_NAK, NULL, 0);
+			return;
+		}
+		/* Reply at the old rate; holding tx_mtx keeps cmd_thread from
+		 * starting a frame that would straddle the switch */
+		chMtxLock(&tx_mtx);
+		tx_frame[PROTO_HDR_SIZE] = PROTO_ACK;
+		streamWrite(host, tx_frame, proto_encode(tx_frame, f->cmd | PROTO_REPLY,
+				f->req, &tx_frame[PROTO_HDR_SIZE], 1));
+		baud_switch(&host_baud, proto_get32(f->payload), NOW_MS());
+		chMtxUnlock();
+		return;
+	case PROTO_CMD_STORAGE:
+		cmd_storage(f);
+		return;
+#if defined(CAM_PROBES)
+	case PROTO_CMD_PROBES:
+		cmd_probes(f);
+		return;
+#endif
+#if defined(CAM_TRACE)
+	case PROTO_CMD_TRACE:
+		cmd_trace(f);
+		return;
+#endif
+	case PROTO_CMD_ACK:
+		if (f->len >= 4) {
+			chSysLock();
+			dl_ack = proto_get32(f->payload);
+			chBSemSignalI(&dl_ack_sem);
+			chSysUnlock();
+		}
+		return;
+	case PROTO_CMD_PREVIEW:
+	case PROTO_CMD_RECORD:
+		if (f->len > 0 && f->payload[0] == 0) {
+			/* Stop is answered here, the start request gets the stats */
+			pv_stop = 1;
+			cmd_reply(f, PROTO_ACK, NULL, 0);
+			return;
+		}
+		break;
+	case PROTO_CMD_QUESTION:
+	case PROTO_CMD_TICKS:
+	case PROTO_CMD_CAPTURE:
+		if (f->len == 0) {
+			cmd_reply(f, PROTO_NAK, NULL, 0);
+			return;
+		}
+		break;
+	}
+
+	slot = chPoolAlloc(&cmd_pool);
+	if (slot == NULL || f->len > CMDQ_ARG_SIZE) {
+		/* Queue full or arguments too long */
+		if (slot != NULL) {
+			chPoolFree(&cmd_pool, slot);
+		}
+		cmd_reply(f, PROTO_NAK, NULL, 0);
+		return;
+	}
+	slot->f = *f;
+	memcpy(slot->arg, f->payload, f->len);
+	slot->f.payload = slot->arg;
+	if (f->cmd == PROTO_CMD_QUESTION || f->cmd == PROTO_CMD_TICKS) {
+		/* Answered by the storage thread */
+		if (stg_post(STG_INTERACTIVE, STG_QLINE, slot) != 0) {
+			chPoolFree(&cmd_pool, slot);
+			cmd_reply(f, PROTO_NAK, NULL, 0);
+		}
+		return;
+	}
+	chMBPost(&cmd_mb, (msg_t)slot, TIME_INFINITE);
+}
+
+static WORKING_AREA(waCmdThread, 1024);
+static msg_t cmd_thread(void *arg) {
+	msg_t msg;
+	cmd_slot_t *slot;
+
+	(void) arg;
+	chRegSetThreadName("cmd");
+	while (TRUE) {
+		chMBFetch(&cmd_mb, &msg, TIME_INFINITE);
+		slot = (cmd_slot_t *)msg;
+		cmd_execute(&slot->f);
+		chPoolFree(&cmd_pool, slot);
+	}
+	return 0;
+}
+
+static WORKING_AREA(waThread2, 1024);
+static msg_t uart_receiver_thread(void *arg)
+{
+  (void) arg;
+
+#ifndef SOLOCAM
+
+  static uint8_t rxbuf[64];
+  proto_frame_t frame;
+  uint32_t timeout;
+  size_t i, n;
+
+  chRegSetThreadName("uart");
+  proto_init(&rx_parser);
+  baud_init(&host_baud, host, BAUD_DEFAULT);
+  chPoolLoadArray(&cmd_pool, cmd_slots, CMDQ_SIZE);
+  chThdCreateStatic(waCmdThread, sizeof(waCmdThread), NORMALPRIO, cmd_thread, NULL);
+  while (TRUE) {
+    timeout = rx_parser.n > 0 ? RX_BYTE_TIMEOUT :
+        host_baud.pending ? BAUD_CONFIRM_MS : STREAM_INFINITE;
+    n = streamRead(host, rxbuf, sizeof(rxbuf), timeout);
+    baud_poll(&host_baud, NOW_MS());
+    if (n == 0) {
+      proto_reset(&rx_parser);
+      continue;
+    }
+    for (i = 0; i < n; i++) {
+      if (proto_feed(&rx_parser, rxbuf[i], &frame)) {
+        baud_frame(&host_baud);
+        cmd_dispatch(&frame);
+      }
+    }
+ }
+#endif
+  return 0;
+}
+
+
+
+static WORKING_AREA(waThread1, 1024);
+static msg_t Thread1(void *arg) {
+	uint8_t camMode = palReadPad(GPIOA, 9);
+	if(!camMode){
+		#define SOLOCAM
+	}
+	#ifdef SOLOCAM
+	(void) arg;
+	chRegSetThreadName("btnthread");
+	palClearPad(GPIOB, 3);
+	cam_on();
+	chThdSleepMilliseconds(1000);
+	cam_init();
+	chThdSleepMilliseconds(1000);
+	while (TRUE) {
+		uint8_t btnval = palReadPad(BUTTON_PORT, BUTTON_PAD);
+		if(!btnval) {
+			palSetPad(GPIOB,3);
+			TRACE(TRACE_TRIGGER, 0);
+			cam_capture();
+			chThdSleepMilliseconds(200);
+			stg_call(STG_BULK, stg_capture, NULL);
+		palTogglePad(GPIOD, 13);
+		chThdSleepMilliseconds(250); palTogglePad(GPIOD, 13);
+
+		chThdSleepMilliseconds(1000);
+		palClearPad(GPIOB, 3);
+		}
+	}
+	#endif
+	chThdSleepMilliseconds(50);
+	return 0;
+}
+
+/*
+ * Frame CRC (fcrc.h) of the capture in ImageBuffer, fed a DMA buffer half
+ * at a time while the frame comes in. dmaTxferEndCb only counts the halves
+ * filled and wakes cam_capture(), which feeds them to the unit from its own
+ * thread while it waits for the frame. The first frame_crc() after the
+ * capture feeds the tail past the last half and keeps the result for the
+ * saves after it. frame_crc_start() starts over, and drops the frame
+ * length kept by frame_length(), before ImageBuffer is filled again.
+ */
+#define FCRC_HALF       (BUFFER_SIZE / 2)
+
+static uint32_t fcrc_value;
+static uint32_t fcrc_fed;               /* Bytes of the frame fed so far */
+static volatile uint8_t fcrc_halves;    /* DMA halves filled */
+static bool_t fcrc_done;
+static uint32_t frame_len;              /* 0 until frame_length() looked */
+static MUTEX_DECL(fcrc_mtx);
+static BSEMAPHORE_DECL(fcrc_sem, TRUE);
+
+#if defined(CAM_CRC_SW)
+static uint32_t fcrc_sw;
+
+static void fcrc_reset(void) {
+	fcrc_sw = FCRC_INIT;
+}
+
+static void fcrc_feed(const uint8_t *p, uint32_t n) {
+	fcrc_sw = fcrc_update(fcrc_sw, p, n);
+}
+
+static uint32_t fcrc_read(void) {
+	return fcrc_sw;
+}
+#else
+static void fcrc_reset(void) {
+	rccEnableAHB1(RCC_AHB1ENR_CRCEN, FALSE);
+	CRC->CR = CRC_CR_RESET;
+}
+
+static void fcrc_feed(const uint8_t *p, uint32_t n) {
+	/* Words as they are in memory, the last one padded with zeros */
+	uint32_t w;
+
+	for (; n >= 4; n -= 4, p += 4) {
+		memcpy(&w, p, 4);
+		CRC->DR = w;
+	}
+	if (n > 0) {
+		w = 0;
+		memcpy(&w, p, n);
+		CRC->DR = w;
+	}
+}
+
+static uint32_t fcrc_read(void) {
+	return CRC->DR;
+}
+#endif
+
+static void frame_crc_start(void) {
+	/* Before ImageBuffer is filled, with no capture DMA armed */
+	chMtxLock(&fcrc_mtx);
+	fcrc_reset();
+	fcrc_fed = 0;
+	fcrc_halves = 0;
+	fcrc_done = FALSE;
+	frame_len = 0;
+	chBSemReset(&fcrc_sem, TRUE);
+	chMtxUnlock();
+}
+
+static void frame_crc_halves(void) {
+	/* Feeds the DMA halves filled since the last call. A third half would
+	 * be the first one written over, which the frame end cuts off. */
+	uint32_t n = fcrc_halves < 2 ? fcrc_halves : 2;
+
+	chMtxLock(&fcrc_mtx);
+	while (!fcrc_done && fcrc_fed < n * FCRC_HALF) {
+		fcrc_feed(&ImageBuffer[fcrc_fed], FCRC_HALF);
+		fcrc_fed += FCRC_HALF;
+	}
+	chMtxUnlock();
+}
+
+static uint32_t frame_crc(void) {
+	uint32_t len = frame_length();
+
+	chMtxLock(&fcrc_mtx);
+	if (!fcrc_done) {
+		if (fcrc_fed > len) {
+			/* EOI before the end of a half, start over on the frame */
+			fcrc_reset();
+			fcrc_fed = 0;
+		}
+		fcrc_feed(&ImageBuffer[fcrc_fed], len - fcrc_fed);
+		fcrc_value = fcrc_read();
+		fcrc_done = TRUE;
+	}
+	chMtxUnlock();
+	return fcrc_value;
+}
+
+/*
+ * Capture metadata (capmeta.h) of the frame in ImageBuffer. cam_capture()
+ * notes when the capture started and when its DMA was armed, the first
+ * frame end after that notes when the frame was in; the segment itself is
+ * made at save time, once the frame CRC and an answer's tally are known.
+ */
+static uint32_t cap_frames;
+static systime_t cap_start, cap_armed;
+static volatile systime_t cap_end;
+static volatile bool_t cap_live;     /* DMA armed for a capture */
+static volatile bool_t cap_ended;
+static uint8_t cam_qs = OV2640_QS_DEFAULT;
+static uint8_t cap_meta[CAPMETA_SIZE];
+
+static uint16_t cap_ms(systime_t from, systime_t to) {
+	uint32_t ms = (uint32_t)(systime_t)(to - from) * (1000 / CH_FREQUENCY);
+
+	return ms < CAPMETA_NONE ? (uint16_t)ms : CAPMETA_NONE - 1;
+}
+
+static const uint8_t *cap_meta_make(uint8_t kind, uint8_t q, uint8_t tally) {
+	uint32_t len = frame_length();
+	capmeta_t m;
+
+	memset(&m, 0, sizeof(m));
+	m.kind = kind;
+	m.q = q;
+	m.tally = tally;
+	m.frame = cap_frames;
+	m.time = get_fattime();
+	m.uptime = (uint32_t)cap_start * (1000 / CH_FREQUENCY);
+	capmeta_dims(ImageBuffer, len, &m.width, &m.height);
+	m.qs = cam_qs;
+	m.fcrc = frame_crc();
+	m.dma = cap_ms(cap_start, cap_armed);
+	m.wait = cap_ended ? cap_ms(cap_armed, cap_end) : CAPMETA_NONE;
+	m.save = cap_ms(cap_start, chTimeNow());
+	capmeta_put(cap_meta, &m);
+	return cap_meta;
+}
+
+int FrameCount = 0; // Number of frames received
+
+void frameEndCb(DCMIDriver* dcmip) {
+	(void) dcmip;
+	if (pv_active) {
+		/* Preview re-arms one frame at a time from cmd_preview */
+		chSysLockFromIsr();
+		chBSemSignalI(&pv_frame_sem);
+		chSysUnlockFromIsr();
+		return;
+	}
+	if (cap_live && !cap_ended) {
+		cap_end = chTimeNow();
+		cap_ended = TRUE;
+	}
+	FrameCount++;
+	TRACE(TRACE_FRAME_END, FrameCount);
+	if (FrameCount >= 10) {
+		dcmiStop(&DCMID1);
+		TRACE(TRACE_DCMI_STOP, 0);
+		FrameCount = 0;
+	} palTogglePad(GPIOD, 12) ; // Green
+}
+
+void dmaTxferEndCb(DCMIDriver* dcmip) {
+	(void) dcmip;
+	TRACE(TRACE_DMA_HALF, 0);
+	if (cap_live) {
+		/* cam_capture() feeds the half to the frame CRC */
+		chSysLockFromIsr();
+		fcrc_halves++;
+		chBSemSignalI(&fcrc_sem);
+		chSysUnlockFromIsr();
+	}
+	palTogglePad(GPIOD, 15); // Blue
+}
+
+/*===========================================================================*/
+/* Initialization and main thread.                                           */
+/*===========================================================================*/
+int main(void) {
+
+	static const evhandler_t evhndl[] = { InsertHandler, RemoveHandler };
+	//Thread *shelltp = NULL;
+	struct EventListener el0, el1;
+
+	/* Initializes ChibiOS HAL and RTOs */
+	halInit();
+	chSysInit();
+	/* Initializes Project Specific HW resources */
+	hwInit();
+	/* Cycle counter, also timing the card writes (blkdev.h) */
+	PROBE_CLOCK_INIT();
+
+	host = uartdmaStart(BAUD_DEFAULT);
+
+	blk_card.start();
+	palSetPadMode(GPIOA, GPIOA_PIN2, PAL_MODE_ALTERNATE(7)); palSetPadMode(GPIOA, GPIOA_PIN3, PAL_MODE_ALTERNATE(7));
+
+	tmr_init(NULL);
+	chPoolLoadArray(&file_pool, file_slots, FILE_SLOTS);
+	stg_init(&stg_q);
+	chThdCreateStatic(waStorageThread, sizeof(waStorageThread), NORMALPRIO + 1,
+			storage_thread, NULL);
+
+	chThdCreateStatic(waThread1, sizeof(waThread1), NORMALPRIO, Thread1, NULL);
+	chThdCreateStatic(waThread2, sizeof(waThread2), HIGHPRIO, uart_receiver_thread, NULL);
+
+	chEvtRegister(&inserted_event, &el0, 0);
+	chEvtRegister(&removed_event, &el1, 1);
+
+	palSetPadMode(GPIOA,0, PAL_MODE_INPUT);
+
+	while (TRUE) {
+
+		chEvtDispatch(evhndl, chEvtWaitOne(ALL_EVENTS));
+	}
+	return 0;
+}
+
+///*===========================================================================*/
+///* Command line commands.                                                    */
+///*===========================================================================*/
+//
+//static void cmd_mem(BaseSequentialStream *chp, int argc, char *argv[]) {
+//	size_t n, size;
+//
+//	(void) argv;
+//	if (argc > 0) {
+//#ifdef DEBUG
+//		chprintf(chp, "Usage: mem\r\n");
+//#endif
+//		return;
+//	}
+//	n = chHeapStatus(NULL, &size);
+//#ifdef DEBUG
+//	chprintf(chp, "core free memory : %u bytes\r\n", chCoreStatus());
+//	chprintf(chp, "heap fragments   : %u\r\n", n);
+//	chprintf(chp, "heap free total  : %u bytes\r\n", size);
+//#endif
+//}
+//
+//static void cmd_threads(BaseSequentialStream *chp, int argc, char *argv[]) {
+//	static const char *states[] = { THD_STATE_NAMES };
+//	Thread *tp;
+//
+//	(void) argv;
+//	if (argc > 0) {
+//#ifdef DEBUG
+//		chprintf(chp, "Usage: threads\r\n");
+//#endif
+//		return;
+//	}
+//#ifdef DEBUG
+//	chprintf(chp, "    addr    stack prio refs     state time\r\n");
+//#endif
+//	tp = chRegFirstThread();
+//	do {
 //#ifdef DEBUG
 //		chprintf(chp, "%.8lx %.8lx %4lu %4lu %9s %lu\r\n", (uint32_t) tp,
 //				(uint32_t) tp->p_ctx.r13, (uint32_t) tp->p_prio,
@@ -924,155 +2013,885 @@ int main(void) {
 //
 static uint8_t cam_init(void) {
 	/* Send the required arrays to init and set the cam to JPEG output */
+	PROBE_BEGIN(PROBE_CAM_INIT);
 	if (cam_write_array(ov2640_reset_regs) != 0) {
 		//chprintf(chp, "reset regs write failed\r\n");
 		error |= 0x01;
 	}
 
-	chThdSleepMilliseconds(250);
+	chThdSleepMilliseconds(250);
+
+	if (cam_write_array(ov2640_jpeg_init_regs) != 0) {
+		//chprintf(chp, "init regs write failed\r\n");
+		error |= 0x02;
+	}
+	if (cam_write_array(ov2640_yuv422_regs) != 0) {
+		//chprintf(chp, "yuv422 regs write failed\r\n");
+		error |= 0x04;
+	}
+
+	if (cam_write_reg(0xFF, 0x01) != 0) {
+		//chprintf(chp, "Error setting page\r\n");
+	}
+
+	if (cam_write_reg(0x15, 0x00) != 0) {
+		//chprintf(chp, "Error setting page\r\n");
+	}
+
+	/* To change resolutions change the below register */
+	if (cam_write_array(ov2640_jpeg_regs) != 0) {
+		//chprintf(chp, "jpeg regs write failed\r\n");
+		error |= 0x08;
+	}
+
+	chThdSleepMilliseconds(100);
+
+	/* To change resolutions change the below register */
+	/* For 320x240 use ov2640_320x240_regs             */
+	/* For 352x288 use ov2640_352x288_regs             */
+	/* For 640x480 use ov2640_640x480_regs             */
+	/* For 800x600 use ov2640_800x600_regs             */
+	/* For 1024x768 use ov2640_1024x768_regs           */
+	/*For 1024x768  use ov2640_1600x1200_reg 			*/
+	//if (cam_write_array(ov2640_1280x1024_regs) != 0) {
+	//if (cam_write_array(ov2640_1600x1200_regs) != 0) {
+	if (cam_write_array(CAM_CAPTURE_REGS) != 0) {
+		//chprintf(chp, "Resolution regs write failed\r\n");
+		error |= 0x10;
+	}
+
+	if (cam_write_array(ov2640_jpeg_regs) != 0) {
+		//chprintf(chp, "jpeg_regs write failed\r\n");
+		error |= 0x20;
+	}
+
+	/* ov2640_negative */
+	if (cam_write_array(ov2640_normal) != 0) {
+		//chprintf(chp, "BW write failed\r\n");
+	}
+
+	if (cam_write_array(ov2640_autolight) != 0) {
+	//if (cam_write_array(ov2640_office) != 0) {
+		//chprintf(chp, "autolight failed");
+	}
+
+	PROBE_END(PROBE_CAM_INIT);
+	if (error != 0x00) {
+		//chprintf(chp, "CAM Init Failed.\r\n");
+		init = 0;
+		return 0x15;
+	} else {
+		//chprintf(chp, "CAM Init Completed.\r\n");
+		init = 1;
+		return 0x06;
+	}
+}
+
+static uint8_t cam_on(void) {
+	/* Apply Clock */
+	pwmEnableChannel(&PWMD1, 0, 2);
+	init = 0;
+	captured = 0;
+	busy = 0;
+	power = 1;
+	/* Define power supply ENABLE pins and then assert them here! */
+	return 0x06;
+}
+
+static uint8_t cam_capture(void) {
+	systime_t waited;
+
+	PROBE_BEGIN(PROBE_CAM_CAPTURE);
+	busy = 1;
+	cap_start = chTimeNow();
+	cap_frames++;
+	dcmiStart(&DCMID1, &dcmicfg);
+	TRACE(TRACE_DCMI_START, 0);
+	chThdSleepMilliseconds(250);
+	frame_crc_start();
+	cap_ended = FALSE;
+	cap_armed = chTimeNow();
+	cap_live = TRUE;
+	dcmiStartReceiveOneShot(&DCMID1, BUFFER_SIZE / 2, ImageBuffer0,
+			ImageBuffer1);
+	while ((waited = chTimeNow() - cap_armed) < MS2ST(250)) {
+		/* The frame CRC takes each DMA half as it fills */
+		chBSemWaitTimeout(&fcrc_sem, MS2ST(250) - waited);
+		frame_crc_halves();
+	}
+	cap_live = FALSE;
+	//chprintf(chp, "Image Capture Complete\r\n", dmaStreamGetTransactionSize(DCMID1.dmarx));
+	busy = 0;
+	captured = 1;
+	TRACE(TRACE_CAPTURE_END, 0);
+	PROBE_END(PROBE_CAM_CAPTURE);
+	return 0x06;
+}
+
+/*
+ * Sizes a new capture file before its data is written: FatFs then finds
+ * all its clusters in one go, with the FAT sectors in the cache, instead
+ * of one cluster at a time between the data writes, and the data goes
+ * out in one stream.
+ *
+ * The size is rounded down to whole sectors. FatFs reads a sector in
+ * before a partial write to it whenever it lies inside the file, which
+ * would hold for a last sector sized in advance, and that read would also
+ * end the card's multi-block write. file_writev() hands all but the tail
+ * over as whole sectors, written straight through, and the tail starts
+ * at the end of the file, where FatFs only fills its buffer and writes it
+ * out at f_close(). The file then has the frame's size as written; the
+ * tail takes one more cluster from the end of the chain when it starts
+ * one.
+ *
+ * FatFs looks for each free cluster from the one before it on, so the
+ * chain only goes back to a lower cluster when the search wraps around
+ * the volume, and it is one run exactly when its last cluster is as far
+ * from its first as the number of clusters says. The block layer is then
+ * told the run, so the card can pre-erase all of it.
+ */
+static FRESULT cam_alloc(FIL *fp, uint32_t len) {
+	FATFS *vol = fp->fs;
+	DWORD size = len & ~(DWORD)(BLK_SECTOR - 1);
+	DWORD clusters, run = 0;
+	FRESULT err;
+
+	if (size == 0) {
+		return FR_OK;
+	}
+	if ((err = f_lseek(fp, size)) != FR_OK) {
+		return err;
+	}
+	if (f_size(fp) < size) {
+		return FR_DENIED;   /* Volume full */
+	}
+	clusters = (size - 1) / ((DWORD)vol->csize * BLK_SECTOR) + 1;
+	if (fp->clust - fp->sclust == clusters - 1) {
+		run = clusters * vol->csize;
+		blk_expect(&disk_blk, vol->database + (fp->sclust - 2) * vol->csize,
+				run);
+	}
+	TRACE(TRACE_FILE_ALLOC, run);
+	return f_lseek(fp, 0);
+}
+
+/*
+ * Writes a file from a list of segments (sglist.h) on from its sector
+ * aligned position. Every piece but the tail is one f_write() of whole
+ * sectors, which FatFs passes down as multi-sector writes straight from
+ * the segment, so the whole clusters of a frame still go to the block
+ * layer together; only the sectors where segments meet and the tail are
+ * put together in sg_stage.
+ */
+static uint8_t sg_stage[SG_SECTOR];
+
+static FRESULT file_writev(FIL *fp, const sg_seg_t *seg, uint8_t nseg,
+		uint32_t *written) {
+	sg_t g;
+	const uint8_t *p;
+	uint32_t n;
+	FRESULT err = FR_OK;
+	UINT bw;
+
+	*written = 0;
+	sg_start(&g, seg, nseg, sg_stage);
+	while (err == FR_OK && (n = sg_next(&g, &p)) > 0) {
+		err = f_write(fp, p, n, &bw);
+		*written += bw;
+		if (err == FR_OK && bw != n) {
+			err = FR_DENIED;    /* Volume full */
+		}
+	}
+	return err;
+}
+
+static uint8_t cam_segments(sg_seg_t *seg, uint32_t len, const uint8_t *meta) {
+	/* The frame in ImageBuffer as segments for file_writev(), with the
+	 * metadata segment meta (capmeta.h) in it unless NULL; seg holds 3 */
+	uint32_t at = meta != NULL ? capmeta_at(ImageBuffer, len) : 0;
+
+	seg[0].p = ImageBuffer;
+	if (at == 0) {
+		seg[0].n = len;
+		return 1;
+	}
+	seg[0].n = at;
+	seg[1].p = meta;
+	seg[1].n = CAPMETA_SIZE;
+	seg[2].p = &ImageBuffer[at];
+	seg[2].n = len - at;
+	return 3;
+}
+
+static uint8_t cam_save(char* filename, const uint8_t *meta, uint32_t *size) {
+	/* Saves the frame with meta in it, the file's size into size */
+	file_slot_t *fs;
+	sg_seg_t seg[3];
+	uint8_t nseg = cam_segments(seg, frame_length(), meta);
+	uint32_t len = sg_total(seg, nseg), written;
+	FRESULT err;
+
+	PROBE_BEGIN(PROBE_CAM_SAVE);
+	if ((fs = file_acquire()) == NULL) {
+		PROBE_END(PROBE_CAM_SAVE);
+		return 0x15;
+	}
+	PROBE_BEGIN(PROBE_FS_OPEN);
+	err = f_open(&fs->fil, filename, FA_READ | FA_WRITE | FA_CREATE_ALWAYS);
+	TRACE(TRACE_FILE_OPEN, err);
+	if (err == FR_OK && (err = cam_alloc(&fs->fil, len)) != FR_OK) {
+		f_close(&fs->fil);
+		f_unlink(filename);
+	}
+	PROBE_END(PROBE_FS_OPEN);
+	if (err != FR_OK) {
+		//chprintf(chp, "FS: f_open(\"hello.txt\") failed.\r\n");
+		//	verbose_error(chp, err);
+		file_release(fs);
+		PROBE_END(PROBE_CAM_SAVE);
+		return 0x15;
+	} else {
+		//chprintf(chp, "FS: f_open(\"hello.txt\") succeeded\r\n");
+	}
+
+	PROBE_BEGIN(PROBE_FS_WRITE);
+	err = file_writev(&fs->fil, seg, nseg, &written);
+	if (err == FR_OK && written != len) {
+		err = FR_DISK_ERR;
+	}
+	PROBE_END(PROBE_FS_WRITE);
+	TRACE(TRACE_FILE_WRITE, f_tell(&fs->fil));
+	PROBE_BEGIN(PROBE_FS_CLOSE);
+	/* The first error counts, a failed save leaves no file behind */
+	if (f_close(&fs->fil) != FR_OK && err == FR_OK) {
+		err = FR_DISK_ERR;
+	}
+	if (err != FR_OK) {
+		f_unlink(filename);
+	}
+	PROBE_END(PROBE_FS_CLOSE);
+	TRACE(TRACE_FILE_CLOSE, err);
+	file_release(fs);
+
+	PROBE_END(PROBE_CAM_SAVE);
+	if (err != FR_OK) {
+		return 0x15;
+	}
+	if (size != NULL) {
+		*size = len;
+	}
+	captured = 0;
+	return 0x06;
+}
+
+/*
+ * Button images are numbered on from the state record (seqname.h), which is
+ * read by the first save after the card is mounted. Only when it is
+ * missing or damaged is the card searched for the highest number in use:
+ * the last shard directory and then the images in it.
+ */
+static seq_t cap_seq;
+static bool_t seq_dir_ready = FALSE;
+
+static uint32_t seq_scan(const char *path, uint8_t dirs) {
+	/* Highest shard (dirs) or image number in path, SEQ_MAX for none */
+	DIR dir;
+	FILINFO fno;
+	uint32_t n, top = SEQ_MAX;
+
+	fno.lfname = NULL;
+	fno.lfsize = 0;
+	if (f_opendir(&dir, path) != FR_OK) {
+		return SEQ_MAX;
+	}
+	while (f_readdir(&dir, &fno) == FR_OK && fno.fname[0] != 0) {
+		if (((fno.fattrib & AM_DIR) != 0) != dirs) {
+			continue;
+		}
+		n = seq_number(fno.fname, dirs ? 4 : 6);
+		if (n < SEQ_MAX && (top == SEQ_MAX || n > top)) {
+			top = n;
+		}
+	}
+	return top;
+}
+
+static void seq_load(void) {
+	file_slot_t *fs;
+	uint8_t rec[SEQ_REC_SIZE];
+	char path[SEQ_PATH_SIZE];
+	uint32_t next = SEQ_MAX, shard;
+	UINT br;
+
+	if ((fs = file_acquire()) != NULL) {
+		if (f_open(&fs->fil, SEQ_FILE, FA_READ) == FR_OK) {
+			if (f_read(&fs->fil, rec, sizeof(rec), &br) == FR_OK
+					&& br == sizeof(rec)) {
+				seq_parse(rec, &next);
+			}
+			f_close(&fs->fil);
+		}
+		file_release(fs);
+	}
+	if (next == SEQ_MAX && (shard = seq_scan("", 1)) != SEQ_MAX) {
+		seq_path(path, shard);
+		path[SEQ_DIR_LEN] = 0;
+		next = seq_scan(path, 0);
+		next = next != SEQ_MAX ? next + 1 : shard;
+	}
+	seq_start(&cap_seq, next != SEQ_MAX ? next : 0);
+	seq_dir_ready = FALSE;
+	seq_ready = TRUE;
+}
+
+static FRESULT seq_save(uint32_t next) {
+	file_slot_t *fs;
+	uint8_t rec[SEQ_REC_SIZE];
+	FRESULT err;
+	UINT bw;
+
+	if ((fs = file_acquire()) == NULL) {
+		return FR_TOO_MANY_OPEN_FILES;
+	}
+	/* Rewritten in place, the record keeps its cluster */
+	seq_record(rec, next);
+	err = f_open(&fs->fil, SEQ_FILE, FA_WRITE | FA_OPEN_ALWAYS);
+	if (err == FR_OK) {
+		err = f_write(&fs->fil, rec, sizeof(rec), &bw);
+		if (err == FR_OK && bw != sizeof(rec)) {
+			err = FR_DENIED;
+		}
+		if (f_close(&fs->fil) != FR_OK && err == FR_OK) {
+			err = FR_DISK_ERR;
+		}
+	}
+	file_release(fs);
+	return err;
+}
+
+static uint8_t stg_capture(void *arg) {
+	/* Saves the captured image under the next number */
+	char path[SEQ_PATH_SIZE];
+	uint32_t n, size;
+	FRESULT err;
+
+	(void) arg;
+	if (!fs_ready) {
+		return 0x15;
+	}
+	ret_room();
+	if (!seq_ready) {
+		seq_load();
+	}
+	if (seq_take(&cap_seq, &n) && seq_save(cap_seq.limit) != FR_OK) {
+		/* Read again before the next, nothing saved under a number the
+		 * record does not cover */
+		seq_ready = FALSE;
+		return 0x15;
+	}
+	seq_path(path, n);
+	if (!seq_dir_ready || n % SEQ_PER_DIR == 0) {
+		path[SEQ_DIR_LEN] = 0;
+		err = f_mkdir(path);
+		path[SEQ_DIR_LEN] = '/';
+		if (err != FR_OK && err != FR_EXIST) {
+			return 0x15;
+		}
+		seq_dir_ready = TRUE;
+	}
+	if (cam_save(path, cap_meta_make(CAT_IMAGE, CAT_ANY, CAT_ANY), &size)
+			!= 0x06) {
+		return 0x15;
+	}
+	cat_add(path, size, frame_crc(), CAT_IMAGE, CAT_ANY, CAT_ANY);
+	return 0x06;
+}
+
+/*
+ * The catalog (catalog.h) gets its record once the file is complete on the
+ * card; a save cut short by a power loss may be missing from it, and a
+ * failed append does not fail the save. Records are read back one at a
+ * time out of the FIL's sector buffer.
+ */
+static uint8_t cat_out[CAT_REPLY_HDR + CAT_PAGE * CAT_REC_SIZE];
+static uint16_t cat_out_len;
 
-	if (cam_write_array(ov2640_jpeg_init_regs) != 0) {
-		//chprintf(chp, "init regs write failed\r\n");
-		error |= 0x02;
+static void cat_add(const char *name, uint32_t size, uint32_t fcrc,
+		uint8_t kind, uint8_t q, uint8_t tally) {
+	file_slot_t *fs;
+	uint8_t rec[CAT_REC_SIZE];
+	cat_rec_t r;
+	UINT bw;
+
+	if ((fs = file_acquire()) == NULL) {
+		return;
 	}
-	if (cam_write_array(ov2640_yuv422_regs) != 0) {
-		//chprintf(chp, "yuv422 regs write failed\r\n");
-		error |= 0x04;
+	memset(&r, 0, sizeof(r));
+	strncpy(r.name, name, sizeof(r.name) - 1);
+	r.size = size;
+	r.fcrc = fcrc;
+	r.time = get_fattime();
+	r.kind = kind;
+	r.q = q;
+	r.tally = tally;
+	cat_put(rec, &r);
+	PROBE_BEGIN(PROBE_FS_META);
+	if (f_open(&fs->fil, CAT_FILE, FA_WRITE | FA_OPEN_ALWAYS) == FR_OK) {
+		/* After the last whole record */
+		if (f_lseek(&fs->fil, f_size(&fs->fil) & ~(CAT_REC_SIZE - 1))
+				== FR_OK) {
+			f_write(&fs->fil, rec, sizeof(rec), &bw);
+		}
+		f_close(&fs->fil);
 	}
+	PROBE_END(PROBE_FS_META);
+	file_release(fs);
+}
 
-	if (cam_write_reg(0xFF, 0x01) != 0) {
-		//chprintf(chp, "Error setting page\r\n");
+static uint8_t stg_catalog(void *arg) {
+	/* One page for the query in arg, into cat_out */
+	const uint8_t *q = arg;
+	file_slot_t *fs;
+	cat_filter_t filter;
+	cat_rec_t r;
+	uint32_t from = proto_get32(q), i, total = 0;
+	uint8_t count = q[4], n = 0;
+	FRESULT err;
+	UINT br;
+
+	filter.kind = q[5];
+	filter.q = q[6];
+	filter.since = proto_get32(&q[7]);
+	if (count == 0 || count > CAT_PAGE) {
+		count = CAT_PAGE;
+	}
+	if (!fs_ready || (fs = file_acquire()) == NULL) {
+		return 0x15;
+	}
+	i = from;
+	err = f_open(&fs->fil, CAT_FILE, FA_READ);
+	if (err == FR_OK) {
+		total = f_size(&fs->fil) / CAT_REC_SIZE;
+		if (from < total) {
+			err = f_lseek(&fs->fil, from * CAT_REC_SIZE);
+		}
+		for (; err == FR_OK && i < total && i - from < CAT_SCAN_MAX
+				&& n < count; i++) {
+			err = f_read(&fs->fil, fs->line, CAT_REC_SIZE, &br);
+			if (err == FR_OK && br == CAT_REC_SIZE
+					&& cat_get((uint8_t *)fs->line, &r) == 0
+					&& cat_match(&r, &filter)) {
+				memcpy(&cat_out[CAT_REPLY_HDR + n++ * CAT_REC_SIZE], fs->line,
+						CAT_REC_SIZE);
+			}
+		}
+		f_close(&fs->fil);
+	} else if (err == FR_NO_FILE) {
+		/* Nothing saved yet */
+		err = FR_OK;
+	}
+	file_release(fs);
+	if (err != FR_OK) {
+		return 0x15;
 	}
+	proto_put32(&cat_out[0], total);
+	proto_put32(&cat_out[4], i > total ? total : i);
+	cat_out[8] = n;
+	cat_out_len = CAT_REPLY_HDR + n * CAT_REC_SIZE;
+	return 0x06;
+}
 
-	if (cam_write_reg(0x15, 0x00) != 0) {
-		//chprintf(chp, "Error setting page\r\n");
+static void cmd_catalog(const proto_frame_t *f) {
+	uint8_t query[CAT_QUERY_SIZE];
+
+	if (f->len < CAT_QUERY_SIZE) {
+		cmd_reply(f, PROTO_NAK, NULL, 0);
+		return;
 	}
+	memcpy(query, f->payload, sizeof(query));
+	if (stg_call(STG_INTERACTIVE, stg_catalog, query) != 0x06) {
+		cmd_reply(f, PROTO_NAK, NULL, 0);
+		return;
+	}
+	cmd_reply(f, PROTO_ACK, cat_out, cat_out_len);
+}
 
-	/* To change resolutions change the below register */
-	if (cam_write_array(ov2640_jpeg_regs) != 0) {
-		//chprintf(chp, "jpeg regs write failed\r\n");
-		error |= 0x08;
+/*
+ * Retention (retain.h). The check before a save is FatFs' free cluster
+ * count; only below RET_LOW_KB is the catalog opened, read from where the
+ * last batch stopped, and the files of its oldest records deleted.
+ */
+static uint32_t ret_head;
+
+static uint32_t ret_free(void) {
+	FATFS *vol;
+	DWORD clusters;
+
+	if (f_getfree("", &clusters, &vol) != FR_OK) {
+		return 0;
 	}
+	return ret_free_kb(clusters, vol->csize);
+}
 
-	chThdSleepMilliseconds(100);
+static void ret_state(uint8_t save) {
+	/* Reads (0) or writes (1) the head in RET_FILE */
+	file_slot_t *fs;
+	uint8_t rec[RET_REC_SIZE];
+	UINT n;
 
-	/* To change resolutions change the below register */
-	/* For 320x240 use ov2640_320x240_regs             */
-	/* For 352x288 use ov2640_352x288_regs             */
-	/* For 640x480 use ov2640_640x480_regs             */
-	/* For 800x600 use ov2640_800x600_regs             */
-	/* For 1024x768 use ov2640_1024x768_regs           */
-	/*For 1024x768  use ov2640_1600x1200_reg 			*/
-	//if (cam_write_array(ov2640_1280x1024_regs) != 0) {
-	//if (cam_write_array(ov2640_1600x1200_regs) != 0) {
-	if (cam_write_array(ov2640_1024x768_regs) != 0) {
-		//chprintf(chp, "Resolution regs write failed\r\n");
-		error |= 0x10;
+	if ((fs = file_acquire()) == NULL) {
+		return;
+	}
+	if (save) {
+		ret_record(rec, ret_head);
+		if (f_open(&fs->fil, RET_FILE, FA_WRITE | FA_OPEN_ALWAYS) == FR_OK) {
+			f_write(&fs->fil, rec, sizeof(rec), &n);
+			f_close(&fs->fil);
+		}
+	} else {
+		ret_head = 0;
+		if (f_open(&fs->fil, RET_FILE, FA_READ) == FR_OK) {
+			if (f_read(&fs->fil, rec, sizeof(rec), &n) != FR_OK
+					|| n != sizeof(rec) || ret_parse(rec, &ret_head) != 0) {
+				ret_head = 0;
+			}
+			f_close(&fs->fil);
+		}
+		ret_ready = TRUE;
 	}
+	file_release(fs);
+}
 
-	if (cam_write_array(ov2640_jpeg_regs) != 0) {
-		//chprintf(chp, "jpeg_regs write failed\r\n");
-		error |= 0x20;
+static void ret_room(void) {
+	file_slot_t *fs;
+	uint8_t *rec;
+	cat_rec_t r;
+	uint32_t head, total, free_kb = ret_free();
+	uint8_t deleted = 0;
+	FRESULT err;
+	UINT n;
+
+	if (free_kb >= RET_LOW_KB) {
+		return;
+	}
+	if (!ret_ready) {
+		ret_state(0);
+	}
+	if ((fs = file_acquire()) == NULL) {
+		return;
+	}
+	head = ret_head;
+	rec = (uint8_t *)fs->line;
+	PROBE_BEGIN(PROBE_FS_META);
+	if (f_open(&fs->fil, CAT_FILE, FA_READ | FA_WRITE) == FR_OK) {
+		total = f_size(&fs->fil) / CAT_REC_SIZE;
+		while (ret_head < total && deleted < RET_BATCH
+				&& free_kb < RET_HIGH_KB) {
+			if (f_lseek(&fs->fil, ret_head * CAT_REC_SIZE) != FR_OK
+					|| f_read(&fs->fil, rec, CAT_REC_SIZE, &n) != FR_OK
+					|| n != CAT_REC_SIZE) {
+				break;
+			}
+			if (cat_get(rec, &r) == 0 && ret_evictable(&r)) {
+				err = f_unlink(r.name);
+				if (err != FR_OK && err != FR_NO_FILE && err != FR_NO_PATH) {
+					break;
+				}
+				if (r.kind == CAT_IMAGE && seq_number(&r.name[SEQ_DIR_LEN + 1],
+						6) % SEQ_PER_DIR == SEQ_PER_DIR - 1) {
+					/* Last of its shard, the directory goes too */
+					r.name[SEQ_DIR_LEN] = 0;
+					f_unlink(r.name);
+				}
+				cat_gone(rec);
+				if (f_lseek(&fs->fil, ret_head * CAT_REC_SIZE) != FR_OK
+						|| f_write(&fs->fil, rec, CAT_REC_SIZE, &n) != FR_OK) {
+					break;
+				}
+				deleted++;
+				free_kb = ret_free();
+			}
+			ret_head++;
+		}
+		f_close(&fs->fil);
+	}
+	PROBE_END(PROBE_FS_META);
+	file_release(fs);
+	TRACE(TRACE_EVICT, deleted);
+	if (ret_head != head) {
+		ret_state(1);
 	}
+}
 
-	/* ov2640_negative */
-	if (cam_write_array(ov2640_normal) != 0) {
-		//chprintf(chp, "BW write failed\r\n");
+/*
+ * Question tallies are the '#' marks at the start of each line of q.txt and
+ * every mark has a matching Qqq-tt.jpg. An answer only writes its image, the
+ * image under its final name is the record of it: questionTicks[] counts it
+ * right away and index_questions() adds the marks to q.txt for all answers
+ * since the last index in one rewrite (see fold_ticks()). After a power loss
+ * the tallies are rolled forward from the images that made it to the card.
+ */
+#define QFILE           "q.txt"
+#define QFILE_NEW       "q.new"
+#define MAXTICKS        99
+
+static uint8_t commit_buf[512];
+
+static uint8_t file_exists(const char *fn) {
+	FILINFO fno;
+	FRESULT err;
+
+	fno.lfname = NULL;
+	fno.lfsize = 0;
+	PROBE_BEGIN(PROBE_FS_META);
+	err = f_stat(fn, &fno);
+	PROBE_END(PROBE_FS_META);
+	return err == FR_OK;
+}
+
+static uint32_t jpeg_length(const uint8_t *p, uint32_t max) {
+	/* Length of the JPEG at p up to and including the EOI marker, max if
+	 * there is none */
+	uint32_t i;
+	for (i = 0; i < max - 1; i++) {
+		if ((p[i] == 0xFF) && (p[i + 1] == 0xD9)) {
+			return i + 2;
+		}
 	}
+	return max;
+}
 
-	if (cam_write_array(ov2640_autolight) != 0) {
-	//if (cam_write_array(ov2640_office) != 0) {
-		//chprintf(chp, "autolight failed");
+static uint32_t frame_length(void) {
+	/* Length of the JPEG in ImageBuffer up to and including the EOI marker,
+	 * looked for once per frame */
+	if (frame_len == 0) {
+		frame_len = jpeg_length(ImageBuffer, BUFFER_SIZE);
 	}
+	return frame_len;
+}
 
-	if (error != 0x00) {
-		//chprintf(chp, "CAM Init Failed.\r\n");
-		init = 0;
-		return 0x15;
-	} else {
-		//chprintf(chp, "CAM Init Completed.\r\n");
-		init = 1;
-		return 0x06;
+static uint8_t cam_set_resolution(const struct regval_list *res, uint8_t qs) {
+	/* Switches the output size and JPEG quality of an initialised camera */
+	if (cam_write_array(res) != 0 || cam_write_array(ov2640_jpeg_regs) != 0
+			|| cam_set_quality(qs) != 0) {
+		return 1;
 	}
+	cam_qs = qs;
+	chThdSleepMilliseconds(100);
+	return 0;
 }
 
-static uint8_t cam_on(void) {
-	/* Apply Clock */
-	pwmEnableChannel(&PWMD1, 0, 2);
-	init = 0;
-	captured = 0;
-	busy = 0;
-	power = 1;
-	/* Define power supply ENABLE pins and then assert them here! */
-	return 0x06;
+static void answer_name(char *fn, uint8_t q, uint8_t ticks) {
+	/* Builds "Qqq-tt.jpg", fn must hold 11 chars */
+	fn[0] = 'Q';
+	seq_digits(&fn[1], q, 2);
+	fn[3] = '-';
+	seq_digits(&fn[4], ticks, 2);
+	strcpy(&fn[6], ".jpg");
 }
 
-static uint8_t cam_capture(void) {
-	busy = 1;
-	dcmiStart(&DCMID1, &dcmicfg);
-	chThdSleepMilliseconds(250);
-	dcmiStartReceiveOneShot(&DCMID1, BUFFER_SIZE / 2, ImageBuffer0,
-			ImageBuffer1);
-	chThdSleepMilliseconds(250);
-	//chprintf(chp, "Image Capture Complete\r\n", dmaStreamGetTransactionSize(DCMID1.dmarx));
-	busy = 0;
-	captured = 1;
-	return 0x06;
+static FRESULT copy_bytes(FIL *dst, FIL *src, DWORD n) {
+	FRESULT err = FR_OK;
+	UINT br, bw;
+
+	while (n > 0) {
+		UINT chunk = n < sizeof(commit_buf) ? (UINT)n : sizeof(commit_buf);
+		PROBE_BEGIN(PROBE_FS_READ);
+		err = f_read(src, commit_buf, chunk, &br);
+		PROBE_END(PROBE_FS_READ);
+		if (err != FR_OK || br == 0) {
+			break;
+		}
+		PROBE_BEGIN(PROBE_FS_WRITE);
+		err = f_write(dst, commit_buf, br, &bw);
+		PROBE_END(PROBE_FS_WRITE);
+		TRACE(TRACE_FILE_WRITE, bw);
+		if (err == FR_OK && bw != br) {
+			err = FR_DENIED; /* Card full */
+		}
+		if (err != FR_OK) {
+			break;
+		}
+		n -= br;
+	}
+	return err;
 }
 
-static uint8_t cam_save(char* filename) {
-	FIL fsrc; /* file object */
+static FRESULT fold_ticks(void) {
+	/* Brings the marks in q.txt up to questionTicks[]. The new contents go
+	 * to q.new which then replaces q.txt, so q.txt is never left half
+	 * rewritten.
+	 */
+	file_slot_t *src, *dst;
 	FRESULT err;
+	UINT bw;
+	uint16_t shift;
+	uint8_t q, n;
 
-	err = f_open(&fsrc, filename, FA_READ | FA_WRITE | FA_CREATE_ALWAYS);
+	for (q = 0; q < numOfQuestions; q++) {
+		if (questionTicks[q] != questionMarks[q]) {
+			break;
+		}
+	}
+	if (q == numOfQuestions) {
+		return FR_OK;
+	}
+	if ((src = file_acquire()) == NULL) {
+		return FR_TOO_MANY_OPEN_FILES;
+	}
+	if ((dst = file_acquire()) == NULL) {
+		file_release(src);
+		return FR_TOO_MANY_OPEN_FILES;
+	}
+	PROBE_BEGIN(PROBE_FS_OPEN);
+	err = f_open(&src->fil, QFILE, FA_READ);
+	if (err == FR_OK) {
+		err = f_open(&dst->fil, QFILE_NEW, FA_WRITE | FA_CREATE_ALWAYS);
+		if (err != FR_OK) {
+			f_close(&src->fil);
+		}
+	}
+	PROBE_END(PROBE_FS_OPEN);
+	TRACE(TRACE_FILE_OPEN, err);
 	if (err != FR_OK) {
-		//chprintf(chp, "FS: f_open(\"hello.txt\") failed.\r\n");
-		//	verbose_error(chp, err);
-		return 0x15;
-	} else {
-		//chprintf(chp, "FS: f_open(\"hello.txt\") succeeded\r\n");
+		file_release(dst);
+		file_release(src);
+		return err;
+	}
+	for (q = 0; q < numOfQuestions && err == FR_OK; q++) {
+		/* Rest of the line before, then the new marks up front */
+		err = copy_bytes(&dst->fil, &src->fil,
+				questionPositions[q] - f_tell(&src->fil));
+		n = questionTicks[q] - questionMarks[q];
+		if (err == FR_OK && n > 0) {
+			memset(commit_buf, '#', n);
+			PROBE_BEGIN(PROBE_FS_WRITE);
+			err = f_write(&dst->fil, commit_buf, n, &bw);
+			PROBE_END(PROBE_FS_WRITE);
+			if (err == FR_OK && bw != n) {
+				err = FR_DENIED; /* Card full */
+			}
+		}
+	}
+	if (err == FR_OK) {
+		err = copy_bytes(&dst->fil, &src->fil, 0xFFFFFFFF);
+	}
+	PROBE_BEGIN(PROBE_FS_CLOSE);
+	if (f_close(&dst->fil) != FR_OK && err == FR_OK) {
+		err = FR_DISK_ERR;
+	}
+	TRACE(TRACE_FILE_CLOSE, err);
+	f_close(&src->fil);
+	PROBE_END(PROBE_FS_CLOSE);
+	file_release(dst);
+	file_release(src);
+	if (err != FR_OK) {
+		f_unlink(QFILE_NEW);
+		return err;
 	}
 
-	uint32_t i;
-	for (i = 0; i < BUFFER_SIZE; i++) {
-		if ((ImageBuffer[i] == 0xFF) && (ImageBuffer[i + 1] == 0xD9)) {
-			/* Found END of JPEG Frame */
-			f_putc(ImageBuffer[i], &fsrc);
-			f_putc(ImageBuffer[i + 1], &fsrc);
-			break;
+	PROBE_BEGIN(PROBE_FS_META);
+	err = f_unlink(QFILE);
+	if (err == FR_OK) {
+		err = f_rename(QFILE_NEW, QFILE);
+	}
+	PROBE_END(PROBE_FS_META);
+	if (err == FR_OK) {
+		for (q = 0, shift = 0; q < numOfQuestions; q++) {
+			questionPositions[q] += shift;
+			shift += questionTicks[q] - questionMarks[q];
+			questionMarks[q] = questionTicks[q];
+		}
+		questionPositions[numOfQuestions] += shift;
+	}
+	return err;
+}
+
+static uint8_t frame_complete(const char *fn) {
+	/* An image only counts once its EOI marker reached the card */
+	file_slot_t *fs;
+	uint8_t tail[2] = {0, 0};
+	UINT br = 0;
+
+	if ((fs = file_acquire()) == NULL) {
+		return 0;
+	}
+	if (f_open(&fs->fil, fn, FA_READ) == FR_OK) {
+		if (f_size(&fs->fil) >= 2) {
+			f_lseek(&fs->fil, f_size(&fs->fil) - 2);
+			f_read(&fs->fil, tail, 2, &br);
 		}
-		f_putc(ImageBuffer[i], &fsrc);
+		f_close(&fs->fil);
 	}
-	f_close(&fsrc);
-	palTogglePad(GPIOD, 13);
-	chThdSleepMilliseconds(250); palTogglePad(GPIOD, 13);
+	file_release(fs);
+	return br == 2 && tail[0] == 0xFF && tail[1] == 0xD9;
+}
 
-	captured = 0;
-	return 0x06;
+static void recover_qfile(void) {
+	/* q.new left behind: either the swap never started (drop it) or power
+	 * went between unlinking q.txt and the rename (finish it).
+	 */
+	if (!file_exists(QFILE_NEW)) {
+		return;
+	}
+	if (file_exists(QFILE)) {
+		f_unlink(QFILE_NEW);
+	} else {
+		f_rename(QFILE_NEW, QFILE);
+	}
 }
 
+static void recover_answers(void) {
+	/* Rolls tallies forward for images that were saved but not marked */
+	uint8_t q;
+	char fn[11];
 
+	for (q = 0; q < numOfQuestions; q++) {
+		while (questionTicks[q] < MAXTICKS) {
+			answer_name(fn, q, questionTicks[q]);
+			if (!frame_complete(fn)) {
+				break;
+			}
+			questionTicks[q]++;
+		}
+	}
+}
 
 static uint8_t index_questions(void) {
-	FIL fsrc; /* file object */
+	file_slot_t *fs;
 	FRESULT err;
-	err = f_open(&fsrc, "q.txt", FA_READ);
+	uint8_t ticks;
+	if ((fs = file_acquire()) == NULL) {
+		return(uint8_t)21;
+	}
+	recover_qfile();
+	PROBE_BEGIN(PROBE_FS_OPEN);
+	err = f_open(&fs->fil, "q.txt", FA_READ);
+	PROBE_END(PROBE_FS_OPEN);
 	if (err != FR_OK) {
 		//chprintf(chp, 0x15); SERIAL FAILED
+		file_release(fs);
 		return(uint8_t)21;
 	} else {
 		numOfQuestions = 0;
-		uint16_t filesize = f_size(&fsrc);
-		uint16_t index;
-		while (!f_eof(&fsrc)) {
-			char inString[500];
-			uint8_t numOfBytesRead;
-			f_gets(&inString, 128, &fsrc);
-			questionPositions[numOfQuestions+1] = f_tell(&fsrc);
+		while (!f_eof(&fs->fil) && numOfQuestions < MAXQUESTIONS - 1) {
+			PROBE_BEGIN(PROBE_FS_READ);
+			fs->line[0] = '\0';
+			f_gets(fs->line, sizeof(fs->line), &fs->fil);
+			PROBE_END(PROBE_FS_READ);
+			for (ticks = 0; ticks < MAXTICKS && fs->line[ticks] == '#';
+					ticks++) {
+			}
+			questionMarks[numOfQuestions] = ticks;
+			questionTicks[numOfQuestions] = ticks;
+			questionPositions[numOfQuestions+1] = f_tell(&fs->fil);
 			numOfQuestions++;
 		}
 	}
-	f_close(&fsrc);
+	f_close(&fs->fil);
+	file_release(fs);
+	recover_answers();
+	fold_ticks();
 	return (uint8_t)6;
 }
 
@@ -1080,99 +2899,299 @@ static uint8_t get_total_questions(void) {
 	return numOfQuestions;
 }
 
-static char* get_question(uint8_t q) {
-	/* Retrieves a question from the question file, along with the number of answers.
-	 * Returns a packet containing the question content, followed by the number of answers (ASCII)
-	 * through UART.
-	 * Parameter - The question index.
-	 */
-	char inString[64];
-	char i;
-	for(i = 0; i < 64; i++){
-		inString[i] = 0;
-	}
-	uint8_t val = 0;
-	FIL fsrc; /* file object */
-	FRESULT err;
-	val = q;
-	err = f_open(&fsrc, "q.txt", FA_READ);
-	if (err != FR_OK) {
-		//chprintf(chp, 0x15); SERIAL ERROR
-	} else {
-		f_lseek(&fsrc, questionPositions[val]);
-		f_gets(&inString, 64, &fsrc);
-
-	}
-	f_close(&fsrc);
-	return inString;
-}
-
 static void cmd_mark_question(uint8_t val) {
 	/* Marks a question as answered in the questions file.
 	 * No returns.
 	 * Parameter - The question index.
 	 */
+	if (val < numOfQuestions && questionTicks[val] < MAXTICKS) {
+		questionTicks[val]++;
+		fold_ticks();
+	}
+}
+
 
-	FIL fsrc; /* file object */
+static uint8_t cam_commit_answer(uint8_t q) {
+	/* Saves the buffered frame as the next answer to question q. The image
+	 * is the only file written, the tally reaches q.txt at the next index.
+	 */
+	file_slot_t *fs;
 	FRESULT err;
+	uint32_t len = 0, written = 0;
+	sg_seg_t seg[3];
+	uint8_t nseg, ticks;
+	char fn[11];
 
-	err = f_open(&fsrc, "q.txt", FA_READ | FA_WRITE);
-	if (err != FR_OK) {
+	if (numOfQuestions == 0 && index_questions() != 6) {
+		/* CAPTURE before any INDEX */
+		return 0x15;
+	}
+	if (q >= numOfQuestions || questionTicks[q] >= MAXTICKS) {
+		return 0x15;
+	}
+	palSetPad(GPIOD, 13);
+	ret_room();
+	if ((fs = file_acquire()) == NULL) {
+		palClearPad(GPIOD, 13);
+		return 0x15;
+	}
+
+	ticks = questionTicks[q];
+	answer_name(fn, q, ticks);
+	nseg = cam_segments(seg, frame_length(),
+			cap_meta_make(CAT_ANSWER, q, ticks));
+	len = sg_total(seg, nseg);
+	PROBE_BEGIN(PROBE_FS_OPEN);
+	err = f_open(&fs->fil, fn, FA_WRITE | FA_CREATE_ALWAYS);
+	if (err == FR_OK && (err = cam_alloc(&fs->fil, len)) != FR_OK) {
+		f_close(&fs->fil);
+	}
+	PROBE_END(PROBE_FS_OPEN);
+	TRACE(TRACE_FILE_OPEN, err);
+	if (err == FR_OK) {
+		PROBE_BEGIN(PROBE_FS_WRITE);
+		err = file_writev(&fs->fil, seg, nseg, &written);
+		PROBE_END(PROBE_FS_WRITE);
+		PROBE_BEGIN(PROBE_FS_CLOSE);
+		if ((f_close(&fs->fil) != FR_OK || written != len)
+				&& err == FR_OK) {
+			err = FR_DISK_ERR;
+		}
+		PROBE_END(PROBE_FS_CLOSE);
+		TRACE(TRACE_FILE_CLOSE, err);
+	}
+	file_release(fs);
+	if (err == FR_OK) {
+		questionTicks[q]++;
+		cat_add(fn, len, frame_crc(), CAT_ANSWER, q, ticks);
 	} else {
-		uint16_t filesize = f_size(&fsrc);
+		/* No half image for recover_answers() to stop at */
+		f_unlink(fn);
+	}
 
-		f_lseek(&fsrc, filesize+1);
+	palClearPad(GPIOD, 13);
+	captured = 0;
+	return err == FR_OK ? 0x06 : 0x15;
+}
 
-		char *inChar;
-		inChar = (char *)malloc(sizeof(char));
+#if defined(CAM_BENCH)
+/*
+ * Hot path benchmarks, see bench.h. The frame is a synthetic one written
+ * over ImageBuffer, so a buffered capture is lost. index_questions() runs
+ * on the card's q.txt; when there is none a full size one is made for the
+ * run and cmd_mark_question() is timed on it too, never on a real q.txt.
+ */
+#define BENCH_FRAME     60000   /* Bytes up to and including EOI */
+#define BENCH_QLINE     120     /* Characters per synthetic question */
+#define BENCH_FILE      "bench.jpg"
+#define BENCH_RUNS_SCAN 20
+#define BENCH_RUNS_SAVE 3
+#define BENCH_RUNS_IDX  5
+#define BENCH_RUNS_MARK 10
+#define BENCH_RUNS_REGS 20
+#define BENCH_RUNS_BLK  4
+#define BENCH_BLK_SEQ_N 64      /* Blocks per sequential write */
+#define BENCH_BLK_RAND_N 16     /* Scattered single blocks per random run */
+
+static void bench_frame(void) {
+	/* SOI, stuffed pseudo-random entropy data, EOI */
+	uint32_t i, x = 1;
+
+	ImageBuffer[0] = 0xFF;
+	ImageBuffer[1] = 0xD8;
+	for (i = 2; i < BENCH_FRAME - 2; i++) {
+		x = x * 1103515245 + 12345;
+		ImageBuffer[i] = (uint8_t)(x >> 16);
+		if (ImageBuffer[i] == 0xFF) {
+			ImageBuffer[++i] = 0x00;
+		}
+	}
+	ImageBuffer[BENCH_FRAME - 2] = 0xFF;
+	ImageBuffer[BENCH_FRAME - 1] = 0xD9;
+	frame_crc_start();
+	captured = 0;
+}
 
-		char thisChar;
-		char nextChar;
+static uint8_t bench_qfile(void) {
+	/* Writes a q.txt with the most questions index_questions() takes */
+	file_slot_t *fs;
+	UINT bw;
+	uint8_t q, ok = 1;
 
-		f_lseek(&fsrc, questionPositions[(int)val]);
-		f_read(&fsrc, inChar, 1, 1);
-		nextChar = *inChar;
-		f_lseek(&fsrc, f_tell(&fsrc)-1);
-		f_putc('#', &fsrc);
+	if ((fs = file_acquire()) == NULL) {
+		return 0;
+	}
+	if (f_open(&fs->fil, QFILE, FA_WRITE | FA_CREATE_NEW) != FR_OK) {
+		file_release(fs);
+		return 0;
+	}
+	memset(commit_buf, 'x', BENCH_QLINE);
+	commit_buf[BENCH_QLINE - 2] = '\r';
+	commit_buf[BENCH_QLINE - 1] = '\n';
+	for (q = 0; q < MAXQUESTIONS - 1 && ok; q++) {
+		seq_digits((char *)commit_buf, q, 2);
+		ok = f_write(&fs->fil, commit_buf, BENCH_QLINE, &bw) == FR_OK
+				&& bw == BENCH_QLINE;
+	}
+	f_close(&fs->fil);
+	if (!ok) {
+		f_unlink(QFILE);
+	}
+	file_release(fs);
+	return ok;
+}
 
-		uint16_t index;
-		for(index = questionPositions[(int)val]; index < filesize; index++) {
-			thisChar = nextChar;
-			f_read(&fsrc, inChar, 1, 1);
-			nextChar = *inChar;
-			f_lseek(&fsrc, f_tell(&fsrc)-1);
-			f_putc(thisChar, &fsrc);
+typedef struct {
+	uint8_t *out;
+	uint16_t n;
+} bench_out_t;
+
+static void bench_blk(bench_out_t *b) {
+	/* Raw writes through the card backend, below FatFs and the cache, of
+	 * what the sectors already hold, so the volume is left as it was. The
+	 * sectors are from the middle half of the card */
+	uint32_t lba[BENCH_BLK_RAND_N], base, span, t, x = 1;
+	bench_stat_t seq, rnd;
+	uint8_t i, k, runs;
+
+	bench_init(&seq);
+	bench_init(&rnd);
+	/* The card has to hold what the cache has, it is read back below it */
+	runs = fs_ready && sc_flush(&disk_cache) == 0
+			&& blk_sync(&disk_blk) == 0 ? BENCH_RUNS_BLK : 0;
+	span = blk_card.sectors() / 2;
+	base = span / 2;
+	for (i = 0; i < runs; i++) {
+		lba[0] = base + i * BENCH_BLK_SEQ_N;
+		if (blk_read(&disk_blk, lba[0], ImageBuffer, BENCH_BLK_SEQ_N) != 0) {
+			break;
+		}
+		t = PROBE_NOW();
+		if (blk_write(&disk_blk, lba[0], ImageBuffer, BENCH_BLK_SEQ_N) != 0
+				|| blk_end(&disk_blk) != 0) {
+			break;
+		}
+		bench_add(&seq, PROBE_NOW() - t);
+
+		for (k = 0; k < BENCH_BLK_RAND_N; k++) {
+			x = x * 1103515245 + 12345;
+			lba[k] = base + (x >> 8) % span;
+			if (blk_read(&disk_blk, lba[k], &ImageBuffer[k * BLK_SECTOR], 1)
+					!= 0) {
+				break;
+			}
+		}
+		if (k < BENCH_BLK_RAND_N) {
+			break;
+		}
+		t = PROBE_NOW();
+		for (k = 0; k < BENCH_BLK_RAND_N; k++) {
+			if (blk_write(&disk_blk, lba[k], &ImageBuffer[k * BLK_SECTOR], 1)
+					!= 0 || blk_end(&disk_blk) != 0) {
+				break;
+			}
+		}
+		if (k < BENCH_BLK_RAND_N) {
+			break;
 		}
+		bench_add(&rnd, PROBE_NOW() - t);
 	}
-	f_close(&fsrc);
+	b->n += bench_put(&b->out[b->n], BENCH_BLK_SEQ, &seq,
+			BENCH_BLK_SEQ_N * BLK_SECTOR);
+	b->n += bench_put(&b->out[b->n], BENCH_BLK_RAND, &rnd,
+			BENCH_BLK_RAND_N * BLK_SECTOR);
 }
 
-static char cam_tick_questions(uint8_t q){
-	char inString[64];
-	char i;
-	for(i = 0; i < 64; i++){
-		inString[i] = 0;
+static uint8_t bench_card(void *arg) {
+	/* Runs on the storage thread, like the code it times */
+	bench_out_t *b = (bench_out_t *)arg;
+	bench_stat_t s;
+	uint32_t t;
+	uint8_t i, own_q;
+
+	bench_init(&s);
+	for (i = 0; i < BENCH_RUNS_SAVE; i++) {
+		t = PROBE_NOW();
+		if (cam_save(BENCH_FILE, NULL, NULL) != 0x06) {
+			break;
+		}
+		bench_add(&s, PROBE_NOW() - t);
 	}
-	uint8_t val = 0;
-	FIL fsrc; /* file object */
-	FRESULT err;
-	val = q;
-	err = f_open(&fsrc, "q.txt", FA_READ);
-	if (err != FR_OK) {
-		//chprintf(chp, 0x15); SERIAL ERROR
-	} else {
-		f_lseek(&fsrc, questionPositions[val]);
-		f_gets(&inString, 64, &fsrc);
+	f_unlink(BENCH_FILE);
+	b->n += bench_put(&b->out[b->n], BENCH_CAM_SAVE, &s, BENCH_FRAME);
+
+	own_q = !file_exists(QFILE) && bench_qfile();
+	bench_init(&s);
+	for (i = 0; i < BENCH_RUNS_IDX; i++) {
+		t = PROBE_NOW();
+		if (index_questions() != 6) {
+			break;
+		}
+		bench_add(&s, PROBE_NOW() - t);
+	}
+	b->n += bench_put(&b->out[b->n], BENCH_INDEX, &s, numOfQuestions);
 
+	bench_init(&s);
+	for (i = 0; own_q && i < BENCH_RUNS_MARK; i++) {
+		t = PROBE_NOW();
+		cmd_mark_question(i);
+		bench_add(&s, PROBE_NOW() - t);
 	}
-	f_close(&fsrc);
-	uint8_t ticks = 0;
-	while(inString[ticks] == '#' && ticks < 64){
-		ticks++;
+	if (own_q) {
+		f_unlink(QFILE);
+		numOfQuestions = 0;
 	}
-	return ticks;
+	b->n += bench_put(&b->out[b->n], BENCH_MARK, &s, 1);
+	bench_blk(b);
+	return 0x06;
 }
 
+static void cmd_bench(const proto_frame_t *f) {
+	uint8_t out[BENCH_HDR_SIZE + 7 * BENCH_REC_SIZE];
+	bench_out_t b = { out, BENCH_HDR_SIZE };
+	const struct regval_list *r;
+	bench_stat_t s;
+	uint32_t t, units;
+	uint8_t i;
+
+	if (busy) {
+		cmd_reply(f, PROTO_NAK, NULL, 0);
+		return;
+	}
+	busy = 1;
+	proto_put32(&out[1], STM32_SYSCLK);
+	bench_frame();
+
+	bench_init(&s);
+	for (i = 0; i < BENCH_RUNS_SCAN; i++) {
+		t = PROBE_NOW();
+		units = jpeg_length(ImageBuffer, BUFFER_SIZE);
+		bench_add(&s, PROBE_NOW() - t);
+	}
+	b.n += bench_put(&out[b.n], BENCH_EOI_SCAN, &s, units);
+	stg_call(STG_BULK, bench_card, &b);
+
+	/* The JPEG table is the last one every resolution change writes, so
+	 * rewriting it leaves the sensor as it was */
+	for (units = 0, r = ov2640_jpeg_regs; r->reg_num != 0xff || r->value != 0xff;
+			r++) {
+		units++;
+	}
+	bench_init(&s);
+	for (i = 0; init && i < BENCH_RUNS_REGS; i++) {
+		t = PROBE_NOW();
+		if (cam_write_array(ov2640_jpeg_regs) != 0) {
+			break;
+		}
+		bench_add(&s, PROBE_NOW() - t);
+	}
+	b.n += bench_put(&out[b.n], BENCH_REGS, &s, units);
+
+	busy = 0;
+	out[BENCH_HDR_SIZE - 1] = (uint8_t)((b.n - BENCH_HDR_SIZE) / BENCH_REC_SIZE);
+	cmd_reply(f, PROTO_ACK, &out[1], b.n - 1);
+}
+#endif
 
 static uint8_t AsciiToHex(char c) {
 	if (c == '0')
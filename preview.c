@@ -0,0 +1,58 @@
+#include "preview.h"
+
+void pv_start(pv_t *p) {
+	p->fill = 0;
+	p->ready = PV_NONE;
+	p->send = PV_NONE;
+	p->seq = 0;
+	p->captured = 0;
+	p->sent = 0;
+	p->dropped = 0;
+	p->bad = 0;
+}
+
+uint8_t pv_frame(pv_t *p, int good) {
+	/* The filling slot completed; returns the slot to capture into next */
+	uint8_t s;
+
+	p->captured++;
+	if (!good) {
+		p->bad++;
+		return p->fill;
+	}
+	if (p->ready != PV_NONE) {
+		/* Still waiting for the link, the older frame goes */
+		p->dropped++;
+		s = p->ready;
+	} else {
+		for (s = 0; s == p->fill || s == p->send; s++) {
+		}
+	}
+	p->ready = p->fill;
+	p->fill = s;
+	return s;
+}
+
+uint8_t pv_take(pv_t *p) {
+	/* Slot to send next, or PV_NONE when no complete frame is waiting */
+	p->send = p->ready;
+	p->ready = PV_NONE;
+	if (p->send != PV_NONE) {
+		p->seq++;
+	}
+	return p->send;
+}
+
+void pv_sent(pv_t *p) {
+	p->send = PV_NONE;
+	p->sent++;
+}
+
+void pv_header(uint8_t *out, uint16_t seq, uint16_t off, uint16_t total) {
+	out[0] = (uint8_t)seq;
+	out[1] = (uint8_t)(seq >> 8);
+	out[2] = (uint8_t)off;
+	out[3] = (uint8_t)(off >> 8);
+	out[4] = (uint8_t)total;
+	out[5] = (uint8_t)(total >> 8);
+}
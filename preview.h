@@ -0,0 +1,46 @@
+/*
+ * preview.h
+ *
+ * Slot bookkeeping for the live preview (PROTO_CMD_PREVIEW).
+ *
+ * Preview frames are captured into PV_SLOTS slots in turn. At any time one
+ * slot is filling, at most one holds the newest complete frame and at most
+ * one is being sent. A frame that completes while the previous one is still
+ * waiting takes its place, so the link always carries the freshest picture
+ * and frames the link could not keep up with are counted as dropped rather
+ * than queued.
+ *
+ * Frames travel as FRAME|REPLY frames carrying seq16, offset16, total16
+ * and the data, without ACKs; the host discards a frame with a gap in it.
+ *
+ * Plain state machine, capturing and sending are left to the caller.
+ */
+
+#ifndef PREVIEW_H_
+#define PREVIEW_H_
+
+#include <stdint.h>
+
+#define PV_SLOTS        3
+#define PV_NONE         0xFF
+#define PV_HDR_SIZE     6
+
+typedef struct {
+	uint8_t fill;
+	uint8_t ready;
+	uint8_t send;
+	uint16_t seq;
+	/* Statistics */
+	uint32_t captured;
+	uint32_t sent;
+	uint32_t dropped;       /* Complete frames overtaken by a newer one */
+	uint32_t bad;           /* Frames without SOI/EOI, recaptured */
+} pv_t;
+
+void pv_start(pv_t *p);
+uint8_t pv_frame(pv_t *p, int good);
+uint8_t pv_take(pv_t *p);
+void pv_sent(pv_t *p);
+void pv_header(uint8_t *out, uint16_t seq, uint16_t off, uint16_t total);
+
+#endif /* PREVIEW_H_ */
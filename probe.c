@@ -0,0 +1,80 @@
+#include "probe.h"
+#include "proto.h"
+
+#if defined(CAM_PROBES)
+probe_t probe_tab[PROBE_COUNT];
+#endif
+
+void probe_reset(probe_t *p) {
+	uint8_t i;
+
+	p->n = 0;
+	p->min = 0xFFFFFFFF;
+	p->max = 0;
+	p->sum = 0;
+	for (i = 0; i < PROBE_BINS; i++) {
+		p->hist[i] = 0;
+	}
+}
+
+void probe_add(probe_t *p, uint32_t ticks) {
+	/* Short enough to run with the kernel locked */
+	uint32_t t = ticks;
+	uint8_t bin = 0;
+
+	if (p->n == 0) {
+		p->min = 0xFFFFFFFF;
+	}
+	p->n++;
+	p->sum += ticks;
+	if (ticks < p->min) {
+		p->min = ticks;
+	}
+	if (ticks > p->max) {
+		p->max = ticks;
+	}
+	while (t >= 4 && bin < PROBE_BINS - 1) {
+		t >>= 2;
+		bin++;
+	}
+	if (p->hist[bin] != 0xFFFF) {
+		p->hist[bin]++;
+	}
+}
+
+uint16_t probe_put(uint8_t *out, uint8_t id, const probe_t *p) {
+	uint8_t i;
+
+	out[0] = id;
+	proto_put32(&out[1], p->n);
+	proto_put32(&out[5], p->n ? p->min : 0);
+	proto_put32(&out[9], p->n ? (uint32_t)(p->sum / p->n) : 0);
+	proto_put32(&out[13], p->max);
+	for (i = 0; i < PROBE_BINS; i++) {
+		out[17 + 2 * i] = (uint8_t)p->hist[i];
+		out[18 + 2 * i] = (uint8_t)(p->hist[i] >> 8);
+	}
+	return PROBE_REC_SIZE;
+}
+
+void probe_get(const uint8_t *in, probe_rec_t *r) {
+	uint8_t i;
+
+	r->id = in[0];
+	r->n = proto_get32(&in[1]);
+	r->min = proto_get32(&in[5]);
+	r->mean = proto_get32(&in[9]);
+	r->max = proto_get32(&in[13]);
+	for (i = 0; i < PROBE_BINS; i++) {
+		r->hist[i] = (uint16_t)(in[17 + 2 * i] | (in[18 + 2 * i] << 8));
+	}
+}
+
+const char *probe_name(uint8_t id) {
+	static const char *const names[PROBE_COUNT] = {
+		"cam_init", "cam_capture", "cam_save", "sccb_write", "sccb_read",
+		"f_open", "f_read", "f_write", "f_close", "f_meta"
+	};
+
+	return id < PROBE_COUNT ? names[id] : "unknown";
+}
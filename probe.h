@@ -0,0 +1,90 @@
+/*
+ * probe.h
+ *
+ * Scoped timing probes (-DCAM_PROBES).
+ *
+ *   PROBE_BEGIN(PROBE_CAM_SAVE);
+ *   ...
+ *   PROBE_END(PROBE_CAM_SAVE);
+ *
+ * times the code in between with the Cortex-M4 DWT cycle counter (backed
+ * by the host monotonic clock in sim/) and folds it into the probe's entry
+ * of a static table: count, min, max, mean and a histogram of power of
+ * four bins, bin i holding times of 4^i up to 4^(i+1) ticks. Without
+ * CAM_PROBES the macros and the table compile to nothing.
+ *
+ * PROTO_CMD_PROBES returns the table as
+ *
+ *   ACK hz32 count8 { id8 n32 min32 mean32 max32 hist16[PROBE_BINS] } * count
+ *
+ * and clears it when its argument is 1.
+ */
+
+#ifndef PROBE_H_
+#define PROBE_H_
+
+#include <stdint.h>
+
+#define PROBE_CAM_INIT      0
+#define PROBE_CAM_CAPTURE   1
+#define PROBE_CAM_SAVE      2
+#define PROBE_SCCB_WRITE    3
+#define PROBE_SCCB_READ     4
+#define PROBE_FS_OPEN       5
+#define PROBE_FS_READ       6
+#define PROBE_FS_WRITE      7
+#define PROBE_FS_CLOSE      8
+#define PROBE_FS_META       9   /* f_unlink, f_rename, f_stat */
+#define PROBE_COUNT         10
+
+#define PROBE_BINS          16
+#define PROBE_REC_SIZE      (17 + 2 * PROBE_BINS)
+#define PROBE_HDR_SIZE      6
+
+/* Cycle counter, CMSIS names */
+#define PROBE_CLOCK_INIT() do {                                            \
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;                        \
+	DWT->CYCCNT = 0;                                                       \
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;                                   \
+} while (0)
+#define PROBE_NOW()         (DWT->CYCCNT)
+
+typedef struct {
+	uint32_t n;
+	uint32_t min;
+	uint32_t max;
+	uint64_t sum;
+	uint16_t hist[PROBE_BINS];
+} probe_t;
+
+typedef struct {
+	uint8_t id;
+	uint32_t n;
+	uint32_t min;
+	uint32_t mean;
+	uint32_t max;
+	uint16_t hist[PROBE_BINS];
+} probe_rec_t;
+
+#if defined(CAM_PROBES)
+extern probe_t probe_tab[PROBE_COUNT];
+
+#define PROBE_BEGIN(id)     uint32_t probe_t0_##id = PROBE_NOW()
+#define PROBE_END(id) do {                                                 \
+	uint32_t probe_dt_ = PROBE_NOW() - probe_t0_##id;                      \
+	chSysLock();                                                           \
+	probe_add(&probe_tab[id], probe_dt_);                                  \
+	chSysUnlock();                                                         \
+} while (0)
+#else
+#define PROBE_BEGIN(id)
+#define PROBE_END(id)
+#endif
+
+void probe_reset(probe_t *p);
+void probe_add(probe_t *p, uint32_t ticks);
+uint16_t probe_put(uint8_t *out, uint8_t id, const probe_t *p);
+void probe_get(const uint8_t *in, probe_rec_t *r);
+const char *probe_name(uint8_t id);
+
+#endif /* PROBE_H_ */
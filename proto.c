@@ -0,0 +1,145 @@
+#include <string.h>
+#include "proto.h"
+
+#define PARSE_MORE  0
+#define PARSE_FRAME 1
+#define PARSE_BAD   2
+
+uint8_t proto_crc8(const uint8_t *p, size_t n) {
+	/* CRC-8, polynomial 0x07 */
+	uint8_t crc = 0;
+	uint8_t i;
+
+	while (n--) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++) {
+			crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+		}
+	}
+	return crc;
+}
+
+uint16_t proto_crc16(uint16_t crc, const uint8_t *p, size_t n) {
+	/* CRC-16/CCITT-FALSE, nibble folded so no table is needed */
+	while (n--) {
+		uint8_t x = (uint8_t)(crc >> 8) ^ *p++;
+		x ^= x >> 4;
+		crc = (uint16_t)((crc << 8) ^ ((uint16_t)x << 12) ^ ((uint16_t)x << 5) ^ x);
+	}
+	return crc;
+}
+
+void proto_init(proto_parser_t *p) {
+	memset(p, 0, sizeof(*p));
+}
+
+void proto_reset(proto_parser_t *p) {
+	/* Abandons a partial frame, e.g. after an inter-byte timeout */
+	p->dropped += p->n - p->used;
+	p->n = 0;
+	p->used = 0;
+}
+
+static int parse(const proto_parser_t *p) {
+	uint16_t len, crc;
+
+	if (p->raw[0] != PROTO_SYNC) {
+		return PARSE_BAD;
+	}
+	if (p->n < PROTO_HDR_SIZE) {
+		return PARSE_MORE;
+	}
+	if (proto_crc8(&p->raw[1], PROTO_HDR_SIZE - 2) != p->raw[PROTO_HDR_SIZE - 1]) {
+		return PARSE_BAD;
+	}
+	len = p->raw[1] | (p->raw[2] << 8);
+	if (len > PROTO_MAX_PAYLOAD) {
+		return PARSE_BAD;
+	}
+	if (p->n < PROTO_HDR_SIZE + len + PROTO_CRC_SIZE) {
+		return PARSE_MORE;
+	}
+	crc = p->raw[PROTO_HDR_SIZE + len] | (p->raw[PROTO_HDR_SIZE + len + 1] << 8);
+	if (proto_crc16(0xFFFF, &p->raw[1], PROTO_HDR_SIZE - 1 + len) != crc) {
+		return PARSE_BAD;
+	}
+	return PARSE_FRAME;
+}
+
+int proto_feed(proto_parser_t *p, uint8_t c, proto_frame_t *f) {
+	/* Feeds one received byte. Returns 1 and fills f when it completes a
+	 * frame; f->payload points into the parser and is valid until the
+	 * next call. A bad frame is rescanned from its next SYNC byte so a
+	 * lost or corrupted byte costs at most the frame it hit.
+	 */
+	int r = PARSE_MORE;
+	uint16_t len;
+
+	if (p->used > 0) {
+		/* Bytes that followed the last frame in a rescanned buffer */
+		p->n -= p->used;
+		memmove(p->raw, &p->raw[p->used], p->n);
+		p->used = 0;
+	}
+	if (p->n == 0 && c != PROTO_SYNC) {
+		p->dropped++;
+		return 0;
+	}
+	p->raw[p->n++] = c;
+
+	while (p->n > 0 && (r = parse(p)) == PARSE_BAD) {
+		uint16_t i = 1;
+		p->bad_frames++;
+		while (i < p->n && p->raw[i] != PROTO_SYNC) {
+			i++;
+		}
+		p->dropped += i;
+		p->n -= i;
+		memmove(p->raw, &p->raw[i], p->n);
+	}
+	if (p->n == 0 || r == PARSE_MORE) {
+		return 0;
+	}
+
+	len = p->raw[1] | (p->raw[2] << 8);
+	f->cmd = p->raw[3];
+	f->req = p->raw[4];
+	f->len = len;
+	f->payload = &p->raw[PROTO_HDR_SIZE];
+	p->used = PROTO_HDR_SIZE + len + PROTO_CRC_SIZE;
+	p->frames++;
+	return 1;
+}
+
+uint32_t proto_get32(const uint8_t *p) {
+	/* Multi-byte fields are little endian */
+	return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16)
+			| ((uint32_t)p[3] << 24);
+}
+
+void proto_put32(uint8_t *p, uint32_t v) {
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+	p[2] = (uint8_t)(v >> 16);
+	p[3] = (uint8_t)(v >> 24);
+}
+
+size_t proto_encode(uint8_t *out, uint8_t cmd, uint8_t req,
+		const uint8_t *payload, uint16_t len) {
+	/* out must hold len + PROTO_HDR_SIZE + PROTO_CRC_SIZE bytes */
+	uint16_t crc;
+
+	out[0] = PROTO_SYNC;
+	out[1] = (uint8_t)len;
+	out[2] = (uint8_t)(len >> 8);
+	out[3] = cmd;
+	out[4] = req;
+	out[5] = proto_crc8(&out[1], PROTO_HDR_SIZE - 2);
+	if (len > 0 && payload != &out[PROTO_HDR_SIZE]) {
+		memmove(&out[PROTO_HDR_SIZE], payload, len);
+	}
+	crc = proto_crc16(0xFFFF, &out[1], PROTO_HDR_SIZE - 1 + len);
+	out[PROTO_HDR_SIZE + len] = (uint8_t)crc;
+	out[PROTO_HDR_SIZE + len + 1] = (uint8_t)(crc >> 8);
+	return PROTO_HDR_SIZE + len + PROTO_CRC_SIZE;
+}
@@ -0,0 +1,101 @@
+/*
+ * proto.h
+ *
+ * Framed command protocol spoken over USART2.
+ *
+ *   SYNC | LEN lo | LEN hi | CMD | REQ | HCS | PAYLOAD[LEN] | CRC lo | CRC hi
+ *
+ * HCS is a CRC-8 of LEN, CMD and REQ so a damaged length is caught before
+ * the parser starts waiting for a payload that is not coming. The CRC is
+ * CRC-16/CCITT-FALSE over everything between SYNC and the CRC.
+ * Replies use the same framing with PROTO_REPLY set in CMD, echo the REQ of
+ * the request and start their payload with an ACK (0x06) or NAK (0x15), so a
+ * host may pipeline requests and match the replies up by REQ.
+ *
+ * No ChibiOS dependencies here so the host tools can build it as well.
+ */
+
+#ifndef PROTO_H_
+#define PROTO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PROTO_SYNC          0xA5
+#define PROTO_HDR_SIZE      6
+#define PROTO_CRC_SIZE      2
+#define PROTO_MAX_PAYLOAD   512
+#define PROTO_MAX_FRAME     (PROTO_HDR_SIZE + PROTO_MAX_PAYLOAD + PROTO_CRC_SIZE)
+
+/* Opcodes, kept equal to the old single byte commands */
+#define PROTO_CMD_CAPTURE   0x21    /* '!' q - capture and save an answer   */
+#define PROTO_CMD_TICKS     0x22    /* '"' q - number of answers to q      */
+#define PROTO_CMD_INDEX     0x2B    /* '+'   - index q.txt, reply count    */
+#define PROTO_CMD_BENCH     0x42    /* 'B'   - run the hot path benchmarks,
+                                       see bench.h                        */
+#define PROTO_CMD_DATA      0x44    /* 'D'   - download chunk, device to host
+                                       only: offset32 then data          */
+#define PROTO_CMD_FRAME     0x46    /* 'F'   - preview frame piece, device
+                                       to host only, see preview.h        */
+#define PROTO_CMD_PROBES    0x50    /* 'P' clear - timing probe table, see
+                                       probe.h                            */
+#define PROTO_CMD_STORAGE   0x53    /* 'S' clear - storage queue depth and
+                                       waits, see storage.h               */
+#define PROTO_CMD_TRACE     0x54    /* 'T' from32 - capture event trace,
+                                       see trace.h                        */
+#define PROTO_CMD_ACK       0x61    /* 'a' offset32 - download ACK, no reply */
+#define PROTO_CMD_BAUD      0x62    /* 'b' baud32 - switch line rate, see
+                                       baud.h                             */
+#define PROTO_CMD_CATALOG   0x63    /* 'c' from32 count8 kind8 q8 since32 -
+                                       page of the catalog of saved
+                                       files, see catalog.h               */
+#define PROTO_CMD_DOWNLOAD  0x64    /* 'd' src offset32 chunk16 window
+                                       [frame32] name - stream a file (src
+                                       1), frame32 of a recording (src 2,
+                                       replies size32 ms32) or the frame
+                                       in ImageBuffer (src 0, replies
+                                       size32 fcrc32), see xfer.h         */
+#define PROTO_CMD_INIT      0x69    /* 'i'   - power up and init camera    */
+#define PROTO_CMD_PING      0x70    /* 'p'   - echo the payload back       */
+#define PROTO_CMD_QUESTION  0x71    /* 'q' q - text of question q          */
+#define PROTO_CMD_RECORD    0x72    /* 'r' on frames16 interval16 name -
+                                       record 320x240 frames into an AVI
+                                       (1) or stop (0), see avi.h         */
+#define PROTO_CMD_STATUS    0x73    /* 's'   - power, init, busy, captured,
+                                       error, commands queued, file slots
+                                       in use, peak and missed            */
+#define PROTO_CMD_PREVIEW   0x76    /* 'v' on - start (1) or stop (0) the
+                                       live preview, see preview.h        */
+
+#define PROTO_REPLY         0x80
+#define PROTO_ACK           0x06
+#define PROTO_NAK           0x15
+
+typedef struct {
+	uint8_t cmd;
+	uint8_t req;
+	uint16_t len;
+	const uint8_t *payload;
+} proto_frame_t;
+
+typedef struct {
+	uint8_t raw[PROTO_MAX_FRAME];
+	uint16_t n;
+	uint16_t used;
+	/* Statistics */
+	uint32_t frames;
+	uint32_t bad_frames;
+	uint32_t dropped;
+} proto_parser_t;
+
+uint8_t proto_crc8(const uint8_t *p, size_t n);
+uint16_t proto_crc16(uint16_t crc, const uint8_t *p, size_t n);
+void proto_init(proto_parser_t *p);
+void proto_reset(proto_parser_t *p);
+int proto_feed(proto_parser_t *p, uint8_t c, proto_frame_t *f);
+uint32_t proto_get32(const uint8_t *p);
+void proto_put32(uint8_t *p, uint32_t v);
+size_t proto_encode(uint8_t *out, uint8_t cmd, uint8_t req,
+		const uint8_t *payload, uint16_t len);
+
+#endif /* PROTO_H_ */
@@ -0,0 +1,29 @@
+#include <string.h>
+
+#include "retain.h"
+#include "proto.h"
+
+int ret_evictable(const cat_rec_t *r) {
+	return r->kind == CAT_IMAGE || r->kind == CAT_RECORDING;
+}
+
+uint32_t ret_free_kb(uint32_t clusters, uint32_t cluster_sectors) {
+	return (uint32_t)((uint64_t)clusters * cluster_sectors / 2);
+}
+
+void ret_record(uint8_t *out, uint32_t head) {
+	memcpy(out, "RET1", 4);
+	proto_put32(&out[4], head);
+	proto_put32(&out[8], ~head);
+}
+
+int ret_parse(const uint8_t *in, uint32_t *head) {
+	/* 0 for a sound record */
+	uint32_t v = proto_get32(&in[4]);
+
+	if (memcmp(in, "RET1", 4) != 0 || proto_get32(&in[8]) != ~v) {
+		return -1;
+	}
+	*head = v;
+	return 0;
+}
@@ -0,0 +1,46 @@
+/*
+ * retain.h
+ *
+ * Room for new saves on a filling card. The free space is FatFs' own
+ * count (f_getfree()), read from FSINFO at mount and kept up to date as
+ * clusters are taken and freed, so looking at it before every save costs
+ * nothing. When it is below RET_LOW_KB the save first deletes the oldest
+ * button images and recordings in catalog order (catalog.h), at most
+ * RET_BATCH of them, until RET_HIGH_KB is free; the card never gets so
+ * full that FatFs walks the whole FAT for a free cluster. Answers are
+ * kept, q.txt counts them.
+ *
+ * A deleted file keeps its catalog record, marked CAT_GONE. Where the
+ * next deletion starts is the catalog index in RET_FILE, a record of
+ * RET_REC_SIZE bytes
+ *
+ *   'RET1' head32 ~head32
+ *
+ * written after every batch. A file deleted before its record was marked
+ * is looked at again and marked then.
+ *
+ * Plain bookkeeping, the files are read and written by the caller.
+ */
+
+#ifndef RETAIN_H_
+#define RETAIN_H_
+
+#include <stdint.h>
+
+#include "catalog.h"
+
+#define RET_FILE            "ret.dat"
+#if !defined(CAM_RET_LOW_KB)
+#define CAM_RET_LOW_KB      4096
+#endif
+#define RET_LOW_KB          CAM_RET_LOW_KB
+#define RET_HIGH_KB         (2 * RET_LOW_KB)
+#define RET_BATCH           8
+#define RET_REC_SIZE        12
+
+int ret_evictable(const cat_rec_t *r);
+uint32_t ret_free_kb(uint32_t clusters, uint32_t cluster_sectors);
+void ret_record(uint8_t *out, uint32_t head);
+int ret_parse(const uint8_t *in, uint32_t *head);
+
+#endif /* RETAIN_H_ */
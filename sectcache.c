@@ -0,0 +1,185 @@
+#include <string.h>
+
+#include "sectcache.h"
+#include "proto.h"
+
+void sc_init(sc_t *c, blk_t *dev, uint8_t (*buf)[SC_SECTOR], sc_line_t *line,
+		uint16_t lines) {
+	c->dev = dev;
+	c->buf = buf;
+	c->line = line;
+	c->lines = lines;
+	c->tick = 0;
+	sc_clear(c);
+	sc_invalidate(c);
+}
+
+void sc_clear(sc_t *c) {
+	memset(&c->st, 0, sizeof(c->st));
+}
+
+void sc_invalidate(sc_t *c) {
+	/* Drops everything, dirty lines included: the card went away */
+	uint16_t i;
+
+	for (i = 0; i < c->lines; i++) {
+		c->line[i].valid = 0;
+		c->line[i].dirty = 0;
+	}
+}
+
+static int find(const sc_t *c, uint32_t lba) {
+	uint16_t i;
+
+	for (i = 0; i < c->lines; i++) {
+		if (c->line[i].valid && c->line[i].lba == lba) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static int dev_write(sc_t *c, uint32_t lba, const uint8_t *buf, uint32_t n) {
+	c->st.dev_writes++;
+	c->st.dev_write_blocks += n;
+	return blk_write(c->dev, lba, buf, n);
+}
+
+int sc_flush(sc_t *c) {
+	/* Dirty lines in order of sector, a run of consecutive ones per write */
+	uint32_t lba, n, k;
+	int i, j;
+
+	for (;;) {
+		i = -1;
+		for (j = 0; j < c->lines; j++) {
+			if (c->line[j].dirty && (i < 0 || c->line[j].lba < c->line[i].lba)) {
+				i = j;
+			}
+		}
+		if (i < 0) {
+			return 0;
+		}
+		lba = c->line[i].lba;
+		for (n = 1; find(c, lba + n) >= 0 && c->line[find(c, lba + n)].dirty;
+				n++) {
+		}
+		c->st.flushes++;
+		c->st.dev_writes++;
+		c->st.dev_write_blocks += n;
+		if (blk_begin(c->dev, lba, n) != 0) {
+			return -1;
+		}
+		for (k = 0; k < n; k++) {
+			if (blk_write(c->dev, lba + k, c->buf[find(c, lba + k)], 1) != 0) {
+				return -1;
+			}
+		}
+		for (k = 0; k < n; k++) {
+			c->line[find(c, lba + k)].dirty = 0;
+		}
+	}
+}
+
+static int victim(sc_t *c) {
+	/* A free line or the least recently used one, written back first */
+	uint16_t i, v = 0;
+
+	for (i = 0; i < c->lines; i++) {
+		if (!c->line[i].valid) {
+			return i;
+		}
+		if (c->line[i].used < c->line[v].used) {
+			v = i;
+		}
+	}
+	if (c->line[v].dirty && sc_flush(c) != 0) {
+		return -1;
+	}
+	c->line[v].valid = 0;
+	return v;
+}
+
+int sc_read(sc_t *c, uint32_t lba, uint8_t *buf, uint32_t n) {
+	uint32_t k;
+	int i;
+
+	if (n == 1 && c->lines > 0) {
+		if ((i = find(c, lba)) < 0) {
+			c->st.misses++;
+			if ((i = victim(c)) < 0) {
+				return -1;
+			}
+			c->st.dev_reads++;
+			c->st.dev_read_blocks++;
+			if (blk_read(c->dev, lba, c->buf[i], 1) != 0) {
+				return -1;
+			}
+			c->line[i].lba = lba;
+			c->line[i].valid = 1;
+			c->line[i].dirty = 0;
+		} else {
+			c->st.hits++;
+		}
+		c->line[i].used = ++c->tick;
+		memcpy(buf, c->buf[i], SC_SECTOR);
+		return 0;
+	}
+
+	/* Straight from the device, then what the cache holds on top */
+	c->st.misses += n;
+	c->st.dev_reads++;
+	c->st.dev_read_blocks += n;
+	if (blk_read(c->dev, lba, buf, n) != 0) {
+		return -1;
+	}
+	for (k = 0; k < n && c->lines > 0; k++) {
+		if ((i = find(c, lba + k)) >= 0) {
+			memcpy(&buf[k * SC_SECTOR], c->buf[i], SC_SECTOR);
+		}
+	}
+	return 0;
+}
+
+int sc_write(sc_t *c, uint32_t lba, const uint8_t *buf, uint32_t n) {
+	uint32_t k;
+	int i;
+
+	if (n == 1 && c->lines > 0) {
+		if ((i = find(c, lba)) < 0 && (i = victim(c)) < 0) {
+			return -1;
+		}
+		c->st.absorbed++;
+		memcpy(c->buf[i], buf, SC_SECTOR);
+		c->line[i].lba = lba;
+		c->line[i].valid = 1;
+		c->line[i].dirty = 1;
+		c->line[i].used = ++c->tick;
+		return 0;
+	}
+
+	if (dev_write(c, lba, buf, n) != 0) {
+		return -1;
+	}
+	for (k = 0; k < n && c->lines > 0; k++) {
+		if ((i = find(c, lba + k)) >= 0) {
+			memcpy(c->buf[i], &buf[k * SC_SECTOR], SC_SECTOR);
+			c->line[i].dirty = 0;
+		}
+	}
+	return 0;
+}
+
+uint16_t sc_put(uint8_t *out, const sc_t *c) {
+	out[0] = (uint8_t)c->lines;
+	out[1] = (uint8_t)(c->lines >> 8);
+	proto_put32(&out[2], c->st.hits);
+	proto_put32(&out[6], c->st.misses);
+	proto_put32(&out[10], c->st.absorbed);
+	proto_put32(&out[14], c->st.dev_reads);
+	proto_put32(&out[18], c->st.dev_read_blocks);
+	proto_put32(&out[22], c->st.dev_writes);
+	proto_put32(&out[26], c->st.dev_write_blocks);
+	proto_put32(&out[30], c->st.flushes);
+	return SC_STATS_SIZE;
+}
@@ -0,0 +1,79 @@
+/*
+ * sectcache.h
+ *
+ * Write-back sector cache between the FatFs disk layer (diskio.c) and a
+ * block device. It keeps a small number of 512 byte sectors with LRU
+ * replacement:
+ *
+ *   - single sector reads are served from the cache, misses are read into
+ *     the least recently used line
+ *   - single sector writes only update the cache and mark the line dirty
+ *   - multi-sector transfers (file data) go straight to the device, with
+ *     cached copies of the sectors they cover kept in step
+ *   - sc_flush() writes the dirty lines back in order of sector, each run
+ *     of consecutive sectors as one multi-block write; evicting a dirty
+ *     line flushes them all the same way
+ *
+ * The device is a block device (blkdev.h); each run is begun with its
+ * length so the card can pre-erase it. With no lines every transfer goes
+ * straight through.
+ *
+ * sc_put() gives the counters as
+ *
+ *   lines16 hits32 misses32 absorbed32 dev_reads32 dev_read_blocks32
+ *   dev_writes32 dev_write_blocks32 flushes32
+ *
+ * where absorbed counts single sector writes that did not reach the device
+ * right away and flushes the runs written back.
+ */
+
+#ifndef SECTCACHE_H_
+#define SECTCACHE_H_
+
+#include <stdint.h>
+
+#include "blkdev.h"
+
+#define SC_SECTOR           BLK_SECTOR
+#define SC_STATS_SIZE       34
+
+typedef struct {
+	uint32_t lba;
+	uint32_t used;      /* LRU stamp */
+	uint8_t valid;
+	uint8_t dirty;
+} sc_line_t;
+
+typedef struct {
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t absorbed;
+	uint32_t dev_reads;
+	uint32_t dev_read_blocks;
+	uint32_t dev_writes;
+	uint32_t dev_write_blocks;
+	uint32_t flushes;
+} sc_stats_t;
+
+typedef struct {
+	blk_t *dev;
+	uint8_t (*buf)[SC_SECTOR];
+	sc_line_t *line;
+	uint16_t lines;
+	uint32_t tick;
+	sc_stats_t st;
+} sc_t;
+
+void sc_init(sc_t *c, blk_t *dev, uint8_t (*buf)[SC_SECTOR], sc_line_t *line,
+		uint16_t lines);
+void sc_invalidate(sc_t *c);
+void sc_clear(sc_t *c);
+int sc_read(sc_t *c, uint32_t lba, uint8_t *buf, uint32_t n);
+int sc_write(sc_t *c, uint32_t lba, const uint8_t *buf, uint32_t n);
+int sc_flush(sc_t *c);
+uint16_t sc_put(uint8_t *out, const sc_t *c);
+
+/* The FatFs disk layer's cache, in diskio.c */
+extern sc_t disk_cache;
+
+#endif /* SECTCACHE_H_ */
@@ -0,0 +1,80 @@
+#include <string.h>
+
+#include "seqname.h"
+#include "proto.h"
+
+void seq_digits(char *out, uint32_t v, uint8_t width) {
+	/* width digits of v, zero padded, no NUL */
+	while (width > 0) {
+		out[--width] = (char)('0' + v % 10);
+		v /= 10;
+	}
+}
+
+void seq_path(char *out, uint32_t n) {
+	/* SEQ_DIR_LEN chars of it are the directory */
+	out[0] = 'S';
+	out[1] = 'W';
+	seq_digits(&out[2], n / SEQ_PER_DIR, 4);
+	out[SEQ_DIR_LEN] = '/';
+	memcpy(&out[SEQ_DIR_LEN + 1], out, 2);
+	seq_digits(&out[SEQ_DIR_LEN + 3], n, 6);
+	strcpy(&out[SEQ_DIR_LEN + 9], ".jpg");
+}
+
+uint32_t seq_number(const char *name, uint8_t digits) {
+	/* n of a "SWdddd" shard (4 digits, its first image) or "SWnnnnnn.jpg"
+	 * image (6) directory entry, SEQ_MAX if it is not one */
+	uint32_t n = 0;
+	uint8_t i;
+
+	if (name[0] != 'S' || name[1] != 'W'
+			|| name[2 + digits] != (digits == 4 ? 0 : '.')) {
+		return SEQ_MAX;
+	}
+	for (i = 2; i < 2 + digits; i++) {
+		if (name[i] < '0' || name[i] > '9') {
+			return SEQ_MAX;
+		}
+		n = n * 10 + (uint32_t)(name[i] - '0');
+	}
+	return digits == 4 ? n * SEQ_PER_DIR : n;
+}
+
+void seq_start(seq_t *s, uint32_t next) {
+	s->next = next < SEQ_MAX ? next : 0;
+	s->limit = s->next;
+}
+
+int seq_take(seq_t *s, uint32_t *n) {
+	/* The next number; 1 when a new lease starts with it and the record
+	 * has to be written with s->limit first */
+	int lease = s->next == s->limit;
+
+	*n = s->next;
+	if (lease) {
+		s->limit = s->next + SEQ_LEASE;
+	}
+	if (++s->next == SEQ_MAX) {
+		s->next = 0;
+		s->limit = 0;
+	}
+	return lease;
+}
+
+void seq_record(uint8_t *out, uint32_t next) {
+	memcpy(out, "SEQ1", 4);
+	proto_put32(&out[4], next);
+	proto_put32(&out[8], ~next);
+}
+
+int seq_parse(const uint8_t *in, uint32_t *next) {
+	/* 0 for a sound record */
+	uint32_t v = proto_get32(&in[4]);
+
+	if (memcmp(in, "SEQ1", 4) != 0 || proto_get32(&in[8]) != ~v) {
+		return -1;
+	}
+	*next = v;
+	return 0;
+}
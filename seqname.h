@@ -0,0 +1,52 @@
+/*
+ * seqname.h
+ *
+ * Names of the images taken with the button (SOLOCAM). Image n is
+ *
+ *   SWdddd/SWnnnnnn.jpg
+ *
+ * nnnnnn being n and dddd n / SEQ_PER_DIR, so no directory holds more than
+ * SEQ_PER_DIR images and finding or adding one never scans more entries
+ * than that. Numbers run up to SEQ_MAX - 1 and then start at 0 again.
+ *
+ * The next number is kept in SEQ_FILE, a record of SEQ_REC_SIZE bytes
+ *
+ *   'SEQ1' next32 ~next32
+ *
+ * read once after the card is mounted. Numbers are handed out in leases of
+ * SEQ_LEASE: the record is written with the end of the lease when it is
+ * taken, before the first image of it, so it is rewritten once every
+ * SEQ_LEASE images and a number is never used twice. Losing power skips
+ * what was left of the lease.
+ *
+ * Plain formatting and bookkeeping, the file is read and written by the
+ * caller.
+ */
+
+#ifndef SEQNAME_H_
+#define SEQNAME_H_
+
+#include <stdint.h>
+
+#define SEQ_FILE            "seq.dat"
+#define SEQ_PER_DIR         100
+#define SEQ_MAX             1000000
+#define SEQ_LEASE           16
+#define SEQ_REC_SIZE        12
+#define SEQ_DIR_LEN         6       /* "SWdddd" */
+#define SEQ_PATH_SIZE       20      /* "SWdddd/SWnnnnnn.jpg" and NUL */
+
+typedef struct {
+	uint32_t next;
+	uint32_t limit;     /* End of the lease in the record */
+} seq_t;
+
+void seq_digits(char *out, uint32_t v, uint8_t width);
+void seq_path(char *out, uint32_t n);
+uint32_t seq_number(const char *name, uint8_t digits);
+void seq_start(seq_t *s, uint32_t next);
+int seq_take(seq_t *s, uint32_t *n);
+void seq_record(uint8_t *out, uint32_t next);
+int seq_parse(const uint8_t *in, uint32_t *next);
+
+#endif /* SEQNAME_H_ */
@@ -0,0 +1,59 @@
+#include <string.h>
+
+#include "sglist.h"
+
+void sg_start(sg_t *g, const sg_seg_t *seg, uint8_t nseg, uint8_t *stage) {
+	g->seg = seg;
+	g->nseg = nseg;
+	g->i = 0;
+	g->off = 0;
+	g->stage = stage;
+	g->staged = 0;
+}
+
+static void sg_skip(sg_t *g) {
+	/* On to the next segment with data left */
+	while (g->i < g->nseg && g->off == g->seg[g->i].n) {
+		g->i++;
+		g->off = 0;
+	}
+}
+
+uint32_t sg_next(sg_t *g, const uint8_t **p) {
+	/* Next piece of the stream at *p, its length or 0 at the end */
+	uint32_t n = 0, k;
+
+	sg_skip(g);
+	if (g->i == g->nseg) {
+		return 0;
+	}
+	k = g->seg[g->i].n - g->off;
+	if (k >= SG_SECTOR) {
+		*p = &g->seg[g->i].p[g->off];
+		k &= ~(uint32_t)(SG_SECTOR - 1);
+		g->off += k;
+		return k;
+	}
+	while (n < SG_SECTOR && g->i < g->nseg) {
+		k = g->seg[g->i].n - g->off;
+		if (k > SG_SECTOR - n) {
+			k = SG_SECTOR - n;
+		}
+		memcpy(&g->stage[n], &g->seg[g->i].p[g->off], k);
+		n += k;
+		g->off += k;
+		sg_skip(g);
+	}
+	g->staged += n;
+	*p = g->stage;
+	return n;
+}
+
+uint32_t sg_total(const sg_seg_t *seg, uint8_t nseg) {
+	uint32_t n = 0;
+
+	while (nseg > 0) {
+		n += seg[--nseg].n;
+	}
+	return n;
+}
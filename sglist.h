@@ -0,0 +1,48 @@
+/*
+ * sglist.h
+ *
+ * Scatter-gather writes: a file written from a list of segments, say the
+ * SOI, a metadata block made for the file and the rest of the frame where
+ * it lies in ImageBuffer, as one stream and without first copying them
+ * together.
+ *
+ * sg_next() cuts the stream into pieces that each start on a sector of
+ * the file, so FatFs hands every piece to the disk layer straight from the
+ * caller's memory as whole sectors:
+ *
+ *   - the whole sectors inside the current segment, as they are
+ *   - otherwise one sector put together in the staging buffer from the
+ *     end of this segment and the start of the next ones
+ *
+ * Only the sectors where segments meet are copied, and the stream's last
+ * piece is the only one that can be short of a sector.
+ *
+ * Plain bookkeeping, the writing is left to the caller.
+ */
+
+#ifndef SGLIST_H_
+#define SGLIST_H_
+
+#include <stdint.h>
+
+#define SG_SECTOR           512
+
+typedef struct {
+	const uint8_t *p;
+	uint32_t n;
+} sg_seg_t;
+
+typedef struct {
+	const sg_seg_t *seg;
+	uint8_t nseg;
+	uint8_t i;          /* Current segment */
+	uint32_t off;       /* Into it */
+	uint8_t *stage;     /* SG_SECTOR bytes */
+	uint32_t staged;    /* Bytes copied into stage, for the statistics */
+} sg_t;
+
+void sg_start(sg_t *g, const sg_seg_t *seg, uint8_t nseg, uint8_t *stage);
+uint32_t sg_next(sg_t *g, const uint8_t **p);
+uint32_t sg_total(const sg_seg_t *seg, uint8_t nseg);
+
+#endif /* SGLIST_H_ */
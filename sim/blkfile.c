@@ -0,0 +1,103 @@
+/*
+ * blkfile.c
+ *
+ * Card backend of the simulation built with -DCAM_BLK_FILE: the image file
+ * (image.c) as a plain block device, read and written with pread() and
+ * pwrite() and no card timing. It has nothing to pre-erase. Beside the
+ * MMC driver model (mmc.c) it shows what the layers above cost on their
+ * own, and the host disk's bandwidth in the PROTO_CMD_BENCH block cases.
+ */
+#define _GNU_SOURCE
+#include <unistd.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "blkdev.h"
+#include "sim.h"
+
+#if defined(CAM_BLK_FILE)
+
+static int fd = -1;
+static int connected;
+static uint32_t sectors, next;
+
+static int file_read(void *dev, uint32_t lba, uint8_t *buf, uint32_t n) {
+	size_t len = (size_t)n * BLK_SECTOR;
+
+	(void)dev;
+	if (lba + n > sectors
+			|| pread(fd, buf, len, (off_t)lba * BLK_SECTOR) != (ssize_t)len) {
+		return -1;
+	}
+	sim_disk.reads++;
+	sim_disk.read_blocks += n;
+	return 0;
+}
+
+static int file_write_begin(void *dev, uint32_t lba, uint32_t erase) {
+	(void)dev;
+	(void)erase;
+	next = lba;
+	sim_disk.writes++;
+	return lba < sectors ? 0 : -1;
+}
+
+static int file_write_block(void *dev, const uint8_t *buf) {
+	(void)dev;
+	if (next >= sectors || pwrite(fd, buf, BLK_SECTOR,
+			(off_t)next * BLK_SECTOR) != BLK_SECTOR) {
+		return -1;
+	}
+	next++;
+	sim_disk.write_blocks++;
+	return 0;
+}
+
+static int file_write_end(void *dev) {
+	(void)dev;
+	return 0;
+}
+
+static int file_sync(void *dev) {
+	(void)dev;
+	sim_disk.syncs++;
+	return fdatasync(fd) == 0 ? 0 : -1;
+}
+
+static const blk_ops_t file_ops = { file_read, file_write_begin,
+		file_write_block, file_write_end, file_sync };
+
+static void file_start(void) {
+}
+
+static int file_inserted(void) {
+	return sim_env("CAMSIM_NOCARD", NULL) == NULL;
+}
+
+static int file_connect(void) {
+	fd = sim_image_open(&sectors);
+	connected = fd >= 0;
+	return connected ? 0 : -1;
+}
+
+static void file_disconnect(void) {
+	connected = 0;
+}
+
+static int file_ready(void) {
+	return connected;
+}
+
+static int file_protect(void) {
+	return 0;
+}
+
+static uint32_t file_sectors(void) {
+	return sectors;
+}
+
+const blk_card_t blk_card = { BLK_CARD_FILE, &file_ops, NULL, file_start,
+		file_inserted, file_connect, file_disconnect, file_ready,
+		file_protect, file_sectors };
+
+#endif /* CAM_BLK_FILE */
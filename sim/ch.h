@@ -0,0 +1,240 @@
+/*
+ * ch.h
+ *
+ * Host simulation of the ChibiOS/RT 2.6 kernel API the firmware uses, on
+ * POSIX threads (kernel.c).
+ *
+ * Every ChibiOS thread is a host thread and priorities are ignored. One
+ * global lock stands in for the interrupt mask: chSysLock() takes it, and
+ * the simulated peripherals take it around their "ISRs", so I-class and
+ * S-class calls keep the meaning they have on target. All waiting is done
+ * on one condition variable under that lock.
+ */
+
+#ifndef _CH_H_
+#define _CH_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef intptr_t msg_t;             /* Mailboxes carry pointers */
+typedef int bool_t;
+typedef uint32_t systime_t;
+typedef int32_t cnt_t;
+typedef uint32_t tprio_t;
+typedef int32_t eventid_t;
+typedef uint32_t eventmask_t;
+typedef uint32_t flagsmask_t;
+typedef uint8_t stkalign_t;
+
+#define TRUE                1
+#define FALSE               0
+#define CH_SUCCESS          FALSE
+#define CH_FAILED           TRUE
+
+#define RDY_OK              0
+#define RDY_TIMEOUT         -1
+#define RDY_RESET           -2
+
+#define TIME_IMMEDIATE      ((systime_t)0)
+#define TIME_INFINITE       ((systime_t)-1)
+#define CH_FREQUENCY        1000
+#define S2ST(sec)           ((systime_t)((sec) * CH_FREQUENCY))
+#define MS2ST(msec)         ((systime_t)(((msec) * CH_FREQUENCY - 1UL) / 1000UL + 1UL))
+#define US2ST(usec)         ((systime_t)(((usec) * CH_FREQUENCY - 1UL) / 1000000UL + 1UL))
+
+#define LOWPRIO             2
+#define NORMALPRIO          64
+#define HIGHPRIO            127
+#define ABSPRIO             255
+
+#define ALL_EVENTS          ((eventmask_t)-1)
+#define EVENT_MASK(eid)     ((eventmask_t)(1 << (eid)))
+
+typedef msg_t (*tfunc_t)(void *);
+typedef void (*vtfunc_t)(void *);
+typedef void (*evhandler_t)(eventid_t);
+typedef void *(*memgetfunc_t)(size_t);
+
+#define SIM_MTX_DEPTH       8
+
+typedef struct Thread {
+	pthread_t p_tid;
+	const char *p_name;
+	tprio_t p_prio;
+	eventmask_t p_epending;
+	struct Mutex *p_mtxlist[SIM_MTX_DEPTH];
+	int p_mtxdepth;
+	tfunc_t p_func;
+	void *p_arg;
+} Thread;
+
+typedef struct Mutex {
+	Thread *m_owner;
+} Mutex;
+
+typedef struct {
+	cnt_t s_cnt;
+} Semaphore;
+
+typedef struct {
+	Semaphore bs_sem;
+} BinarySemaphore;
+
+typedef struct {
+	msg_t *mb_buffer;
+	msg_t *mb_top;
+	msg_t *mb_wrptr;
+	msg_t *mb_rdptr;
+	cnt_t mb_used;
+} Mailbox;
+
+struct pool_header {
+	struct pool_header *ph_next;
+};
+
+typedef struct {
+	struct pool_header *mp_next;
+	size_t mp_object_size;
+	memgetfunc_t mp_provider;
+} MemoryPool;
+
+typedef struct EventListener {
+	struct EventListener *el_next;
+	Thread *el_listener;
+	eventmask_t el_mask;
+	flagsmask_t el_flags;
+} EventListener;
+
+typedef struct EventSource {
+	EventListener *es_next;
+} EventSource;
+
+typedef struct VirtualTimer {
+	struct VirtualTimer *vt_next;
+	uint64_t vt_time;           /* Host microseconds */
+	vtfunc_t vt_func;
+	void *vt_par;
+} VirtualTimer;
+
+typedef struct memory_heap MemoryHeap;
+
+#define WORKING_AREA(s, n)          stkalign_t s[n]
+#define THD_WA_SIZE(n)              (n)
+#define MUTEX_DECL(name)            Mutex name = { NULL }
+#define _SEMAPHORE_DATA(name, n)    { n }
+#define SEMAPHORE_DECL(name, n)     Semaphore name = _SEMAPHORE_DATA(name, n)
+#define BSEMAPHORE_DECL(name, taken) BinarySemaphore name = { { (taken) ? 0 : 1 } }
+#define MAILBOX_DECL(name, buffer, size)                                    \
+	Mailbox name = { (msg_t *)(buffer), (msg_t *)(buffer) + (size),        \
+	                 (msg_t *)(buffer), (msg_t *)(buffer), 0 }
+#define MEMORYPOOL_DECL(name, size, provider)                               \
+	MemoryPool name = { NULL, size, provider }
+#define _EVENTSOURCE_DATA(name)     { NULL }
+#define EVENTSOURCE_DECL(name)      EventSource name = _EVENTSOURCE_DATA(name)
+
+#define chDbgAssert(c, func, msg)   do {                                   \
+	if (!(c)) {                                                             \
+		sim_panic(func);                                                    \
+	}                                                                       \
+} while (0)
+#define chDbgCheck(c, func)         chDbgAssert(c, #func, "")
+
+/* System */
+void chSysInit(void);
+void chSysHalt(void);
+void chSysLock(void);
+void chSysUnlock(void);
+#define chSysLockFromIsr()          chSysLock()
+#define chSysUnlockFromIsr()        chSysUnlock()
+systime_t chTimeNow(void);
+#define chTimeElapsedSince(start)   (chTimeNow() - (start))
+void sim_panic(const char *msg);
+
+/* Threads */
+Thread *chThdCreateStatic(void *wsp, size_t size, tprio_t prio, tfunc_t pf,
+		void *arg);
+Thread *chThdSelf(void);
+void chThdSleep(systime_t time);
+#define chThdSleepSeconds(sec)      chThdSleep(S2ST(sec))
+#define chThdSleepMilliseconds(ms)  chThdSleep(MS2ST(ms))
+#define chThdSleepMicroseconds(us)  sim_sleep_us(us)
+void sim_sleep_us(uint32_t us);
+void chThdYield(void);
+void chRegSetThreadName(const char *name);
+
+/* Mutexes */
+void chMtxInit(Mutex *mp);
+void chMtxLock(Mutex *mp);
+bool_t chMtxTryLock(Mutex *mp);
+Mutex *chMtxUnlock(void);
+
+/* Semaphores */
+void chSemInit(Semaphore *sp, cnt_t n);
+void chSemReset(Semaphore *sp, cnt_t n);
+msg_t chSemWait(Semaphore *sp);
+msg_t chSemWaitS(Semaphore *sp);
+msg_t chSemWaitTimeout(Semaphore *sp, systime_t time);
+msg_t chSemWaitTimeoutS(Semaphore *sp, systime_t time);
+void chSemSignal(Semaphore *sp);
+void chSemSignalI(Semaphore *sp);
+#define chSemGetCounterI(sp)        ((sp)->s_cnt)
+
+#define chBSemInit(bsp, taken)      chSemInit(&(bsp)->bs_sem, (taken) ? 0 : 1)
+void chBSemReset(BinarySemaphore *bsp, bool_t taken);
+#define chBSemResetI(bsp, taken)    ((bsp)->bs_sem.s_cnt = (taken) ? 0 : 1)
+#define chBSemWait(bsp)             chSemWait(&(bsp)->bs_sem)
+#define chBSemWaitS(bsp)            chSemWaitS(&(bsp)->bs_sem)
+#define chBSemWaitTimeout(bsp, t)   chSemWaitTimeout(&(bsp)->bs_sem, t)
+#define chBSemWaitTimeoutS(bsp, t)  chSemWaitTimeoutS(&(bsp)->bs_sem, t)
+void chBSemSignal(BinarySemaphore *bsp);
+void chBSemSignalI(BinarySemaphore *bsp);
+#define chBSemGetStateI(bsp)        ((bsp)->bs_sem.s_cnt > 0 ? FALSE : TRUE)
+
+/* Mailboxes */
+void chMBInit(Mailbox *mbp, msg_t *buf, cnt_t n);
+void chMBReset(Mailbox *mbp);
+msg_t chMBPost(Mailbox *mbp, msg_t msg, systime_t timeout);
+msg_t chMBPostI(Mailbox *mbp, msg_t msg);
+msg_t chMBFetch(Mailbox *mbp, msg_t *msgp, systime_t timeout);
+msg_t chMBFetchI(Mailbox *mbp, msg_t *msgp);
+#define chMBSizeI(mbp)              ((cnt_t)((mbp)->mb_top - (mbp)->mb_buffer))
+#define chMBGetUsedCountI(mbp)      ((mbp)->mb_used)
+#define chMBGetFreeCountI(mbp)      (chMBSizeI(mbp) - (mbp)->mb_used)
+
+/* Memory pools and heap */
+void chPoolInit(MemoryPool *mp, size_t size, memgetfunc_t provider);
+void chPoolLoadArray(MemoryPool *mp, void *p, size_t n);
+void *chPoolAlloc(MemoryPool *mp);
+void *chPoolAllocI(MemoryPool *mp);
+void chPoolFree(MemoryPool *mp, void *objp);
+void chPoolFreeI(MemoryPool *mp, void *objp);
+void *chHeapAlloc(MemoryHeap *heapp, size_t size);
+void chHeapFree(void *p);
+void *chCoreAlloc(size_t size);
+
+/* Events */
+#define chEvtInit(esp)              ((esp)->es_next = NULL)
+void chEvtRegisterMask(EventSource *esp, EventListener *elp,
+		eventmask_t mask);
+#define chEvtRegister(esp, elp, eid) chEvtRegisterMask(esp, elp, EVENT_MASK(eid))
+void chEvtUnregister(EventSource *esp, EventListener *elp);
+void chEvtBroadcastFlagsI(EventSource *esp, flagsmask_t flags);
+#define chEvtBroadcastI(esp)        chEvtBroadcastFlagsI(esp, 0)
+void chEvtBroadcastFlags(EventSource *esp, flagsmask_t flags);
+#define chEvtBroadcast(esp)         chEvtBroadcastFlags(esp, 0)
+void chEvtSignalI(Thread *tp, eventmask_t mask);
+void chEvtSignal(Thread *tp, eventmask_t mask);
+eventmask_t chEvtGetAndClearEvents(eventmask_t mask);
+eventmask_t chEvtWaitOne(eventmask_t mask);
+eventmask_t chEvtWaitAny(eventmask_t mask);
+eventmask_t chEvtWaitAnyTimeout(eventmask_t mask, systime_t time);
+void chEvtDispatch(const evhandler_t *handlers, eventmask_t mask);
+
+/* Virtual timers, run from the simulation's timer thread */
+void chVTSetI(VirtualTimer *vtp, systime_t delay, vtfunc_t vtfunc, void *par);
+void chVTResetI(VirtualTimer *vtp);
+bool_t chVTIsArmedI(VirtualTimer *vtp);
+
+#endif /* _CH_H_ */
@@ -0,0 +1,10 @@
+/*
+ * chprintf.h
+ *
+ * Host simulation: the firmware includes it but prints nothing.
+ */
+
+#ifndef _CHPRINTF_H_
+#define _CHPRINTF_H_
+
+#endif /* _CHPRINTF_H_ */
@@ -0,0 +1,258 @@
+/*
+ * dcmi.c
+ *
+ * DCMI model. The sensor free runs from dcmiStart(); a one-shot capture
+ * waits for the next VSYNC, takes one frame time to read the frame out and
+ * then calls frame_end_cb from the DCMI "interrupt", like the target
+ * driver. Data lands in the two DMA buffers in order and is cut off when
+ * the frame does not fit.
+ *
+ * Frames come from the CAMSIM_FRAMES files in turn, or are synthesised:
+ * a JPEG shell (SOI, APP0, stuffed entropy data, EOI) sized from the
+ * output resolution and quantiser programmed into the sensor. Frame rate
+ * follows CAMSIM_FPS, scaled for the sensor mode and clock divider the way
+ * ovemu_fps() works it out.
+ */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "sim.h"
+
+#define MAX_FILES   256
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static pthread_t tid;
+static int started;
+
+static uint64_t vsync0;
+static uint8_t *shot_buf[2];
+static uint32_t shot_n;
+static unsigned shot_gen;       /* Bumped by every arm and stop */
+static int shot_armed;
+
+static char *files[MAX_FILES];
+static unsigned nfiles, next_file;
+
+static uint32_t frames, truncated, aborted;
+static uint64_t frame_bytes;
+
+static int by_name(const void *a, const void *b) {
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void load_files(void) {
+	const char *spec = sim_env("CAMSIM_FRAMES", NULL);
+	char *list, *tok, *save = NULL, path[1024];
+	struct dirent *de;
+	DIR *d;
+
+	if (spec == NULL) {
+		return;
+	}
+	if ((d = opendir(spec)) != NULL) {
+		while ((de = readdir(d)) != NULL && nfiles < MAX_FILES) {
+			const char *dot = strrchr(de->d_name, '.');
+
+			if (dot != NULL && (strcasecmp(dot, ".jpg") == 0
+					|| strcasecmp(dot, ".jpeg") == 0)) {
+				snprintf(path, sizeof(path), "%s/%s", spec, de->d_name);
+				files[nfiles++] = strdup(path);
+			}
+		}
+		closedir(d);
+		qsort(files, nfiles, sizeof(files[0]), by_name);
+	} else {
+		list = strdup(spec);
+		for (tok = strtok_r(list, ":", &save); tok != NULL && nfiles < MAX_FILES;
+				tok = strtok_r(NULL, ":", &save)) {
+			files[nfiles++] = strdup(tok);
+		}
+		free(list);
+	}
+	if (nfiles == 0) {
+		fprintf(stderr, "camsim: no frames in %s\n", spec);
+	}
+}
+
+static void sensor_mode(uint32_t *w, uint32_t *h, uint8_t *qs, double *fps) {
+	ovemu_cfg_t c;
+
+	ovemu_decode(sim_sensor(), &c);
+	*w = c.width;
+	*h = c.height;
+	*qs = c.qs != 0 ? c.qs : 0x0C;    /* 0 is not a valid QS */
+	*fps = ovemu_fps(&c, (double)sim_env_int("CAMSIM_FPS", 15));
+}
+
+static size_t synth_frame(uint8_t *out, size_t max, uint32_t w, uint32_t h,
+		uint8_t qs) {
+	/* About 0.6 bit per pixel at QS 12, scaling with 1/QS, +-10%, after
+	 * the headers an OV2640 frame starts with (no tables) */
+	uint8_t head[] = {
+		0xFF, 0xD8, 0xFF, 0xE0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0x00,
+		0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00,
+		0xFF, 0xC0, 0x00, 0x11, 0x08, 0, 0, 0, 0, 0x03,
+		0x01, 0x21, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01,
+		0xFF, 0xDA, 0x00, 0x0C, 0x03, 0x01, 0x00, 0x02, 0x11, 0x03, 0x11,
+		0x00, 0x3F, 0x00
+	};
+	size_t n = (size_t)((double)w * h * 0.6 / 8 * 12 / qs);
+	size_t i;
+
+	n = n * (90 + rand() % 21) / 100;
+	if (n < 1024) {
+		n = 1024;
+	}
+	if (n > max) {
+		n = max;
+	}
+	head[25] = (uint8_t)(h >> 8);
+	head[26] = (uint8_t)h;
+	head[27] = (uint8_t)(w >> 8);
+	head[28] = (uint8_t)w;
+	memcpy(out, head, sizeof(head));
+	for (i = sizeof(head); i < n - 2; i++) {
+		out[i] = (uint8_t)rand();
+		if (out[i] == 0xFF) {
+			out[++i] = 0x00;
+		}
+	}
+	out[n - 2] = 0xFF;
+	out[n - 1] = 0xD9;
+	return n;
+}
+
+static size_t next_frame(uint8_t *out, size_t max, uint32_t w, uint32_t h,
+		uint8_t qs) {
+	size_t n = 0;
+	FILE *fp;
+
+	if (nfiles == 0) {
+		return synth_frame(out, max, w, h, qs);
+	}
+	if ((fp = fopen(files[next_file], "rb")) != NULL) {
+		n = fread(out, 1, max, fp);
+		fclose(fp);
+	}
+	next_file = (next_file + 1) % nfiles;
+	return n;
+}
+
+static int wait_until(uint64_t until, unsigned gen) {
+	/* Sleeps until the time has come, 0 if the capture was cancelled */
+	struct timespec ts;
+
+	while (shot_gen == gen && sim_now_us() < until) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += 1000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&cond, &lock, &ts);
+	}
+	return shot_gen == gen;
+}
+
+static void *dcmi_thread(void *arg) {
+	static uint8_t frame[1 << 20];
+	uint64_t now, period, vsync;
+	uint32_t w, h, n;
+	size_t len;
+	unsigned gen;
+	uint8_t qs;
+	double fps;
+
+	(void)arg;
+	pthread_setname_np(pthread_self(), "dcmi");
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		while (!shot_armed) {
+			pthread_cond_wait(&cond, &lock);
+		}
+		gen = shot_gen;
+		sensor_mode(&w, &h, &qs, &fps);
+		period = (uint64_t)(1000000 / fps);
+		now = sim_now_us();
+		vsync = vsync0 + (now - vsync0 + period - 1) / period * period;
+		if (!wait_until(vsync + period, gen)) {
+			aborted++;
+			continue;
+		}
+		n = shot_n;
+		len = next_frame(frame, sizeof(frame), w, h, qs);
+		if (len > 2 * (size_t)n) {
+			truncated++;
+			len = 2 * (size_t)n;
+		}
+		memcpy(shot_buf[0], frame, len < n ? len : n);
+		if (len > n) {
+			memcpy(shot_buf[1], frame + n, len - n);
+		}
+		frames++;
+		frame_bytes += len;
+		shot_armed = 0;
+		DCMID1.state = DCMI_READY;
+		pthread_mutex_unlock(&lock);
+		if (len > n && DCMID1.config->dma_xfer_end_cb != NULL) {
+			/* The DMA moved on to the second buffer */
+			DCMID1.config->dma_xfer_end_cb(&DCMID1);
+		}
+		if (DCMID1.config->frame_end_cb != NULL) {
+			DCMID1.config->frame_end_cb(&DCMID1);
+		}
+		pthread_mutex_lock(&lock);
+	}
+	return NULL;
+}
+
+void sim_dcmi_report(FILE *fp) {
+	fprintf(fp, "camsim: dcmi %u frames %.1f KB avg, %u truncated %u aborted\n",
+			frames, frames ? frame_bytes / 1024.0 / frames : 0.0, truncated,
+			aborted);
+}
+
+void dcmiStart(DCMIDriver *dcmip, const DCMIConfig *config) {
+	pthread_mutex_lock(&lock);
+	if (!started) {
+		load_files();
+		pthread_create(&tid, NULL, dcmi_thread, NULL);
+		started = 1;
+	}
+	if (dcmip->state != DCMI_READY && dcmip->state != DCMI_ACTIVE) {
+		vsync0 = sim_now_us();
+	}
+	dcmip->config = config;
+	if (dcmip->state != DCMI_ACTIVE) {
+		dcmip->state = DCMI_READY;
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void dcmiStop(DCMIDriver *dcmip) {
+	pthread_mutex_lock(&lock);
+	shot_armed = 0;
+	shot_gen++;
+	dcmip->state = DCMI_STOP;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+}
+
+void dcmiStartReceiveOneShot(DCMIDriver *dcmip, uint32_t n, uint8_t *rxbuf0,
+		uint8_t *rxbuf1) {
+	pthread_mutex_lock(&lock);
+	shot_buf[0] = rxbuf0;
+	shot_buf[1] = rxbuf1;
+	shot_n = n;
+	shot_armed = 1;
+	shot_gen++;
+	dcmip->state = DCMI_ACTIVE;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,11 @@
+/*
+ * evtimer.h
+ *
+ * Host simulation: the firmware includes it but polls the card with a
+ * VirtualTimer of its own.
+ */
+
+#ifndef _EVTIMER_H_
+#define _EVTIMER_H_
+
+#endif /* _EVTIMER_H_ */
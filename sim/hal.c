@@ -0,0 +1,225 @@
+/*
+ * hal.c
+ *
+ * PAL, I2C/SCCB, PWM, SPI and MMC stand-ins and the simulation set-up done
+ * from halInit(), see hal.h and sim.h.
+ */
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "sim.h"
+
+GPIO_TypeDef sim_gpio[5];
+I2CDriver I2CD1;
+PWMDriver PWMD1;
+SPIDriver SPID2;
+DCMIDriver DCMID1;
+
+static volatile uint64_t button_until;
+
+const char *sim_env(const char *name, const char *def) {
+	const char *v = getenv(name);
+
+	return v != NULL && *v != 0 ? v : def;
+}
+
+long sim_env_int(const char *name, long def) {
+	const char *v = getenv(name);
+
+	return v != NULL && *v != 0 ? strtol(v, NULL, 0) : def;
+}
+
+static void report(void) {
+	fprintf(stderr, "camsim: %.3f s\n", chTimeNow() / (double)CH_FREQUENCY);
+	sim_sccb_report(stderr);
+	sim_dcmi_report(stderr);
+	sim_disk_report(stderr);
+	sim_uart_report(stderr);
+}
+
+static void on_signal(int sig) {
+	if (sig == SIGUSR1) {
+		button_until = sim_now_us() + 300000;
+	} else {
+		exit(0);
+	}
+}
+
+static void *run_timer(void *arg) {
+	sim_sleep_us((uint32_t)(uintptr_t)arg * 1000);
+	exit(0);
+	return NULL;
+}
+
+void halInit(void) {
+	pthread_t tid;
+	long run_ms = (long)(atof(sim_env("CAMSIM_RUN_S", "0")) * 1000);
+
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	chTimeNow();
+	atexit(report);
+	signal(SIGUSR1, on_signal);
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	if (run_ms > 0) {
+		pthread_create(&tid, NULL, run_timer, (void *)(uintptr_t)run_ms);
+	}
+}
+
+/*
+ * PAL. Inputs read their pull-up unless driven by the simulation; PD2 is
+ * the camera button.
+ */
+void palSetPadMode(GPIO_TypeDef *port, unsigned pad, uint32_t mode) {
+	port->mode[pad] = mode;
+	if (mode & PAL_MODE_INPUT_PULLUP) {
+		port->idr |= (uint16_t)(1 << pad);
+	}
+}
+
+void palSetPad(GPIO_TypeDef *port, unsigned pad) {
+	port->odr |= (uint16_t)(1 << pad);
+}
+
+void palClearPad(GPIO_TypeDef *port, unsigned pad) {
+	port->odr &= (uint16_t)~(1 << pad);
+}
+
+void palTogglePad(GPIO_TypeDef *port, unsigned pad) {
+	port->odr ^= (uint16_t)(1 << pad);
+}
+
+uint8_t palReadPad(GPIO_TypeDef *port, unsigned pad) {
+	/* The button thread polls without sleeping; on target it shares the
+	 * CPU round robin, here it would spin a host core */
+	sim_sleep_us(1000);
+	if (port == GPIOD && pad == 2) {
+		return sim_now_us() >= button_until;
+	}
+	return (port->idr >> pad) & 1;
+}
+
+/*
+ * I2C with the OV2640 on it, modelled by ovemu.c. Each transaction takes
+ * the time its bits need at the configured clock.
+ */
+static ovemu_t sensor;
+
+const ovemu_t *sim_sensor(void) {
+	return &sensor;
+}
+
+void sim_sccb_report(FILE *fp) {
+	ovemu_cfg_t c, any;
+
+	fprintf(fp, "camsim: sccb %u writes (%u bank selects, %u redundant) %u reads"
+			" %u naks, bus %.1f ms\n", sensor.writes, sensor.bank_selects,
+			sensor.redundant, sensor.reads, sensor.naks, sensor.bus_ns / 1e6);
+	ovemu_decode(&sensor, &c);
+	fprintf(fp, "camsim: sensor ");
+	ovemu_print(&c, fp);
+	memset(&any, 0, sizeof(any));
+	ovemu_check(&c, &any, fp);
+}
+
+void i2cStart(I2CDriver *i2cp, const I2CConfig *config) {
+	i2cp->config = config;
+	chMtxInit(&i2cp->mutex);
+	ovemu_init(&sensor, config->clock_speed);
+}
+
+void i2cAcquireBus(I2CDriver *i2cp) {
+	chMtxLock(&i2cp->mutex);
+}
+
+void i2cReleaseBus(I2CDriver *i2cp) {
+	(void)i2cp;
+	chMtxUnlock();
+}
+
+msg_t i2cMasterTransmitTimeout(I2CDriver *i2cp, i2caddr_t addr,
+		const uint8_t *txbuf, size_t txbytes, uint8_t *rxbuf, size_t rxbytes,
+		systime_t timeout) {
+	uint32_t ns;
+	int rc;
+
+	(void)timeout;
+	rc = ovemu_xfer(&sensor, (uint8_t)addr, txbuf, txbytes, rxbuf, rxbytes,
+			&ns);
+	sim_sleep_us(ns / 1000);
+	if (rc != 0) {
+		i2cp->errors++;
+		return RDY_RESET;
+	}
+	return RDY_OK;
+}
+
+msg_t i2cMasterReceiveTimeout(I2CDriver *i2cp, i2caddr_t addr,
+		uint8_t *rxbuf, size_t rxbytes, systime_t timeout) {
+	/* The OV2640 only answers reads that name a register first */
+	(void)i2cp;
+	(void)addr;
+	(void)timeout;
+	memset(rxbuf, 0, rxbytes);
+	return RDY_RESET;
+}
+
+/*
+ * PWM
+ */
+void pwmStart(PWMDriver *pwmp, const PWMConfig *config) {
+	pwmp->config = config;
+}
+
+void pwmEnableChannel(PWMDriver *pwmp, unsigned channel, uint32_t width) {
+	(void)width;
+	pwmp->enabled |= 1u << channel;
+}
+
+void pwmDisableChannel(PWMDriver *pwmp, unsigned channel) {
+	pwmp->enabled &= ~(1u << channel);
+}
+
+/*
+ * RTC, the host clock
+ */
+RTCDriver RTCD1;
+
+uint32_t rtcGetTimeFat(RTCDriver *rtcp) {
+	time_t now = time(NULL);
+	struct tm tm;
+
+	(void)rtcp;
+	localtime_r(&now, &tm);
+	return ((uint32_t)(tm.tm_year - 80) << 25)
+			| ((uint32_t)(tm.tm_mon + 1) << 21) | ((uint32_t)tm.tm_mday << 16)
+			| ((uint32_t)tm.tm_hour << 11) | ((uint32_t)tm.tm_min << 5)
+			| ((uint32_t)tm.tm_sec >> 1);
+}
+
+/*
+ * DWT. Writing CYCCNT sets the count from then on, as on the core.
+ */
+CoreDebug_Type sim_coredebug;
+static DWT_Type dwt;
+static uint32_t dwt_last;
+static uint64_t dwt_base_us;
+
+DWT_Type *sim_dwt(void) {
+	uint64_t now = sim_now_us();
+
+	if (dwt.CYCCNT != dwt_last) {
+		dwt_base_us = now - (uint64_t)dwt.CYCCNT * 1000000 / STM32_SYSCLK;
+	}
+	if (dwt.CTRL & DWT_CTRL_CYCCNTENA_Msk) {
+		dwt.CYCCNT = (uint32_t)((now - dwt_base_us) * (STM32_SYSCLK / 1000000));
+	}
+	dwt_last = dwt.CYCCNT;
+	return &dwt;
+}
@@ -0,0 +1,260 @@
+/*
+ * hal.h
+ *
+ * Host simulation of the ChibiOS 2.6 HAL subset the firmware uses: PAL,
+ * I2C (SCCB), PWM, SPI, MMC over SPI and the DCMI driver. hal.c keeps pad
+ * states and puts I2C on the sensor model (ovemu.c), dcmi.c models the
+ * camera interface.
+ */
+
+#ifndef _HAL_H_
+#define _HAL_H_
+
+#include "ch.h"
+
+void halInit(void);
+
+/*
+ * PAL
+ */
+typedef struct {
+	uint32_t mode[16];
+	uint16_t odr;
+	uint16_t idr;
+} GPIO_TypeDef;
+
+extern GPIO_TypeDef sim_gpio[5];
+#define GPIOA                       (&sim_gpio[0])
+#define GPIOB                       (&sim_gpio[1])
+#define GPIOC                       (&sim_gpio[2])
+#define GPIOD                       (&sim_gpio[3])
+#define GPIOE                       (&sim_gpio[4])
+
+#define GPIOA_PIN2                  2
+#define GPIOA_PIN3                  3
+#define GPIOB_PIN12                 12
+#define GPIOB_PIN13                 13
+#define GPIOB_PIN14                 14
+#define GPIOB_PIN15                 15
+
+#define PAL_MODE_INPUT              0x01
+#define PAL_MODE_INPUT_PULLUP       0x02
+#define PAL_MODE_OUTPUT_PUSHPULL    0x04
+#define PAL_MODE_ALTERNATE(n)       (0x08 | ((n) << 8))
+#define PAL_STM32_OTYPE_OPENDRAIN   0x10
+#define PAL_STM32_OSPEED_HIGHEST    0x20
+
+void palSetPadMode(GPIO_TypeDef *port, unsigned pad, uint32_t mode);
+void palSetPad(GPIO_TypeDef *port, unsigned pad);
+void palClearPad(GPIO_TypeDef *port, unsigned pad);
+void palTogglePad(GPIO_TypeDef *port, unsigned pad);
+uint8_t palReadPad(GPIO_TypeDef *port, unsigned pad);
+
+/*
+ * I2C, addressed by the SCCB helpers only
+ */
+typedef uint16_t i2caddr_t;
+typedef enum { OPMODE_I2C = 1, OPMODE_SMBUS_DEVICE, OPMODE_SMBUS_HOST } i2copmode_t;
+typedef enum { STD_DUTY_CYCLE = 1, FAST_DUTY_CYCLE_2, FAST_DUTY_CYCLE_16_9 } i2cdutycycle_t;
+
+typedef struct {
+	i2copmode_t op_mode;
+	uint32_t clock_speed;
+	i2cdutycycle_t duty_cycle;
+} I2CConfig;
+
+typedef struct {
+	const I2CConfig *config;
+	Mutex mutex;
+	uint32_t errors;
+} I2CDriver;
+
+extern I2CDriver I2CD1;
+
+void i2cStart(I2CDriver *i2cp, const I2CConfig *config);
+void i2cAcquireBus(I2CDriver *i2cp);
+void i2cReleaseBus(I2CDriver *i2cp);
+msg_t i2cMasterTransmitTimeout(I2CDriver *i2cp, i2caddr_t addr,
+		const uint8_t *txbuf, size_t txbytes, uint8_t *rxbuf, size_t rxbytes,
+		systime_t timeout);
+msg_t i2cMasterReceiveTimeout(I2CDriver *i2cp, i2caddr_t addr,
+		uint8_t *rxbuf, size_t rxbytes, systime_t timeout);
+
+/*
+ * PWM, only the XCLK enable matters
+ */
+typedef enum { PWM_OUTPUT_DISABLED = 0, PWM_OUTPUT_ACTIVE_HIGH, PWM_OUTPUT_ACTIVE_LOW } pwmmode_t;
+typedef struct PWMDriver PWMDriver;
+typedef void (*pwmcallback_t)(PWMDriver *pwmp);
+
+typedef struct {
+	pwmmode_t mode;
+	pwmcallback_t callback;
+} PWMChannelConfig;
+
+typedef struct {
+	uint32_t frequency;
+	uint32_t period;
+	pwmcallback_t callback;
+	PWMChannelConfig channels[4];
+	uint16_t cr2;
+	uint16_t dier;
+} PWMConfig;
+
+struct PWMDriver {
+	const PWMConfig *config;
+	uint32_t enabled;
+};
+
+extern PWMDriver PWMD1;
+
+void pwmStart(PWMDriver *pwmp, const PWMConfig *config);
+void pwmEnableChannel(PWMDriver *pwmp, unsigned channel, uint32_t width);
+void pwmDisableChannel(PWMDriver *pwmp, unsigned channel);
+
+/*
+ * SPI and MMC over SPI. The card is the image file behind mmc.c.
+ */
+#define SPI_CR1_BR_0                0x0008
+#define SPI_CR1_BR_1                0x0010
+#define SPI_CR1_BR_2                0x0020
+
+typedef struct SPIDriver SPIDriver;
+
+typedef struct {
+	void (*end_cb)(SPIDriver *spip);
+	GPIO_TypeDef *ssport;
+	uint16_t sspad;
+	uint16_t cr1;
+} SPIConfig;
+
+struct SPIDriver {
+	const SPIConfig *config;
+};
+
+extern SPIDriver SPID2;
+
+/* Only the card is on SPI2: bytes sent go to its command parser (mmc.c) */
+void spiStart(SPIDriver *spip, const SPIConfig *config);
+void spiSelect(SPIDriver *spip);
+void spiUnselect(SPIDriver *spip);
+void spiSend(SPIDriver *spip, size_t n, const void *txbuf);
+void spiReceive(SPIDriver *spip, size_t n, void *rxbuf);
+
+typedef enum { BLK_UNINIT = 0, BLK_STOP, BLK_ACTIVE, BLK_CONNECTING,
+	BLK_DISCONNECTING, BLK_READY, BLK_READING, BLK_WRITING, BLK_SYNCING
+} blkstate_t;
+
+typedef struct {
+	SPIDriver *spip;
+	const SPIConfig *lscfg;
+	const SPIConfig *hscfg;
+} MMCConfig;
+
+typedef struct {
+	blkstate_t state;
+	const MMCConfig *config;
+	bool_t block_addresses;
+	uint32_t capacity;
+} MMCDriver;
+
+typedef MMCDriver BaseBlockDevice;
+
+extern MMCDriver MMCD1;             /* Defined by the firmware */
+
+void mmcObjectInit(MMCDriver *mmcp);
+void mmcStart(MMCDriver *mmcp, const MMCConfig *config);
+bool_t mmcConnect(MMCDriver *mmcp);
+bool_t mmcDisconnect(MMCDriver *mmcp);
+bool_t mmcIsCardInserted(MMCDriver *mmcp);
+bool_t mmcStartSequentialRead(MMCDriver *mmcp, uint32_t startblk);
+bool_t mmcSequentialRead(MMCDriver *mmcp, uint8_t *buffer);
+bool_t mmcStopSequentialRead(MMCDriver *mmcp);
+bool_t mmcStartSequentialWrite(MMCDriver *mmcp, uint32_t startblk);
+bool_t mmcSequentialWrite(MMCDriver *mmcp, const uint8_t *buffer);
+bool_t mmcStopSequentialWrite(MMCDriver *mmcp);
+bool_t mmcSync(MMCDriver *mmcp);
+#define mmcIsWriteProtected(mmcp)   FALSE
+#define mmcsdGetCardCapacity(mmcp)  ((mmcp)->capacity)
+#define blkIsInserted(bbdp)         mmcIsCardInserted(bbdp)
+#define blkGetDriverState(bbdp)     ((bbdp)->state)
+
+/*
+ * RTC, for FatFs time stamps: the host clock
+ */
+#define HAL_USE_RTC                 TRUE
+
+typedef struct {
+	int unused;
+} RTCDriver;
+
+extern RTCDriver RTCD1;
+
+uint32_t rtcGetTimeFat(RTCDriver *rtcp);
+
+/*
+ * DMA, only what the firmware declares
+ */
+typedef struct {
+	uint32_t ndtr;
+} stm32_dma_stream_t;
+
+#define dmaStreamGetTransactionSize(dmastp) ((dmastp)->ndtr)
+
+/*
+ * DCMI
+ */
+#define DCMI_CR_PCKPOL              0x0020
+#define DCMI_CR_HSPOL               0x0040
+#define DCMI_CR_VSPOL               0x0080
+#define DCMI_CR_JPEG                0x0008
+#define DCMI_CR_CM                  0x0002
+
+typedef struct DCMIDriver DCMIDriver;
+typedef void (*dcmicallback_t)(DCMIDriver *dcmip);
+
+typedef struct {
+	dcmicallback_t frame_end_cb;
+	dcmicallback_t dma_xfer_end_cb;
+	uint32_t cr;
+} DCMIConfig;
+
+typedef enum { DCMI_UNINIT = 0, DCMI_STOP, DCMI_READY, DCMI_ACTIVE } dcmistate_t;
+
+struct DCMIDriver {
+	dcmistate_t state;
+	const DCMIConfig *config;
+	const stm32_dma_stream_t *dmarx;
+};
+
+extern DCMIDriver DCMID1;
+
+void dcmiStart(DCMIDriver *dcmip, const DCMIConfig *config);
+void dcmiStop(DCMIDriver *dcmip);
+void dcmiStartReceiveOneShot(DCMIDriver *dcmip, uint32_t n, uint8_t *rxbuf0,
+		uint8_t *rxbuf1);
+
+/*
+ * Cortex-M4 cycle counter. Every access through DWT reloads CYCCNT from
+ * the host monotonic clock scaled to the core clock.
+ */
+#define STM32_SYSCLK                168000000
+
+typedef struct {
+	uint32_t CTRL;
+	uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct {
+	uint32_t DEMCR;
+} CoreDebug_Type;
+
+#define DWT_CTRL_CYCCNTENA_Msk      0x00000001
+#define CoreDebug_DEMCR_TRCENA_Msk  0x01000000
+
+DWT_Type *sim_dwt(void);
+extern CoreDebug_Type sim_coredebug;
+#define DWT                         sim_dwt()
+#define CoreDebug                   (&sim_coredebug)
+
+#endif /* _HAL_H_ */
@@ -0,0 +1,136 @@
+/*
+ * image.c
+ *
+ * The SD card image of the simulation, the CAMSIM_IMAGE file, shared by
+ * the card backends: the MMC driver model (mmc.c) and the plain file
+ * device (blkfile.c). A missing image is created sparse and formatted
+ * FAT32 (no partition table, 4 KB clusters) when the card is first
+ * connected, so a first run needs no tools.
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sim.h"
+
+#define SECTOR      512
+#define SPC         8       /* Sectors per cluster */
+#define RESERVED    32
+
+sim_disk_t sim_disk;
+
+static int fd = -1;
+
+static void put16(uint8_t *p, uint16_t v) {
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+	put16(p, (uint16_t)v);
+	put16(p + 2, (uint16_t)(v >> 16));
+}
+
+static int format(int f, uint32_t n) {
+	/* FAT32 with the root directory in cluster 2 and a backup boot sector
+	 * at 6, as mkfs.vfat lays it out */
+	uint8_t s[SECTOR];
+	uint32_t fatsz = (n - RESERVED + 128 * SPC + 1) / (128 * SPC + 2);
+	uint32_t clusters = (n - RESERVED - 2 * fatsz) / SPC;
+	uint32_t k;
+
+	if (clusters < 65526) {
+		fprintf(stderr, "camsim: image too small for FAT32\n");
+		return -1;
+	}
+	memset(s, 0, sizeof(s));
+	s[0] = 0xEB;
+	s[1] = 0x58;
+	s[2] = 0x90;
+	memcpy(&s[3], "CAMSIM  ", 8);
+	put16(&s[11], SECTOR);
+	s[13] = SPC;
+	put16(&s[14], RESERVED);
+	s[16] = 2;
+	s[21] = 0xF8;
+	put16(&s[24], 63);
+	put16(&s[26], 255);
+	put32(&s[32], n);
+	put32(&s[36], fatsz);
+	put32(&s[44], 2);
+	put16(&s[48], 1);
+	put16(&s[50], 6);
+	s[64] = 0x80;
+	s[66] = 0x29;
+	put32(&s[67], (uint32_t)time(NULL));
+	memcpy(&s[71], "CAMSIM     ", 11);
+	memcpy(&s[82], "FAT32   ", 8);
+	s[510] = 0x55;
+	s[511] = 0xAA;
+	if (pwrite(f, s, SECTOR, 0) != SECTOR
+			|| pwrite(f, s, SECTOR, 6 * SECTOR) != SECTOR) {
+		return -1;
+	}
+
+	memset(s, 0, sizeof(s));
+	put32(&s[0], 0x41615252);
+	put32(&s[484], 0x61417272);
+	put32(&s[488], clusters - 1);
+	put32(&s[492], 3);
+	put32(&s[508], 0xAA550000);
+	if (pwrite(f, s, SECTOR, 1 * SECTOR) != SECTOR
+			|| pwrite(f, s, SECTOR, 7 * SECTOR) != SECTOR) {
+		return -1;
+	}
+
+	memset(s, 0, sizeof(s));
+	put32(&s[0], 0x0FFFFFF8);
+	put32(&s[4], 0x0FFFFFFF);
+	put32(&s[8], 0x0FFFFFFF);
+	for (k = 0; k < 2; k++) {
+		if (pwrite(f, s, SECTOR, (off_t)(RESERVED + k * fatsz) * SECTOR)
+				!= SECTOR) {
+			return -1;
+		}
+	}
+	fprintf(stderr, "camsim: formatted %u MB FAT32, %u clusters\n",
+			(unsigned)(n / 2048), (unsigned)clusters);
+	return 0;
+}
+
+int sim_image_open(uint32_t *sectors) {
+	/* The image's descriptor, or -1 */
+	const char *path = sim_env("CAMSIM_IMAGE", "sd.img");
+	off_t size;
+
+	if (fd < 0) {
+		fd = open(path, O_RDWR);
+	}
+	if (fd < 0) {
+		size = (off_t)sim_env_int("CAMSIM_IMAGE_MB", 512) << 20;
+		fd = open(path, O_RDWR | O_CREAT, 0644);
+		if (fd < 0 || ftruncate(fd, size) != 0
+				|| format(fd, (uint32_t)(size / SECTOR)) != 0) {
+			perror(path);
+			if (fd >= 0) {
+				close(fd);
+			}
+			fd = -1;
+			return -1;
+		}
+	}
+	*sectors = (uint32_t)(lseek(fd, 0, SEEK_END) / SECTOR);
+	return fd;
+}
+
+void sim_disk_report(FILE *fp) {
+	fprintf(fp, "camsim: card %u reads (%llu blocks) %u writes (%llu blocks)"
+			" %u pre-erased %u refused %u syncs, %.2f s busy\n",
+			sim_disk.reads, (unsigned long long)sim_disk.read_blocks,
+			sim_disk.writes, (unsigned long long)sim_disk.write_blocks,
+			sim_disk.erases, sim_disk.refused, sim_disk.syncs,
+			sim_disk.busy_us / 1e6);
+}
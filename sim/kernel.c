@@ -0,0 +1,581 @@
+/*
+ * kernel.c
+ *
+ * ChibiOS/RT kernel API on POSIX threads, see ch.h.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ch.h"
+#include "sim.h"
+
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sim_cond;
+static __thread Thread *self;
+static uint64_t epoch;
+static VirtualTimer *vtlist;
+
+uint64_t sim_now_us(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static void clock_init(void) {
+	pthread_condattr_t ca;
+
+	if (epoch != 0) {
+		return;
+	}
+	epoch = sim_now_us();
+	pthread_condattr_init(&ca);
+	pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+	pthread_cond_init(&sim_cond, &ca);
+}
+
+static uint64_t deadline(systime_t time) {
+	return time == TIME_INFINITE ? UINT64_MAX :
+			sim_now_us() + (uint64_t)time * (1000000 / CH_FREQUENCY);
+}
+
+static int sim_wait(uint64_t until) {
+	/* Waits for any state change, 0 once until has passed */
+	struct timespec ts;
+
+	if (until == UINT64_MAX) {
+		pthread_cond_wait(&sim_cond, &sim_lock);
+		return 1;
+	}
+	if (sim_now_us() >= until) {
+		return 0;
+	}
+	ts.tv_sec = (time_t)(until / 1000000);
+	ts.tv_nsec = (long)(until % 1000000) * 1000;
+	return pthread_cond_timedwait(&sim_cond, &sim_lock, &ts) != ETIMEDOUT;
+}
+
+static void sim_wakeup(void) {
+	pthread_cond_broadcast(&sim_cond);
+}
+
+void sim_panic(const char *msg) {
+	fprintf(stderr, "camsim: panic: %s\n", msg);
+	abort();
+}
+
+/*
+ * System
+ */
+static void *vt_thread(void *arg);
+
+void chSysInit(void) {
+	pthread_t tid;
+
+	clock_init();
+	self = calloc(1, sizeof(Thread));
+	self->p_tid = pthread_self();
+	self->p_name = "main";
+	self->p_prio = NORMALPRIO;
+	pthread_create(&tid, NULL, vt_thread, NULL);
+}
+
+void chSysHalt(void) {
+	sim_panic("chSysHalt");
+}
+
+void chSysLock(void) {
+	pthread_mutex_lock(&sim_lock);
+}
+
+void chSysUnlock(void) {
+	pthread_mutex_unlock(&sim_lock);
+}
+
+systime_t chTimeNow(void) {
+	clock_init();
+	return (systime_t)((sim_now_us() - epoch) / (1000000 / CH_FREQUENCY));
+}
+
+/*
+ * Threads
+ */
+static void *thread_start(void *arg) {
+	Thread *tp = arg;
+
+	self = tp;
+	tp->p_func(tp->p_arg);
+	return NULL;
+}
+
+Thread *chThdCreateStatic(void *wsp, size_t size, tprio_t prio, tfunc_t pf,
+		void *arg) {
+	/* The working area only documents the target stack size */
+	Thread *tp = calloc(1, sizeof(Thread));
+
+	(void)wsp;
+	(void)size;
+	tp->p_prio = prio;
+	tp->p_func = pf;
+	tp->p_arg = arg;
+	pthread_create(&tp->p_tid, NULL, thread_start, tp);
+	return tp;
+}
+
+Thread *chThdSelf(void) {
+	if (self == NULL) {
+		/* A simulation thread calling into the kernel */
+		self = calloc(1, sizeof(Thread));
+		self->p_tid = pthread_self();
+		self->p_name = "sim";
+	}
+	return self;
+}
+
+void sim_sleep_us(uint32_t us) {
+	struct timespec ts;
+
+	ts.tv_sec = us / 1000000;
+	ts.tv_nsec = (long)(us % 1000000) * 1000;
+	while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+	}
+}
+
+void chThdSleep(systime_t time) {
+	sim_sleep_us(time * (1000000 / CH_FREQUENCY));
+}
+
+void chThdYield(void) {
+	sched_yield();
+}
+
+void chRegSetThreadName(const char *name) {
+	chThdSelf()->p_name = name;
+	pthread_setname_np(pthread_self(), name);
+}
+
+/*
+ * Mutexes, not recursive, released in reverse order as on target
+ */
+void chMtxInit(Mutex *mp) {
+	mp->m_owner = NULL;
+}
+
+void chMtxLock(Mutex *mp) {
+	Thread *tp = chThdSelf();
+
+	chSysLock();
+	chDbgAssert(mp->m_owner != tp, "chMtxLock(), #1", "recursive lock");
+	while (mp->m_owner != NULL) {
+		sim_wait(UINT64_MAX);
+	}
+	mp->m_owner = tp;
+	chDbgAssert(tp->p_mtxdepth < SIM_MTX_DEPTH, "chMtxLock(), #2", "depth");
+	tp->p_mtxlist[tp->p_mtxdepth++] = mp;
+	chSysUnlock();
+}
+
+bool_t chMtxTryLock(Mutex *mp) {
+	Thread *tp = chThdSelf();
+	bool_t ok = FALSE;
+
+	chSysLock();
+	if (mp->m_owner == NULL && tp->p_mtxdepth < SIM_MTX_DEPTH) {
+		mp->m_owner = tp;
+		tp->p_mtxlist[tp->p_mtxdepth++] = mp;
+		ok = TRUE;
+	}
+	chSysUnlock();
+	return ok;
+}
+
+Mutex *chMtxUnlock(void) {
+	Thread *tp = chThdSelf();
+	Mutex *mp;
+
+	chSysLock();
+	chDbgAssert(tp->p_mtxdepth > 0, "chMtxUnlock(), #1", "not owner");
+	mp = tp->p_mtxlist[--tp->p_mtxdepth];
+	mp->m_owner = NULL;
+	sim_wakeup();
+	chSysUnlock();
+	return mp;
+}
+
+/*
+ * Semaphores
+ */
+void chSemInit(Semaphore *sp, cnt_t n) {
+	sp->s_cnt = n;
+}
+
+void chSemReset(Semaphore *sp, cnt_t n) {
+	chSysLock();
+	sp->s_cnt = n;
+	sim_wakeup();
+	chSysUnlock();
+}
+
+msg_t chSemWaitTimeoutS(Semaphore *sp, systime_t time) {
+	uint64_t until;
+
+	if (sp->s_cnt <= 0) {
+		if (time == TIME_IMMEDIATE) {
+			return RDY_TIMEOUT;
+		}
+		until = deadline(time);
+		while (sp->s_cnt <= 0) {
+			if (!sim_wait(until) && sp->s_cnt <= 0) {
+				return RDY_TIMEOUT;
+			}
+		}
+	}
+	sp->s_cnt--;
+	return RDY_OK;
+}
+
+msg_t chSemWaitS(Semaphore *sp) {
+	return chSemWaitTimeoutS(sp, TIME_INFINITE);
+}
+
+msg_t chSemWaitTimeout(Semaphore *sp, systime_t time) {
+	msg_t msg;
+
+	chSysLock();
+	msg = chSemWaitTimeoutS(sp, time);
+	chSysUnlock();
+	return msg;
+}
+
+msg_t chSemWait(Semaphore *sp) {
+	return chSemWaitTimeout(sp, TIME_INFINITE);
+}
+
+void chSemSignalI(Semaphore *sp) {
+	sp->s_cnt++;
+	sim_wakeup();
+}
+
+void chSemSignal(Semaphore *sp) {
+	chSysLock();
+	chSemSignalI(sp);
+	chSysUnlock();
+}
+
+void chBSemReset(BinarySemaphore *bsp, bool_t taken) {
+	chSemReset(&bsp->bs_sem, taken ? 0 : 1);
+}
+
+void chBSemSignalI(BinarySemaphore *bsp) {
+	if (bsp->bs_sem.s_cnt < 1) {
+		bsp->bs_sem.s_cnt = 1;
+		sim_wakeup();
+	}
+}
+
+void chBSemSignal(BinarySemaphore *bsp) {
+	chSysLock();
+	chBSemSignalI(bsp);
+	chSysUnlock();
+}
+
+/*
+ * Mailboxes
+ */
+void chMBInit(Mailbox *mbp, msg_t *buf, cnt_t n) {
+	mbp->mb_buffer = mbp->mb_wrptr = mbp->mb_rdptr = buf;
+	mbp->mb_top = buf + n;
+	mbp->mb_used = 0;
+}
+
+void chMBReset(Mailbox *mbp) {
+	chSysLock();
+	mbp->mb_wrptr = mbp->mb_rdptr = mbp->mb_buffer;
+	mbp->mb_used = 0;
+	sim_wakeup();
+	chSysUnlock();
+}
+
+msg_t chMBPostI(Mailbox *mbp, msg_t msg) {
+	if (chMBGetFreeCountI(mbp) <= 0) {
+		return RDY_TIMEOUT;
+	}
+	*mbp->mb_wrptr++ = msg;
+	if (mbp->mb_wrptr >= mbp->mb_top) {
+		mbp->mb_wrptr = mbp->mb_buffer;
+	}
+	mbp->mb_used++;
+	sim_wakeup();
+	return RDY_OK;
+}
+
+msg_t chMBPost(Mailbox *mbp, msg_t msg, systime_t timeout) {
+	uint64_t until = deadline(timeout);
+	msg_t rdymsg;
+
+	chSysLock();
+	while ((rdymsg = chMBPostI(mbp, msg)) != RDY_OK
+			&& timeout != TIME_IMMEDIATE && sim_wait(until)) {
+	}
+	chSysUnlock();
+	return rdymsg;
+}
+
+msg_t chMBFetchI(Mailbox *mbp, msg_t *msgp) {
+	if (mbp->mb_used <= 0) {
+		return RDY_TIMEOUT;
+	}
+	*msgp = *mbp->mb_rdptr++;
+	if (mbp->mb_rdptr >= mbp->mb_top) {
+		mbp->mb_rdptr = mbp->mb_buffer;
+	}
+	mbp->mb_used--;
+	sim_wakeup();
+	return RDY_OK;
+}
+
+msg_t chMBFetch(Mailbox *mbp, msg_t *msgp, systime_t timeout) {
+	uint64_t until = deadline(timeout);
+	msg_t rdymsg;
+
+	chSysLock();
+	while ((rdymsg = chMBFetchI(mbp, msgp)) != RDY_OK
+			&& timeout != TIME_IMMEDIATE && sim_wait(until)) {
+	}
+	chSysUnlock();
+	return rdymsg;
+}
+
+/*
+ * Memory pools and heap
+ */
+void chPoolInit(MemoryPool *mp, size_t size, memgetfunc_t provider) {
+	mp->mp_next = NULL;
+	mp->mp_object_size = size;
+	mp->mp_provider = provider;
+}
+
+void *chPoolAllocI(MemoryPool *mp) {
+	struct pool_header *php = mp->mp_next;
+
+	if (php != NULL) {
+		mp->mp_next = php->ph_next;
+	} else if (mp->mp_provider != NULL) {
+		php = mp->mp_provider(mp->mp_object_size);
+	}
+	return php;
+}
+
+void *chPoolAlloc(MemoryPool *mp) {
+	void *objp;
+
+	chSysLock();
+	objp = chPoolAllocI(mp);
+	chSysUnlock();
+	return objp;
+}
+
+void chPoolFreeI(MemoryPool *mp, void *objp) {
+	struct pool_header *php = objp;
+
+	php->ph_next = mp->mp_next;
+	mp->mp_next = php;
+}
+
+void chPoolFree(MemoryPool *mp, void *objp) {
+	chSysLock();
+	chPoolFreeI(mp, objp);
+	chSysUnlock();
+}
+
+void chPoolLoadArray(MemoryPool *mp, void *p, size_t n) {
+	while (n-- > 0) {
+		chPoolFree(mp, p);
+		p = (uint8_t *)p + mp->mp_object_size;
+	}
+}
+
+void *chHeapAlloc(MemoryHeap *heapp, size_t size) {
+	(void)heapp;
+	return malloc(size);
+}
+
+void chHeapFree(void *p) {
+	free(p);
+}
+
+void *chCoreAlloc(size_t size) {
+	return malloc(size);
+}
+
+/*
+ * Events
+ */
+void chEvtRegisterMask(EventSource *esp, EventListener *elp,
+		eventmask_t mask) {
+	Thread *tp = chThdSelf();
+
+	chSysLock();
+	elp->el_next = esp->es_next;
+	esp->es_next = elp;
+	elp->el_listener = tp;
+	elp->el_mask = mask;
+	elp->el_flags = 0;
+	chSysUnlock();
+}
+
+void chEvtUnregister(EventSource *esp, EventListener *elp) {
+	EventListener **pp;
+
+	chSysLock();
+	for (pp = &esp->es_next; *pp != NULL; pp = &(*pp)->el_next) {
+		if (*pp == elp) {
+			*pp = elp->el_next;
+			break;
+		}
+	}
+	chSysUnlock();
+}
+
+void chEvtSignalI(Thread *tp, eventmask_t mask) {
+	tp->p_epending |= mask;
+	sim_wakeup();
+}
+
+void chEvtSignal(Thread *tp, eventmask_t mask) {
+	chSysLock();
+	chEvtSignalI(tp, mask);
+	chSysUnlock();
+}
+
+void chEvtBroadcastFlagsI(EventSource *esp, flagsmask_t flags) {
+	EventListener *elp;
+
+	for (elp = esp->es_next; elp != NULL; elp = elp->el_next) {
+		elp->el_flags |= flags;
+		chEvtSignalI(elp->el_listener, elp->el_mask);
+	}
+}
+
+void chEvtBroadcastFlags(EventSource *esp, flagsmask_t flags) {
+	chSysLock();
+	chEvtBroadcastFlagsI(esp, flags);
+	chSysUnlock();
+}
+
+eventmask_t chEvtGetAndClearEvents(eventmask_t mask) {
+	Thread *tp = chThdSelf();
+	eventmask_t m;
+
+	chSysLock();
+	m = tp->p_epending & mask;
+	tp->p_epending &= ~m;
+	chSysUnlock();
+	return m;
+}
+
+static eventmask_t wait_events(eventmask_t mask, int one, systime_t time) {
+	Thread *tp = chThdSelf();
+	uint64_t until = deadline(time);
+	eventmask_t m;
+
+	chSysLock();
+	while ((m = tp->p_epending & mask) == 0) {
+		if (time == TIME_IMMEDIATE || !sim_wait(until)) {
+			m = tp->p_epending & mask;
+			break;
+		}
+	}
+	if (one) {
+		m &= ~(m - 1);
+	}
+	tp->p_epending &= ~m;
+	chSysUnlock();
+	return m;
+}
+
+eventmask_t chEvtWaitOne(eventmask_t mask) {
+	return wait_events(mask, 1, TIME_INFINITE);
+}
+
+eventmask_t chEvtWaitAny(eventmask_t mask) {
+	return wait_events(mask, 0, TIME_INFINITE);
+}
+
+eventmask_t chEvtWaitAnyTimeout(eventmask_t mask, systime_t time) {
+	return wait_events(mask, 0, time);
+}
+
+void chEvtDispatch(const evhandler_t *handlers, eventmask_t mask) {
+	eventid_t eid = 0;
+
+	while (mask) {
+		if (mask & EVENT_MASK(eid)) {
+			mask &= ~EVENT_MASK(eid);
+			handlers[eid](eid);
+		}
+		eid++;
+	}
+}
+
+/*
+ * Virtual timers. As in ChibiOS 2.6 the callback runs with the lock
+ * released and takes it itself.
+ */
+void chVTSetI(VirtualTimer *vtp, systime_t delay, vtfunc_t vtfunc,
+		void *par) {
+	VirtualTimer **pp;
+
+	vtp->vt_time = sim_now_us() + (uint64_t)delay * (1000000 / CH_FREQUENCY);
+	vtp->vt_func = vtfunc;
+	vtp->vt_par = par;
+	for (pp = &vtlist; *pp != NULL && (*pp)->vt_time <= vtp->vt_time;
+			pp = &(*pp)->vt_next) {
+	}
+	vtp->vt_next = *pp;
+	*pp = vtp;
+	sim_wakeup();
+}
+
+void chVTResetI(VirtualTimer *vtp) {
+	VirtualTimer **pp;
+
+	for (pp = &vtlist; *pp != NULL; pp = &(*pp)->vt_next) {
+		if (*pp == vtp) {
+			*pp = vtp->vt_next;
+			break;
+		}
+	}
+	vtp->vt_func = NULL;
+}
+
+bool_t chVTIsArmedI(VirtualTimer *vtp) {
+	return vtp->vt_func != NULL;
+}
+
+static void *vt_thread(void *arg) {
+	VirtualTimer *vtp;
+	vtfunc_t fn;
+
+	(void)arg;
+	chRegSetThreadName("vt");
+	chSysLock();
+	for (;;) {
+		vtp = vtlist;
+		if (vtp == NULL || vtp->vt_time > sim_now_us()) {
+			sim_wait(vtp == NULL ? UINT64_MAX : vtp->vt_time);
+			continue;
+		}
+		vtlist = vtp->vt_next;
+		fn = vtp->vt_func;
+		vtp->vt_func = NULL;
+		chSysUnlock();
+		fn(vtp->vt_par);
+		chSysLock();
+	}
+	return NULL;
+}
@@ -0,0 +1,217 @@
+/*
+ * mmc.c
+ *
+ * The MMC over SPI driver of the simulation, with the card being the image
+ * file (image.c). The firmware's own disk layer (diskio.c, with the
+ * sector cache and block layer) runs on top as on the target. Every read
+ * or write sequence costs the command overhead plus the per block time, so
+ * the counts of commands and blocks are what the card would have seen.
+ * Written blocks the card was not told to pre-erase (ACMD23, sent over the
+ * SPI calls) cost CAMSIM_SD_ERASE_US more each; CAMSIM_SD_NO_ACMD23 makes
+ * the card refuse it like an MMC card does.
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "sim.h"
+
+#define SECTOR      512
+
+static int fd = -1;
+static MMCDriver *card;             /* Connected, for the SPI side */
+static uint64_t cmd_us, block_us, erase_us;
+
+static uint32_t seq_lba, seq_n, seq_erase;
+static uint64_t seq_us;
+static uint8_t spi_cmd[6], spi_n, spi_r1 = 0xFF, spi_app;
+
+static void card_time(uint64_t us) {
+	struct timespec ts = { (time_t)(us / 1000000), (long)(us % 1000000) * 1000 };
+
+	sim_disk.busy_us += us;
+	nanosleep(&ts, NULL);
+}
+
+static int image_open(MMCDriver *mmcp) {
+	cmd_us = (uint64_t)sim_env_int("CAMSIM_SD_CMD_US", 100);
+	block_us = (uint64_t)sim_env_int("CAMSIM_SD_BLOCK_US", 250);
+	erase_us = (uint64_t)sim_env_int("CAMSIM_SD_ERASE_US", 100);
+	fd = sim_image_open(&mmcp->capacity);
+	return fd < 0 ? -1 : 0;
+}
+
+void mmcObjectInit(MMCDriver *mmcp) {
+	mmcp->state = BLK_STOP;
+	mmcp->config = NULL;
+}
+
+void mmcStart(MMCDriver *mmcp, const MMCConfig *config) {
+	mmcp->config = config;
+	mmcp->state = BLK_ACTIVE;
+}
+
+bool_t mmcIsCardInserted(MMCDriver *mmcp) {
+	(void)mmcp;
+	return sim_env("CAMSIM_NOCARD", NULL) == NULL;
+}
+
+bool_t mmcConnect(MMCDriver *mmcp) {
+	if (!mmcIsCardInserted(mmcp) || image_open(mmcp) != 0) {
+		return CH_FAILED;
+	}
+	mmcp->state = BLK_READY;
+	mmcp->block_addresses = TRUE;
+	card = mmcp;
+	return CH_SUCCESS;
+}
+
+bool_t mmcDisconnect(MMCDriver *mmcp) {
+	mmcp->state = BLK_ACTIVE;
+	return CH_SUCCESS;
+}
+
+static bool_t seq_start(MMCDriver *mmcp, uint32_t startblk, blkstate_t st) {
+	if (mmcp->state != BLK_READY || startblk >= mmcp->capacity) {
+		return CH_FAILED;
+	}
+	mmcp->state = st;
+	seq_lba = startblk;
+	seq_n = 0;
+	seq_us = cmd_us;
+	return CH_SUCCESS;
+}
+
+static bool_t seq_stop(MMCDriver *mmcp, blkstate_t st) {
+	if (mmcp->state != st) {
+		return CH_FAILED;
+	}
+	mmcp->state = BLK_READY;
+	seq_erase = 0;
+	card_time(seq_us);
+	return CH_SUCCESS;
+}
+
+bool_t mmcStartSequentialRead(MMCDriver *mmcp, uint32_t startblk) {
+	return seq_start(mmcp, startblk, BLK_READING);
+}
+
+bool_t mmcSequentialRead(MMCDriver *mmcp, uint8_t *buffer) {
+	if (mmcp->state != BLK_READING || seq_lba + seq_n >= mmcp->capacity
+			|| pread(fd, buffer, SECTOR, (off_t)(seq_lba + seq_n) * SECTOR)
+			!= SECTOR) {
+		return CH_FAILED;
+	}
+	seq_n++;
+	seq_us += block_us;
+	sim_disk.read_blocks++;
+	return CH_SUCCESS;
+}
+
+bool_t mmcStopSequentialRead(MMCDriver *mmcp) {
+	sim_disk.reads++;
+	return seq_stop(mmcp, BLK_READING);
+}
+
+bool_t mmcStartSequentialWrite(MMCDriver *mmcp, uint32_t startblk) {
+	return seq_start(mmcp, startblk, BLK_WRITING);
+}
+
+bool_t mmcSequentialWrite(MMCDriver *mmcp, const uint8_t *buffer) {
+	if (mmcp->state != BLK_WRITING || seq_lba + seq_n >= mmcp->capacity
+			|| pwrite(fd, buffer, SECTOR, (off_t)(seq_lba + seq_n) * SECTOR)
+			!= SECTOR) {
+		return CH_FAILED;
+	}
+	seq_us += block_us + (seq_n < seq_erase ? 0 : erase_us);
+	seq_n++;
+	sim_disk.write_blocks++;
+	return CH_SUCCESS;
+}
+
+bool_t mmcStopSequentialWrite(MMCDriver *mmcp) {
+	sim_disk.writes++;
+	return seq_stop(mmcp, BLK_WRITING);
+}
+
+/*
+ * The SPI side of the card, for the commands the driver has no call for:
+ * CMD55 and ACMD23, answered with R1 on the next byte read. The data
+ * transfers themselves go through the calls above.
+ */
+void spiStart(SPIDriver *spip, const SPIConfig *config) {
+	spip->config = config;
+}
+
+void spiSelect(SPIDriver *spip) {
+	(void)spip;
+	spi_n = 0;
+}
+
+void spiUnselect(SPIDriver *spip) {
+	(void)spip;
+	spi_r1 = 0xFF;
+}
+
+static uint8_t spi_command(uint8_t cmd, uint32_t arg) {
+	uint8_t app = spi_app;
+
+	spi_app = 0;
+	card_time(cmd_us);
+	if (card == NULL || card->state != BLK_READY) {
+		return 0x04;                /* Illegal command */
+	}
+	if (cmd == 55) {
+		spi_app = 1;
+		return 0x00;
+	}
+	if (app && cmd == 23 && sim_env("CAMSIM_SD_NO_ACMD23", NULL) == NULL) {
+		seq_erase = arg & 0x7FFFFF;
+		sim_disk.erases++;
+		return 0x00;
+	}
+	sim_disk.refused++;
+	return 0x04;
+}
+
+void spiSend(SPIDriver *spip, size_t n, const void *txbuf) {
+	const uint8_t *p = txbuf;
+
+	(void)spip;
+	while (n-- > 0) {
+		if (spi_n == 0 && (*p & 0xC0) != 0x40) {
+			p++;
+			continue;
+		}
+		spi_cmd[spi_n++] = *p++;
+		if (spi_n == sizeof(spi_cmd)) {
+			spi_r1 = spi_command(spi_cmd[0] & 0x3F,
+					(uint32_t)spi_cmd[1] << 24 | (uint32_t)spi_cmd[2] << 16
+					| (uint32_t)spi_cmd[3] << 8 | spi_cmd[4]);
+			spi_n = 0;
+		}
+	}
+}
+
+void spiReceive(SPIDriver *spip, size_t n, void *rxbuf) {
+	uint8_t *p = rxbuf;
+
+	(void)spip;
+	while (n-- > 0) {
+		*p++ = spi_r1;
+		spi_r1 = 0xFF;
+	}
+}
+
+bool_t mmcSync(MMCDriver *mmcp) {
+	if (mmcp->state != BLK_READY) {
+		return CH_FAILED;
+	}
+	sim_disk.syncs++;
+	return fdatasync(fd) == 0 ? CH_SUCCESS : CH_FAILED;
+}
@@ -0,0 +1,136 @@
+/*
+ * ovcheck.c
+ *
+ * Replays the OV2640 register sequences of the firmware against the
+ * register model (ovemu.h) through the real SCCB.c and OV2640.c, and
+ * checks what each one leaves the sensor configured for:
+ *
+ *   init       the cam_init() sequence of main.c, capture resolution
+ *   WxH        cam_set_resolution() to each size table after init
+ *
+ * Every line gives the SCCB writes, how many of them only selected a bank
+ * or rewrote the value already there, and the bus time at the 100 kHz the
+ * firmware runs I2C at; the delays cam_init() sleeps are listed apart.
+ * Exits non-zero when any sequence misses its configuration.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "SCCB.h"
+#include "OV2640.h"
+#include "ovemu.h"
+
+#define I2C_CLOCK       100000
+
+/* The I2C driver, straight onto the model */
+I2CDriver I2CD1;
+static ovemu_t sensor;
+
+void i2cAcquireBus(I2CDriver *i2cp) {
+	(void)i2cp;
+}
+
+void i2cReleaseBus(I2CDriver *i2cp) {
+	(void)i2cp;
+}
+
+msg_t i2cMasterTransmitTimeout(I2CDriver *i2cp, i2caddr_t addr,
+		const uint8_t *txbuf, size_t txbytes, uint8_t *rxbuf, size_t rxbytes,
+		systime_t timeout) {
+	uint32_t ns;
+
+	(void)i2cp;
+	(void)timeout;
+	return ovemu_xfer(&sensor, (uint8_t)addr, txbuf, txbytes, rxbuf, rxbytes,
+			&ns) == 0 ? RDY_OK : RDY_RESET;
+}
+
+static unsigned cam_init(void) {
+	/* Same tables in the same order as cam_init() in main.c; returns the
+	 * milliseconds it sleeps in between */
+	unsigned err = 0;
+
+	err |= cam_write_array(ov2640_reset_regs);
+	err |= cam_write_array(ov2640_jpeg_init_regs);
+	err |= cam_write_array(ov2640_yuv422_regs);
+	err |= cam_write_reg(0xFF, 0x01);
+	err |= cam_write_reg(0x15, 0x00);
+	err |= cam_write_array(ov2640_jpeg_regs);
+	err |= cam_write_array(ov2640_1024x768_regs);
+	err |= cam_write_array(ov2640_jpeg_regs);
+	err |= cam_write_array(ov2640_normal);
+	err |= cam_write_array(ov2640_autolight);
+	if (err) {
+		printf("init: SCCB write failed\n");
+	}
+	return 250 + 100;
+}
+
+static int report(const char *name, const ovemu_t *before, unsigned sleep_ms,
+		const ovemu_cfg_t *want) {
+	ovemu_cfg_t c;
+	int bad;
+
+	ovemu_decode(&sensor, &c);
+	printf("%-10s %4u writes %3u bank %3u redundant %6.2f ms bus",
+			name, sensor.writes - before->writes,
+			sensor.bank_selects - before->bank_selects,
+			sensor.redundant - before->redundant,
+			(sensor.bus_ns - before->bus_ns) / 1e6);
+	if (sleep_ms) {
+		printf(" + %u ms sleep", sleep_ms);
+	}
+	printf("  ");
+	ovemu_print(&c, stdout);
+	bad = ovemu_check(&c, want, stdout);
+	printf("%-10s %s\n", "", bad ? "FAIL" : "ok");
+	return bad != 0;
+}
+
+int main(void) {
+	static const struct {
+		const char *name;
+		const struct regval_list *regs;
+		uint16_t width;
+		uint16_t height;
+	} sizes[] = {
+		{ "320x240", ov2640_320x240_regs, 320, 240 },
+		{ "352x288", ov2640_352x288_regs, 352, 288 },
+		{ "640x480", ov2640_640x480_regs, 640, 480 },
+		{ "800x600", ov2640_800x600_regs, 800, 600 },
+		{ "1024x768", ov2640_1024x768_regs, 1024, 768 },
+		{ "1280x1024", ov2640_1280x1024_regs, 1280, 1024 },
+		{ "1600x1200", ov2640_1600x1200_regs, 1600, 1200 },
+	};
+	ovemu_t before, inited;
+	ovemu_cfg_t want;
+	unsigned sleep_ms, i;
+	int fail = 0;
+
+	ovemu_init(&sensor, I2C_CLOCK);
+	memset(&want, 0, sizeof(want));
+	want.width = 1024;
+	want.height = 768;
+	want.format = OVEMU_FMT_JPEG;
+	want.qs = OV2640_QS_DEFAULT;
+
+	before = sensor;
+	sleep_ms = cam_init();
+	fail |= report("init", &before, sleep_ms, &want);
+	inited = sensor;
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		/* cam_set_resolution() of main.c */
+		sensor = inited;
+		before = sensor;
+		cam_write_array(sizes[i].regs);
+		cam_write_array(ov2640_jpeg_regs);
+		cam_set_quality(OV2640_QS_DEFAULT);
+		want.width = sizes[i].width;
+		want.height = sizes[i].height;
+		fail |= report(sizes[i].name, &before, 0, &want);
+	}
+	return fail;
+}
@@ -0,0 +1,208 @@
+/*
+ * ovemu.c
+ *
+ * OV2640 register model, see ovemu.h. Power-on values are only kept for
+ * the registers the decoder looks at; everything else reads 0 until
+ * written.
+ */
+#include <string.h>
+
+#include "ovemu.h"
+
+/* DSP bank */
+#define R_QS            0x44
+#define R_ZMOW          0x5A
+#define R_ZMOH          0x5B
+#define R_ZMHH          0x5C
+#define R_HSIZE8        0xC0
+#define R_VSIZE8        0xC1
+#define R_IMAGE_MODE    0xDA
+#define R_RESET         0xE0
+/* Sensor bank */
+#define R_CLKRC         0x11
+#define R_COM7          0x12
+/* Both */
+#define R_BANK          0xFF
+
+#define COM7_SRST       0x80
+#define COM7_CIF        0x10
+#define COM7_SVGA       0x40
+#define COM7_COLORBAR   0x02
+
+static void defaults(ovemu_t *e) {
+	memset(e->regs, 0, sizeof(e->regs));
+	e->regs[0][R_QS] = 0x0C;
+	e->regs[0][R_ZMOW] = 0x90;      /* 1600x1200 */
+	e->regs[0][R_ZMOH] = 0x2C;
+	e->regs[0][R_ZMHH] = 0x05;
+	e->regs[0][R_HSIZE8] = 0xC8;
+	e->regs[0][R_VSIZE8] = 0x96;
+	e->regs[0][R_RESET] = 0x04;
+	e->regs[0][R_BANK] = e->regs[1][R_BANK] = 0x7F;
+}
+
+void ovemu_init(ovemu_t *e, uint32_t clock_hz) {
+	memset(e, 0, sizeof(*e));
+	e->clock_hz = clock_hz;
+	defaults(e);
+}
+
+void ovemu_reset(ovemu_t *e) {
+	/* As COM7 SRST: registers back to defaults, the bank selection stays */
+	uint8_t sel = e->regs[0][R_BANK];
+
+	defaults(e);
+	e->regs[0][R_BANK] = e->regs[1][R_BANK] = sel;
+	e->resets++;
+}
+
+static uint8_t bank(const ovemu_t *e) {
+	return e->regs[0][R_BANK] & 1;
+}
+
+int ovemu_xfer(ovemu_t *e, uint8_t addr, const uint8_t *tx, size_t ntx,
+		uint8_t *rx, size_t nrx, uint32_t *ns) {
+	/* One write, or write then repeated start read. Address and data bytes
+	 * are 9 bits with the ACK, plus start and stop. Returns -1 on NAK. */
+	uint32_t bits = (uint32_t)(1 + ntx) * 9 + 2;
+	uint8_t *r;
+	size_t i;
+
+	if (nrx > 0) {
+		bits += (uint32_t)(1 + nrx) * 9 + 1;
+	}
+	*ns = (uint32_t)((uint64_t)bits * 1000000000 / e->clock_hz);
+	e->bus_ns += *ns;
+	if (addr != OVEMU_ADDR || ntx == 0) {
+		e->naks++;
+		return -1;
+	}
+	if (ntx >= 2) {
+		e->writes++;
+		r = &e->regs[bank(e)][tx[0]];
+		if (tx[0] == R_BANK) {
+			e->bank_selects++;
+			e->redundant += *r == tx[1];
+			e->regs[0][R_BANK] = e->regs[1][R_BANK] = tx[1];
+		} else if (bank(e) == OVEMU_BANK_SENSOR && tx[0] == R_COM7
+				&& (tx[1] & COM7_SRST)) {
+			ovemu_reset(e);
+		} else {
+			e->redundant += *r == tx[1];
+			*r = tx[1];
+		}
+	}
+	if (nrx > 0) {
+		e->reads++;
+		for (i = 0; i < nrx; i++) {
+			rx[i] = e->regs[bank(e)][(uint8_t)(tx[0] + i)];
+		}
+	}
+	return 0;
+}
+
+uint8_t ovemu_reg(const ovemu_t *e, uint8_t bank, uint8_t reg) {
+	return e->regs[bank & 1][reg];
+}
+
+void ovemu_decode(const ovemu_t *e, ovemu_cfg_t *c) {
+	const uint8_t *dsp = e->regs[OVEMU_BANK_DSP];
+	const uint8_t *sen = e->regs[OVEMU_BANK_SENSOR];
+	uint8_t mode = dsp[R_IMAGE_MODE];
+
+	c->width = (uint16_t)((((dsp[R_ZMHH] & 0x03) << 8) | dsp[R_ZMOW]) * 4);
+	c->height = (uint16_t)((((dsp[R_ZMHH] & 0x04) << 6) | dsp[R_ZMOH]) * 4);
+	c->in_width = (uint16_t)(dsp[R_HSIZE8] * 8);
+	c->in_height = (uint16_t)(dsp[R_VSIZE8] * 8);
+	if (sen[R_COM7] & COM7_SVGA) {
+		c->win_width = 800;
+		c->win_height = 600;
+	} else if (sen[R_COM7] & COM7_CIF) {
+		c->win_width = 400;
+		c->win_height = 296;
+	} else {
+		c->win_width = 1600;
+		c->win_height = 1200;
+	}
+	if (mode & 0x10) {
+		c->format = OVEMU_FMT_JPEG;
+	} else if ((mode & 0x0C) == 0x04) {
+		c->format = OVEMU_FMT_RAW10;
+	} else if ((mode & 0x0C) == 0x08) {
+		c->format = OVEMU_FMT_RGB565;
+	} else {
+		c->format = OVEMU_FMT_YUV422;
+	}
+	c->qs = dsp[R_QS];
+	c->clkdiv = (uint8_t)((sen[R_CLKRC] & 0x3F) + 1);
+	c->bank = bank(e);
+	c->colorbar = (sen[R_COM7] & COM7_COLORBAR) != 0;
+	c->dsp_reset = dsp[R_RESET];
+}
+
+double ovemu_fps(const ovemu_cfg_t *c, double uxga_fps) {
+	/* The SVGA and CIF modes read out a quarter and a sixteenth of the
+	 * array and run at two and four times the UXGA rate */
+	double fps = uxga_fps / c->clkdiv;
+
+	if (c->win_width == 800) {
+		fps *= 2;
+	} else if (c->win_width == 400) {
+		fps *= 4;
+	}
+	return fps;
+}
+
+const char *ovemu_format_name(uint8_t format) {
+	static const char *const names[] = {
+		"?", "YUV422", "RAW10", "RGB565", "JPEG"
+	};
+
+	return format <= OVEMU_FMT_JPEG ? names[format] : "?";
+}
+
+void ovemu_print(const ovemu_cfg_t *c, FILE *fp) {
+	fprintf(fp, "%ux%u %s qs %u, dsp in %ux%u, window %ux%u, clk /%u, %s bank",
+			c->width, c->height, ovemu_format_name(c->format), c->qs,
+			c->in_width, c->in_height, c->win_width, c->win_height, c->clkdiv,
+			c->bank == OVEMU_BANK_DSP ? "dsp" : "sensor");
+	if (c->colorbar) {
+		fprintf(fp, ", COLOUR BAR");
+	}
+	if (c->dsp_reset) {
+		fprintf(fp, ", DSP RESET 0x%02X", c->dsp_reset);
+	}
+	fprintf(fp, "\n");
+}
+
+int ovemu_check(const ovemu_cfg_t *c, const ovemu_cfg_t *want, FILE *fp) {
+	/* Checks the fields of want that are not zero, and always that the
+	 * image fits through the pipeline and the sensor is streaming real
+	 * image data. Returns the number of mismatches, each one reported. */
+	int bad = 0;
+
+#define CHECK(cond, ...) \
+	do { if (!(cond)) { fprintf(fp, "  " __VA_ARGS__); bad++; } } while (0)
+
+	CHECK(!want->width || c->width == want->width,
+			"width %u, expected %u\n", c->width, want->width);
+	CHECK(!want->height || c->height == want->height,
+			"height %u, expected %u\n", c->height, want->height);
+	CHECK(!want->format || c->format == want->format,
+			"format %s, expected %s\n", ovemu_format_name(c->format),
+			ovemu_format_name(want->format));
+	CHECK(!want->qs || c->qs == want->qs,
+			"qs %u, expected %u\n", c->qs, want->qs);
+	CHECK(!want->clkdiv || c->clkdiv == want->clkdiv,
+			"clock divider %u, expected %u\n", c->clkdiv, want->clkdiv);
+	CHECK(c->width <= c->in_width && c->height <= c->in_height,
+			"output %ux%u larger than the DSP input %ux%u\n", c->width,
+			c->height, c->in_width, c->in_height);
+	CHECK(c->in_width <= c->win_width && c->in_height <= c->win_height,
+			"DSP input %ux%u larger than the sensor window %ux%u\n",
+			c->in_width, c->in_height, c->win_width, c->win_height);
+	CHECK(!c->colorbar, "colour bar test pattern enabled\n");
+	CHECK(!c->dsp_reset, "DSP held in reset (0x%02X)\n", c->dsp_reset);
+#undef CHECK
+	return bad;
+}
@@ -0,0 +1,70 @@
+/*
+ * ovemu.h
+ *
+ * Register level model of the OV2640 behind SCCB.
+ *
+ * Keeps both register banks (0xFF selects DSP or sensor), applies the COM7
+ * software reset, counts transactions and the bus time they take, and
+ * decodes the configuration the registers add up to: output size and
+ * format, JPEG quality, sensor window and clock divider. ovemu_check()
+ * compares that against what a register sequence is meant to leave behind,
+ * so a reordered or trimmed init table can be proven equivalent on the host.
+ */
+
+#ifndef OVEMU_H_
+#define OVEMU_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define OVEMU_ADDR          (0x60 >> 1)
+
+#define OVEMU_BANK_DSP      0
+#define OVEMU_BANK_SENSOR   1
+
+/* Output formats, from the DSP IMAGE_MODE register */
+#define OVEMU_FMT_YUV422    1
+#define OVEMU_FMT_RAW10     2
+#define OVEMU_FMT_RGB565    3
+#define OVEMU_FMT_JPEG      4
+
+typedef struct {
+	uint8_t regs[2][256];
+	uint32_t clock_hz;
+	/* Statistics */
+	uint32_t writes;
+	uint32_t reads;
+	uint32_t naks;
+	uint32_t bank_selects;
+	uint32_t redundant;     /* Writes that left the register as it was */
+	uint32_t resets;
+	uint64_t bus_ns;
+} ovemu_t;
+
+typedef struct {
+	uint16_t width;         /* DSP output, ZMOW/ZMOH */
+	uint16_t height;
+	uint16_t in_width;      /* DSP input, HSIZE8/VSIZE8 */
+	uint16_t in_height;
+	uint16_t win_width;     /* Sensor window of the COM7 mode */
+	uint16_t win_height;
+	uint8_t format;
+	uint8_t qs;
+	uint8_t clkdiv;         /* Pixel clock divider, CLKRC + 1 */
+	uint8_t bank;           /* Bank left selected */
+	uint8_t colorbar;       /* COM7 test pattern on */
+	uint8_t dsp_reset;      /* RESET bits still held */
+} ovemu_cfg_t;
+
+void ovemu_init(ovemu_t *e, uint32_t clock_hz);
+void ovemu_reset(ovemu_t *e);
+int ovemu_xfer(ovemu_t *e, uint8_t addr, const uint8_t *tx, size_t ntx,
+		uint8_t *rx, size_t nrx, uint32_t *ns);
+uint8_t ovemu_reg(const ovemu_t *e, uint8_t bank, uint8_t reg);
+void ovemu_decode(const ovemu_t *e, ovemu_cfg_t *c);
+double ovemu_fps(const ovemu_cfg_t *c, double uxga_fps);
+const char *ovemu_format_name(uint8_t format);
+void ovemu_print(const ovemu_cfg_t *c, FILE *fp);
+int ovemu_check(const ovemu_cfg_t *c, const ovemu_cfg_t *want, FILE *fp);
+
+#endif /* OVEMU_H_ */
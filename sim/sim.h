@@ -0,0 +1,59 @@
+/*
+ * sim.h
+ *
+ * Controls and statistics of the host simulation. Everything is configured
+ * through CAMSIM_* environment variables, as the firmware owns main():
+ *
+ *   CAMSIM_FRAMES      JPEG files to capture, ':' separated, or a directory
+ *                      of them; synthetic frames sized from the sensor
+ *                      resolution and quality when unset
+ *   CAMSIM_FPS         sensor frame rate at full resolution (15)
+ *   CAMSIM_IMAGE       card image, FAT32 formatted on first use (sd.img)
+ *   CAMSIM_IMAGE_MB    size of a new card image (512, at least 260)
+ *   CAMSIM_NOCARD      start with no card inserted
+ *   CAMSIM_SD_CMD_US   card command overhead per disk access (100)
+ *   CAMSIM_SD_BLOCK_US card time per 512 byte block (250, SPI at 18 MHz)
+ *   CAMSIM_LINK        also make the host link reachable under this path
+ *   CAMSIM_RUN_S       exit after this many seconds
+ *
+ * SIGUSR1 presses the camera button for 300 ms. Statistics of every
+ * simulated peripheral are printed to stderr on exit.
+ */
+
+#ifndef SIM_H_
+#define SIM_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ovemu.h"
+
+uint64_t sim_now_us(void);
+const char *sim_env(const char *name, const char *def);
+long sim_env_int(const char *name, long def);
+
+/* The OV2640 model behind SCCB */
+const ovemu_t *sim_sensor(void);
+
+/* The card image (image.c) and what the card backend did with it */
+typedef struct {
+	uint32_t reads;
+	uint32_t writes;
+	uint32_t syncs;
+	uint32_t erases;
+	uint32_t refused;
+	uint64_t read_blocks;
+	uint64_t write_blocks;
+	uint64_t busy_us;
+} sim_disk_t;
+
+extern sim_disk_t sim_disk;
+
+int sim_image_open(uint32_t *sectors);
+
+void sim_sccb_report(FILE *fp);
+void sim_dcmi_report(FILE *fp);
+void sim_disk_report(FILE *fp);
+void sim_uart_report(FILE *fp);
+
+#endif /* SIM_H_ */
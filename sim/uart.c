@@ -0,0 +1,66 @@
+/*
+ * uart.c
+ *
+ * Host link of the simulation: uartdma.h on the master side of a
+ * pseudo-terminal, through the host tools' ttystream. The host tools open
+ * the slave like the USB serial adapter on the bench, and writes are paced
+ * to the negotiated baud rate the way the USART would shift them out.
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "sim.h"
+#include "ttystream.h"
+#include "uartdma.h"
+
+static ttystream_t host;
+
+stream_t *uartdmaStart(uint32_t baud) {
+	const char *alias = sim_env("CAMSIM_LINK", NULL);
+	struct termios tio;
+	int m, s;
+
+	m = posix_openpt(O_RDWR | O_NOCTTY);
+	if (m < 0 || grantpt(m) != 0 || unlockpt(m) != 0) {
+		perror("camsim: posix_openpt");
+		exit(1);
+	}
+	/* Keeping the slave open means reads never see the hangup between two
+	 * host tool runs; raw so nothing is echoed or translated */
+	s = open(ptsname(m), O_RDWR | O_NOCTTY);
+	if (s < 0 || tcgetattr(s, &tio) != 0) {
+		perror("camsim: open slave");
+		exit(1);
+	}
+	cfmakeraw(&tio);
+	tcsetattr(s, TCSANOW, &tio);
+
+	fprintf(stderr, "camsim: host link on %s\n", ptsname(m));
+	if (alias != NULL) {
+		unlink(alias);
+		if (symlink(ptsname(m), alias) != 0) {
+			perror(alias);
+		}
+	}
+	ttystream_init(&host, m, 0, baud);
+	return &host.s;
+}
+
+void uartdmaGetStats(uartdma_stats_t *st) {
+	st->rx_bytes = host.rx_bytes;
+	st->tx_bytes = host.tx_bytes;
+	st->rx_overruns = 0;
+	st->line_errors = 0;
+	st->irqs = 0;
+}
+
+void sim_uart_report(FILE *fp) {
+	fprintf(fp, "camsim: uart %u bytes in, %u bytes out at %u baud\n",
+			host.rx_bytes, host.tx_bytes, host.baud);
+}
@@ -0,0 +1,98 @@
+#include "storage.h"
+#include "proto.h"
+
+void stg_init(stg_queue_t *q) {
+	q->n = 0;
+	stg_clear(q);
+}
+
+void stg_clear(stg_queue_t *q) {
+	uint8_t i;
+
+	q->peak = q->n;
+	q->batched = 0;
+	for (i = 0; i < STG_CLASSES; i++) {
+		q->cls[i].n = 0;
+		q->cls[i].wait_sum = 0;
+		q->cls[i].wait_max = 0;
+	}
+}
+
+int stg_push(stg_queue_t *q, uint8_t cls, uint8_t kind, void *p,
+		uint32_t now) {
+	/* Returns -1 when the queue is full */
+	uint8_t i;
+
+	if (q->n == STG_QUEUE_SIZE || cls >= STG_CLASSES) {
+		return -1;
+	}
+	/* Behind everything of the same or a more urgent class */
+	for (i = q->n; i > 0 && q->ent[i - 1].cls > cls; i--) {
+		q->ent[i] = q->ent[i - 1];
+	}
+	q->ent[i].p = p;
+	q->ent[i].t = now;
+	q->ent[i].cls = cls;
+	q->ent[i].kind = kind;
+	if (++q->n > q->peak) {
+		q->peak = q->n;
+	}
+	return 0;
+}
+
+static void *remove_at(stg_queue_t *q, uint8_t i, uint32_t now) {
+	stg_class_t *c = &q->cls[q->ent[i].cls];
+	uint32_t wait = now - q->ent[i].t;
+	void *p = q->ent[i].p;
+
+	c->n++;
+	c->wait_sum += wait;
+	if (wait > c->wait_max) {
+		c->wait_max = wait;
+	}
+	q->n--;
+	for (; i < q->n; i++) {
+		q->ent[i] = q->ent[i + 1];
+	}
+	return p;
+}
+
+void *stg_pop(stg_queue_t *q, uint8_t *kind, uint32_t now) {
+	/* Most urgent request or NULL */
+	if (q->n == 0) {
+		return NULL;
+	}
+	*kind = q->ent[0].kind;
+	return remove_at(q, 0, now);
+}
+
+void *stg_take(stg_queue_t *q, uint8_t kind, uint32_t now) {
+	/* Next request of the given kind, whatever its class, or NULL */
+	uint8_t i;
+
+	for (i = 0; i < q->n; i++) {
+		if (q->ent[i].kind == kind) {
+			q->batched++;
+			return remove_at(q, i, now);
+		}
+	}
+	return NULL;
+}
+
+uint16_t stg_put(uint8_t *out, const stg_queue_t *q) {
+	uint16_t n = 7;
+	uint8_t i;
+
+	out[0] = q->n;
+	out[1] = q->peak;
+	proto_put32(&out[2], q->batched);
+	out[6] = STG_CLASSES;
+	for (i = 0; i < STG_CLASSES; i++) {
+		proto_put32(&out[n], q->cls[i].n);
+		proto_put32(&out[n + 4], q->cls[i].n
+				? q->cls[i].wait_sum / q->cls[i].n : 0);
+		proto_put32(&out[n + 8], q->cls[i].wait_max);
+		n += 12;
+	}
+	return n;
+}
@@ -0,0 +1,71 @@
+/*
+ * storage.h
+ *
+ * Request queue of the storage thread. The card is only touched by one
+ * thread, which takes requests in order of class:
+ *
+ *   STG_CONTROL      card inserted or removed
+ *   STG_INTERACTIVE  what the host is waiting on: question text, tallies,
+ *                    indexing, download reads
+ *   STG_BULK         image saves and answer commits
+ *
+ * and in order of arrival within a class. A request is not preempted, so
+ * an interactive one waits for at most the bulk write in progress instead
+ * of every write queued ahead of it. Requests of a kind that can share
+ * an open file are taken out together with stg_take() and served as a
+ * batch.
+ *
+ * The queue counts per class the requests served and their mean and
+ * longest wait from stg_push() to being taken. PROTO_CMD_STORAGE returns
+ *
+ *   ACK depth8 peak8 batched32 classes8 { n32 mean_ms32 max_ms32 } * classes
+ *       cache card
+ *
+ * with cache the disk sector cache counters (sc_put(), sectcache.h) and
+ * card those of the block device under it (blk_put(), blkdev.h), and
+ * clears all of them when its argument is 1.
+ */
+
+#ifndef STORAGE_H_
+#define STORAGE_H_
+
+#include <stdint.h>
+
+#define STG_CONTROL         0
+#define STG_INTERACTIVE     1
+#define STG_BULK            2
+#define STG_CLASSES         3
+
+#define STG_QUEUE_SIZE      16
+#define STG_STATS_SIZE      (7 + 12 * STG_CLASSES)
+
+typedef struct {
+	void *p;
+	uint32_t t;         /* ms, when queued */
+	uint8_t cls;
+	uint8_t kind;
+} stg_ent_t;
+
+typedef struct {
+	uint32_t n;
+	uint32_t wait_sum;
+	uint32_t wait_max;
+} stg_class_t;
+
+typedef struct {
+	stg_ent_t ent[STG_QUEUE_SIZE];  /* By class, then by arrival */
+	uint8_t n;
+	uint8_t peak;
+	uint32_t batched;
+	stg_class_t cls[STG_CLASSES];
+} stg_queue_t;
+
+void stg_init(stg_queue_t *q);
+int stg_push(stg_queue_t *q, uint8_t cls, uint8_t kind, void *p,
+		uint32_t now);
+void *stg_pop(stg_queue_t *q, uint8_t *kind, uint32_t now);
+void *stg_take(stg_queue_t *q, uint8_t kind, uint32_t now);
+void stg_clear(stg_queue_t *q);
+uint16_t stg_put(uint8_t *out, const stg_queue_t *q);
+
+#endif /* STORAGE_H_ */
@@ -0,0 +1,40 @@
+/*
+ * stream.h
+ *
+ * Byte stream the host link runs over. The firmware binds it to the DMA
+ * driven USART2 (uartdma.c); the host tools bind it to a pseudo-terminal
+ * (host/ttystream.c), so everything above it runs unchanged on Linux.
+ *
+ * read() waits up to timeout_ms for at least one byte and then returns what
+ * is buffered, up to n. write() queues all n bytes, blocking while the
+ * transmit buffer is full; it is not reentrant, callers serialise frames.
+ * flush() returns once the last queued byte has left the wire.
+ */
+
+#ifndef STREAM_H_
+#define STREAM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define STREAM_INFINITE     0xFFFFFFFF
+
+typedef struct stream stream_t;
+
+struct stream_vmt {
+	size_t (*read)(stream_t *sp, uint8_t *bp, size_t n, uint32_t timeout_ms);
+	size_t (*write)(stream_t *sp, const uint8_t *bp, size_t n);
+	void (*flush)(stream_t *sp);
+	int (*set_baud)(stream_t *sp, uint32_t baud);
+};
+
+struct stream {
+	const struct stream_vmt *vmt;
+};
+
+#define streamRead(sp, bp, n, t)    ((sp)->vmt->read(sp, bp, n, t))
+#define streamWrite(sp, bp, n)      ((sp)->vmt->write(sp, bp, n))
+#define streamFlush(sp)             ((sp)->vmt->flush(sp))
+#define streamSetBaud(sp, b)        ((sp)->vmt->set_baud(sp, b))
+
+#endif /* STREAM_H_ */
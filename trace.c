@@ -0,0 +1,74 @@
+#include "trace.h"
+#include "proto.h"
+
+#if defined(CAM_TRACE)
+trace_ring_t trace_ring;
+#endif
+
+void trace_put(trace_ring_t *r, uint32_t t, uint8_t ev, uint32_t arg) {
+	/* LDREX/STREX on the Cortex-M4, safe against any interrupt */
+	uint32_t seq = __atomic_fetch_add(&r->head, 1, __ATOMIC_RELAXED);
+	trace_slot_t *s = &r->slot[seq & (TRACE_SIZE - 1)];
+
+	s->seq = 0;
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	s->t = t;
+	s->ev = ev | (arg << 8);
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	s->seq = seq + 1;
+}
+
+uint8_t trace_dump(const trace_ring_t *r, uint32_t from, uint8_t *out,
+		uint8_t max, uint32_t *first) {
+	/* Copies up to max events from sequence number from on into out and
+	 * returns how many. Stops at a slot still being written; the host
+	 * asks again later.
+	 */
+	uint32_t head = r->head, seq, t, ev;
+	const trace_slot_t *s;
+	uint8_t n = 0;
+
+	if (head - from > TRACE_SIZE) {
+		from = head - TRACE_SIZE;
+	}
+	*first = from;
+	while (n < max && from + n != head) {
+		s = &r->slot[(from + n) & (TRACE_SIZE - 1)];
+		seq = s->seq;
+		__atomic_signal_fence(__ATOMIC_SEQ_CST);
+		t = s->t;
+		ev = s->ev;
+		__atomic_signal_fence(__ATOMIC_SEQ_CST);
+		if (seq != from + n + 1 || s->seq != seq) {
+			if (n == 0 && (int32_t)(seq - 1 - from) > 0) {
+				/* Overwritten while reading, skip ahead */
+				from++;
+				*first = from;
+				continue;
+			}
+			break;
+		}
+		proto_put32(&out[n * TRACE_REC_SIZE], t);
+		proto_put32(&out[n * TRACE_REC_SIZE + 4], ev);
+		n++;
+	}
+	return n;
+}
+
+void trace_get(const uint8_t *in, trace_ev_t *e) {
+	uint32_t ev = proto_get32(&in[4]);
+
+	e->t = proto_get32(in);
+	e->ev = (uint8_t)ev;
+	e->arg = ev >> 8;
+}
+
+const char *trace_name(uint8_t ev) {
+	static const char *const names[TRACE_EVENTS] = {
+		"trigger", "dcmi_start", "dma_half", "frame_end", "dcmi_stop",
+		"capture_end", "f_open", "f_write", "f_close", "sccb_error",
+		"f_alloc", "evict"
+	};
+
+	return ev < TRACE_EVENTS ? names[ev] : "unknown";
+}
@@ -0,0 +1,87 @@
+/*
+ * trace.h
+ *
+ * Capture pipeline event trace (-DCAM_TRACE).
+ *
+ *   TRACE(TRACE_FRAME_END, FrameCount);
+ *
+ * stamps an event with the DWT cycle counter (PROBE_NOW, probe.h) and
+ * appends it to a static ring of TRACE_SIZE events, overwriting the oldest.
+ * Writers claim a slot with one atomic increment of the ring head and never
+ * lock or wait, so events can be recorded from interrupt handlers (DCMI
+ * frame end, DMA) as well as from threads. Each slot carries the sequence
+ * number it was written for, stored last; a reader only takes a slot whose
+ * number matches before and after the copy, which drops events that were
+ * still being written or were overwritten under it. Without CAM_TRACE the
+ * macro and the ring compile to nothing.
+ *
+ * PROTO_CMD_TRACE from32 returns the events from sequence number from32 on:
+ *
+ *   ACK hz32 head32 first32 count8 { t32 ev8 arg24 } * count
+ *
+ * head32 is the number of events recorded so far and first32 the sequence
+ * number of the first event returned, later than from32 when older events
+ * were overwritten. At most TRACE_DUMP_MAX events fit in one reply; the
+ * host asks again from first32 + count until it reaches head32.
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+
+#define TRACE_TRIGGER       0   /* arg: 0 button, 1 host command         */
+#define TRACE_DCMI_START    1
+#define TRACE_DMA_HALF      2   /* DMA switched to the other buffer      */
+#define TRACE_FRAME_END     3   /* arg: frames since the DCMI started    */
+#define TRACE_DCMI_STOP     4
+#define TRACE_CAPTURE_END   5
+#define TRACE_FILE_OPEN     6   /* arg: FRESULT                          */
+#define TRACE_FILE_WRITE    7   /* arg: bytes written                    */
+#define TRACE_FILE_CLOSE    8   /* arg: FRESULT                          */
+#define TRACE_SCCB_ERROR    9   /* arg: register, status << 8, 1 << 16
+                                   on reads                              */
+#define TRACE_FILE_ALLOC    10  /* arg: sectors of a contiguous run,
+                                   0 when fragmented                     */
+#define TRACE_EVICT         11  /* arg: files deleted for room, see
+                                   retain.h                              */
+#define TRACE_EVENTS        12
+
+#define TRACE_SIZE          256 /* Events kept, a power of two */
+#define TRACE_REC_SIZE      8
+#define TRACE_HDR_SIZE      14
+#define TRACE_DUMP_MAX      62  /* (PROTO_MAX_PAYLOAD - TRACE_HDR_SIZE)
+                                   / TRACE_REC_SIZE                      */
+
+typedef struct {
+	volatile uint32_t seq;  /* Sequence number + 1, 0 while written */
+	uint32_t t;
+	uint32_t ev;            /* Event in the low byte, argument above */
+} trace_slot_t;
+
+typedef struct {
+	volatile uint32_t head;
+	trace_slot_t slot[TRACE_SIZE];
+} trace_ring_t;
+
+typedef struct {
+	uint32_t t;
+	uint8_t ev;
+	uint32_t arg;
+} trace_ev_t;
+
+#if defined(CAM_TRACE)
+extern trace_ring_t trace_ring;
+
+#define TRACE(ev, arg)      trace_put(&trace_ring, PROBE_NOW(), (ev), (arg))
+#else
+#define TRACE(ev, arg)
+#endif
+
+void trace_put(trace_ring_t *r, uint32_t t, uint8_t ev, uint32_t arg);
+uint8_t trace_dump(const trace_ring_t *r, uint32_t from, uint8_t *out,
+		uint8_t max, uint32_t *first);
+void trace_get(const uint8_t *in, trace_ev_t *e);
+const char *trace_name(uint8_t ev);
+
+#endif /* TRACE_H_ */
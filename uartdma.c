@@ -0,0 +1,247 @@
+#include <string.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "uartdma.h"
+
+#define RX_MASK     (UARTDMA_RX_SIZE - 1)
+#define TX_MASK     (UARTDMA_TX_SIZE - 1)
+
+#define DMA_MODE    (STM32_DMA_CR_CHSEL(4) |                            \
+                     STM32_DMA_CR_PL(STM32_UART_USART2_DMA_PRIORITY) |  \
+                     STM32_DMA_CR_DMEIE | STM32_DMA_CR_TEIE)
+
+static const stm32_dma_stream_t *rx_dma;
+static const stm32_dma_stream_t *tx_dma;
+
+static uint8_t rx_ring[UARTDMA_RX_SIZE];
+static uint32_t rx_tail;            /* Free running, reader side */
+static volatile uint32_t rx_laps;   /* DMA wraps, counted in the TC ISR */
+static BSEMAPHORE_DECL(rx_sem, TRUE);
+
+static uint8_t tx_ring[UARTDMA_TX_SIZE];
+static volatile uint32_t tx_head;   /* Free running, writer side */
+static volatile uint32_t tx_tail;   /* Free running, advanced on TC */
+static volatile uint32_t tx_run;    /* Bytes in the transfer under way */
+static BSEMAPHORE_DECL(tx_sem, TRUE);
+
+static uartdma_stats_t stats;
+
+static uint32_t rx_head(void) {
+	/* Position the DMA will write next, as a free running count. NDTR
+	 * reloads as the ring wraps but the lap is only counted once the TC
+	 * interrupt runs; the DMA is never behind the reader, so a head behind
+	 * the tail means that interrupt is still pending. */
+	uint32_t head;
+
+	chSysLock();
+	head = rx_laps * UARTDMA_RX_SIZE +
+			(UARTDMA_RX_SIZE - dmaStreamGetTransactionSize(rx_dma));
+	chSysUnlock();
+	if ((int32_t)(head - rx_tail) < 0) {
+		head += UARTDMA_RX_SIZE;
+	}
+	return head;
+}
+
+static void tx_start_locked(void) {
+	uint32_t pos = tx_tail & TX_MASK;
+	uint32_t n = tx_head - tx_tail;
+
+	if (n == 0) {
+		tx_run = 0;
+		return;
+	}
+	if (n > UARTDMA_TX_SIZE - pos) {
+		n = UARTDMA_TX_SIZE - pos;
+	}
+	tx_run = n;
+	dmaStreamSetMemory0(tx_dma, &tx_ring[pos]);
+	dmaStreamSetTransactionSize(tx_dma, n);
+	dmaStreamSetMode(tx_dma, DMA_MODE | STM32_DMA_CR_DIR_M2P |
+			STM32_DMA_CR_MINC | STM32_DMA_CR_TCIE);
+	dmaStreamEnable(tx_dma);
+}
+
+static void rx_dma_isr(void *p, uint32_t flags) {
+	(void)p;
+	chSysLockFromIsr();
+	if (flags & STM32_DMA_ISR_TCIF) {
+		rx_laps++;
+	}
+	stats.irqs++;
+	chBSemSignalI(&rx_sem);
+	chSysUnlockFromIsr();
+}
+
+static void tx_dma_isr(void *p, uint32_t flags) {
+	(void)p;
+	(void)flags;
+	chSysLockFromIsr();
+	stats.tx_bytes += tx_run;
+	tx_tail += tx_run;
+	stats.irqs++;
+	tx_start_locked();
+	chBSemSignalI(&tx_sem);
+	chSysUnlockFromIsr();
+}
+
+CH_IRQ_HANDLER(STM32_USART2_HANDLER) {
+	uint16_t sr;
+
+	CH_IRQ_PROLOGUE();
+	sr = USART2->SR;
+	/* Reading DR after SR clears IDLE and the error flags. RXNE is already
+	 * cleared by the DMA so nothing is lost by it. */
+	(void)USART2->DR;
+	chSysLockFromIsr();
+	if (sr & (USART_SR_ORE | USART_SR_NE | USART_SR_FE)) {
+		stats.line_errors++;
+	}
+	stats.irqs++;
+	chBSemSignalI(&rx_sem);
+	chSysUnlockFromIsr();
+	CH_IRQ_EPILOGUE();
+}
+
+static size_t udma_read(stream_t *sp, uint8_t *bp, size_t n,
+		uint32_t timeout_ms) {
+	uint32_t head, avail, pos, run;
+	size_t got = 0;
+
+	(void)sp;
+	while ((head = rx_head()) == rx_tail) {
+		if (chBSemWaitTimeout(&rx_sem, timeout_ms == STREAM_INFINITE ?
+				TIME_INFINITE : MS2ST(timeout_ms)) == RDY_TIMEOUT) {
+			return 0;
+		}
+	}
+	avail = head - rx_tail;
+	if (avail > UARTDMA_RX_SIZE) {
+		/* The DMA went round on us, the oldest data is gone */
+		stats.rx_overruns++;
+		rx_tail = head - UARTDMA_RX_SIZE;
+		avail = UARTDMA_RX_SIZE;
+	}
+	while (got < n && avail > 0) {
+		pos = rx_tail & RX_MASK;
+		run = UARTDMA_RX_SIZE - pos;
+		if (run > avail) {
+			run = avail;
+		}
+		if (run > n - got) {
+			run = n - got;
+		}
+		memcpy(&bp[got], &rx_ring[pos], run);
+		got += run;
+		rx_tail += run;
+		avail -= run;
+	}
+	stats.rx_bytes += got;
+	return got;
+}
+
+static size_t udma_write(stream_t *sp, const uint8_t *bp, size_t n) {
+	uint32_t pos, run;
+	size_t done = 0;
+
+	(void)sp;
+	while (done < n) {
+		chSysLock();
+		while (tx_head - tx_tail == UARTDMA_TX_SIZE) {
+			chBSemWaitS(&tx_sem);
+		}
+		chSysUnlock();
+		/* Only the TC ISR moves tx_tail, so the space found can only grow */
+		pos = tx_head & TX_MASK;
+		run = UARTDMA_TX_SIZE - (tx_head - tx_tail);
+		if (run > UARTDMA_TX_SIZE - pos) {
+			run = UARTDMA_TX_SIZE - pos;
+		}
+		if (run > n - done) {
+			run = n - done;
+		}
+		memcpy(&tx_ring[pos], &bp[done], run);
+		done += run;
+		chSysLock();
+		tx_head += run;
+		if (tx_run == 0) {
+			tx_start_locked();
+		}
+		chSysUnlock();
+	}
+	return n;
+}
+
+static void udma_flush(stream_t *sp) {
+	(void)sp;
+	chSysLock();
+	while (tx_head != tx_tail) {
+		chBSemWaitS(&tx_sem);
+	}
+	chSysUnlock();
+	/* DMA done only means the last byte is in DR, wait for the shifter */
+	while (!(USART2->SR & USART_SR_TC)) {
+		chThdSleepMilliseconds(1);
+	}
+}
+
+static int udma_set_baud(stream_t *sp, uint32_t baud) {
+	(void)sp;
+	if (baud == 0 || STM32_PCLK1 / baud < 16) {
+		return -1;
+	}
+	USART2->CR1 &= ~USART_CR1_UE;
+	USART2->BRR = STM32_PCLK1 / baud;
+	USART2->CR1 |= USART_CR1_UE;
+	return 0;
+}
+
+static const struct stream_vmt udma_vmt = {
+	udma_read, udma_write, udma_flush, udma_set_baud
+};
+
+static stream_t udma_stream = { &udma_vmt };
+
+stream_t *uartdmaStart(uint32_t baud) {
+	bool_t b;
+
+	rccEnableUSART2(FALSE);
+	rx_dma = STM32_DMA_STREAM(STM32_UART_USART2_RX_DMA_STREAM);
+	tx_dma = STM32_DMA_STREAM(STM32_UART_USART2_TX_DMA_STREAM);
+	b = dmaStreamAllocate(rx_dma, STM32_UART_USART2_IRQ_PRIORITY,
+			rx_dma_isr, NULL);
+	chDbgAssert(!b, "uartdmaStart(), #1", "stream already allocated");
+	b = dmaStreamAllocate(tx_dma, STM32_UART_USART2_IRQ_PRIORITY,
+			tx_dma_isr, NULL);
+	chDbgAssert(!b, "uartdmaStart(), #2", "stream already allocated");
+	dmaStreamSetPeripheral(rx_dma, &USART2->DR);
+	dmaStreamSetPeripheral(tx_dma, &USART2->DR);
+
+	USART2->CR1 = 0;
+	USART2->BRR = STM32_PCLK1 / baud;
+	USART2->CR2 = USART_CR2_STOP1_BITS | USART_CR2_LINEN;
+	USART2->CR3 = USART_CR3_DMAR | USART_CR3_DMAT | USART_CR3_EIE;
+	(void)USART2->SR;
+	(void)USART2->DR;
+
+	/* RX runs for ever, circular over the whole ring */
+	dmaStreamSetMemory0(rx_dma, rx_ring);
+	dmaStreamSetTransactionSize(rx_dma, UARTDMA_RX_SIZE);
+	dmaStreamSetMode(rx_dma, DMA_MODE | STM32_DMA_CR_DIR_P2M |
+			STM32_DMA_CR_MINC | STM32_DMA_CR_CIRC | STM32_DMA_CR_HTIE |
+			STM32_DMA_CR_TCIE);
+	dmaStreamEnable(rx_dma);
+
+	nvicEnableVector(USART2_IRQn,
+			CORTEX_PRIORITY_MASK(STM32_UART_USART2_IRQ_PRIORITY));
+	USART2->CR1 = USART_CR1_UE | USART_CR1_TE | USART_CR1_RE |
+			USART_CR1_IDLEIE;
+	return &udma_stream;
+}
+
+void uartdmaGetStats(uartdma_stats_t *st) {
+	chSysLock();
+	*st = stats;
+	chSysUnlock();
+}
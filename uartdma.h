@@ -0,0 +1,31 @@
+/*
+ * uartdma.h
+ *
+ * USART2 driven by DMA on both directions, exposed as a stream_t.
+ *
+ * RX runs a circular DMA into a ring that is never stopped; the reader only
+ * moves its tail. The half/full transfer and line idle interrupts wake it,
+ * so a burst costs a couple of interrupts instead of one per byte. TX copies
+ * into a second ring and DMA drains it a contiguous run at a time.
+ */
+
+#ifndef UARTDMA_H_
+#define UARTDMA_H_
+
+#include "stream.h"
+
+#define UARTDMA_RX_SIZE     1024    /* Power of two */
+#define UARTDMA_TX_SIZE     1024    /* Power of two */
+
+typedef struct {
+	uint32_t rx_bytes;
+	uint32_t tx_bytes;
+	uint32_t rx_overruns;   /* Ring lapped before the reader got to it */
+	uint32_t line_errors;   /* Framing, noise and USART overrun */
+	uint32_t irqs;
+} uartdma_stats_t;
+
+stream_t *uartdmaStart(uint32_t baud);
+void uartdmaGetStats(uartdma_stats_t *st);
+
+#endif /* UARTDMA_H_ */
@@ -0,0 +1,77 @@
+#include "xfer.h"
+
+void xfer_start(xfer_t *x, uint32_t size, uint32_t offset, uint16_t chunk,
+		uint8_t window) {
+	x->size = size;
+	x->acked = offset < size ? offset : size;
+	x->next = x->acked;
+	x->high = x->acked;
+	x->rewound = 0xFFFFFFFF;
+	x->chunk = chunk > 0 ? chunk : 1;
+	x->window = (uint32_t)(window > 0 ? window : 1) * x->chunk;
+	x->retries = 0;
+	x->aborted = 0;
+	x->chunks = 0;
+	x->resent = 0;
+	x->timeouts = 0;
+}
+
+int xfer_next(xfer_t *x, uint32_t *off, uint16_t *len) {
+	/* Returns 1 with the next chunk to send while the window has room */
+	uint32_t n;
+
+	if (x->aborted || x->next >= x->size || x->next - x->acked >= x->window) {
+		return 0;
+	}
+	n = x->size - x->next;
+	if (n > x->chunk) {
+		n = x->chunk;
+	}
+	*off = x->next;
+	*len = (uint16_t)n;
+	x->chunks++;
+	if (x->next < x->high) {
+		x->resent++;
+	}
+	x->next += n;
+	if (x->next > x->high) {
+		x->high = x->next;
+	}
+	return 1;
+}
+
+void xfer_ack(xfer_t *x, uint32_t ack) {
+	if (ack == XFER_ABORT) {
+		x->aborted = 1;
+		return;
+	}
+	if (ack > x->next) {
+		return; /* Not something we sent */
+	}
+	if (ack > x->acked) {
+		x->acked = ack;
+		x->retries = 0;
+	} else if (ack == x->acked && x->next > x->acked && x->rewound != ack) {
+		/* Host saw a gap: resend from what it has, once per gap */
+		x->rewound = ack;
+		x->next = ack;
+	}
+}
+
+int xfer_timeout(xfer_t *x) {
+	/* No ACK in time: go back to the acknowledged offset. Returns 0 once
+	 * the host has been silent for XFER_MAX_RETRIES timeouts in a row.
+	 */
+	x->timeouts++;
+	if (++x->retries > XFER_MAX_RETRIES) {
+		x->aborted = 1;
+		return 0;
+	}
+	x->rewound = x->acked;
+	x->next = x->acked;
+	return 1;
+}
+
+int xfer_done(const xfer_t *x) {
+	return x->aborted || x->acked >= x->size;
+}
@@ -0,0 +1,47 @@
+/*
+ * xfer.h
+ *
+ * Sender side of the windowed download used by PROTO_CMD_DOWNLOAD.
+ *
+ * The object is sent as DATA frames carrying their byte offset. The host
+ * acknowledges with the offset it expects next (a cumulative ACK), and the
+ * sender keeps up to `window` chunks in flight past the last ACK. A repeated
+ * ACK or a timeout rewinds to the acknowledged offset (go-back-N). Each
+ * chunk is protected by the frame CRC; resuming is just starting at a
+ * non-zero offset.
+ *
+ * Plain state machine, waiting for ACKs is left to the caller.
+ */
+
+#ifndef XFER_H_
+#define XFER_H_
+
+#include <stdint.h>
+
+#define XFER_MAX_RETRIES    5
+#define XFER_ABORT          0xFFFFFFFF  /* ACK value that cancels */
+
+typedef struct {
+	uint32_t size;
+	uint32_t acked;
+	uint32_t next;
+	uint32_t high;          /* Furthest byte sent so far */
+	uint32_t window;        /* Bytes allowed past acked */
+	uint32_t rewound;       /* acked value of the last go-back */
+	uint16_t chunk;
+	uint8_t retries;
+	uint8_t aborted;
+	/* Statistics */
+	uint32_t chunks;
+	uint32_t resent;
+	uint32_t timeouts;
+} xfer_t;
+
+void xfer_start(xfer_t *x, uint32_t size, uint32_t offset, uint16_t chunk,
+		uint8_t window);
+int xfer_next(xfer_t *x, uint32_t *off, uint16_t *len);
+void xfer_ack(xfer_t *x, uint32_t ack);
+int xfer_timeout(xfer_t *x);
+int xfer_done(const xfer_t *x);
+
+#endif /* XFER_H_ */